@@ -0,0 +1,693 @@
+/*
+ * bench.c - p9wl-bench: replay frame traces through the send pipeline
+ *
+ * Runs the real send thread (scroll detection, change detection,
+ * compression, tile cache, batch building, pipelined writes) on the
+ * frames of a trace from draw/trace.h, against an in-process 9P sink
+ * on a socketpair that answers every Twrite at once. No Plan 9 server
+ * and no Wayland session are involved, so the numbers measure the
+ * encoder and the host, not the link.
+ *
+ * Replay is closed-loop: each frame is handed to send_frame() and the
+ * next one only after the send thread has taken and finished it, so
+ * no frame is dropped and every run of a trace does the same work.
+ * Capture timestamps are reported but not reproduced.
+ *
+ * Usage:
+ *
+ *   p9wl-bench [-W n] [-E level] [-C MiB] [-B] [-v] <trace>
+ *   p9wl-bench -g <kind> [-n frames] <out>
+ *
+ *   The second form writes a synthetic trace: term-scroll, browser-
+ *   scroll, video or idle-caret ("make bench-traces" writes all four
+ *   to bench/traces/). Real traces come from p9wl -T <file>.
+ *
+ *   The send path keeps module state in send.c, so one process
+ *   replays one trace.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include <wlr/util/log.h>
+
+#include "types.h"
+#include "p9/p9.h"
+#include "input/input.h"
+#include "draw/arena.h"
+#include "draw/compress.h"
+#include "draw/metrics.h"
+#include "draw/parallel.h"
+#include "draw/send.h"
+#include "draw/trace.h"
+
+#define FRAME_US        16667       /* Generated traces: 60 Hz */
+#define IDLE_POLL_NS    20000       /* Send thread idle check */
+#define TILE_ALIGN_UP(x) (((x) + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE)
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <trace>\n", prog);
+    fprintf(stderr, "       %s -g <kind> [-n frames] <out>\n", prog);
+    fprintf(stderr, "\nReplay options:\n");
+    fprintf(stderr, "  -W <n>         Compression worker threads (1-%d, default: auto)\n",
+            MAX_WORKERS);
+    fprintf(stderr, "  -E <level>     Compression effort 0-3 (default: %d)\n",
+            COMPRESS_EFFORT_DEFAULT);
+    fprintf(stderr, "  -C <MiB>       Tile cache size (0 disables, default: %d)\n",
+            TILE_CACHE_DEFAULT_MB);
+    fprintf(stderr, "  -B             Tile-major framebuffers\n");
+    fprintf(stderr, "  -v             Verbose (send path info messages)\n");
+    fprintf(stderr, "\nTrace generation:\n");
+    fprintf(stderr, "  -g <kind>      term-scroll, browser-scroll, video or idle-caret\n");
+    fprintf(stderr, "  -n <frames>    Number of frames (default: per kind)\n");
+}
+
+/* ============== Loopback 9P Sink ============== */
+
+/*
+ * The far end of the draw connection: version, attach and clunk are
+ * acknowledged, Twrite gets an Rwrite for its full count, anything
+ * else an Rerror.  Counts the bytes it receives.
+ */
+struct sink {
+    int fd;
+    pthread_t thread;
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t writes;
+};
+
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put_u32(uint8_t *p, uint32_t v) { put_u16(p, v); put_u16(p + 2, v >> 16); }
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int sink_read(int fd, uint8_t *buf, size_t n) {
+    while (n > 0) {
+        ssize_t r = read(fd, buf, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        buf += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int sink_write(int fd, const uint8_t *buf, size_t n) {
+    while (n > 0) {
+        ssize_t r = write(fd, buf, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        buf += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static void *sink_thread_func(void *arg) {
+    struct sink *k = arg;
+    size_t cap = P9_MSIZE;
+    uint8_t *msg = malloc(cap);
+    uint8_t reply[64];
+
+    while (msg && sink_read(k->fd, msg, 4) == 0) {
+        uint32_t size = get_u32(msg);
+        if (size < 7) break;
+        if (size > cap) {
+            uint8_t *grown = realloc(msg, size);
+            if (!grown) break;
+            msg = grown;
+            cap = size;
+        }
+        if (sink_read(k->fd, msg + 4, size - 4) < 0) break;
+        atomic_fetch_add_explicit(&k->bytes, size, memory_order_relaxed);
+
+        uint8_t type = msg[4];
+        const uint8_t *rbuf = reply;
+        uint32_t rlen;
+        uint8_t rtype = type + 1;
+        if (type == Tversion) {
+            /* Echo msize and version: same layout */
+            msg[4] = Rversion;
+            rbuf = msg;
+            rlen = size;
+        } else if (type == Tattach) {
+            rlen = 7 + 13;
+            memset(reply + 7, 0, 13);
+            reply[7] = 0x80;                    /* QTDIR */
+        } else if (type == Twrite && size >= 23) {
+            rlen = 11;
+            memcpy(reply + 7, msg + 19, 4);     /* count */
+            atomic_fetch_add_explicit(&k->writes, 1, memory_order_relaxed);
+        } else if (type == Tclunk) {
+            rlen = 7;
+        } else {
+            static const char ename[] = "not supported by p9wl-bench";
+            rlen = 7 + 2 + sizeof(ename) - 1;
+            rtype = Rerror;
+            put_u16(reply + 7, sizeof(ename) - 1);
+            memcpy(reply + 9, ename, sizeof(ename) - 1);
+        }
+        if (rbuf == reply) {
+            put_u32(reply, rlen);
+            reply[4] = rtype;
+            memcpy(reply + 5, msg + 5, 2);      /* tag */
+        }
+        if (sink_write(k->fd, rbuf, rlen) < 0) break;
+    }
+    free(msg);
+    close(k->fd);
+    return NULL;
+}
+
+/* ============== Replay ============== */
+
+/* Load a row-major trace image into framebuf in the server's layout */
+static void fb_load(struct server *s, const uint32_t *image) {
+    if (!s->tile_major) {
+        memcpy(s->framebuf, image, (size_t)s->width * s->height * 4);
+        return;
+    }
+    for (int ty = 0; ty < s->tiles_y; ty++) {
+        for (int tx = 0; tx < s->tiles_x; tx++) {
+            uint32_t *dst = fb_tile(s, s->framebuf, tx, ty);
+            const uint32_t *src = image + (size_t)ty * TILE_SIZE * s->width + tx * TILE_SIZE;
+            for (int row = 0; row < TILE_SIZE; row++)
+                memcpy(dst + row * TILE_SIZE, src + (size_t)row * s->width, TILE_SIZE * 4);
+        }
+    }
+}
+
+/* Wait until the send thread has taken and finished every frame */
+static void wait_idle(struct server *s) {
+    struct timespec ts = { 0, IDLE_POLL_NS };
+    for (;;) {
+        pthread_mutex_lock(&s->send_lock);
+        int idle = s->pending_buf < 0 && s->active_buf < 0;
+        pthread_mutex_unlock(&s->send_lock);
+        if (idle || !s->running) return;
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Draw state as init_draw() leaves it, ids and all */
+static void bench_draw_init(struct server *s) {
+    struct draw_state *draw = &s->draw;
+    draw->p9 = &s->p9_draw;
+    draw->drawdata_fid = 1;
+    draw->screen_id = 3;
+    draw->image_id = 1;
+    draw->opaque_id = 2;
+    draw->delta_id = 5;
+    draw->width = draw->image_cap_w = s->width;
+    draw->height = draw->image_cap_h = s->height;
+    draw->visible_width = s->visible_width;
+    draw->visible_height = s->visible_height;
+    draw->logical_width = s->visible_width;
+    draw->logical_height = s->visible_height;
+    draw->scale = 1.0f;
+    if (s->tile_cache_mb > 0) {
+        int slots = (int)((long)s->tile_cache_mb * 1024 * 1024 / (TILE_SIZE * TILE_SIZE * 4));
+        int cols = 4096 / TILE_SIZE;
+        if (cols > slots) cols = slots;
+        draw->cache_id = 6;
+        draw->cache_cols = cols;
+        draw->cache_rows = slots / cols;
+    }
+    draw->fill_id_base = 7;
+    draw->fill_count = FILL_PALETTE_SIZE;
+}
+
+static double mib(uint64_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+static void report(const char *path, const struct trace_geom *g, int frames,
+                   uint64_t span_us, double elapsed, const struct sink *k) {
+    uint64_t raw = metrics_counter(METRIC_BYTES_RAW);
+    uint64_t sent = metrics_counter(METRIC_BYTES_SENT);
+    uint64_t wire = atomic_load(&k->bytes);
+
+    printf("trace       %s: %dx%d (visible %dx%d), %d frames over %.2f s\n",
+           path, g->width, g->height, g->visible_width, g->visible_height,
+           frames, span_us * 1e-6);
+    printf("replay      %.3f s, %.1f frames/s, %.1f MiB/s input\n", elapsed,
+           frames / elapsed,
+           mib((uint64_t)frames * g->visible_width * g->visible_height * 4) / elapsed);
+    printf("bytes       raw %.2f MiB, payload %.2f MiB, wire %.2f MiB (%.1f MiB/s)\n",
+           mib(raw), mib(sent), mib(wire), mib(wire) / elapsed);
+    printf("per frame   %.1f KiB wire, ratio %.2f:1 (raw/payload)\n",
+           frames ? wire / 1024.0 / frames : 0.0, sent ? (double)raw / sent : 0.0);
+    printf("tiles       %llu sent: %llu lz77, %llu delta, %llu raw, %llu merged, "
+           "%llu solid, %llu cached (%llu misses); %llu scrolls\n",
+           (unsigned long long)metrics_counter(METRIC_TILES),
+           (unsigned long long)metrics_counter(METRIC_TILES_COMPRESSED),
+           (unsigned long long)metrics_counter(METRIC_TILES_DELTA),
+           (unsigned long long)metrics_counter(METRIC_TILES_RAW),
+           (unsigned long long)metrics_counter(METRIC_TILES_MERGED),
+           (unsigned long long)metrics_counter(METRIC_TILES_SOLID),
+           (unsigned long long)metrics_counter(METRIC_CACHE_HITS),
+           (unsigned long long)metrics_counter(METRIC_CACHE_MISSES),
+           (unsigned long long)metrics_counter(METRIC_SCROLLS));
+    printf("batches     %llu (%llu Twrite), %llu errors\n",
+           (unsigned long long)metrics_counter(METRIC_BATCHES),
+           (unsigned long long)atomic_load(&k->writes),
+           (unsigned long long)metrics_counter(METRIC_WRITE_ERRORS));
+
+    printf("\n%-10s %8s %10s %10s %10s %10s\n",
+           "stage", "count", "total ms", "mean us", "p50 us", "p99 us");
+    for (int st = 0; st < METRIC_STAGE_COUNT; st++) {
+        struct metric_summary m;
+        metrics_summary(st, &m);
+        if (m.count == 0) continue;     /* Output thread stages */
+        printf("%-10s %8llu %10.2f %10.1f %10s%llu %10s%llu\n",
+               metrics_stage_name(st), (unsigned long long)m.count,
+               m.sum_us * 1e-3, (double)m.sum_us / m.count,
+               "<=", (unsigned long long)m.p50_us,
+               "<=", (unsigned long long)m.p99_us);
+    }
+}
+
+static int replay(const char *path, int tile_major, int cache_mb, int effort) {
+    struct trace_geom g;
+    struct trace_reader *r = trace_reader_open(path, &g);
+    if (!r) return 1;
+
+    struct server s = {0};
+    s.running = 1;
+    s.scale = 1.0f;
+    s.tile_major = tile_major;
+    s.tile_cache_mb = cache_mb;
+    s.compress_effort = effort;
+    s.width = g.width;
+    s.height = g.height;
+    s.visible_width = g.visible_width;
+    s.visible_height = g.visible_height;
+    s.tiles_x = s.width / TILE_SIZE;
+    s.tiles_y = s.height / TILE_SIZE;
+    int ntiles = s.tiles_x * s.tiles_y;
+
+    s.fb_cap = (size_t)s.width * s.height;
+    s.framebuf = arena_map(s.fb_cap * 4);
+    s.prev_framebuf = arena_map(s.fb_cap * 4);
+    s.send_buf[0] = arena_map(s.fb_cap * 4);
+    s.send_buf[1] = arena_map(s.fb_cap * 4);
+    uint32_t *image = arena_map(s.fb_cap * 4);
+    s.dirty_staging = calloc(1, ntiles);
+    int ret = 1;
+    if (!s.framebuf || !s.prev_framebuf || !s.send_buf[0] || !s.send_buf[1] ||
+        !image || !s.dirty_staging) {
+        wlr_log(WLR_ERROR, "Memory allocation failed");
+        goto out;
+    }
+
+    s.force_full_frame = 1;
+    s.pending_buf = -1;
+    s.active_buf = -1;
+    pthread_mutex_init(&s.send_lock, NULL);
+    pthread_cond_init(&s.send_cond, NULL);
+    input_queue_init(&s.input_queue);
+    if (send_init(&s) < 0) goto out;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        wlr_log(WLR_ERROR, "socketpair: %s", strerror(errno));
+        goto out;
+    }
+    struct sink sink = { .fd = sv[1] };
+    if (pthread_create(&sink.thread, NULL, sink_thread_func, &sink) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        goto out;
+    }
+    if (p9_connect_fd(&s.p9_draw, sv[0]) < 0) {
+        pthread_join(sink.thread, NULL);
+        goto out;
+    }
+    bench_draw_init(&s);
+    pthread_create(&s.send_thread, NULL, send_thread_func, &s);
+
+    int frames = 0, valid, rc;
+    uint64_t t_us = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while ((rc = trace_reader_next(r, image, s.dirty_staging, &valid, &t_us)) > 0 &&
+           s.running) {
+        fb_load(&s, image);
+        s.dirty_staging_valid = valid;
+        send_frame(&s);
+        wait_idle(&s);
+        frames++;
+    }
+    if (rc < 0)
+        wlr_log(WLR_ERROR, "trace: %s is corrupt after frame %d", path, frames);
+
+    pthread_mutex_lock(&s.send_lock);
+    s.running = 0;
+    pthread_cond_signal(&s.send_cond);
+    pthread_mutex_unlock(&s.send_lock);
+    pthread_join(s.send_thread, NULL);     /* Drains in-flight batches */
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    p9_disconnect(&s.p9_draw);
+    pthread_join(sink.thread, NULL);
+
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    report(path, &g, frames, t_us, elapsed, &sink);
+    ret = rc < 0;
+
+out:
+    trace_reader_close(r);
+    arena_unmap(s.framebuf, s.fb_cap * 4);
+    arena_unmap(s.prev_framebuf, s.fb_cap * 4);
+    arena_unmap(s.send_buf[0], s.fb_cap * 4);
+    arena_unmap(s.send_buf[1], s.fb_cap * 4);
+    arena_unmap(image, s.fb_cap * 4);
+    free(s.dirty_staging);
+    send_cleanup(&s);
+    return ret;
+}
+
+/* ============== Synthetic Traces ============== */
+
+/*
+ * Deterministic stand-ins for the four workloads the send path is
+ * tuned for.  Text is drawn from a fixed set of pseudo-glyphs, so
+ * repeated characters repeat pixels the way a real font does.
+ */
+
+#define GLYPH_W     8
+#define GLYPH_H     16
+#define GLYPHS      94
+
+struct gen {
+    struct trace_geom g;
+    int tiles_x, tiles_y;
+    uint32_t *img;
+    uint8_t *damage;
+    uint16_t glyph[GLYPHS][GLYPH_H];
+};
+
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352d;
+    x ^= x >> 15; x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static void gen_glyphs(struct gen *gn) {
+    for (int c = 0; c < GLYPHS; c++) {
+        for (int row = 0; row < GLYPH_H; row++) {
+            uint32_t h = hash32(c * GLYPH_H + row + 1);
+            /* Ink in columns 1..6 of rows 3..12, x-height ~40% dense */
+            gn->glyph[c][row] = (row >= 3 && row <= 12) ? (h & (h >> 7) & 0x7E) : 0;
+        }
+    }
+}
+
+static void fill_rect(struct gen *gn, int x, int y, int w, int h, uint32_t color) {
+    for (int j = y; j < y + h && j < gn->g.visible_height; j++) {
+        if (j < 0) continue;
+        uint32_t *row = gn->img + (size_t)j * gn->g.width;
+        for (int i = x < 0 ? 0 : x; i < x + w && i < gn->g.visible_width; i++)
+            row[i] = color;
+    }
+}
+
+/* One glyph cell; rows outside [clip_y0, clip_y1) are not drawn */
+static void draw_glyph(struct gen *gn, int x, int y, int c, uint32_t fg, uint32_t bg,
+                       int clip_y0, int clip_y1) {
+    for (int row = 0; row < GLYPH_H; row++) {
+        int j = y + row;
+        if (j < clip_y0 || j >= clip_y1) continue;
+        uint32_t *p = gn->img + (size_t)j * gn->g.width + x;
+        uint16_t bits = c < 0 ? 0 : gn->glyph[c % GLYPHS][row];
+        for (int col = 0; col < GLYPH_W && x + col < gn->g.visible_width; col++)
+            p[col] = (bits >> col) & 1 ? fg : bg;
+    }
+}
+
+/* Text line n: words of 1-9 glyphs, deterministic per (n, seed) */
+static void draw_text_line(struct gen *gn, int x, int y, int cols, uint32_t n, uint32_t seed,
+                           uint32_t fg, uint32_t bg, int clip_y0, int clip_y1) {
+    uint32_t h = hash32(n * 2654435761u + seed);
+    int len = (h % 8 == 0) ? 0 : (int)(h % cols);      /* Some blank lines */
+    int word = 0;
+    for (int i = 0; i < cols; i++) {
+        int c = -1;
+        if (i < len) {
+            if (word == 0) {
+                h = hash32(h);
+                word = 1 + h % 9;
+            } else {
+                word--;
+                if (word > 0) c = hash32(h + i) % GLYPHS;
+            }
+        }
+        draw_glyph(gn, x + i * GLYPH_W, y, c, fg, bg, clip_y0, clip_y1);
+    }
+}
+
+static void damage_rect(struct gen *gn, int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) return;
+    int tx0 = x / TILE_SIZE, ty0 = y / TILE_SIZE;
+    int tx1 = (x + w - 1) / TILE_SIZE, ty1 = (y + h - 1) / TILE_SIZE;
+    if (tx1 >= gn->tiles_x) tx1 = gn->tiles_x - 1;
+    if (ty1 >= gn->tiles_y) ty1 = gn->tiles_y - 1;
+    for (int ty = ty0; ty <= ty1; ty++)
+        memset(gn->damage + ty * gn->tiles_x + tx0,
+               DAMAGE_DIRTY | DAMAGE_FOREGROUND, tx1 - tx0 + 1);
+}
+
+/* Terminal: 1280x800, one new line per frame scrolls the rest up */
+static void gen_term_scroll(struct gen *gn, int f) {
+    const uint32_t fg = 0xFFD0D0D0, bg = 0xFF101010;
+    int rows = gn->g.visible_height / GLYPH_H, cols = gn->g.visible_width / GLYPH_W;
+    for (int r = 0; r < rows; r++)
+        draw_text_line(gn, 0, r * GLYPH_H, cols, f + r, 1, fg, bg, 0, gn->g.visible_height);
+    damage_rect(gn, 0, 0, gn->g.visible_width, gn->g.visible_height);
+}
+
+/* Browser: 1920x1080, page with text, images and a fixed header */
+static void gen_browser_scroll(struct gen *gn, int f) {
+    const int header = 88, margin = 320, side = 300;
+    int vw = gn->g.visible_width, vh = gn->g.visible_height;
+
+    /* Flicks of decaying velocity, ~30 px/frame on average */
+    double t = (f % 60) / 60.0;
+    int scroll = (f / 60) * 1800 + (int)(1800 * (1 - exp(-4 * t)) / (1 - exp(-4)));
+
+    fill_rect(gn, 0, header, vw, vh - header, 0xFFFFFFFF);
+    int pitch = 22;                         /* Line spacing */
+    int first = scroll / pitch;
+    for (int n = first; ; n++) {
+        int y = header + n * pitch - scroll;
+        if (y >= vh) break;
+        int block = n / 40;
+        if (hash32(block) % 3 == 0 && n % 40 < 14) {
+            /* Image: a banded gradient */
+            if (n % 40 == 0) {
+                int y0 = y, h = 14 * pitch;
+                for (int j = (y0 < header ? header : y0); j < y0 + h && j < vh; j++) {
+                    uint32_t *row = gn->img + (size_t)j * gn->g.width;
+                    for (int i = margin; i < vw - margin - side; i++) {
+                        uint32_t dx = i - margin, dy = j - y0 + block * 7;
+                        row[i] = 0xFF000000 | ((dx / 8) & 0xFF) << 16 |
+                                 ((dy / 2) & 0xFF) << 8 | ((128 + block * 40) & 0xFF);
+                    }
+                }
+            }
+            continue;
+        }
+        int cols = (vw - 2 * margin - side) / GLYPH_W;
+        draw_text_line(gn, margin, y + 3, cols, n, 2, 0xFF202020, 0xFFFFFFFF, header, vh);
+    }
+
+    /* Sidebar scrolls with the page at half speed */
+    for (int j = header; j < vh; j++) {
+        uint32_t *row = gn->img + (size_t)j * gn->g.width;
+        int pos = j - header + scroll / 2;
+        uint32_t c = (pos / 90) % 2 ? 0xFFF0F0F4 : 0xFFE4E8F0;
+        for (int i = vw - side; i < vw - 16; i++) row[i] = c;
+    }
+
+    /* Scrollbar thumb */
+    fill_rect(gn, vw - 16, header, 16, vh - header, 0xFFEAEAEA);
+    fill_rect(gn, vw - 14, header + (scroll / 40) % (vh - header - 80), 12, 80, 0xFFA0A0A0);
+
+    if (f == 0) {
+        fill_rect(gn, 0, 0, vw, header, 0xFF3A3A40);
+        fill_rect(gn, 200, 24, vw - 400, 40, 0xFFFFFFFF);
+        draw_text_line(gn, 216, 36, 60, 7, 3, 0xFF202020, 0xFFFFFFFF, 0, header);
+        damage_rect(gn, 0, 0, vw, vh);
+    } else {
+        damage_rect(gn, 0, header, vw, vh - header);
+    }
+}
+
+/* Video: 1280x720 player, 640x360 moving picture with grain */
+static void gen_video(struct gen *gn, int f) {
+    const int vx = 320, vy = 120, vwid = 640, vhgt = 360;
+    int vw = gn->g.visible_width, vh = gn->g.visible_height;
+    if (f == 0) {
+        fill_rect(gn, 0, 0, vw, vh, 0xFF181818);
+        for (int r = 0; r < 6; r++)
+            draw_text_line(gn, vx, vy + vhgt + 40 + r * 20, vwid / GLYPH_W, r, 4,
+                           0xFFB0B0B0, 0xFF181818, 0, vh);
+    }
+    for (int j = 0; j < vhgt; j++) {
+        uint32_t *row = gn->img + (size_t)(vy + j) * gn->g.width + vx;
+        for (int i = 0; i < vwid; i++) {
+            double u = i / 60.0, v = j / 60.0, t = f / 20.0;
+            double p = sin(u + t) + sin(v * 1.3 - t * 0.7) + sin((u + v) * 0.7 + t * 1.1);
+            int grain = (int)(hash32(f * 1000003u + j * vwid + i) & 7) - 4;
+            int rr = (int)(128 + 40 * p) + grain, gg = (int)(100 + 30 * sin(p + t)) + grain,
+                bb = (int)(90 + 50 * cos(p)) + grain;
+            row[i] = 0xFF000000 | (uint32_t)(rr & 0xFF) << 16 | (uint32_t)(gg & 0xFF) << 8 |
+                     (uint32_t)(bb & 0xFF);
+        }
+    }
+    damage_rect(gn, vx, vy, vwid, vhgt);
+
+    /* Progress bar advances once a second */
+    if (f % 60 == 0) {
+        int y = vy + vhgt + 12;
+        fill_rect(gn, vx, y, vwid, 6, 0xFF404040);
+        fill_rect(gn, vx, y, (f / 60 * 8) % vwid, 6, 0xFFE03030);
+        damage_rect(gn, vx, y, vwid, 6);
+    }
+    if (f == 0) damage_rect(gn, 0, 0, vw, vh);
+}
+
+/* Idle terminal: 1280x800, only a caret blinking at 2 Hz */
+static void gen_idle_caret(struct gen *gn, int f) {
+    const uint32_t fg = 0xFFD0D0D0, bg = 0xFF101010;
+    int rows = gn->g.visible_height / GLYPH_H, cols = gn->g.visible_width / GLYPH_W;
+    int cx = 2 * GLYPH_W, cy = (rows - 1) * GLYPH_H;
+    if (f == 0) {
+        for (int r = 0; r < rows - 1; r++)
+            draw_text_line(gn, 0, r * GLYPH_H, cols, r, 5, fg, bg, 0, gn->g.visible_height);
+        fill_rect(gn, 0, cy, gn->g.visible_width, GLYPH_H, bg);
+        draw_glyph(gn, 0, cy, 3, fg, bg, 0, gn->g.visible_height);      /* Prompt */
+        damage_rect(gn, 0, 0, gn->g.visible_width, gn->g.visible_height);
+    }
+    fill_rect(gn, cx, cy, GLYPH_W, GLYPH_H, f % 2 ? bg : fg);
+    damage_rect(gn, cx, cy, GLYPH_W, GLYPH_H);
+}
+
+static const struct {
+    const char *name;
+    int width, height;
+    int frames;
+    uint64_t frame_us;
+    void (*draw)(struct gen *gn, int f);
+} kinds[] = {
+    { "term-scroll",    1280,  800, 240, FRAME_US, gen_term_scroll },
+    { "browser-scroll", 1920, 1080, 180, FRAME_US, gen_browser_scroll },
+    { "video",          1280,  720, 120, FRAME_US, gen_video },
+    { "idle-caret",     1280,  800,  60, 500000,   gen_idle_caret },
+};
+
+static int generate(const char *kind, const char *out, int nframes) {
+    int k = -1;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+        if (strcmp(kind, kinds[i].name) == 0) k = (int)i;
+    if (k < 0) {
+        fprintf(stderr, "Unknown trace kind: %s\n", kind);
+        return 1;
+    }
+    if (nframes <= 0) nframes = kinds[k].frames;
+
+    struct gen *gn = calloc(1, sizeof(*gn));
+    if (!gn) return 1;
+    gn->g.visible_width = kinds[k].width;
+    gn->g.visible_height = kinds[k].height;
+    gn->g.width = TILE_ALIGN_UP(kinds[k].width);
+    gn->g.height = TILE_ALIGN_UP(kinds[k].height);
+    gn->tiles_x = gn->g.width / TILE_SIZE;
+    gn->tiles_y = gn->g.height / TILE_SIZE;
+    size_t size = (size_t)gn->g.width * gn->g.height * 4;
+    gn->img = arena_map(size);
+    gn->damage = calloc(1, gn->tiles_x * gn->tiles_y);
+    gen_glyphs(gn);
+
+    int ret = 1;
+    struct trace_writer *w = gn->img && gn->damage ? trace_writer_open(out, &gn->g) : NULL;
+    if (w) {
+        ret = 0;
+        for (int f = 0; f < nframes && ret == 0; f++) {
+            memset(gn->damage, 0, gn->tiles_x * gn->tiles_y);
+            kinds[k].draw(gn, f);
+            if (trace_writer_frame(w, f * kinds[k].frame_us, gn->img, 0, gn->damage) < 0)
+                ret = 1;
+        }
+        if (trace_writer_close(w) < 0) ret = 1;
+        if (ret == 0)
+            printf("%s: %d %s frames, %dx%d\n", out, nframes, kind,
+                   gn->g.visible_width, gn->g.visible_height);
+    }
+    arena_unmap(gn->img, size);
+    free(gn->damage);
+    free(gn);
+    return ret;
+}
+
+/* ============== Main ============== */
+
+int main(int argc, char *argv[]) {
+    const char *kind = NULL, *path = NULL;
+    int nframes = 0, tile_major = 0, cache_mb = TILE_CACHE_DEFAULT_MB;
+    int effort = COMPRESS_EFFORT_DEFAULT;
+    enum wlr_log_importance log_level = WLR_ERROR;
+    struct parallel_config pool_cfg = {0};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            kind = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            nframes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            pool_cfg.nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+            effort = atoi(argv[++i]);
+            if (effort < COMPRESS_EFFORT_RAW || effort > COMPRESS_EFFORT_HIGH) {
+                fprintf(stderr, "Invalid effort level: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            cache_mb = atoi(argv[++i]);
+            if (cache_mb < 0) cache_mb = 0;
+            if (cache_mb > TILE_CACHE_MAX_MB) cache_mb = TILE_CACHE_MAX_MB;
+        } else if (strcmp(argv[i], "-B") == 0) {
+            tile_major = 1;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            log_level = WLR_INFO;
+        } else if (argv[i][0] == '-' || path) {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    wlr_log_init(log_level, NULL);
+    if (kind)
+        return generate(kind, path, nframes);
+
+    if (parallel_configure(&pool_cfg) < 0)
+        return 1;
+    return replay(path, tile_major, cache_mb, effort);
+}
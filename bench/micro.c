@@ -0,0 +1,565 @@
+/*
+ * micro.c - p9wl-micro: microbenchmarks of the per-tile hot paths
+ *
+ * Times the kernels that SIMD and algorithm changes touch, one at a
+ * time, on fixed tile corpora:
+ *
+ *   compress_tile_data      LZ77 of one 16×16 tile (raw rows)
+ *   compress_tile_adaptive  direct vs alpha-delta choice of one tile
+ *   tile_changed            scalar reference compare (equal tiles,
+ *                           the full-scan worst case)
+ *   tilecmp_tile            dispatched SIMD compare, same tiles
+ *   phase_correlate_detect  one region, content moved up 7 rows
+ *   parallel_for            dispatch of count trivial items
+ *
+ * Corpora are 512×512 frames (1024 tiles) of one kind each: solid,
+ * text, gradient, photo (smooth shading with sensor noise) and noise;
+ * each -r <trace> adds the last two frames of a p9wl -T trace as a
+ * corpus of real content. The "previous frame" used by the delta and compare
+ * paths differs from the current one by a 4×4 block per tile.
+ *
+ * Output:
+ *
+ *   One JSON object per line on stdout, e.g.
+ *
+ *     {"bench":"compress_tile_data","corpus":"text","kernel":"avx2",
+ *      "ops":524288,"ns_per_op":212.4,"ns_min":209.8,"mb_per_s":4821.3,
+ *      "ratio":3.41}
+ *
+ *   ns_per_op is the median of -R repeats of at least -t ms each,
+ *   ns_min the fastest; mb_per_s is input pixel bytes at the median.
+ *   ratio (compressors) is input over output bytes, stored tiles
+ *   counting as raw. Diff two runs to see a regression; a change to
+ *   any of these kernels should quote the before and after lines.
+ *
+ * Usage:
+ *
+ *   p9wl-micro [-t ms] [-R repeats] [-E level] [-W n] [-r trace]...
+ *              [-b bench] [-c corpus]
+ *
+ *   -b and -c run one benchmark or corpus only (by name). "make
+ *   bench-micro" runs everything, with the bench-traces as real
+ *   corpora, into bench/micro.jsonl.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include <wlr/util/log.h>
+
+#include "types.h"
+#include "draw/arena.h"
+#include "draw/compress.h"
+#include "draw/draw_helpers.h"
+#include "draw/parallel.h"
+#include "draw/phase_correlate.h"
+#include "draw/tilecmp.h"
+#include "draw/trace.h"
+
+#define CORPUS_DIM      512
+#define MAX_REPEATS     15
+#define SCROLL_DY       7
+#define MAX_TRACES      8
+
+struct corpus {
+    char name[64];
+    int width, height;          /* Multiples of TILE_SIZE */
+    uint32_t *cur;
+    uint32_t *prev;             /* Previous frame (synthetic: cur with a
+                                 * 4×4 change per tile) */
+    uint32_t *scrolled;         /* cur moved up SCROLL_DY rows */
+    uint32_t *copy;             /* Same pixels as cur, other memory */
+    int ntiles;
+};
+
+struct options {
+    double min_ms;
+    int repeats;
+    const char *only_bench;
+    const char *only_corpus;
+    int effort;                 /* COMPRESS_EFFORT_*, -E */
+};
+
+static volatile uint64_t sink;  /* Keeps results alive */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352d;
+    x ^= x >> 15; x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* ============== Corpora ============== */
+
+static uint32_t rgb(int r, int g, int b) {
+    r = r < 0 ? 0 : r > 255 ? 255 : r;
+    g = g < 0 ? 0 : g > 255 ? 255 : g;
+    b = b < 0 ? 0 : b > 255 ? 255 : b;
+    return 0xFF000000 | (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+}
+
+static uint32_t px_solid(int x, int y) {
+    uint32_t h = hash32((y / TILE_SIZE) * 977 + x / TILE_SIZE);
+    return rgb(h & 0xFF, (h >> 8) & 0xFF, (h >> 16) & 0xFF);
+}
+
+/* 8×16 cells of pseudo-glyphs, dark on white */
+static uint32_t px_text(int x, int y) {
+    int cx = x / 8, cy = y / 16, gx = x % 8, gy = y % 16;
+    uint32_t cell = hash32(cy * 1031 + cx);
+    if (cell % 5 == 0 || gy < 3 || gy > 12 || gx == 0 || gx == 7)
+        return 0xFFFFFFFF;
+    uint32_t bits = hash32((cell % 94) * 16 + gy);
+    return (bits >> gx) & (bits >> (gx + 7)) & 1 ? 0xFF202020 : 0xFFFFFFFF;
+}
+
+static uint32_t px_gradient(int x, int y) {
+    return rgb(x / 2, y / 2, 255 - (x + y) / 4);
+}
+
+static uint32_t px_photo(int x, int y) {
+    double u = x / 37.0, v = y / 23.0;
+    double p = sin(u) * cos(v * 0.7) + 0.5 * sin((u + v) * 1.9);
+    int n = (int)(hash32(y * CORPUS_DIM + x) & 7) - 4;
+    return rgb((int)(120 + 60 * p) + n, (int)(100 + 50 * sin(p + u * 0.3)) + n,
+               (int)(80 + 40 * cos(p * 1.3)) + n);
+}
+
+static uint32_t px_noise(int x, int y) {
+    return 0xFF000000 | (hash32(y * CORPUS_DIM + x + 12345) & 0xFFFFFF);
+}
+
+/* scrolled, copy (and, for synthetic corpora, prev) from cur */
+static void corpus_derive(struct corpus *c, int make_prev) {
+    if (make_prev) {
+        memcpy(c->prev, c->cur, (size_t)c->width * c->height * 4);
+        for (int ty = 0; ty < c->height / TILE_SIZE; ty++) {
+            for (int tx = 0; tx < c->width / TILE_SIZE; tx++) {
+                /* A caret-sized change somewhere in every tile */
+                uint32_t h = hash32(ty * 4099 + tx);
+                int ox = tx * TILE_SIZE + h % (TILE_SIZE - 4);
+                int oy = ty * TILE_SIZE + (h >> 8) % (TILE_SIZE - 4);
+                for (int j = 0; j < 4; j++)
+                    for (int i = 0; i < 4; i++)
+                        c->prev[(size_t)(oy + j) * c->width + ox + i] ^= 0x00FFFFFF;
+            }
+        }
+    }
+    for (int y = 0; y < c->height; y++) {
+        int sy = y + SCROLL_DY < c->height ? y + SCROLL_DY : y;
+        memcpy(c->scrolled + (size_t)y * c->width, c->cur + (size_t)sy * c->width,
+               (size_t)c->width * 4);
+    }
+    memcpy(c->copy, c->cur, (size_t)c->width * c->height * 4);
+    c->ntiles = (c->width / TILE_SIZE) * (c->height / TILE_SIZE);
+}
+
+static int corpus_alloc(struct corpus *c, const char *name, int width, int height) {
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->width = width;
+    c->height = height;
+    size_t size = (size_t)width * height * 4;
+    c->cur = arena_map(size);
+    c->prev = arena_map(size);
+    c->scrolled = arena_map(size);
+    c->copy = arena_map(size);
+    return c->cur && c->prev && c->scrolled && c->copy ? 0 : -1;
+}
+
+static void corpus_free(struct corpus *c) {
+    size_t size = (size_t)c->width * c->height * 4;
+    arena_unmap(c->cur, size);
+    arena_unmap(c->prev, size);
+    arena_unmap(c->scrolled, size);
+    arena_unmap(c->copy, size);
+}
+
+static int corpus_synthetic(struct corpus *c, const char *name, uint32_t (*px)(int, int)) {
+    if (corpus_alloc(c, name, CORPUS_DIM, CORPUS_DIM) < 0) return -1;
+    for (int y = 0; y < CORPUS_DIM; y++)
+        for (int x = 0; x < CORPUS_DIM; x++)
+            c->cur[(size_t)y * CORPUS_DIM + x] = px(x, y);
+    corpus_derive(c, 1);
+    return 0;
+}
+
+/* Last frame of a trace as cur; the frame before it as prev */
+static int corpus_trace(struct corpus *c, const char *path) {
+    struct trace_geom g;
+    struct trace_reader *r = trace_reader_open(path, &g);
+    if (!r) return -1;
+    const char *base = strrchr(path, '/');
+    char name[64];
+    snprintf(name, sizeof(name), "trace:%s", base ? base + 1 : path);
+    uint8_t *damage = malloc((size_t)(g.width / TILE_SIZE) * (g.height / TILE_SIZE));
+    if (!damage || corpus_alloc(c, name, g.width, g.height) < 0) {
+        free(damage);
+        trace_reader_close(r);
+        return -1;
+    }
+    int valid, rc, frames = 0;
+    uint64_t t_us;
+    size_t size = (size_t)g.width * g.height * 4;
+    /* Decode into scrolled (scratch) so the frame before stays in cur */
+    for (;;) {
+        memcpy(c->scrolled, c->cur, size);
+        rc = trace_reader_next(r, c->scrolled, damage, &valid, &t_us);
+        if (rc <= 0) break;
+        memcpy(c->prev, c->cur, size);
+        memcpy(c->cur, c->scrolled, size);
+        frames++;
+    }
+    free(damage);
+    trace_reader_close(r);
+    if (rc < 0 || frames == 0) {
+        fprintf(stderr, "%s: unreadable or empty trace\n", path);
+        return -1;
+    }
+    corpus_derive(c, 0);
+    return 0;
+}
+
+/* ============== Timing ============== */
+
+typedef uint64_t (*bench_fn)(void *ctx, uint64_t iters);
+
+struct timing {
+    uint64_t ops;               /* Per repeat */
+    double ns_med, ns_min;
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Calibrate to min_ms per repeat, then time the repeats */
+static void time_bench(const struct options *o, bench_fn fn, void *ctx, struct timing *t) {
+    uint64_t target = (uint64_t)(o->min_ms * 1e6);
+    uint64_t iters = 1, dt;
+    for (;;) {
+        uint64_t t0 = now_ns();
+        sink += fn(ctx, iters);
+        dt = now_ns() - t0;
+        if (dt >= target / 4 || iters >= (1ull << 32)) break;
+        iters *= dt < target / 64 ? 16 : 2;
+    }
+    if (dt > 0 && dt < target)
+        iters = (uint64_t)((double)iters * target / dt) + 1;
+
+    double ns[MAX_REPEATS];
+    for (int i = 0; i < o->repeats; i++) {
+        uint64_t t0 = now_ns();
+        sink += fn(ctx, iters);
+        ns[i] = (double)(now_ns() - t0) / iters;
+    }
+    qsort(ns, o->repeats, sizeof(ns[0]), cmp_double);
+    t->ops = iters;
+    t->ns_med = ns[o->repeats / 2];
+    t->ns_min = ns[0];
+}
+
+static void emit(const char *bench, const char *corpus, const char *kernel,
+                 const struct timing *t, double bytes_per_op, double ratio) {
+    printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"kernel\":\"%s\","
+           "\"ops\":%llu,\"ns_per_op\":%.1f,\"ns_min\":%.1f",
+           bench, corpus, kernel, (unsigned long long)t->ops, t->ns_med, t->ns_min);
+    if (bytes_per_op > 0)
+        printf(",\"mb_per_s\":%.1f", bytes_per_op / t->ns_med * 1e9 / (1024.0 * 1024.0));
+    if (ratio > 0)
+        printf(",\"ratio\":%.3f", ratio);
+    printf("}\n");
+    fflush(stdout);
+}
+
+/* ============== Tile Benchmarks ============== */
+
+struct tile_ctx {
+    const struct corpus *c;
+    uint8_t raw[TILE_SIZE * TILE_SIZE * 4 * 64];    /* 64 tiles, packed rows */
+    int nraw;
+    int effort;                                     /* -E */
+    uint8_t dst[TILE_OUT_MAX];
+};
+
+/* Tile i of the corpus, cycling in raster order */
+static inline void tile_xy(const struct corpus *c, uint64_t i, int *x, int *y) {
+    int tiles_x = c->width / TILE_SIZE;
+    int idx = (int)(i % c->ntiles);
+    *x = (idx % tiles_x) * TILE_SIZE;
+    *y = (idx / tiles_x) * TILE_SIZE;
+}
+
+static uint64_t run_compress_data(void *arg, uint64_t iters) {
+    struct tile_ctx *t = arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        uint8_t *raw = t->raw + (i % t->nraw) * (TILE_SIZE * TILE_SIZE * 4);
+        sum += compress_tile_data(t->dst, sizeof(t->dst), raw, TILE_SIZE * 4, TILE_SIZE,
+                                  t->effort);
+    }
+    return sum;
+}
+
+static uint64_t run_compress_adaptive(void *arg, uint64_t iters) {
+    struct tile_ctx *t = arg;
+    const struct corpus *c = t->c;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        int x, y;
+        tile_xy(c, i, &x, &y);
+        sum += compress_tile_adaptive(t->dst, sizeof(t->dst), c->cur, c->width,
+                                      c->prev, c->width, x, y, TILE_SIZE, TILE_SIZE,
+                                      t->effort);
+    }
+    return sum;
+}
+
+static uint64_t run_tile_changed(void *arg, uint64_t iters) {
+    struct tile_ctx *t = arg;
+    const struct corpus *c = t->c;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        int x, y;
+        tile_xy(c, i, &x, &y);
+        sum += tile_changed(c->cur, c->copy, c->width, x, y, TILE_SIZE, TILE_SIZE);
+    }
+    return sum;
+}
+
+static uint64_t run_tilecmp_tile(void *arg, uint64_t iters) {
+    struct tile_ctx *t = arg;
+    const struct corpus *c = t->c;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        int x, y;
+        tile_xy(c, i, &x, &y);
+        sum += tilecmp_tile(c->cur, c->copy, c->width, x, y, TILE_SIZE, TILE_SIZE);
+    }
+    return sum;
+}
+
+/* Pack the corpus's first tiles as raw rows for compress_tile_data() */
+static void tile_ctx_init(struct tile_ctx *t, const struct corpus *c, int effort) {
+    t->c = c;
+    t->effort = effort;
+    t->nraw = c->ntiles < 64 ? c->ntiles : 64;
+    for (int k = 0; k < t->nraw; k++) {
+        int x, y;
+        /* Spread over the frame rather than its top rows */
+        tile_xy(c, (uint64_t)k * c->ntiles / t->nraw, &x, &y);
+        uint8_t *dst = t->raw + k * (TILE_SIZE * TILE_SIZE * 4);
+        for (int row = 0; row < TILE_SIZE; row++)
+            memcpy(dst + row * TILE_SIZE * 4, c->cur + (size_t)(y + row) * c->width + x,
+                   TILE_SIZE * 4);
+    }
+}
+
+/* Input over output bytes for one pass over the corpus */
+static double compress_ratio(struct tile_ctx *t, int adaptive) {
+    const struct corpus *c = t->c;
+    const double tile_bytes = TILE_SIZE * TILE_SIZE * 4;
+    double in = 0, out = 0;
+    int n = adaptive ? c->ntiles : t->nraw;
+    for (int i = 0; i < n; i++) {
+        int size;
+        if (adaptive) {
+            int x, y;
+            tile_xy(c, i, &x, &y);
+            size = compress_tile_adaptive(t->dst, sizeof(t->dst), c->cur, c->width,
+                                          c->prev, c->width, x, y, TILE_SIZE, TILE_SIZE,
+                                          t->effort);
+            if (size > 0) size += ALPHA_DELTA_OVERHEAD;
+            else size = -size;
+        } else {
+            size = compress_tile_data(t->dst, sizeof(t->dst),
+                                      t->raw + i * (int)tile_bytes, TILE_SIZE * 4, TILE_SIZE,
+                                      t->effort);
+        }
+        in += tile_bytes;
+        out += size > 0 ? size : tile_bytes;
+    }
+    return out > 0 ? in / out : 0;
+}
+
+/* ============== Phase Correlation ============== */
+
+struct phase_ctx {
+    const struct corpus *c;
+    int w, h;
+    int dx, dy, valid;
+};
+
+static uint64_t run_phase(void *arg, uint64_t iters) {
+    struct phase_ctx *p = arg;
+    const struct corpus *c = p->c;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iters; i++) {
+        struct phase_result r = phase_correlate_detect(c->scrolled, c->cur, c->width,
+                                                       0, 0, p->w, p->h, MAX_SCROLL_DETECT);
+        p->dx = r.dx;
+        p->dy = r.dy;
+        p->valid = r.valid;
+        sum += r.valid;
+    }
+    return sum;
+}
+
+/* ============== Parallel Dispatch ============== */
+
+struct dispatch_ctx {
+    int count;
+    atomic_uint_least64_t done;
+};
+
+static void dispatch_item(void *arg, int idx) {
+    struct dispatch_ctx *d = arg;
+    atomic_fetch_add_explicit(&d->done, (unsigned)idx + 1, memory_order_relaxed);
+}
+
+static uint64_t run_dispatch(void *arg, uint64_t iters) {
+    struct dispatch_ctx *d = arg;
+    for (uint64_t i = 0; i < iters; i++)
+        parallel_for(d->count, dispatch_item, d);
+    return atomic_load(&d->done);
+}
+
+/* ============== Main ============== */
+
+static int want(const char *only, const char *name) {
+    return !only || strcmp(only, name) == 0;
+}
+
+static void bench_corpus(const struct options *o, const struct corpus *c) {
+    if (!want(o->only_corpus, c->name)) return;
+    const double tile_bytes = TILE_SIZE * TILE_SIZE * 4;
+    struct timing t;
+
+    struct tile_ctx *tc = malloc(sizeof(*tc));
+    if (!tc) return;
+    tile_ctx_init(tc, c, o->effort);
+    if (want(o->only_bench, "compress_tile_data")) {
+        time_bench(o, run_compress_data, tc, &t);
+        emit("compress_tile_data", c->name, compress_kernel_name(), &t, tile_bytes,
+             compress_ratio(tc, 0));
+    }
+    if (want(o->only_bench, "compress_tile_adaptive")) {
+        time_bench(o, run_compress_adaptive, tc, &t);
+        emit("compress_tile_adaptive", c->name, compress_kernel_name(), &t, tile_bytes,
+             compress_ratio(tc, 1));
+    }
+    if (want(o->only_bench, "tile_changed")) {
+        time_bench(o, run_tile_changed, tc, &t);
+        emit("tile_changed", c->name, "scalar", &t, 2 * tile_bytes, 0);
+    }
+    if (want(o->only_bench, "tilecmp_tile")) {
+        time_bench(o, run_tilecmp_tile, tc, &t);
+        emit("tilecmp_tile", c->name, tilecmp_kernel_name(), &t, 2 * tile_bytes, 0);
+    }
+    free(tc);
+
+    if (want(o->only_bench, "phase_correlate_detect")) {
+        struct phase_ctx p = { .c = c };
+        p.w = c->width < CORPUS_DIM ? c->width : CORPUS_DIM;
+        p.h = c->height < CORPUS_DIM ? c->height : CORPUS_DIM;
+        time_bench(o, run_phase, &p, &t);
+        emit("phase_correlate_detect", c->name, "fftw", &t, 2.0 * p.w * p.h * 4, 0);
+        if (!p.valid || p.dx != 0 || p.dy != -SCROLL_DY)
+            fprintf(stderr, "phase_correlate_detect on %s: got %s (%d,%d), expected (0,%d)\n",
+                    c->name, p.valid ? "shift" : "invalid", p.dx, p.dy, -SCROLL_DY);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct options o = { .min_ms = 100, .repeats = 5, .effort = COMPRESS_EFFORT_DEFAULT };
+    struct parallel_config pool_cfg = {0};
+    const char *traces[MAX_TRACES];
+    int ntraces = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            o.min_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            o.repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+            o.effort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            pool_cfg.nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc && ntraces < MAX_TRACES) {
+            traces[ntraces++] = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            o.only_bench = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            o.only_corpus = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-t ms] [-R repeats] [-E level] [-W n] "
+                            "[-r trace] [-b bench] [-c corpus]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (o.min_ms <= 0) o.min_ms = 100;
+    if (o.repeats < 1) o.repeats = 1;
+    if (o.repeats > MAX_REPEATS) o.repeats = MAX_REPEATS;
+    if (o.effort < COMPRESS_EFFORT_RAW) o.effort = COMPRESS_EFFORT_RAW;
+    if (o.effort > COMPRESS_EFFORT_HIGH) o.effort = COMPRESS_EFFORT_HIGH;
+
+    wlr_log_init(WLR_ERROR, NULL);
+    if (parallel_configure(&pool_cfg) < 0)
+        return 1;
+    tilecmp_init();
+    compress_pool_init(parallel_worker_count());
+
+    static const struct {
+        const char *name;
+        uint32_t (*px)(int, int);
+    } synth[] = {
+        { "solid", px_solid },
+        { "text", px_text },
+        { "gradient", px_gradient },
+        { "photo", px_photo },
+        { "noise", px_noise },
+    };
+    for (size_t i = 0; i < sizeof(synth) / sizeof(synth[0]); i++) {
+        struct corpus c;
+        if (!want(o.only_corpus, synth[i].name)) continue;
+        if (corpus_synthetic(&c, synth[i].name, synth[i].px) < 0) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        bench_corpus(&o, &c);
+        corpus_free(&c);
+    }
+    for (int i = 0; i < ntraces; i++) {
+        struct corpus c;
+        if (corpus_trace(&c, traces[i]) < 0) return 1;
+        bench_corpus(&o, &c);
+        corpus_free(&c);
+    }
+
+    /* Dispatch overhead: per call, by item count */
+    if (want(o.only_bench, "parallel_for") && !o.only_corpus) {
+        static const int counts[] = { 1, 16, 256, 4096 };
+        char name[32];
+        for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+            struct dispatch_ctx d = { .count = counts[i] };
+            struct timing t;
+            time_bench(&o, run_dispatch, &d, &t);
+            snprintf(name, sizeof(name), "items:%d", counts[i]);
+            emit("parallel_for", name, "pool", &t, 0, 0);
+        }
+    }
+
+    phase_correlate_cleanup();
+    return 0;
+}
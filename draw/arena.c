@@ -0,0 +1,96 @@
+/*
+ * arena.c - Huge-page backed mappings and bump arenas
+ *
+ * MAP_HUGETLB first, then a normal mapping with MADV_HUGEPAGE for
+ * transparent huge pages. See arena.h.
+ */
+
+#define _GNU_SOURCE             /* MAP_HUGETLB, MADV_HUGEPAGE */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <wlr/util/log.h>
+
+#include "arena.h"
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/* ============== Mappings ============== */
+
+/* Mapped length for a request: whole huge pages from 2 MiB up */
+static size_t map_len(size_t size) {
+    size_t page = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+void *arena_map(size_t size) {
+    if (size == 0) return NULL;
+    size_t len = map_len(size);
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (len >= HUGE_PAGE_SIZE)
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        /* Best effort: THP may be disabled or set to "never" */
+        if (len >= HUGE_PAGE_SIZE)
+            madvise(p, len, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+}
+
+void arena_unmap(void *p, size_t size) {
+    if (p && size > 0)
+        munmap(p, map_len(size));
+}
+
+/* ============== Bump Arenas ============== */
+
+int arena_init(struct arena *a, size_t cap) {
+    memset(a, 0, sizeof(*a));
+    atomic_init(&a->used, 0);
+    a->base = arena_map(cap);
+    if (!a->base) {
+        wlr_log(WLR_ERROR, "arena: failed to map %zu bytes", cap);
+        return -1;
+    }
+    a->cap = cap;
+    a->mapped = 1;
+    return 0;
+}
+
+void arena_init_static(struct arena *a, void *buf, size_t cap) {
+    /* Align the start so pieces keep ARENA_ALIGN */
+    uintptr_t start = ((uintptr_t)buf + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+    size_t skip = start - (uintptr_t)buf;
+    a->base = (unsigned char *)start;
+    a->cap = cap > skip ? cap - skip : 0;
+    a->mapped = 0;
+    atomic_init(&a->used, 0);
+}
+
+void *arena_bump(struct arena *a, size_t n) {
+    if (!a->base) return NULL;
+    size_t sz = ARENA_SIZE(n);
+    size_t off = atomic_fetch_add_explicit(&a->used, sz, memory_order_relaxed);
+    if (off + sz > a->cap) return NULL;
+    return a->base + off;
+}
+
+void arena_fini(struct arena *a) {
+    if (a->mapped)
+        arena_unmap(a->base, a->cap);
+    a->base = NULL;
+    a->cap = 0;
+    a->mapped = 0;
+    atomic_store(&a->used, 0);
+}
@@ -0,0 +1,89 @@
+/*
+ * arena.h - Huge-page backed mappings and bump arenas
+ *
+ * The frame path streams several large buffers every frame: the four
+ * framebuffers (framebuf, prev_framebuf, send_buf[0/1]) and the send
+ * thread's per-tile tables. At 8K that is hundreds of MB touched per
+ * frame; on 4 KiB pages it costs a TLB miss every few rows.
+ *
+ * Mappings:
+ *
+ *   arena_map() returns zeroed, page-aligned anonymous memory. Sizes of
+ *   2 MiB and up are rounded to whole 2 MiB pages and mapped with
+ *   MAP_HUGETLB first; if the system has no reserved huge pages, a
+ *   normal mapping is advised MADV_HUGEPAGE so transparent huge pages
+ *   can back it. Smaller sizes are plain page-rounded mappings. Pages
+ *   are only committed when first touched, so a generous reservation
+ *   costs what is used.
+ *
+ *   arena_unmap() must get the same size that was passed to
+ *   arena_map(), which repeats the rounding.
+ *
+ * Bump Arenas:
+ *
+ *   struct arena carves one mapping (or caller memory) into pieces
+ *   aligned to ARENA_ALIGN (a cache line), so neighbouring pieces
+ *   written by different threads never share a line. arena_bump() is
+ *   a single atomic fetch_add and may be called from any thread;
+ *   arena_reset() (owner only, nothing in flight) reuses the arena for
+ *   the next frame. The send thread uses one arena for its per-tile
+ *   tables (carved once) and one for the compressed tile payloads of
+ *   the current frame (reset every frame), see send.c.
+ *
+ *   A full arena returns NULL; callers treat that like any other
+ *   allocation failure (a tile payload falls back to a raw load).
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* Piece alignment (cache line) */
+#define ARENA_ALIGN 64
+
+/* Size of a piece of n bytes in an arena, padding included */
+#define ARENA_SIZE(n) (((size_t)(n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena {
+    unsigned char *base;
+    size_t cap;
+    atomic_size_t used;
+    int mapped;             /* base came from arena_map() */
+};
+
+/*
+ * Map size bytes of zeroed memory, huge-page backed where possible.
+ * Returns NULL on failure (or size 0).
+ */
+void *arena_map(size_t size);
+
+/* Unmap memory from arena_map(size). NULL is ignored. */
+void arena_unmap(void *p, size_t size);
+
+/*
+ * Initialize an arena over a new mapping of cap bytes.
+ * Returns 0 on success, -1 on failure (the arena is then empty and
+ * every arena_bump() returns NULL).
+ */
+int arena_init(struct arena *a, size_t cap);
+
+/* Initialize an arena over caller memory (e.g. a stack buffer). */
+void arena_init_static(struct arena *a, void *buf, size_t cap);
+
+/*
+ * Take n bytes, ARENA_ALIGN aligned. Thread-safe.
+ * Returns NULL if the arena is full.
+ */
+void *arena_bump(struct arena *a, size_t n);
+
+/* Drop all pieces. Not thread-safe; no piece may still be in use. */
+static inline void arena_reset(struct arena *a) {
+    atomic_store_explicit(&a->used, 0, memory_order_relaxed);
+}
+
+/* Release the mapping. Safe on a zeroed or failed arena. */
+void arena_fini(struct arena *a);
+
+#endif /* ARENA_H */
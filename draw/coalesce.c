@@ -0,0 +1,208 @@
+/*
+ * coalesce.c - Merge changed tiles into larger load rectangles
+ *
+ * Candidates are aligned 4×4-tile blocks, or single tile rows of
+ * blocks that are not fully changed. See coalesce.h for the
+ * plan / compress / accept protocol.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "coalesce.h"
+
+/* 'Y'/'y' load header size */
+#define LOAD_HDR 21
+
+/* ============== Internal Helpers ============== */
+
+/* Bytes the tile costs when sent on its own */
+static inline int tile_cost(const struct tile_work *w, const struct tile_result *r) {
+    return LOAD_HDR + (r->size > 0 ? r->size : w->w * w->h * 4);
+}
+
+static int ensure_cap(void **buf, int *cap, int need, size_t elem) {
+    if (*cap >= need) return 0;
+    void *p = realloc(*buf, (size_t)need * elem);
+    if (!p) return -1;
+    *buf = p;
+    *cap = need;
+    return 0;
+}
+
+/* Largest useful payload: must fit a batch and save 25% over raw */
+static inline int rect_dst_max(const struct coalesce_ctx *ctx,
+                               const struct coalesce_rect *r) {
+    int dst_max = r->w * r->h * 4 * 3 / 4;
+    if (dst_max > (int)ctx->max_cmd - LOAD_HDR)
+        dst_max = (int)ctx->max_cmd - LOAD_HDR;
+    return dst_max;
+}
+
+/* Append a candidate if every tile in the span is a work item */
+static int add_candidate(struct coalesce_ctx *ctx,
+                         int tx, int ty, int ntx, int nty) {
+    for (int y = ty; y < ty + nty; y++)
+        for (int x = tx; x < tx + ntx; x++)
+            if (ctx->tile_work[y * ctx->tiles_x + x] < 0) return 0;
+
+    struct coalesce_rect *r = &ctx->rects[ctx->rect_count++];
+    r->x1 = tx * TILE_SIZE;
+    r->y1 = ty * TILE_SIZE;
+    r->w = ntx * TILE_SIZE;
+    r->h = nty * TILE_SIZE;
+    r->first = ctx->tile_work[ty * ctx->tiles_x + tx];
+    r->size = 0;
+    r->accepted = 0;
+    r->data = NULL;
+    return 1;
+}
+
+/* ============== Public API ============== */
+
+int coalesce_plan(struct coalesce_ctx *ctx,
+                  const uint32_t *pixels, int stride,
+                  const struct tile_work *work, int work_count,
+                  int tiles_x, int tiles_y, size_t max_cmd,
+                  int *work_rect) {
+    ctx->rect_count = 0;
+    ctx->band_count = 0;
+    for (int i = 0; i < work_count; i++) work_rect[i] = -1;
+    if (work_count <= 0 || tiles_x <= 0 || tiles_y <= 0) return 0;
+
+    /* Band table first: the send thread streams by band even when
+     * there is nothing to merge */
+    int nbands = (tiles_y + COALESCE_BLOCK - 1) / COALESCE_BLOCK;
+    if (ensure_cap((void **)&ctx->bands, &ctx->band_cap, nbands,
+                   sizeof(struct coalesce_band)) < 0)
+        return 0;
+    int wi = 0;
+    for (int b = 0; b < nbands; b++) {
+        int ty_end = (b + 1) * COALESCE_BLOCK;
+        while (wi < work_count && work[wi].y1 / TILE_SIZE < ty_end) wi++;
+        ctx->bands[b].work_end = wi;
+        ctx->bands[b].rect_end = 0;
+    }
+    ctx->band_count = nbands;
+
+    int ntiles = tiles_x * tiles_y;
+    int blocks_x = tiles_x / COALESCE_BLOCK;
+    int max_rects = blocks_x * nbands * COALESCE_BLOCK;
+    if (blocks_x == 0 || work_count < COALESCE_BLOCK ||
+        ensure_cap((void **)&ctx->tile_work, &ctx->tile_cap, ntiles, sizeof(int)) < 0 ||
+        ensure_cap((void **)&ctx->rects, &ctx->rect_cap, max_rects,
+                   sizeof(struct coalesce_rect)) < 0)
+        return 0;
+    memset(ctx->tile_work, 0xFF, ntiles * sizeof(int));
+
+    for (int i = 0; i < work_count; i++) {
+        const struct tile_work *tw = &work[i];
+        if (tw->w != TILE_SIZE || tw->h != TILE_SIZE) continue;
+        ctx->tile_work[(tw->y1 / TILE_SIZE) * tiles_x + tw->x1 / TILE_SIZE] = i;
+    }
+
+    ctx->pixels = pixels;
+    ctx->stride = stride;
+    ctx->tiles_x = tiles_x;
+    ctx->max_cmd = max_cmd;
+    ctx->effort = work[0].effort;
+
+    /* Whole blocks, else the block's fully changed rows; candidates
+     * are emitted band by band so bands[b].rect_end is monotonic */
+    for (int b = 0; b < nbands; b++) {
+        int by = b * COALESCE_BLOCK;
+        int rows = tiles_y - by;
+        if (rows > COALESCE_BLOCK) rows = COALESCE_BLOCK;
+        for (int bx = 0; bx + COALESCE_BLOCK <= tiles_x; bx += COALESCE_BLOCK) {
+            if (rows == COALESCE_BLOCK &&
+                add_candidate(ctx, bx, by, COALESCE_BLOCK, COALESCE_BLOCK))
+                continue;
+            for (int ty = by; ty < by + rows; ty++)
+                add_candidate(ctx, bx, ty, COALESCE_BLOCK, 1);
+        }
+        ctx->bands[b].rect_end = ctx->rect_count;
+    }
+
+    /* Payload arena, laid out after the list is final */
+    size_t arena_need = 0;
+    for (int i = 0; i < ctx->rect_count; i++) {
+        int n = rect_dst_max(ctx, &ctx->rects[i]);
+        arena_need += n > 0 ? (size_t)n : 0;
+    }
+    if (arena_need > ctx->arena_cap) {
+        uint8_t *p = realloc(ctx->arena, arena_need);
+        if (!p) {
+            ctx->rect_count = 0;
+            for (int b = 0; b < nbands; b++) ctx->bands[b].rect_end = 0;
+            return 0;
+        }
+        ctx->arena = p;
+        ctx->arena_cap = arena_need;
+    }
+    uint8_t *pos = ctx->arena;
+    for (int i = 0; i < ctx->rect_count; i++) {
+        int n = rect_dst_max(ctx, &ctx->rects[i]);
+        ctx->rects[i].data = pos;
+        pos += n > 0 ? n : 0;
+    }
+
+    return ctx->rect_count;
+}
+
+void coalesce_compress(struct coalesce_ctx *ctx, int idx) {
+    struct coalesce_rect *r = &ctx->rects[idx];
+    int dst_max = rect_dst_max(ctx, r);
+    r->size = (dst_max > 0)
+        ? compress_rect_direct(r->data, dst_max, ctx->pixels, ctx->stride,
+                               r->x1, r->y1, r->w, r->h, ctx->effort)
+        : 0;
+}
+
+int coalesce_accept(struct coalesce_ctx *ctx, int rect_start, int rect_end,
+                    const struct tile_work *work,
+                    const struct tile_result *results, int *work_rect) {
+    int covered = 0;
+    for (int i = rect_start; i < rect_end; i++) {
+        struct coalesce_rect *r = &ctx->rects[i];
+        int tx1 = r->x1 / TILE_SIZE, ty1 = r->y1 / TILE_SIZE;
+        int tx2 = tx1 + r->w / TILE_SIZE, ty2 = ty1 + r->h / TILE_SIZE;
+
+        int budget = 0, delta = 0;
+        for (int ty = ty1; ty < ty2 && !delta; ty++) {
+            for (int tx = tx1; tx < tx2; tx++) {
+                int wi = ctx->tile_work[ty * ctx->tiles_x + tx];
+                if (results[wi].is_delta) { delta = 1; break; }
+                budget += tile_cost(&work[wi], &results[wi]);
+            }
+        }
+
+        int raw_cost = LOAD_HDR + r->w * r->h * 4;
+        if (delta) {
+            r->accepted = 0;
+        } else if (r->size > 0 && LOAD_HDR + r->size < budget) {
+            r->accepted = 1;
+        } else if (raw_cost < budget && raw_cost <= (int)ctx->max_cmd) {
+            r->accepted = 1;
+            r->size = 0;
+        } else {
+            r->accepted = 0;
+        }
+        if (!r->accepted) continue;
+
+        for (int ty = ty1; ty < ty2; ty++) {
+            for (int tx = tx1; tx < tx2; tx++) {
+                work_rect[ctx->tile_work[ty * ctx->tiles_x + tx]] = i;
+                covered++;
+            }
+        }
+    }
+    return covered;
+}
+
+void coalesce_free(struct coalesce_ctx *ctx) {
+    free(ctx->tile_work);
+    free(ctx->rects);
+    free(ctx->bands);
+    free(ctx->arena);
+    memset(ctx, 0, sizeof(*ctx));
+}
@@ -0,0 +1,142 @@
+/*
+ * coalesce.h - Merge changed tiles into larger load rectangles
+ *
+ * Every changed tile normally costs its own 21-byte 'Y' (or 'y')
+ * header, and the LZ77 encoder restarts at each 16-pixel tile edge.
+ * When an update covers a large area (video, page flips, full
+ * redraws), loading several adjacent tiles with one command is both
+ * fewer commands and better compression, because row matches run
+ * across the old tile edges.
+ *
+ * Candidate Shapes:
+ *
+ *   The tile grid is split into aligned blocks of COALESCE_BLOCK ×
+ *   COALESCE_BLOCK tiles (64×64 px). For each block:
+ *
+ *     - if every tile of the block is a full-size work item, the
+ *       whole 64×64 block is a candidate;
+ *     - otherwise every tile row of the block whose COALESCE_BLOCK
+ *       tiles are all work items is a 64×16 candidate.
+ *
+ *   Small isolated changes never form a candidate and keep 16×16
+ *   granularity.
+ *
+ * Streaming:
+ *
+ *   Candidates are chosen from tile positions alone, so they can be
+ *   compressed by the same worker job as the tiles (see send.c).
+ *   The frame is cut into bands of COALESCE_BLOCK tile rows; a band's
+ *   candidates follow its tiles in the job order, so the send thread
+ *   can accept and emit band b while later bands still compress:
+ *
+ *     coalesce_plan()      pick candidates, record band boundaries
+ *     coalesce_compress()  per candidate, on any worker
+ *     coalesce_accept()    per band, once its tiles and candidates
+ *                          are done
+ *
+ * Acceptance:
+ *
+ *   A candidate is kept only if none of its tiles chose alpha-delta
+ *   (those need a per-tile composite from delta_id) and its single
+ *   command is smaller than the sum of its tiles' separate commands
+ *   and fits in one batch. A candidate that does not compress is
+ *   still kept as one raw 'y' load when that beats the separate tiles
+ *   (e.g. all tiles were raw anyway).
+ *
+ * Emission (send.c):
+ *
+ *   work_rect[i] names the accepted rectangle covering work item i,
+ *   or -1. The send thread emits a rectangle's load when it reaches
+ *   the rectangle's first work item (rect->first) and skips the loads
+ *   of the other members; per-tile bookkeeping (cache fills,
+ *   prev_framebuf) is unchanged.
+ *
+ * Memory:
+ *
+ *   struct coalesce_ctx owns the tile map, rectangle list, band table
+ *   and an arena for compressed payloads. Buffers grow on demand and
+ *   are reused across frames; the send thread owns the context.
+ */
+
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "compress.h"
+
+/* Block edge in tiles (COALESCE_BLOCK * TILE_SIZE <= COMPRESS_RECT_MAX) */
+#define COALESCE_BLOCK 4
+
+struct coalesce_rect {
+    int x1, y1, w, h;       /* Pixel rectangle */
+    int first;              /* Work index at which the load is emitted */
+    int size;               /* Compressed payload size, 0 = raw load */
+    int accepted;
+    uint8_t *data;          /* Compressed payload (in ctx->arena) */
+};
+
+struct coalesce_band {
+    int work_end;           /* One past the band's last work index */
+    int rect_end;           /* One past the band's last candidate */
+};
+
+struct coalesce_ctx {
+    int *tile_work;                 /* Tile index → work index, -1 = none */
+    int tile_cap;
+    struct coalesce_rect *rects;
+    int rect_cap, rect_count;
+    struct coalesce_band *bands;
+    int band_cap, band_count;
+    uint8_t *arena;
+    size_t arena_cap;
+
+    /* Set by coalesce_plan() for coalesce_compress() */
+    const uint32_t *pixels;
+    int stride, tiles_x;
+    size_t max_cmd;
+    int effort;                     /* The work items' (one frame's) */
+};
+
+/*
+ * Choose candidate rectangles for this frame's work list.
+ *
+ * ctx:        coalescing state (zero-initialize before first use)
+ * pixels:     frame the tiles come from (row-major XRGB32)
+ * stride:     its stride in pixels
+ * work:       changed tiles in scanline tile order, as built by the
+ *             send thread
+ * work_count: number of work items
+ * tiles_x/y:  tile grid dimensions
+ * max_cmd:    largest command that fits in one batch
+ * work_rect:  output, work_count entries, all set to -1
+ *
+ * Returns the number of candidates (ctx->rect_count), 0 if there are
+ * none or on allocation failure. The band table (ctx->bands) is
+ * filled whenever work_count > 0; band_count is 0 if it could not be
+ * allocated.
+ */
+int coalesce_plan(struct coalesce_ctx *ctx,
+                  const uint32_t *pixels, int stride,
+                  const struct tile_work *work, int work_count,
+                  int tiles_x, int tiles_y, size_t max_cmd,
+                  int *work_rect);
+
+/* Compress candidate idx. Thread-safe across distinct indices. */
+void coalesce_compress(struct coalesce_ctx *ctx, int idx);
+
+/*
+ * Accept or reject candidates [rect_start, rect_end) now that their
+ * tiles' results are final, and mark the tiles of accepted ones in
+ * work_rect.
+ *
+ * Returns the number of work items covered by accepted rectangles.
+ */
+int coalesce_accept(struct coalesce_ctx *ctx, int rect_start, int rect_end,
+                    const struct tile_work *work,
+                    const struct tile_result *results, int *work_rect);
+
+/* Release all buffers. Safe on a zeroed context. */
+void coalesce_free(struct coalesce_ctx *ctx);
+
+#endif /* COALESCE_H */
@@ -2,25 +2,33 @@
  * compress.c - Tile compression for Plan 9 draw protocol
  *
  * LZ77-style row matching compression with special cases for
- * solid colors and alpha-delta encoding.
+ * solid colors and alpha-delta encoding.  The match finder is a
+ * pixel-granular kernel generated per instruction set (see
+ * DEFINE_LZ77_KERNEL) and selected at runtime, like tilecmp.c.
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <wlr/util/log.h>
 #include "compress.h"
 #include "parallel.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define COMPRESS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define COMPRESS_NEON 1
+#include <arm_neon.h>
+#endif
+
 /* Hash table for fast match finding — uses generation counter to avoid
  * per-tile memset.  Each compression thread gets its own copy via
  * __thread, and the generation is bumped once per tile instead of
  * clearing the 2KB+ table. */
 #define HASH_BITS 10
 #define HASH_SIZE (1 << HASH_BITS)
-#define HASH_MASK (HASH_SIZE - 1)
-
-static inline uint32_t hash3(const uint8_t *p) {
-    return ((p[0] << 5) ^ (p[1] << 2) ^ p[2]) & HASH_MASK;
-}
 
 static __thread uint16_t htab_pos[HASH_SIZE];
 static __thread uint16_t htab_gen[HASH_SIZE];
@@ -55,109 +63,362 @@ static int encode_solid_tile(uint8_t *dst, const uint8_t *pixel, int h) {
     return out;
 }
 
+/* ============== Vector Match Primitives ============== */
+
 /*
- * Fast LZ77 compression for a tile.
- * Uses hash table with generation counter (no per-tile memset).
+ * match_<isa>(a, b, maxlen): length of the common prefix of a and b,
+ * at most maxlen (<= LZ77_MAX_MATCH).  Both pointers must have
+ * LZ77_MAX_MATCH readable bytes; the kernel falls back to the scalar
+ * compare near the end of the buffer.
+ *
+ * rows_<isa>(a, b, n): 1 if the n-byte rows are equal (n % 4 == 0).
  */
-static int lz77_compress_fast(uint8_t *dst, int dst_max, uint8_t *raw, int raw_size, int bytes_per_row) {
-    int out = 0;
-    int h = raw_size / bytes_per_row;
-    uint8_t lit[128];
-    int nlit = 0;
-    
-    /* Bump generation instead of memset — wraps every 65535 tiles */
-    current_gen++;
-    if (current_gen == 0) {
-        memset(htab_gen, 0, sizeof(htab_gen));
-        current_gen = 1;
+#define LZ77_MAX_MATCH 32   /* Pixel-aligned cap under the format's 34 */
+
+static inline int match_scalar(const uint8_t *a, const uint8_t *b, int maxlen) {
+    int len = 0;
+    while (len < maxlen && a[len] == b[len]) len++;
+    return len;
+}
+
+static inline int rows_scalar(const uint8_t *a, const uint8_t *b, int n) {
+    return memcmp(a, b, n) == 0;
+}
+
+#ifdef COMPRESS_X86
+__attribute__((target("avx2")))
+static inline int match_avx2(const uint8_t *a, const uint8_t *b, int maxlen) {
+    __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)a),
+                                   _mm256_loadu_si256((const __m256i *)b));
+    uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(eq);
+    int len = ne ? __builtin_ctz(ne) : 32;
+    return len < maxlen ? len : maxlen;
+}
+
+__attribute__((target("avx2")))
+static inline int rows_avx2(const uint8_t *a, const uint8_t *b, int n) {
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+        if (!_mm256_testz_si256(x, x)) return 0;
     }
-    
-    for (int row = 0; row < h; row++) {
-        int row_start = row * bytes_per_row;
-        int row_end = row_start + bytes_per_row;
-        int pos = row_start;
-        
-        /* Fast path: row equals previous row */
-        if (row > 0 && memcmp(raw + row_start, raw + row_start - bytes_per_row, bytes_per_row) == 0) {
-            if (nlit > 0) {
-                if (out + 1 + nlit > dst_max) return 0;
-                dst[out++] = 0x80 | (nlit - 1);
-                memcpy(dst + out, lit, nlit);
-                out += nlit;
-                nlit = 0;
-            }
-            int remaining = bytes_per_row;
-            int off_code = bytes_per_row - 1;
-            while (remaining > 0) {
-                int len = remaining > 34 ? 34 : remaining;
-                if (out + 2 > dst_max) return 0;
-                dst[out++] = ((len - 3) << 2) | ((off_code >> 8) & 0x03);
-                dst[out++] = off_code & 0xFF;
-                remaining -= len;
-            }
-            continue;
-        }
-        
-        while (pos < row_end) {
-            int best = 0, boff = 0;
-            int maxlen = row_end - pos;
-            if (maxlen > 34) maxlen = 34;
-            
-            if (maxlen >= 3 && pos >= 3) {
-                uint32_t hv = hash3(raw + pos);
-                int candidate = htab_pos[hv];
-                int valid = (htab_gen[hv] == current_gen) &&
-                            candidate > 0 && pos - candidate <= 256;
-                htab_gen[hv] = current_gen;
-                htab_pos[hv] = pos;
-                
-                if (valid) {
-                    int off = pos - candidate;
-                    int len = 0;
-                    while (len < maxlen && raw[pos - off + len] == raw[pos + len]) len++;
-                    if (len >= 3) { best = len; boff = off; }
-                }
-                
-                if (best < maxlen && row > 0) {
-                    int off = bytes_per_row;
-                    if (pos - off >= 0) {
-                        int len = 0;
-                        while (len < maxlen && raw[pos - off + len] == raw[pos + len]) len++;
-                        if (len > best) { best = len; boff = off; }
-                    }
-                }
-            }
-            
-            if (best >= 3) {
-                if (nlit > 0) {
-                    if (out + 1 + nlit > dst_max) return 0;
-                    dst[out++] = 0x80 | (nlit - 1);
-                    memcpy(dst + out, lit, nlit);
-                    out += nlit;
-                    nlit = 0;
-                }
-                if (out + 2 > dst_max) return 0;
-                dst[out++] = ((best - 3) << 2) | ((boff - 1) >> 8);
-                dst[out++] = (boff - 1) & 0xFF;
-                pos += best;
-            } else {
-                lit[nlit++] = raw[pos++];
-                if (nlit == 128 || pos == row_end) {
-                    if (out + 1 + nlit > dst_max) return 0;
-                    dst[out++] = 0x80 | (nlit - 1);
-                    memcpy(dst + out, lit, nlit);
-                    out += nlit;
-                    nlit = 0;
-                }
-            }
-        }
+    return memcmp(a + i, b + i, n - i) == 0;
+}
+
+__attribute__((target("sse2")))
+static inline int match_sse2(const uint8_t *a, const uint8_t *b, int maxlen) {
+    uint32_t eq0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b)));
+    uint32_t eq1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)(a + 16)), _mm_loadu_si128((const __m128i *)(b + 16))));
+    uint32_t ne = ~(eq0 | eq1 << 16);
+    int len = ne ? __builtin_ctz(ne) : 32;
+    return len < maxlen ? len : maxlen;
+}
+
+__attribute__((target("sse2")))
+static inline int rows_sse2(const uint8_t *a, const uint8_t *b, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) return 0;
     }
-    
-    return out;
+    return memcmp(a + i, b + i, n - i) == 0;
+}
+#endif
+
+#ifdef COMPRESS_NEON
+/* 4 bits per byte: nibble i is 0xF where a[i] == b[i] */
+static inline uint64_t eq_mask_neon(const uint8_t *a, const uint8_t *b) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+
+static inline int match_neon(const uint8_t *a, const uint8_t *b, int maxlen) {
+    uint64_t ne = ~eq_mask_neon(a, b);
+    int len = ne ? __builtin_ctzll(ne) / 4 : 16;
+    if (len == 16) {
+        ne = ~eq_mask_neon(a + 16, b + 16);
+        len += ne ? __builtin_ctzll(ne) / 4 : 16;
+    }
+    return len < maxlen ? len : maxlen;
+}
+
+static inline int rows_neon(const uint8_t *a, const uint8_t *b, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        if (~eq_mask_neon(a + i, b + i)) return 0;
+    return memcmp(a + i, b + i, n - i) == 0;
+}
+#endif
+
+/* ============== Pixel-Aligned LZ77 Kernels ============== */
+
+/* Multiplicative hash of one 32-bit pixel */
+static inline uint32_t hash_px(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline int flush_literals(uint8_t *dst, int out, int dst_max,
+                                 const uint8_t *lit, int nlit) {
+    if (out + 1 + nlit > dst_max) return -1;
+    dst[out++] = 0x80 | (nlit - 1);
+    memcpy(dst + out, lit, nlit);
+    return out + nlit;
+}
+
+/*
+ * Previous position with the same pixel hash, per pixel of the current
+ * buffer (-1 = none).  Only the high-effort kernels keep chains; the
+ * entries of a buffer are all written before they are read, so the
+ * array needs no clearing.
+ */
+static __thread int16_t chain_prev[COMPRESS_RECT_MAX * COMPRESS_RECT_MAX];
+
+/* Hash chain length of the high-effort kernels */
+#define LZ77_HIGH_DEPTH 8
+
+/* Record pos under hash hv; with chains, link it to the previous entry */
+static inline int lz77_insert(uint32_t hv, int pos, int chain) {
+    int cand = htab_gen[hv] == current_gen ? htab_pos[hv] : -1;
+    htab_gen[hv] = current_gen;
+    htab_pos[hv] = pos;
+    if (chain) chain_prev[pos >> 2] = cand;
+    return cand;
+}
+
+/* Hash-table candidate for pos without recording pos */
+static inline int lz77_peek(uint32_t hv) {
+    return htab_gen[hv] == current_gen ? htab_pos[hv] : -1;
 }
 
+/*
+ * Generate lz77_<name>() and lz77_<name>_high() from a match and a
+ * row-compare primitive.
+ *
+ * Matches and literal runs never cross a row end, and matches reach
+ * back at most 256 bytes besides the previous-row reference.  The
+ * search runs on whole pixels: at each pixel the kernel tries the previous row,
+ * the previous pixel and one hash-table candidate keyed on the 4-byte
+ * pixel value, keeps the longest match rounded down to whole pixels,
+ * and otherwise emits the pixel as 4 literal bytes.  Positions stay
+ * pixel-aligned, so every hash probe is a real pixel and the vector
+ * compare covers a whole match in one or two loads.
+ *
+ * The _high variant (COMPRESS_EFFORT_HIGH) follows the hash chain up
+ * to LZ77_HIGH_DEPTH candidates, hashes every pixel a match covers,
+ * and matches lazily.  Every token costs two bytes whatever its
+ * length, so dropping a match for a literal rarely pays; instead the
+ * current match is shortened when that lets the following match
+ * reach further (one-step lookahead over each pixel-aligned split).
+ * Both are one always-inlined body with depth and lazy as constants,
+ * so the default variant is unchanged.
+ */
+#define DEFINE_LZ77_KERNEL(name, attr, match, rows_equal)                     \
+attr static inline __attribute__((always_inline))                             \
+int lz77_find_##name(const uint8_t *raw, int raw_size, int pos, int maxlen,  \
+                     int off_row, int off_px, int cand, int depth,            \
+                     int *boff_out) {                                         \
+    int vec = (raw_size - pos >= LZ77_MAX_MATCH);                             \
+    int best = 0, boff = 0;                                                   \
+    int offs[2] = { off_row, off_px };                                        \
+    for (int k = 0; k < 2 && best < maxlen; k++) {                            \
+        int off = offs[k];                                                    \
+        if (off <= 0) continue;                                               \
+        int len = vec ? match(raw + pos - off, raw + pos, maxlen)             \
+                      : match_scalar(raw + pos - off, raw + pos, maxlen);     \
+        len &= ~3;                                                            \
+        if (len > best) { best = len; boff = off; }                          \
+    }                                                                         \
+    for (int d = 0; d < depth && cand >= 0 && best < maxlen; d++) {           \
+        int off = pos - cand;                                                 \
+        if (off > 256) break;                                                 \
+        if (off != off_row && off != off_px) {                                \
+            int len = vec ? match(raw + cand, raw + pos, maxlen)              \
+                          : match_scalar(raw + cand, raw + pos, maxlen);      \
+            len &= ~3;                                                        \
+            if (len > best) { best = len; boff = off; }                      \
+        }                                                                     \
+        cand = depth > 1 ? chain_prev[cand >> 2] : -1;                        \
+    }                                                                         \
+    *boff_out = boff;                                                         \
+    return best;                                                              \
+}                                                                             \
+                                                                              \
+/* Longest match at pos, without recording pos in the hash table */           \
+attr static inline __attribute__((always_inline))                             \
+int lz77_next_##name(const uint8_t *raw, int raw_size, int pos, int row_end, \
+                     int off_row, int depth) {                                \
+    int maxlen = row_end - pos, boff;                                         \
+    if (maxlen > LZ77_MAX_MATCH) maxlen = LZ77_MAX_MATCH;                     \
+    return lz77_find_##name(raw, raw_size, pos, maxlen, off_row, 4,          \
+                            lz77_peek(hash_px(raw + pos)), depth, &boff);     \
+}                                                                             \
+                                                                              \
+attr static inline __attribute__((always_inline))                             \
+int lz77_body_##name(uint8_t *dst, int dst_max, const uint8_t *raw,          \
+                     int raw_size, int bytes_per_row,                         \
+                     int depth, int lazy) {                                   \
+    int out = 0, nlit = 0;                                                    \
+    int h = raw_size / bytes_per_row;                                         \
+    int chain = depth > 1;                                                    \
+    uint8_t lit[128];                                                         \
+                                                                              \
+    current_gen++;                                                            \
+    if (current_gen == 0) {                                                   \
+        memset(htab_gen, 0, sizeof(htab_gen));                                \
+        current_gen = 1;                                                      \
+    }                                                                         \
+                                                                              \
+    for (int row = 0; row < h; row++) {                                       \
+        int row_start = row * bytes_per_row;                                  \
+        int row_end = row_start + bytes_per_row;                              \
+        int off_row = row > 0 ? bytes_per_row : 0;                            \
+                                                                              \
+        if (row > 0 && rows_equal(raw + row_start - bytes_per_row,            \
+                                  raw + row_start, bytes_per_row)) {          \
+            if (nlit > 0) {                                                   \
+                if ((out = flush_literals(dst, out, dst_max, lit, nlit)) < 0) \
+                    return 0;                                                 \
+                nlit = 0;                                                     \
+            }                                                                 \
+            int off_code = bytes_per_row - 1;                                 \
+            for (int remaining = bytes_per_row; remaining > 0; ) {            \
+                int len = remaining > 34 ? 34 : remaining;                    \
+                if (out + 2 > dst_max) return 0;                              \
+                dst[out++] = ((len - 3) << 2) | ((off_code >> 8) & 0x03);     \
+                dst[out++] = off_code & 0xFF;                                 \
+                remaining -= len;                                             \
+            }                                                                 \
+            if (chain) {                                                      \
+                for (int q = row_start; q < row_end; q += 4)                  \
+                    lz77_insert(hash_px(raw + q), q, chain);                  \
+            }                                                                 \
+            continue;                                                         \
+        }                                                                     \
+                                                                              \
+        for (int pos = row_start; pos < row_end; ) {                          \
+            int maxlen = row_end - pos;                                       \
+            if (maxlen > LZ77_MAX_MATCH) maxlen = LZ77_MAX_MATCH;             \
+            int boff;                                                         \
+            int cand = lz77_insert(hash_px(raw + pos), pos, chain);           \
+            int best = lz77_find_##name(raw, raw_size, pos, maxlen, off_row, \
+                                        pos > row_start ? 4 : 0, cand,        \
+                                        depth, &boff);                        \
+                                                                              \
+            if (lazy && best >= 4 && best < maxlen && pos + best < row_end) { \
+                int reach = best + lz77_next_##name(raw, raw_size, pos + best, \
+                                                    row_end, off_row, depth); \
+                for (int l = best - 4; l >= 4; l -= 4) {                      \
+                    int r = l + lz77_next_##name(raw, raw_size, pos + l,      \
+                                                 row_end, off_row, depth);    \
+                    if (r > reach) { reach = r; best = l; }                   \
+                }                                                             \
+            }                                                                 \
+                                                                              \
+            if (best >= 4) {                                                  \
+                if (nlit > 0) {                                               \
+                    if ((out = flush_literals(dst, out, dst_max, lit, nlit)) < 0) \
+                        return 0;                                             \
+                    nlit = 0;                                                 \
+                }                                                             \
+                if (out + 2 > dst_max) return 0;                              \
+                dst[out++] = ((best - 3) << 2) | ((boff - 1) >> 8);           \
+                dst[out++] = (boff - 1) & 0xFF;                               \
+                if (chain) {                                                  \
+                    for (int q = pos + 4; q < pos + best; q += 4)             \
+                        lz77_insert(hash_px(raw + q), q, chain);              \
+                }                                                             \
+                pos += best;                                                  \
+            } else {                                                          \
+                memcpy(lit + nlit, raw + pos, 4);                             \
+                nlit += 4;                                                    \
+                pos += 4;                                                     \
+                if (nlit == 128 || pos == row_end) {                          \
+                    if ((out = flush_literals(dst, out, dst_max, lit, nlit)) < 0) \
+                        return 0;                                             \
+                    nlit = 0;                                                 \
+                }                                                             \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+    return out;                                                               \
+}                                                                             \
+                                                                              \
+attr static int lz77_##name(uint8_t *dst, int dst_max, const uint8_t *raw,   \
+                            int raw_size, int bytes_per_row) {               \
+    return lz77_body_##name(dst, dst_max, raw, raw_size, bytes_per_row, 1, 0); \
+}                                                                             \
+                                                                              \
+attr static int lz77_##name##_high(uint8_t *dst, int dst_max,                \
+                                   const uint8_t *raw, int raw_size,         \
+                                   int bytes_per_row) {                       \
+    return lz77_body_##name(dst, dst_max, raw, raw_size, bytes_per_row,      \
+                            LZ77_HIGH_DEPTH, 1);                              \
+}
+
+DEFINE_LZ77_KERNEL(scalar, , match_scalar, rows_scalar)
+#ifdef COMPRESS_X86
+DEFINE_LZ77_KERNEL(avx2, __attribute__((target("avx2"))), match_avx2, rows_avx2)
+DEFINE_LZ77_KERNEL(sse2, __attribute__((target("sse2"))), match_sse2, rows_sse2)
+#endif
+#ifdef COMPRESS_NEON
+DEFINE_LZ77_KERNEL(neon, , match_neon, rows_neon)
+#endif
+
+/* ============== Dispatch ============== */
+
+typedef int (*lz77_fn)(uint8_t *, int, const uint8_t *, int, int);
+
+static struct {
+    lz77_fn fn;
+    lz77_fn high;
+    const char *name;
+} lz77 = { lz77_scalar, lz77_scalar_high, "scalar" };
+
+static pthread_once_t lz77_once = PTHREAD_ONCE_INIT;
+
+static void select_lz77(void) {
+#ifdef COMPRESS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lz77.fn = lz77_avx2;
+        lz77.high = lz77_avx2_high;
+        lz77.name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        lz77.fn = lz77_sse2;
+        lz77.high = lz77_sse2_high;
+        lz77.name = "sse2";
+    }
+#elif defined(COMPRESS_NEON)
+    lz77.fn = lz77_neon;
+    lz77.high = lz77_neon_high;
+    lz77.name = "neon";
+#endif
+    wlr_log(WLR_INFO, "LZ77 kernel: %s", lz77.name);
+}
+
+const char *compress_kernel_name(void) {
+    return lz77.name;
+}
+
+/* ============== Effort ============== */
+
+/* LZ77 stage for an effort level, NULL below COMPRESS_EFFORT_FAST */
+static inline lz77_fn lz77_for_effort(int level) {
+    if (level < COMPRESS_EFFORT_FAST) return NULL;
+    return level >= COMPRESS_EFFORT_HIGH ? lz77.high : lz77.fn;
+}
+
+/* ============== Tile Compression ============== */
+
 int compress_tile_data(uint8_t *dst, int dst_max, 
-                       uint8_t *raw, int bytes_per_row, int h) {
+                       uint8_t *raw, int bytes_per_row, int h, int effort) {
     int raw_size = h * bytes_per_row;
     
     /* Check if all zeros */
@@ -191,7 +452,9 @@ int compress_tile_data(uint8_t *dst, int dst_max,
     if (is_solid) {
         out = encode_solid_tile(dst, raw, h);
     } else {
-        out = lz77_compress_fast(dst, dst_max, raw, raw_size, bytes_per_row);
+        lz77_fn fn = lz77_for_effort(effort);
+        if (!fn) return 0;
+        out = fn(dst, dst_max, raw, raw_size, bytes_per_row);
         if (out == 0) return 0;
     }
     
@@ -203,7 +466,7 @@ int compress_tile_data(uint8_t *dst, int dst_max,
 /* Internal: no validation, caller guarantees valid inputs */
 static int compress_tile_direct_internal(uint8_t *dst, int dst_max, 
                                          uint32_t *pixels, int stride, 
-                                         int x1, int y1, int w, int h) {
+                                         int x1, int y1, int w, int h, int effort) {
     int bytes_per_row = w * 4;
     uint8_t raw[TILE_SIZE * TILE_SIZE * 4];
     
@@ -212,16 +475,17 @@ static int compress_tile_direct_internal(uint8_t *dst, int dst_max,
                &pixels[(y1 + row) * stride + x1], bytes_per_row);
     }
     
-    return compress_tile_data(dst, dst_max, raw, bytes_per_row, h);
+    return compress_tile_data(dst, dst_max, raw, bytes_per_row, h, effort);
 }
 
-/* Internal: no validation */
-static int compress_tile_alpha_delta_internal(uint8_t *dst, int dst_max,
-                                              uint32_t *pixels, int stride,
-                                              uint32_t *prev_pixels, int prev_stride,
-                                              int x1, int y1, int w, int h) {
+/*
+ * Build the alpha-delta buffer of a tile.  Returns the number of
+ * changed pixels.
+ */
+static int build_alpha_delta(uint8_t *delta, uint32_t *pixels, int stride,
+                             uint32_t *prev_pixels, int prev_stride,
+                             int x1, int y1, int w, int h) {
     int bytes_per_row = w * 4;
-    uint8_t delta[TILE_SIZE * TILE_SIZE * 4];
     int changed = 0;
     
     for (int row = 0; row < h; row++) {
@@ -241,50 +505,66 @@ static int compress_tile_alpha_delta_internal(uint8_t *dst, int dst_max,
             }
         }
     }
+    return changed;
+}
+
+/* Alpha-delta is only tried for 1..75% changed pixels */
+static inline int delta_worthwhile(int changed, int w, int h) {
+    return changed > 0 && changed <= (w * h * 3 / 4);
+}
+
+/* Internal: no validation */
+static int compress_tile_alpha_delta_internal(uint8_t *dst, int dst_max,
+                                              uint32_t *pixels, int stride,
+                                              uint32_t *prev_pixels, int prev_stride,
+                                              int x1, int y1, int w, int h, int effort) {
+    uint8_t delta[TILE_SIZE * TILE_SIZE * 4];
+    int changed = build_alpha_delta(delta, pixels, stride, prev_pixels, prev_stride,
+                                    x1, y1, w, h);
+    if (!delta_worthwhile(changed, w, h)) return 0;
     
-    if (changed == 0) return 0;
-    if (changed > (w * h * 3 / 4)) return 0;
-    
-    return compress_tile_data(dst, dst_max, delta, bytes_per_row, h);
+    return compress_tile_data(dst, dst_max, delta, w * 4, h, effort);
 }
 
 /* Public entry points with validation */
 
 int compress_tile_direct(uint8_t *dst, int dst_max, 
                          uint32_t *pixels, int stride, 
-                         int x1, int y1, int w, int h) {
+                         int x1, int y1, int w, int h, int effort) {
     if (w <= 0 || h <= 0 || w > TILE_SIZE || h > TILE_SIZE) return 0;
-    return compress_tile_direct_internal(dst, dst_max, pixels, stride, x1, y1, w, h);
+    return compress_tile_direct_internal(dst, dst_max, pixels, stride, x1, y1, w, h, effort);
 }
 
 int compress_tile_alpha_delta(uint8_t *dst, int dst_max,
                               uint32_t *pixels, int stride,
                               uint32_t *prev_pixels, int prev_stride,
-                              int x1, int y1, int w, int h) {
+                              int x1, int y1, int w, int h, int effort) {
     if (w <= 0 || h <= 0 || w > TILE_SIZE || h > TILE_SIZE) return 0;
     if (!prev_pixels) return 0;
     return compress_tile_alpha_delta_internal(dst, dst_max, pixels, stride,
                                               prev_pixels, prev_stride,
-                                              x1, y1, w, h);
+                                              x1, y1, w, h, effort);
 }
 
 int compress_tile_adaptive(uint8_t *dst, int dst_max,
                            uint32_t *pixels, int stride,
                            uint32_t *prev_pixels, int prev_stride,
-                           int x1, int y1, int w, int h) {
+                           int x1, int y1, int w, int h, int effort) {
     if (w <= 0 || h <= 0 || w > TILE_SIZE || h > TILE_SIZE) return 0;
     
     uint8_t temp[1200];
     
-    int direct_size = compress_tile_direct_internal(dst, dst_max, pixels, stride, x1, y1, w, h);
+    int direct_size = compress_tile_direct_internal(dst, dst_max, pixels, stride,
+                                                    x1, y1, w, h, effort);
     
-    if (!prev_pixels)
+    /* Below the default effort only the direct path is tried */
+    if (!prev_pixels || effort < COMPRESS_EFFORT_DEFAULT)
         return direct_size > 0 ? -direct_size : 0;
     
     int delta_size = compress_tile_alpha_delta_internal(temp, sizeof(temp),
                                                         pixels, stride,
                                                         prev_pixels, prev_stride,
-                                                        x1, y1, w, h);
+                                                        x1, y1, w, h, effort);
     
     if (delta_size > 0) {
         int delta_total = delta_size + ALPHA_DELTA_OVERHEAD;
@@ -297,6 +577,42 @@ int compress_tile_adaptive(uint8_t *dst, int dst_max,
     return direct_size > 0 ? -direct_size : 0;
 }
 
+int compress_rect_direct(uint8_t *dst, int dst_max,
+                         const uint32_t *pixels, int stride,
+                         int x1, int y1, int w, int h, int effort) {
+    static __thread uint8_t raw[COMPRESS_RECT_MAX * COMPRESS_RECT_MAX * 4];
+    if (w <= 0 || h <= 0 || w > COMPRESS_RECT_MAX || h > COMPRESS_RECT_MAX)
+        return 0;
+    lz77_fn fn = lz77_for_effort(effort);
+    if (!fn) return 0;
+    
+    int bytes_per_row = w * 4;
+    int raw_size = bytes_per_row * h;
+    for (int row = 0; row < h; row++) {
+        memcpy(raw + row * bytes_per_row,
+               &pixels[(y1 + row) * stride + x1], bytes_per_row);
+    }
+    
+    int out = fn(dst, dst_max, raw, raw_size, bytes_per_row);
+    if (out == 0 || out >= raw_size * 3 / 4) return 0;
+    return out;
+}
+
+int tile_solid_color(const uint32_t *pixels, int stride,
+                     int x1, int y1, int w, int h, uint32_t *color) {
+    if (w <= 0 || h <= 0) return 0;
+    
+    const uint32_t *row = pixels + y1 * stride + x1;
+    uint32_t first = row[0];
+    for (int y = 0; y < h; y++, row += stride) {
+        for (int x = 0; x < w; x++) {
+            if (row[x] != first) return 0;
+        }
+    }
+    *color = first;
+    return 1;
+}
+
 /* ============== Parallel Compression ============== */
 
 struct compress_ctx {
@@ -304,33 +620,87 @@ struct compress_ctx {
     struct tile_result *results;
 };
 
-static void compress_one_tile(void *ctx, int idx) {
-    struct compress_ctx *c = ctx;
-    struct tile_work *w = &c->tiles[idx];
-    struct tile_result *r = &c->results[idx];
+/*
+ * Path to run alone for a tile whose delta is worthwhile: sparse
+ * changes go to alpha-delta, otherwise the tile's last winner;
+ * COMPRESS_PATH_ANY runs both.
+ */
+static inline int predict_path(int changed, int npixels, int hint) {
+    if (changed <= npixels / 8) return COMPRESS_PATH_DELTA;
+    return hint;
+}
+
+void compress_tile_work(const struct tile_work *w, struct tile_result *r) {
+    r->data = NULL;
+    r->size = 0;
+    r->is_delta = 0;
+    r->predicted = COMPRESS_PATH_ANY;
+    r->trials = 0;
+    if (w->w <= 0 || w->h <= 0 || w->w > TILE_SIZE || w->h > TILE_SIZE) return;
     
-    int result = compress_tile_adaptive(
-        r->data, sizeof(r->data),
-        w->pixels, w->stride,
-        w->prev_pixels, w->prev_stride,
-        w->x1, w->y1, w->w, w->h
-    );
+    /* Direct only: no previous frame, low effort, or a delta that
+     * compress_tile_alpha_delta_internal() would reject anyway */
+    uint8_t delta[TILE_SIZE * TILE_SIZE * 4];
+    int effort_level = w->effort;
+    int delta_ok = 0, path = COMPRESS_PATH_ANY;
+    if (w->prev_pixels && effort_level >= COMPRESS_EFFORT_DEFAULT) {
+        int changed = build_alpha_delta(delta, w->pixels, w->stride,
+                                        w->prev_pixels, w->prev_stride,
+                                        0, 0, w->w, w->h);
+        delta_ok = delta_worthwhile(changed, w->w, w->h);
+        if (delta_ok && effort_level < COMPRESS_EFFORT_HIGH) {
+            r->predicted = predict_path(changed, w->w * w->h, w->hint);
+            if (!w->verify) path = r->predicted;
+        }
+    }
     
-    if (result > 0) {
-        r->size = result;
-        r->is_delta = 1;
-    } else if (result < 0) {
-        r->size = -result;
-        r->is_delta = 0;
-    } else {
-        r->size = 0;
-        r->is_delta = 0;
+    /* A predicted path that fails to compress falls back to the other */
+    uint8_t direct[TILE_RESULT_MAX];
+    uint8_t temp[1200];
+    int direct_size = -1, delta_size = -1;      /* -1 = not run */
+    if (path != COMPRESS_PATH_DELTA)
+        direct_size = compress_tile_direct_internal(direct, sizeof(direct),
+                                                    w->pixels, w->stride,
+                                                    0, 0, w->w, w->h, effort_level);
+    if (delta_ok && (path != COMPRESS_PATH_DIRECT || direct_size == 0))
+        delta_size = compress_tile_data(temp, sizeof(temp), delta, w->w * 4, w->h,
+                                        effort_level);
+    if (direct_size < 0 && delta_size <= 0)
+        direct_size = compress_tile_direct_internal(direct, sizeof(direct),
+                                                    w->pixels, w->stride,
+                                                    0, 0, w->w, w->h, effort_level);
+    r->trials = (direct_size >= 0) + (delta_size >= 0);
+    
+    const uint8_t *src = NULL;
+    int size = 0, is_delta = 0;
+    if (delta_size > 0 &&
+        (direct_size <= 0 || delta_size + ALPHA_DELTA_OVERHEAD < direct_size)) {
+        src = temp;
+        size = delta_size;
+        is_delta = 1;
+    } else if (direct_size > 0) {
+        src = direct;
+        size = direct_size;
     }
+    
+    /* Packed into the frame's output; a full arena means a raw load */
+    uint8_t *dst = (size > 0 && w->out) ? arena_bump(w->out, size) : NULL;
+    if (!dst) return;
+    memcpy(dst, src, size);
+    r->data = dst;
+    r->size = size;
+    r->is_delta = is_delta;
+}
+
+static void compress_one_tile(void *ctx, int idx) {
+    struct compress_ctx *c = ctx;
+    compress_tile_work(&c->tiles[idx], &c->results[idx]);
 }
 
-/* No init/shutdown needed - parallel_for handles everything */
+/* Threads come from parallel_for; init only selects the LZ77 kernel */
 int compress_pool_init(int nthreads) {
     (void)nthreads;
+    pthread_once(&lz77_once, select_lz77);
     return 0;
 }
 
@@ -37,12 +37,29 @@
  * LZ77 Compression (compress_tile_data):
  *
  *   Both encoding paths call compress_tile_data() for final compression.
- *   Uses a hash table for O(1) match finding:
- *     - HASH_SIZE = 1024 entries
- *     - Matches 3+ bytes against hash and previous row
+ *   The match finder works on whole pixels:
+ *     - At each pixel, tries the previous row, the previous pixel and
+ *       one candidate from a 1024-entry hash of the 4-byte pixel value
+ *     - Keeps the longest match, rounded down to whole pixels (4..32
+ *       bytes), else emits the pixel as 4 literal bytes
  *     - Back-reference: (len-3) << 2 | (offset-1) >> 8, (offset-1) & 0xFF
  *     - Literal: 0x80 | (count-1), followed by bytes
  *
+ *   The output is the standard Plan 9 compressed-image token stream;
+ *   only the encoder's choice of tokens is pixel-granular.
+ *
+ * Kernels:
+ *
+ *     avx2    one 32-byte compare per match, 32-byte row equality
+ *     sse2    two 16-byte compares per match, 16-byte row equality
+ *     neon    two 16-byte compares per match, 16-byte row equality
+ *     scalar  byte loop and memcmp (reference)
+ *
+ *   All kernels produce identical output. compress_pool_init() picks
+ *   one at runtime (__builtin_cpu_supports on x86, per-function
+ *   target attributes as in tilecmp.c); before that the scalar kernel
+ *   is used.
+ *
  *   Internal optimizations:
  *     - Solid color: tiles with a single color (including all-black)
  *       use a compact encoding with one literal pixel plus row-repeat
@@ -64,12 +81,50 @@
  *     - Returns negative size if direct is smaller
  *     - Returns 0 if neither achieves 25% compression
  *
- *   When prev_pixels is NULL, only the direct path is attempted.
+ *   When prev_pixels is NULL, or below COMPRESS_EFFORT_DEFAULT, only
+ *   the direct path is attempted.
  *
  *   Note: alpha-delta may also return 0 (and thus be unavailable) if
  *   more than 75% of pixels changed, since the delta buffer would be
  *   too dense for effective compression.
  *
+ * Path Prediction (compress_tile_work):
+ *
+ *   compress_tile_adaptive() runs LZ77 twice per tile. The work path
+ *   builds the delta buffer first (one cheap pass) and, when both
+ *   paths are possible, predicts the winner:
+ *
+ *     changed <= 1/8 of the pixels   alpha-delta
+ *     otherwise                      w->hint, the tile's last winner
+ *                                    (both when unknown)
+ *
+ *   Only the predicted path is compressed; if it fails to reach 25%
+ *   the other one is tried. Tiles with no delta possible (no previous
+ *   frame, 0 or > 75% changed) only ever run direct. The send thread
+ *   keeps the per-tile winners and sets w->verify on a rotating
+ *   subset of tiles, which run both paths so the hit rate can be
+ *   measured (logged with the frame statistics).
+ *
+ * Effort Levels (tile_work.effort):
+ *
+ *     0 raw      solid-color detection only; everything else is sent
+ *                uncompressed (compress_rect_direct() returns 0)
+ *     1 fast     direct path only, no alpha-delta trial
+ *     2 default  predicted path, one hash candidate per pixel
+ *     3 high     both paths always; the _high kernels follow hash chains up
+ *                to 8 candidates deep, hash every pixel a match covers
+ *                and match lazily (a match is cut back a pixel at a
+ *                time when the match found where it then ends reaches
+ *                further)
+ *
+ *   The level travels with the work: each tile_work item carries it,
+ *   and the direct entry points take it as an argument. At level 2
+ *   the kernels emit the same tokens as before effort levels existed.
+ *   Each send thread picks the level per frame, for its own window:
+ *   fixed with -E, or derived from that window's measured link
+ *   throughput (see send.h). The workers, shared by every window
+ *   with -w, thus compress each tile at its own window's level.
+ *
  * Parallel Compression:
  *
  *   compress_tiles_parallel() uses the parallel_for() infrastructure
@@ -81,6 +136,7 @@
 #define COMPRESS_H
 
 #include <stdint.h>
+#include "arena.h"
 
 #ifndef TILE_SIZE
 #define TILE_SIZE 16
@@ -89,30 +145,70 @@
 /* Overhead for alpha-delta composite command (Plan 9 'd' command) */
 #define ALPHA_DELTA_OVERHEAD 45
 
+/*
+ * Largest rectangle edge accepted by compress_rect_direct(), in pixels.
+ * 64 px XRGB32 rows are 256 bytes, well inside the 1024-byte window of
+ * the Plan 9 'Y' decoder used for previous-row back-references.
+ */
+#define COMPRESS_RECT_MAX (4 * TILE_SIZE)
+
+/* Effort levels (see Effort Levels above) */
+#define COMPRESS_EFFORT_RAW     0
+#define COMPRESS_EFFORT_FAST    1
+#define COMPRESS_EFFORT_DEFAULT 2
+#define COMPRESS_EFFORT_HIGH    3
+
 /* ============== Data Structures ============== */
 
 /*
  * Per-tile compression result.
  *
- * data:     compressed data buffer (sized for worst case)
- * size:     compressed size in bytes, 0 if compression failed
- * is_delta: 1 if alpha-delta encoding, 0 if direct XRGB32
+ * Compact (16 bytes): the payload itself is written to the work item's
+ * output arena (tile_work.out), packed with the other payloads of the
+ * frame instead of a worst-case buffer per result.
+ *
+ * data:      compressed payload, NULL if size is 0
+ * size:      compressed size in bytes, 0 if compression failed or the
+ *            output arena was full (the tile is then sent raw)
+ * is_delta:  1 if alpha-delta encoding, 0 if direct XRGB32
+ * predicted: path the predictor chose (COMPRESS_PATH_*), ANY if it
+ *            made no choice; with tile_work.verify both still run
+ * trials:    number of paths actually compressed (0..2)
  */
 struct tile_result {
-    uint8_t data[TILE_SIZE * TILE_SIZE * 4 + 256];
+    const uint8_t *data;
     int size;
-    int is_delta;
+    uint8_t is_delta;
+    uint8_t predicted;
+    uint8_t trials;
 };
 
+/* Scratch for one tile's encoders (largest payload before the arena) */
+#define TILE_RESULT_MAX (TILE_SIZE * TILE_SIZE * 4 + 256)
+
+/* Largest payload kept in an arena (encoders reject >= 3/4 of raw) */
+#define TILE_OUT_MAX ARENA_SIZE(TILE_SIZE * TILE_SIZE * 3)
+
+/* Encoding paths, for tile_work.hint and tile_result.predicted */
+#define COMPRESS_PATH_ANY       0   /* Unknown: try both */
+#define COMPRESS_PATH_DIRECT    1
+#define COMPRESS_PATH_DELTA     2
+
 /*
  * Work item for parallel compression.
  *
- * pixels:      current frame pixel buffer (XRGB32)
- * stride:      current frame stride in pixels
- * prev_pixels: previous frame pixel buffer (XRGB32), may be NULL
- * prev_stride: previous frame stride in pixels
- * x1, y1:      top-left corner of tile in pixel coordinates
+ * pixels:      first pixel of the tile in the current frame (XRGB32)
+ * stride:      stride in pixels between the tile's rows (the frame
+ *              width, or TILE_SIZE for tile-major buffers)
+ * prev_pixels: first pixel of the tile in the previous frame, may be NULL
+ * prev_stride: stride in pixels between its rows
+ * x1, y1:      top-left corner of tile in screen coordinates
  * w, h:        tile dimensions (may be < TILE_SIZE at edges)
+ * hint:        path that won for this tile last time (COMPRESS_PATH_*)
+ * verify:      ignore the predictor and try both paths
+ * effort:      COMPRESS_EFFORT_* of the frame the tile belongs to
+ * out:         arena receiving the payload (see arena.h); must stay
+ *              valid, and not be reset, while the result is in use
  *
  * Results are written to the corresponding tile_result in the
  * results array passed to compress_tiles_parallel(), indexed by
@@ -124,6 +220,10 @@ struct tile_work {
     uint32_t *prev_pixels;
     int prev_stride;
     int x1, y1, w, h;
+    int hint;
+    int verify;
+    int effort;
+    struct arena *out;
 };
 
 /* ============== Core Compression Functions ============== */
@@ -139,12 +239,13 @@ struct tile_work {
  * raw:           raw pixel data (row-major, XRGB32 or ARGB32 delta)
  * bytes_per_row: bytes per row in raw buffer
  * h:             number of rows
+ * effort:        COMPRESS_EFFORT_* (LZ77 kernel; none below fast)
  *
  * Returns compressed size, or 0 if compression failed or didn't
  * achieve at least 25% reduction.
  */
 int compress_tile_data(uint8_t *dst, int dst_max, 
-                       uint8_t *raw, int bytes_per_row, int h);
+                       uint8_t *raw, int bytes_per_row, int h, int effort);
 
 /*
  * Compress a tile using the direct encoding path.
@@ -157,12 +258,13 @@ int compress_tile_data(uint8_t *dst, int dst_max,
  * stride:  frame buffer stride in pixels
  * x1, y1:  tile top-left corner
  * w, h:    tile dimensions (must be <= TILE_SIZE)
+ * effort:  COMPRESS_EFFORT_*
  *
  * Returns compressed size, or 0 if compression failed.
  */
 int compress_tile_direct(uint8_t *dst, int dst_max, 
                          uint32_t *pixels, int stride, 
-                         int x1, int y1, int w, int h);
+                         int x1, int y1, int w, int h, int effort);
 
 /*
  * Compress a tile using the alpha-delta encoding path.
@@ -180,6 +282,7 @@ int compress_tile_direct(uint8_t *dst, int dst_max,
  * prev_stride: previous frame stride in pixels
  * x1, y1:      tile top-left corner
  * w, h:        tile dimensions (must be <= TILE_SIZE)
+ * effort:      COMPRESS_EFFORT_*
  *
  * Returns compressed size, or 0 if:
  *   - No pixels changed (delta is empty)
@@ -189,7 +292,7 @@ int compress_tile_direct(uint8_t *dst, int dst_max,
 int compress_tile_alpha_delta(uint8_t *dst, int dst_max,
                               uint32_t *pixels, int stride,
                               uint32_t *prev_pixels, int prev_stride,
-                              int x1, int y1, int w, int h);
+                              int x1, int y1, int w, int h, int effort);
 
 /*
  * Adaptively compress a tile using the best encoding path.
@@ -208,6 +311,7 @@ int compress_tile_alpha_delta(uint8_t *dst, int dst_max,
  * prev_stride: previous frame stride in pixels
  * x1, y1:      tile top-left corner
  * w, h:        tile dimensions
+ * effort:      COMPRESS_EFFORT_* (direct only below the default)
  *
  * Returns:
  *   > 0: alpha-delta size (use alpha composite to draw);
@@ -218,15 +322,59 @@ int compress_tile_alpha_delta(uint8_t *dst, int dst_max,
 int compress_tile_adaptive(uint8_t *dst, int dst_max,
                            uint32_t *pixels, int stride,
                            uint32_t *prev_pixels, int prev_stride,
-                           int x1, int y1, int w, int h);
+                           int x1, int y1, int w, int h, int effort);
+
+/*
+ * Compress a multi-tile rectangle using the direct encoding path.
+ *
+ * Like compress_tile_direct() but for rectangles of up to
+ * COMPRESS_RECT_MAX × COMPRESS_RECT_MAX pixels, used to load several
+ * adjacent tiles with one 'Y' command (see coalesce.h). Row matches
+ * run across the original tile edges, so wide content compresses
+ * better than as separate tiles. Solid rectangles go through the
+ * generic LZ77 path (encode_solid_tile assumes 16-pixel rows).
+ *
+ * dst:     output buffer
+ * dst_max: maximum bytes to write
+ * pixels:  frame buffer (XRGB32)
+ * stride:  frame buffer stride in pixels
+ * x1, y1:  rectangle top-left corner
+ * w, h:    rectangle dimensions (must be <= COMPRESS_RECT_MAX)
+ * effort:  COMPRESS_EFFORT_*
+ *
+ * Returns compressed size, or 0 if compression failed, did not fit
+ * in dst_max, or didn't achieve at least 25% reduction.
+ */
+int compress_rect_direct(uint8_t *dst, int dst_max,
+                         const uint32_t *pixels, int stride,
+                         int x1, int y1, int w, int h, int effort);
+
+/*
+ * Check whether a tile is a single solid color.
+ *
+ * Solid tiles are cheaper to send as a 'd' fill from a 1x1 replicated
+ * color image than as any compressed load (see send.c). Stops at the
+ * first pixel that differs, so non-solid tiles are rejected quickly.
+ *
+ * pixels: frame buffer (XRGB32)
+ * stride: stride in pixels
+ * x1, y1: tile top-left corner
+ * w, h:   tile dimensions
+ * color:  output - the tile color (only written when solid)
+ *
+ * Returns 1 if every pixel equals the first, 0 otherwise.
+ */
+int tile_solid_color(const uint32_t *pixels, int stride,
+                     int x1, int y1, int w, int h, uint32_t *color);
 
 /* ============== Parallel Compression API ============== */
 
 /*
- * Initialize compression thread pool.
+ * Initialize compression.
  *
- * Currently a no-op - parallel_for() handles thread management.
- * Provided for API consistency.
+ * Selects the LZ77 kernel for this CPU (once; logs it at WLR_INFO).
+ * Threads are managed by parallel_for(), so there is no pool to
+ * create.
  *
  * nthreads: ignored
  *
@@ -234,6 +382,11 @@ int compress_tile_adaptive(uint8_t *dst, int dst_max,
  */
 int compress_pool_init(int nthreads);
 
+/*
+ * Name of the active LZ77 kernel ("avx2", "sse2", "neon", "scalar").
+ */
+const char *compress_kernel_name(void);
+
 /*
  * Shutdown compression thread pool.
  *
@@ -241,6 +394,19 @@ int compress_pool_init(int nthreads);
  */
 void compress_pool_shutdown(void);
 
+/*
+ * Compress one work item into its result slot.
+ *
+ * Same choice as compress_tile_adaptive(), but at the default effort
+ * usually compresses only the predicted path (see Path Prediction)
+ * and fills data, size, is_delta, predicted and trials. The payload is
+ * encoded in stack scratch and copied once into w->out. This is the
+ * per-item body of compress_tiles_parallel(), exposed for callers that
+ * schedule tiles themselves (the send thread's streaming job, see
+ * send.c). Thread-safe across distinct result slots.
+ */
+void compress_tile_work(const struct tile_work *w, struct tile_result *r);
+
 /*
  * Compress multiple tiles in parallel.
  *
@@ -18,6 +18,7 @@
 #include "draw.h"
 #include "../p9/p9.h"
 #include "send.h"  /* For TILE_SIZE */
+#include "draw_cmd.h"
 
 #define DRAW_SCALE 1.0f
 
@@ -216,10 +217,10 @@ lookup_ok:;
         wlr_log(WLR_INFO, "relookup_window: resize pending %dx%d -> %dx%d, main thread will handle",
                 draw->width, draw->height, new_width, new_height);
     } else {
-        /* Just position change, update now and force full redraw */
+        /* Just position change, update now; image_id is unchanged, so
+         * the caller only has to copy it to the new window image */
         wlr_log(WLR_INFO, "Window position updated: '%s' at (%d,%d) %dx%d",
                 draw->winname, draw->win_minx, draw->win_miny, draw->width, draw->height);
-        s->force_full_frame = 1;
         s->frame_dirty = 1;
     }
     
@@ -269,9 +270,9 @@ static int init_relookup_fids(struct server *s) {
     draw->relookup_ctl_fid = p9r->next_fid++;
     draw->relookup_winname_fid = p9r->next_fid++;
     
-    /* Walk to /dev/draw */
+    /* Walk to /dev/draw (global, not per window: from the attach root) */
     wnames[0] = "draw";
-    if (p9_walk(p9r, p9r->root_fid, draw->relookup_draw_fid, 1, wnames) < 0) {
+    if (p9_walk(p9r, p9r->attach_fid, draw->relookup_draw_fid, 1, wnames) < 0) {
         wlr_log(WLR_ERROR, "relookup: failed to walk to /dev/draw");
         return -1;
     }
@@ -316,6 +317,21 @@ static int init_relookup_fids(struct server *s) {
     return 0;
 }
 
+/*
+ * init_relookup_fids() needs only client_id, so it runs on a thread of
+ * its own while init_draw() goes on: its round trips go out on
+ * p9_relookup alongside init_draw's on p9_draw.
+ */
+static void *relookup_fids_thread(void *arg) {
+    struct server *s = arg;
+    if (init_relookup_fids(s) < 0) {
+        wlr_log(WLR_ERROR, "Failed to init relookup fids (non-fatal, relookup will use main conn)");
+        /* Fall through — relookup_window will check p9_relookup != NULL */
+        s->draw.p9_relookup = NULL;
+    }
+    return NULL;
+}
+
 /* ============== Draw Initialization ============== */
 
 int init_draw(struct server *s) {
@@ -333,9 +349,9 @@ int init_draw(struct server *s) {
     draw->win_minx = 0;
     draw->win_miny = 0;
     
-    /* Walk to /dev/draw */
+    /* Walk to /dev/draw (global, not per window: from the attach root) */
     wnames[0] = "draw";
-    if (p9_walk(p9, p9->root_fid, draw->draw_fid, 1, wnames) < 0) {
+    if (p9_walk(p9, p9->attach_fid, draw->draw_fid, 1, wnames) < 0) {
         wlr_log(WLR_ERROR, "Failed to walk to /dev/draw");
         return -1;
     }
@@ -367,6 +383,10 @@ int init_draw(struct server *s) {
     draw->client_id = atoi((char*)buf);
     wlr_log(WLR_INFO, "Draw client ID: %d", draw->client_id);
     
+    pthread_t relookup_thread;
+    int relookup_started =
+        pthread_create(&relookup_thread, NULL, relookup_fids_thread, s) == 0;
+    
     /* Parse initial dimensions from fields 4-7 (R rectangle: minx, miny, maxx, maxy) */
     rminx = atoi((char*)buf + 4*12);
     rminy = atoi((char*)buf + 5*12);
@@ -377,7 +397,7 @@ int init_draw(struct server *s) {
     
     if (actual_width <= 0 || actual_height <= 0) {
         wlr_log(WLR_ERROR, "Invalid screen dimensions: %dx%d", actual_width, actual_height);
-        return -1;
+        goto fail;
     }
     
     /* Inset by RIO_BORDER on each side to preserve rio's window border,
@@ -402,13 +422,13 @@ int init_draw(struct server *s) {
     wnames[1] = "data";
     if (p9_walk(p9, draw->draw_fid, draw->drawdata_fid, 2, wnames) < 0) {
         wlr_log(WLR_ERROR, "Failed to walk to /dev/draw/%d/data", draw->client_id);
-        return -1;
+        goto fail;
     }
     
     uint32_t iounit;
     if (p9_open(p9, draw->drawdata_fid, ORDWR, &iounit) < 0) {
         wlr_log(WLR_ERROR, "Failed to open /dev/draw/%d/data", draw->client_id);
-        return -1;
+        goto fail;
     }
     draw->iounit = iounit;
     wlr_log(WLR_INFO, "Draw data fd opened (iounit=%u)", iounit);
@@ -419,12 +439,12 @@ int init_draw(struct server *s) {
     wnames[1] = "ctl";
     if (p9_walk(p9, draw->draw_fid, draw->drawctl_fid, 2, wnames) < 0) {
         wlr_log(WLR_ERROR, "Failed to walk to /dev/draw/%d/ctl", draw->client_id);
-        return -1;
+        goto fail;
     }
     
     if (p9_open(p9, draw->drawctl_fid, OREAD, NULL) < 0) {
         wlr_log(WLR_ERROR, "Failed to open /dev/draw/%d/ctl", draw->client_id);
-        return -1;
+        goto fail;
     }
     
     /* Read the window name from /dev/winname */
@@ -574,7 +594,7 @@ int init_draw(struct server *s) {
     int written = p9_write(p9, draw->drawdata_fid, 0, bcmd, off);
     if (written < 0) {
         wlr_log(WLR_ERROR, "Failed to allocate framebuffer image");
-        return -1;
+        goto fail;
     }
     wlr_log(WLR_INFO, "Allocated framebuffer image %d (%dx%d logical, %.2fx scale) format=XRGB32", 
             draw->image_id, logical_width, logical_height, DRAW_SCALE);
@@ -601,7 +621,7 @@ int init_draw(struct server *s) {
     written = p9_write(p9, draw->drawdata_fid, 0, bcmd, off);
     if (written < 0) {
         wlr_log(WLR_ERROR, "Failed to allocate opaque mask");
-        return -1;
+        goto fail;
     }
     wlr_log(WLR_INFO, "Allocated opaque mask image %d", draw->opaque_id);
     
@@ -627,20 +647,70 @@ int init_draw(struct server *s) {
     written = p9_write(p9, draw->drawdata_fid, 0, bcmd, off);
     if (written < 0) {
         wlr_log(WLR_ERROR, "Failed to allocate delta image");
-        return -1;
+        goto fail;
     }
     wlr_log(WLR_INFO, "Allocated delta image %d (%dx%d) ARGB32 for alpha-delta compression", 
             draw->delta_id, draw->width, draw->height);
+    draw->image_cap_w = draw->width;
+    draw->image_cap_h = draw->height;
+    
+    /* Allocate tile cache image (non-fatal: cache stays disabled) */
+    draw->cache_id = 0;
+    draw->cache_cols = draw->cache_rows = 0;
+    int cache_mb = s->tile_cache_mb;
+    if (cache_mb > TILE_CACHE_MAX_MB) cache_mb = TILE_CACHE_MAX_MB;
+    if (cache_mb > 0) {
+        int slots = (int)((long)cache_mb * 1024 * 1024 / (TILE_SIZE * TILE_SIZE * 4));
+        int cols = 4096 / TILE_SIZE;
+        if (cols > slots) cols = slots;
+        int rows = slots / cols;
+        
+        off = alloc_image_cmd(bcmd, 6, CHAN_XRGB32, 0,
+                              0, 0, cols * TILE_SIZE, rows * TILE_SIZE, 0x00000000);
+        if (p9_write(p9, draw->drawdata_fid, 0, bcmd, off) < 0) {
+            wlr_log(WLR_ERROR, "Failed to allocate tile cache image (cache disabled)");
+        } else {
+            draw->cache_id = 6;
+            draw->cache_cols = cols;
+            draw->cache_rows = rows;
+            wlr_log(WLR_INFO, "Allocated tile cache image %d (%dx%d slots, %d MiB)",
+                    draw->cache_id, cols, rows, cache_mb);
+        }
+    }
+    
+    /* Allocate fill color palette (non-fatal: solid tiles go out as loads) */
+    draw->fill_id_base = 0;
+    draw->fill_count = 0;
+    uint8_t fcmd[FILL_PALETTE_SIZE * sizeof(bcmd)];
+    int foff = 0;
+    for (int i = 0; i < FILL_PALETTE_SIZE; i++)
+        foff += alloc_image_cmd(fcmd + foff, 7 + i, CHAN_XRGB32, 1,
+                                0, 0, 1, 1, 0x000000FF);
+    /* One write for the whole palette, not a round trip per image */
+    if (p9_write(p9, draw->drawdata_fid, 0, fcmd, foff) < 0)
+        wlr_log(WLR_ERROR, "Failed to allocate fill images %d..%d",
+                7, 7 + FILL_PALETTE_SIZE - 1);
+    else
+        draw->fill_count = FILL_PALETTE_SIZE;
+    if (draw->fill_count > 0) {
+        draw->fill_id_base = 7;
+        wlr_log(WLR_INFO, "Allocated %d fill color images (%d..%d)",
+                draw->fill_count, draw->fill_id_base,
+                draw->fill_id_base + draw->fill_count - 1);
+    }
     
     draw->xor_enabled = 0;  /* Will be enabled after first successful full frame */
     
-    /* Open relookup fids on the separate connection.
-     * Must be after we know client_id (from draw/new). */
-    if (init_relookup_fids(s) < 0) {
-        wlr_log(WLR_ERROR, "Failed to init relookup fids (non-fatal, relookup will use main conn)");
-        /* Fall through — relookup_window will check p9_relookup != NULL */
-        draw->p9_relookup = NULL;
-    }
+    /* Relookup fids on the separate connection, opened meanwhile */
+    if (relookup_started)
+        pthread_join(relookup_thread, NULL);
+    else
+        relookup_fids_thread(s);
     
     return 0;
+
+fail:
+    if (relookup_started)
+        pthread_join(relookup_thread, NULL);
+    return -1;
 }
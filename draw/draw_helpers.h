@@ -147,6 +147,9 @@ static inline void tile_bounds(int tx, int ty, int frame_w, int frame_h,
  * w, h:       tile dimensions
  *
  * Returns non-zero if any pixel differs.
+ *
+ * Scalar reference version.  The send thread uses the SIMD kernels in
+ * tilecmp.h (tilecmp_row/tilecmp_tile), which must agree with this.
  */
 static inline int tile_changed(uint32_t *curr, uint32_t *prev, int stride,
                                int x1, int y1, int w, int h) {
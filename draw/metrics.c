@@ -0,0 +1,284 @@
+/*
+ * metrics.c - Per-stage latency histograms and pipeline counters
+ *
+ * Static arrays of relaxed atomics, and a small thread serving
+ * Prometheus text snapshots on a Unix socket. See metrics.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <wlr/util/log.h>
+
+#include "metrics.h"
+
+#define METRICS_POLL_MS     250     /* Stop flag check interval */
+#define METRICS_REQ_MS      50      /* Wait for an HTTP request line */
+
+static const char *const stage_names[METRIC_STAGE_COUNT] = {
+    [METRIC_DAMAGE]   = "damage",
+    [METRIC_FB_COPY]  = "fb_copy",
+    [METRIC_SCROLL]   = "scroll",
+    [METRIC_COLLECT]  = "collect",
+    [METRIC_COMPRESS] = "compress",
+    [METRIC_BATCH]    = "batch",
+    [METRIC_WRITE]    = "write",
+    [METRIC_RWRITE]   = "rwrite",
+    [METRIC_FRAME]    = "frame",
+};
+
+static const struct {
+    const char *name, *help;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_FRAMES]           = { "frames", "Frames sent" },
+    [METRIC_TILES]            = { "tiles", "Tiles sent, any encoding" },
+    [METRIC_TILES_COMPRESSED] = { "tiles_compressed", "Tiles sent as direct LZ77 loads" },
+    [METRIC_TILES_DELTA]      = { "tiles_delta", "Tiles sent as alpha-delta loads" },
+    [METRIC_TILES_RAW]        = { "tiles_raw", "Tiles sent uncompressed" },
+    [METRIC_TILES_MERGED]     = { "tiles_merged", "Tiles carried by merged rectangle loads" },
+    [METRIC_TILES_SOLID]      = { "tiles_solid", "Tiles drawn by fills" },
+    [METRIC_CACHE_HITS]       = { "cache_hits", "Tiles copied from the server-side cache" },
+    [METRIC_CACHE_MISSES]     = { "cache_misses", "Tile cache lookups that missed" },
+    [METRIC_SCROLLS]          = { "scrolls", "Scroll regions applied" },
+    [METRIC_BYTES_RAW]        = { "bytes_raw", "Pixel bytes before encoding" },
+    [METRIC_BYTES_SENT]       = { "bytes_sent", "Payload bytes written" },
+    [METRIC_BATCHES]          = { "batches", "Twrite batches queued" },
+    [METRIC_WRITE_ERRORS]     = { "write_errors", "Batches that failed or were lost" },
+};
+
+static const struct {
+    const char *name, *help;
+} gauge_info[METRIC_GAUGE_COUNT] = {
+    [METRIC_DRAIN_WINDOW]  = { "drain_window", "Batches allowed in flight" },
+    [METRIC_DRAIN_PENDING] = { "drain_pending", "Batches in flight" },
+    [METRIC_EFFORT]        = { "compress_effort", "Compression effort level" },
+};
+
+struct histogram {
+    atomic_uint_least64_t bucket[METRICS_BUCKETS + 1];     /* Last is +Inf */
+    atomic_uint_least64_t sum_us;
+};
+
+static struct histogram hist[METRIC_STAGE_COUNT];
+static atomic_uint_least64_t counters[METRIC_COUNTER_COUNT];
+static atomic_int_least64_t gauges[METRIC_GAUGE_COUNT];
+
+static struct {
+    int fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    pthread_t thread;
+    atomic_int running;
+} ep = { .fd = -1 };
+
+/* ============== Recording ============== */
+
+/* Smallest i with us <= 2^i, or METRICS_BUCKETS (+Inf) */
+static inline int bucket_of(uint64_t us) {
+    if (us <= 1) return 0;
+    int i = 64 - __builtin_clzll(us - 1);
+    return i < METRICS_BUCKETS ? i : METRICS_BUCKETS;
+}
+
+void metrics_observe(enum metric_stage stage, uint64_t us) {
+    struct histogram *h = &hist[stage];
+    atomic_fetch_add_explicit(&h->bucket[bucket_of(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, us, memory_order_relaxed);
+}
+
+void metrics_add(enum metric_counter counter, uint64_t n) {
+    atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+void metrics_set(enum metric_gauge gauge, int64_t value) {
+    atomic_store_explicit(&gauges[gauge], value, memory_order_relaxed);
+}
+
+/* ============== Readers ============== */
+
+/* Upper bound of the bucket holding the rank-th observation (1-based) */
+static uint64_t quantile_us(const uint64_t *b, uint64_t rank) {
+    uint64_t cum = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cum += b[i];
+        if (cum >= rank) return 1ull << i;
+    }
+    return UINT64_MAX;
+}
+
+void metrics_summary(enum metric_stage stage, struct metric_summary *out) {
+    struct histogram *h = &hist[stage];
+    uint64_t b[METRICS_BUCKETS + 1];
+    uint64_t count = 0;
+    for (int i = 0; i <= METRICS_BUCKETS; i++) {
+        b[i] = atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+        count += b[i];
+    }
+    out->count = count;
+    out->sum_us = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+    out->p50_us = count ? quantile_us(b, (count + 1) / 2) : 0;
+    out->p99_us = count ? quantile_us(b, count - count / 100) : 0;
+}
+
+uint64_t metrics_counter(enum metric_counter counter) {
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+const char *metrics_stage_name(enum metric_stage stage) {
+    return stage_names[stage];
+}
+
+/* ============== Snapshot ============== */
+
+static void write_snapshot(FILE *f) {
+    fprintf(f, "# HELP p9wl_stage_seconds Frame pipeline stage latency\n"
+               "# TYPE p9wl_stage_seconds histogram\n");
+    for (int st = 0; st < METRIC_STAGE_COUNT; st++) {
+        struct histogram *h = &hist[st];
+        uint64_t cum = 0;
+        for (int i = 0; i < METRICS_BUCKETS; i++) {
+            cum += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+            fprintf(f, "p9wl_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                    stage_names[st], (double)(1ull << i) * 1e-6,
+                    (unsigned long long)cum);
+        }
+        cum += atomic_load_explicit(&h->bucket[METRICS_BUCKETS], memory_order_relaxed);
+        fprintf(f, "p9wl_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                stage_names[st], (unsigned long long)cum);
+        fprintf(f, "p9wl_stage_seconds_sum{stage=\"%s\"} %.6f\n", stage_names[st],
+                atomic_load_explicit(&h->sum_us, memory_order_relaxed) * 1e-6);
+        /* From the buckets, so _count always equals the +Inf bucket */
+        fprintf(f, "p9wl_stage_seconds_count{stage=\"%s\"} %llu\n",
+                stage_names[st], (unsigned long long)cum);
+    }
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        fprintf(f, "# HELP p9wl_%s_total %s\n# TYPE p9wl_%s_total counter\n"
+                   "p9wl_%s_total %llu\n",
+                counter_info[c].name, counter_info[c].help, counter_info[c].name,
+                counter_info[c].name,
+                (unsigned long long)atomic_load_explicit(&counters[c], memory_order_relaxed));
+    }
+
+    for (int g = 0; g < METRIC_GAUGE_COUNT; g++) {
+        fprintf(f, "# HELP p9wl_%s %s\n# TYPE p9wl_%s gauge\np9wl_%s %lld\n",
+                gauge_info[g].name, gauge_info[g].help, gauge_info[g].name,
+                gauge_info[g].name,
+                (long long)atomic_load_explicit(&gauges[g], memory_order_relaxed));
+    }
+}
+
+static void write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        p += n;
+        len -= n;
+    }
+}
+
+/* One connection: optional request line, one snapshot, close */
+static void serve_client(int fd) {
+    char req[512];
+    ssize_t n = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, METRICS_REQ_MS) > 0)
+        n = read(fd, req, sizeof(req));
+    int http = (n >= 3 && memcmp(req, "GET", 3) == 0);
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return;
+    write_snapshot(f);
+    fclose(f);
+
+    if (http) {
+        char hdr[160];
+        int hl = snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n\r\n", len);
+        write_all(fd, hdr, hl);
+    }
+    write_all(fd, text, len);
+    free(text);
+}
+
+/* ============== Endpoint ============== */
+
+static void *metrics_thread_func(void *arg) {
+    (void)arg;
+    while (atomic_load(&ep.running)) {
+        struct pollfd pfd = { .fd = ep.fd, .events = POLLIN };
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) continue;
+        int fd = accept(ep.fd, NULL, NULL);
+        if (fd < 0) continue;
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        wlr_log(WLR_ERROR, "metrics: socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        wlr_log(WLR_ERROR, "metrics: socket: %s", strerror(errno));
+        return -1;
+    }
+    /* Replace a socket left over from an earlier run, nothing else */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            wlr_log(WLR_ERROR, "metrics: %s exists and is not a socket", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        wlr_log(WLR_ERROR, "metrics: cannot listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    ep.fd = fd;
+    strcpy(ep.path, path);
+    atomic_store(&ep.running, 1);
+    if (pthread_create(&ep.thread, NULL, metrics_thread_func, NULL) != 0) {
+        wlr_log(WLR_ERROR, "metrics: failed to create thread");
+        atomic_store(&ep.running, 0);
+        close(fd);
+        unlink(path);
+        ep.fd = -1;
+        return -1;
+    }
+    wlr_log(WLR_INFO, "metrics: serving on %s", path);
+    return 0;
+}
+
+void metrics_stop(void) {
+    if (ep.fd < 0) return;
+    atomic_store(&ep.running, 0);
+    pthread_join(ep.thread, NULL);
+    close(ep.fd);
+    unlink(ep.path);
+    ep.fd = -1;
+}
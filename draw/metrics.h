@@ -0,0 +1,140 @@
+/*
+ * metrics.h - Per-stage latency histograms and pipeline counters
+ *
+ * The "Send #" log line every 30 frames shows one frame in thirty;
+ * this module keeps totals for all of them and serves them on a Unix
+ * socket in Prometheus text format, for capacity planning and for
+ * catching regressions between builds.
+ *
+ * Recording:
+ *
+ *   Every stage of the frame pipeline reports its duration with
+ *   metrics_observe(); counters are bumped with metrics_add() and
+ *   gauges set with metrics_set(). All three are a handful of relaxed
+ *   atomic operations on static arrays: no lock, no allocation, safe
+ *   from any thread (output, send, drain callbacks, workers). When no
+ *   endpoint was started they still record, which costs the same few
+ *   nanoseconds and keeps the call sites unconditional.
+ *
+ *   Histograms have power-of-two buckets in microseconds, 1 µs up to
+ *   METRICS_BUCKETS - 1 doublings (about 2 s), plus +Inf:
+ *
+ *     bucket i counts durations <= 2^i µs (i < METRICS_BUCKETS)
+ *
+ *   which is 15% resolution at worst and enough to tell a 3 ms frame
+ *   from a 12 ms one.
+ *
+ * Stages:
+ *
+ *   damage     output thread: scene damage → dirty tile map
+ *   fb_copy    output thread: wlroots buffer → framebuf
+ *   scroll     send thread: detect_scroll() + apply to prev_framebuf
+ *   collect    send thread: change detection over candidate tiles
+ *   compress   send thread: compression start to last result (overlaps
+ *              batch when streaming)
+ *   batch      send thread: building the frame's draw commands
+ *   write      send thread: one p9_flush() (socket write)
+ *   rwrite     drain: Twrite to Rwrite of one batch
+ *   frame      send thread: whole frame, buffer taken to flushed
+ *
+ * Endpoint:
+ *
+ *   metrics_start(path) listens on a Unix socket. Each connection gets
+ *   one snapshot and is closed; a request starting with "GET" is
+ *   answered as HTTP, so both of these work:
+ *
+ *     socat - UNIX-CONNECT:/tmp/p9wl.metrics
+ *     curl --unix-socket /tmp/p9wl.metrics http://p9wl/metrics
+ *
+ *   In-process readers (the p9wl-bench report) use metrics_summary()
+ *   and metrics_counter() instead.
+ *
+ *   Snapshots read the arrays with relaxed loads, so a scrape taken
+ *   mid-frame may see a counter one update ahead of another; totals
+ *   are always monotonic.
+ */
+
+#ifndef P9WL_METRICS_H
+#define P9WL_METRICS_H
+
+#include <stdint.h>
+
+/* Histogram buckets: 1 µs .. 2^(METRICS_BUCKETS-1) µs, then +Inf */
+#define METRICS_BUCKETS 22
+
+enum metric_stage {
+    METRIC_DAMAGE,
+    METRIC_FB_COPY,
+    METRIC_SCROLL,
+    METRIC_COLLECT,
+    METRIC_COMPRESS,
+    METRIC_BATCH,
+    METRIC_WRITE,
+    METRIC_RWRITE,
+    METRIC_FRAME,
+    METRIC_STAGE_COUNT
+};
+
+enum metric_counter {
+    METRIC_FRAMES,              /* Frames sent */
+    METRIC_TILES,               /* Tiles sent, any encoding */
+    METRIC_TILES_COMPRESSED,    /* Direct LZ77 loads */
+    METRIC_TILES_DELTA,         /* Alpha-delta loads */
+    METRIC_TILES_RAW,           /* Uncompressed loads */
+    METRIC_TILES_MERGED,        /* Carried by a merged rectangle load */
+    METRIC_TILES_SOLID,         /* Drawn by fills */
+    METRIC_CACHE_HITS,          /* Copied from the tile cache */
+    METRIC_CACHE_MISSES,
+    METRIC_SCROLLS,             /* Scroll regions applied */
+    METRIC_BYTES_RAW,           /* Pixel bytes before encoding */
+    METRIC_BYTES_SENT,          /* Payload bytes written */
+    METRIC_BATCHES,             /* Twrite batches */
+    METRIC_WRITE_ERRORS,        /* Failed or lost batches */
+    METRIC_COUNTER_COUNT
+};
+
+/* Gauges describe one pipeline: the root window's with -w */
+enum metric_gauge {
+    METRIC_DRAIN_WINDOW,        /* Batches allowed in flight */
+    METRIC_DRAIN_PENDING,       /* Batches in flight */
+    METRIC_EFFORT,              /* Compression effort level */
+    METRIC_GAUGE_COUNT
+};
+
+/* Record one duration of a stage, in microseconds. Lock-free. */
+void metrics_observe(enum metric_stage stage, uint64_t us);
+
+/* Add n to a counter. Lock-free. */
+void metrics_add(enum metric_counter counter, uint64_t n);
+
+/* Set a gauge. Lock-free. */
+void metrics_set(enum metric_gauge gauge, int64_t value);
+
+/* Totals of one stage; quantiles are bucket upper bounds */
+struct metric_summary {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+};
+
+/* Read a stage histogram (the benchmark's report). */
+void metrics_summary(enum metric_stage stage, struct metric_summary *out);
+
+/* Current value of a counter. */
+uint64_t metrics_counter(enum metric_counter counter);
+
+/* Stage label as used in the snapshot ("compress", ...). */
+const char *metrics_stage_name(enum metric_stage stage);
+
+/*
+ * Serve snapshots on a Unix socket at path (replacing a stale socket;
+ * fails if path is any other kind of file).
+ * Returns 0 on success, -1 on error (recording continues regardless).
+ */
+int metrics_start(const char *path);
+
+/* Stop the endpoint and remove the socket. Safe if never started. */
+void metrics_stop(void);
+
+#endif /* P9WL_METRICS_H */
@@ -1,112 +1,442 @@
 /*
  * parallel.c - Simple parallel for with persistent workers
  *
- * Threads are created once and reused. No per-call overhead.
+ * Threads are created once and reused. Jobs live in pool-owned slots;
+ * indices are claimed in chunks with atomic fetch_add, and locks are
+ * only taken to sleep or to wake a sleeper. Pool size and CPU
+ * placement come from parallel_configure(). See parallel.h.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE             /* cpu_set_t, pthread_attr_setaffinity_np */
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <unistd.h>
+
+#include <wlr/util/log.h>
+
 #include "parallel.h"
+#include "timeline.h"
 
-#define MAX_WORKERS 8
+/* Spin rounds (sched_yield each) before a worker or waiter sleeps */
+#define SPIN_ROUNDS 64
+
+#define CHUNK_MAX 32
+
+enum {
+    SLOT_FREE,
+    SLOT_SETUP,     /* Owner is filling in the job */
+    SLOT_ACTIVE,    /* Workers may claim indices */
+    SLOT_DRAINING   /* All done; owner waits for users to leave */
+};
+
+struct job_slot {
+    atomic_int state;
+    atomic_int users;           /* Workers currently inside the job */
 
-static struct {
-    pthread_t threads[MAX_WORKERS];
-    int nthreads;
-    
     parallel_fn fn;
     void *ctx;
     int count;
-    int next_idx;
-    int done_count;
-    
+    int chunk;
+    atomic_int next;            /* Next unclaimed index */
+    atomic_int done;            /* Completed items */
+
+    /* Streaming: per-index completion flags */
+    int streaming;
+    atomic_uchar *ready;
+    int ready_cap;
+
+    /* Completion wait (only locked when a waiter is announced) */
+    atomic_int waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static struct {
+    pthread_t threads[MAX_WORKERS];
+    int nthreads;
+
+    /* Placement from parallel_configure() */
+    int want_threads;           /* 0 = auto */
+    cpu_set_t worker_cpus;
+    int worker_ncpus;           /* 0 = inherit the process mask */
+    cpu_set_t io_cpus;
+    int io_ncpus;               /* 0 = no pinning */
+
+    struct job_slot slots[PARALLEL_MAX_JOBS];
+
+    atomic_uint work_seq;       /* Bumped on every publish */
+    atomic_int sleepers;
     pthread_mutex_t lock;
     pthread_cond_t work_cond;
-    pthread_cond_t done_cond;
-    int shutdown;
-    int initialized;
+    atomic_int shutdown;
+    atomic_int running;         /* Workers exist */
 } pool;
 
-static void *worker_func(void *arg) {
-    (void)arg;
-    
-    pthread_mutex_lock(&pool.lock);
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* ============== CPU Lists ============== */
+
+/* Read a NUMA node's CPU list from sysfs into buf */
+static int node_cpulist(int node, char *buf, size_t len) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Parse "0-3,8,10-11" or "node:N" into set.
+ * Returns the number of CPUs in the set, -1 on syntax error.
+ */
+static int parse_cpulist(const char *str, cpu_set_t *set) {
+    char nodebuf[1024];
+    CPU_ZERO(set);
+
+    if (strncmp(str, "node:", 5) == 0) {
+        char *end;
+        long node = strtol(str + 5, &end, 10);
+        if (end == str + 5 || *end || node < 0 ||
+            node_cpulist((int)node, nodebuf, sizeof(nodebuf)) < 0)
+            return -1;
+        str = nodebuf;
+    }
+
+    const char *p = str;
+    while (*p && !isspace((unsigned char)*p)) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) return -1;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            if (end == p + 1) return -1;
+            p = end;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+        if (*p == ',') p++;
+        else if (*p && !isspace((unsigned char)*p)) return -1;
+    }
+    return CPU_COUNT(set);
+}
+
+/* The n-th CPU (wrapping) of set, -1 if empty */
+static int nth_cpu(const cpu_set_t *set, int n) {
+    int count = CPU_COUNT(set);
+    if (count == 0) return -1;
+    n %= count;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, set) && n-- == 0) return c;
+    return -1;
+}
+
+/* ============== Job Execution ============== */
+
+static void job_notify(struct job_slot *j) {
+    if (atomic_load(&j->waiting)) {
+        pthread_mutex_lock(&j->lock);
+        pthread_cond_broadcast(&j->cond);
+        pthread_mutex_unlock(&j->lock);
+    }
+}
+
+/*
+ * Claim and run chunks of j until none are left.  Caller must hold a
+ * user reference (or own the slot).  Returns the number of items run.
+ */
+static int job_run(struct job_slot *j) {
+    int ran = 0;
     for (;;) {
-        while (pool.next_idx >= pool.count && !pool.shutdown)
-            pthread_cond_wait(&pool.work_cond, &pool.lock);
-        
-        if (pool.shutdown) {
-            pthread_mutex_unlock(&pool.lock);
-            return NULL;
+        int start = atomic_fetch_add(&j->next, j->chunk);
+        if (start >= j->count) break;
+        int end = start + j->chunk;
+        if (end > j->count) end = j->count;
+
+        for (int idx = start; idx < end; idx++) {
+            j->fn(j->ctx, idx);
+            if (j->streaming) {
+                atomic_store(&j->ready[idx], 1);
+                job_notify(j);
+            }
+        }
+        ran += end - start;
+        if (atomic_fetch_add(&j->done, end - start) + (end - start) == j->count)
+            job_notify(j);
+    }
+    return ran;
+}
+
+/* Wait until pred(j, arg) holds: spin, then sleep on the job's cond */
+static void job_wait(struct job_slot *j, int (*pred)(struct job_slot *, int), int arg) {
+    for (int i = 0; i < SPIN_ROUNDS; i++) {
+        if (pred(j, arg)) return;
+        sched_yield();
+    }
+    atomic_store(&j->waiting, 1);
+    pthread_mutex_lock(&j->lock);
+    while (!pred(j, arg))
+        pthread_cond_wait(&j->cond, &j->lock);
+    pthread_mutex_unlock(&j->lock);
+    atomic_store(&j->waiting, 0);
+}
+
+static int pred_all_done(struct job_slot *j, int arg) {
+    (void)arg;
+    return atomic_load(&j->done) >= j->count;
+}
+
+static int pred_item_ready(struct job_slot *j, int idx) {
+    return atomic_load(&j->ready[idx]) != 0;
+}
+
+/* ============== Workers ============== */
+
+/* Serve one chunk-run on any active slot; returns items run */
+static int serve_slots(void) {
+    int ran = 0;
+    for (int i = 0; i < PARALLEL_MAX_JOBS; i++) {
+        struct job_slot *j = &pool.slots[i];
+        if (atomic_load(&j->state) != SLOT_ACTIVE) continue;
+
+        atomic_fetch_add(&j->users, 1);
+        if (atomic_load(&j->state) == SLOT_ACTIVE) {
+            uint64_t t0 = timeline_now();
+            int n = job_run(j);
+            if (n > 0) timeline_span("worker_job", t0);
+            ran += n;
         }
-        
-        int idx = pool.next_idx++;
-        if (idx < pool.count) {
-            parallel_fn fn = pool.fn;
-            void *ctx = pool.ctx;
-            pthread_mutex_unlock(&pool.lock);
-            
-            fn(ctx, idx);
-            
-            pthread_mutex_lock(&pool.lock);
-            if (++pool.done_count == pool.count)
-                pthread_cond_signal(&pool.done_cond);
+        atomic_fetch_sub(&j->users, 1);
+    }
+    return ran;
+}
+
+static void *worker_func(void *arg) {
+    (void)arg;
+    timeline_thread_name("worker");
+
+    while (!atomic_load(&pool.shutdown)) {
+        unsigned seq = atomic_load(&pool.work_seq);
+        if (serve_slots() > 0) continue;
+
+        int found = 0;
+        for (int i = 0; i < SPIN_ROUNDS && !found; i++) {
+            sched_yield();
+            found = atomic_load(&pool.work_seq) != seq;
         }
+        if (found) continue;
+
+        pthread_mutex_lock(&pool.lock);
+        atomic_fetch_add(&pool.sleepers, 1);
+        while (atomic_load(&pool.work_seq) == seq && !atomic_load(&pool.shutdown))
+            pthread_cond_wait(&pool.work_cond, &pool.lock);
+        atomic_fetch_sub(&pool.sleepers, 1);
+        pthread_mutex_unlock(&pool.lock);
     }
+    return NULL;
 }
 
-static void ensure_initialized(void) {
-    if (pool.initialized) return;
-    
+static void init_pool(void) {
     pthread_mutex_init(&pool.lock, NULL);
     pthread_cond_init(&pool.work_cond, NULL);
-    pthread_cond_init(&pool.done_cond, NULL);
-    
-    pool.nthreads = sysconf(_SC_NPROCESSORS_ONLN) / 2;
-    if (pool.nthreads < 1) pool.nthreads = 1;
-    if (pool.nthreads > MAX_WORKERS) pool.nthreads = MAX_WORKERS;
-    
-    for (int i = 0; i < pool.nthreads; i++)
-        pthread_create(&pool.threads[i], NULL, worker_func, NULL);
-    
-    pool.initialized = 1;
+    for (int i = 0; i < PARALLEL_MAX_JOBS; i++) {
+        pthread_mutex_init(&pool.slots[i].lock, NULL);
+        pthread_cond_init(&pool.slots[i].cond, NULL);
+    }
+
+    /* Auto size: half the CPUs we may run on (taskset/cgroup aware) */
+    int n = pool.want_threads;
+    if (n <= 0) {
+        cpu_set_t mask;
+        int cpus = pool.worker_ncpus;
+        if (cpus == 0)
+            cpus = (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+                ? CPU_COUNT(&mask) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus / 2;
+        if (n < 1) n = 1;
+        if (n > PARALLEL_AUTO_MAX) n = PARALLEL_AUTO_MAX;
+    }
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+
+    int created = 0;
+    for (int i = 0; i < n; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        int cpu = pool.worker_ncpus ? nth_cpu(&pool.worker_cpus, i) : -1;
+        if (cpu >= 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+        }
+        if (pthread_create(&pool.threads[created], &attr, worker_func, NULL) == 0)
+            created++;
+        pthread_attr_destroy(&attr);
+    }
+    pool.nthreads = created;
+    atomic_store(&pool.running, created > 0);
+
+    wlr_log(WLR_INFO, "Worker pool: %d threads%s", created,
+            pool.worker_ncpus ? " (pinned)" : "");
+}
+
+/* ============== Slot Management ============== */
+
+static struct job_slot *slot_acquire(void) {
+    pthread_once(&init_once, init_pool);
+    if (!atomic_load(&pool.running)) return NULL;
+
+    for (int i = 0; i < PARALLEL_MAX_JOBS; i++) {
+        int expected = SLOT_FREE;
+        if (atomic_compare_exchange_strong(&pool.slots[i].state, &expected, SLOT_SETUP))
+            return &pool.slots[i];
+    }
+    return NULL;
+}
+
+static void slot_publish(struct job_slot *j, int count, parallel_fn fn,
+                         void *ctx, int chunk, int streaming) {
+    j->fn = fn;
+    j->ctx = ctx;
+    j->count = count;
+    j->chunk = chunk;
+    j->streaming = streaming;
+    atomic_store(&j->next, 0);
+    atomic_store(&j->done, 0);
+    atomic_store(&j->state, SLOT_ACTIVE);
+
+    atomic_fetch_add(&pool.work_seq, 1);
+    if (atomic_load(&pool.sleepers) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.work_cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+static void slot_release(struct job_slot *j) {
+    job_wait(j, pred_all_done, 0);
+    atomic_store(&j->state, SLOT_DRAINING);
+    while (atomic_load(&j->users) > 0)
+        sched_yield();
+    atomic_store(&j->state, SLOT_FREE);
+}
+
+/* ============== Public API ============== */
+
+int parallel_configure(const struct parallel_config *cfg) {
+    if (cfg->worker_cpus) {
+        pool.worker_ncpus = parse_cpulist(cfg->worker_cpus, &pool.worker_cpus);
+        if (pool.worker_ncpus <= 0) {
+            wlr_log(WLR_ERROR, "Bad worker CPU list '%s'", cfg->worker_cpus);
+            pool.worker_ncpus = 0;
+            return -1;
+        }
+    }
+    if (cfg->io_cpus) {
+        pool.io_ncpus = parse_cpulist(cfg->io_cpus, &pool.io_cpus);
+        if (pool.io_ncpus <= 0) {
+            wlr_log(WLR_ERROR, "Bad I/O thread CPU list '%s'", cfg->io_cpus);
+            pool.io_ncpus = 0;
+            return -1;
+        }
+    }
+
+    /* An explicit CPU list without a count means one worker per CPU */
+    pool.want_threads = cfg->nthreads;
+    if (pool.want_threads <= 0 && pool.worker_ncpus > 0)
+        pool.want_threads = pool.worker_ncpus;
+    return 0;
+}
+
+int parallel_worker_count(void) {
+    pthread_once(&init_once, init_pool);
+    return atomic_load(&pool.running) ? pool.nthreads : 0;
+}
+
+void parallel_pin_io_thread(const char *name) {
+    if (pool.io_ncpus == 0) return;
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(pool.io_cpus), &pool.io_cpus);
+    if (err)
+        wlr_log(WLR_ERROR, "%s thread: pin failed: %s", name, strerror(err));
+    else
+        wlr_log(WLR_INFO, "%s thread: pinned to %d CPUs", name, pool.io_ncpus);
 }
 
 void parallel_for(int count, parallel_fn fn, void *ctx) {
     if (count <= 0) return;
-    
-    ensure_initialized();
-    
-    pthread_mutex_lock(&pool.lock);
-    pool.fn = fn;
-    pool.ctx = ctx;
-    pool.count = count;
-    pool.next_idx = 0;
-    pool.done_count = 0;
-    
-    pthread_cond_broadcast(&pool.work_cond);
-    
-    while (pool.done_count < count)
-        pthread_cond_wait(&pool.done_cond, &pool.lock);
-    
-    pthread_mutex_unlock(&pool.lock);
+
+    struct job_slot *j = (count > 1) ? slot_acquire() : NULL;
+    if (!j) {
+        for (int i = 0; i < count; i++) fn(ctx, i);
+        return;
+    }
+
+    int chunk = count / (pool.nthreads * 8);
+    if (chunk < 1) chunk = 1;
+    if (chunk > CHUNK_MAX) chunk = CHUNK_MAX;
+
+    slot_publish(j, count, fn, ctx, chunk, 0);
+    job_run(j);
+    slot_release(j);
+}
+
+int parallel_stream_start(int count, parallel_fn fn, void *ctx) {
+    if (count <= 0) return -1;
+
+    struct job_slot *j = slot_acquire();
+    if (!j) return -1;
+
+    if (count > j->ready_cap) {
+        atomic_uchar *r = realloc(j->ready, count * sizeof(*r));
+        if (!r) {
+            atomic_store(&j->state, SLOT_FREE);
+            return -1;
+        }
+        j->ready = r;
+        j->ready_cap = count;
+    }
+    memset((void *)j->ready, 0, count * sizeof(*j->ready));
+
+    slot_publish(j, count, fn, ctx, 1, 1);
+    return (int)(j - pool.slots);
+}
+
+int parallel_stream_ready(int job, int idx) {
+    return atomic_load(&pool.slots[job].ready[idx]) != 0;
+}
+
+void parallel_stream_wait(int job, int idx) {
+    struct job_slot *j = &pool.slots[job];
+    if (atomic_load(&j->ready[idx])) return;
+    job_wait(j, pred_item_ready, idx);
+}
+
+void parallel_stream_finish(int job) {
+    slot_release(&pool.slots[job]);
 }
 
 void parallel_cleanup(void) {
-    if (!pool.initialized) return;
-    
+    if (!atomic_load(&pool.running)) return;
+
     pthread_mutex_lock(&pool.lock);
-    pool.shutdown = 1;
+    atomic_store(&pool.shutdown, 1);
     pthread_cond_broadcast(&pool.work_cond);
     pthread_mutex_unlock(&pool.lock);
-    
+
     for (int i = 0; i < pool.nthreads; i++)
         pthread_join(pool.threads[i], NULL);
-    
-    pthread_mutex_destroy(&pool.lock);
-    pthread_cond_destroy(&pool.work_cond);
-    pthread_cond_destroy(&pool.done_cond);
-    pool.initialized = 0;
+    atomic_store(&pool.running, 0);
+
+    for (int i = 0; i < PARALLEL_MAX_JOBS; i++) {
+        free(pool.slots[i].ready);
+        pool.slots[i].ready = NULL;
+        pool.slots[i].ready_cap = 0;
+    }
 }
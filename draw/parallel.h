@@ -7,68 +7,102 @@
  *
  * Architecture Overview:
  *
- *   The pool uses a dynamic work distribution model where workers
- *   compete for indices from a shared counter protected by a mutex:
+ *   Work is published as jobs in a small table of pool-owned slots.
+ *   Workers claim chunks of indices with an atomic fetch_add on the
+ *   job's claim counter; no lock is taken per index or per chunk:
  *
  *     Caller Thread              Worker Threads
  *     ─────────────              ──────────────
  *     parallel_for() ──┐         ┌─── worker 0
- *       set fn, ctx    │    ┌────┼─── worker 1
- *       set count      ├────┤    ├─── worker 2
- *       broadcast ─────┤    │    └─── worker 3
+ *       take free slot │    ┌────┼─── worker 1
+ *       publish job ───┤    │    ├─── worker 2
+ *       claim chunks   ├────┤    └─── worker 3
  *       wait done ◄────┘    │         ...
- *                           └─── workers claim next_idx under lock
+ *                           └─── fetch_add(next, chunk) on any
+ *                                active slot
  *
  *   Each worker:
- *     1. Waits on work_cond for work
- *     2. Claims next_idx under pool.lock (increment + read)
- *     3. Calls fn(ctx, idx) outside the lock
- *     4. Increments done_count and signals if complete
- *     5. Loops back to wait for more work
+ *     1. Scans the slot table for an active job with unclaimed work
+ *     2. Claims [next, next + chunk) with one fetch_add
+ *     3. Calls fn(ctx, idx) for each index of the chunk
+ *     4. Adds the chunk to the job's done counter
+ *     5. Spins briefly when no work is found, then sleeps
  *
- * Thread Count:
+ *   The caller of parallel_for() claims chunks of its own job too, so
+ *   a job always makes progress even when every worker is busy.
  *
- *   Workers = min(MAX_WORKERS, sysconf(_SC_NPROCESSORS_ONLN) / 2)
+ * Jobs In Flight:
  *
- *   Using half the CPU count leaves headroom for the main thread,
- *   send thread, and drain thread. MAX_WORKERS (8) caps the pool
- *   to avoid excessive context switching on high-core systems.
+ *   Up to PARALLEL_MAX_JOBS jobs can be active at once, from any
+ *   threads (e.g. detect_scroll() for one frame while the send
+ *   thread's streaming compression of another is still running).
+ *   Workers serve all active jobs. If every slot is taken, the
+ *   caller simply runs its job inline.
  *
- * Lazy Initialization:
+ * Chunking:
+ *
+ *   chunk = count / (workers × 8), clamped to [1, 32]. Large jobs
+ *   amortize the claim over several items; small jobs still spread
+ *   across workers. Streaming jobs use chunk = 1 so items complete
+ *   in index order as closely as possible.
+ *
+ * Spin-Then-Block:
+ *
+ *   Idle workers spin (with sched_yield) for a short while before
+ *   sleeping on pool.work_cond; a submitter only takes pool.lock
+ *   when some worker is actually asleep. Waiters for completion do
+ *   the same on the job's own condition variable, and workers only
+ *   lock it when a waiter has announced itself. In steady state
+ *   (frames arriving back to back) no mutex is touched at all.
+ *
+ * Slot Lifetime:
+ *
+ *   A worker registers on a slot (users++) before reading the job
+ *   and re-checks that it is still active. The owner releases a slot
+ *   only after done == count and users == 0, so a worker never runs
+ *   an index of a job that has been torn down.
  *
- *   The thread pool is created on the first call to parallel_for():
+ * Thread Count:
+ *
+ *   By default:
  *
- *     1. Initialize mutex, condition variables
- *     2. Determine thread count from CPU cores
- *     3. Create worker threads (all start waiting)
- *     4. Set initialized flag
+ *     Workers = min(PARALLEL_AUTO_MAX, usable CPUs / 2)
  *
- *   Subsequent calls reuse the existing pool with no allocation.
+ *   where usable CPUs is the process affinity mask (so taskset and
+ *   cpuset cgroups are honoured), or the size of the worker CPU list
+ *   when one is configured. Using half leaves headroom for the main
+ *   thread, send thread, and drain thread. PARALLEL_AUTO_MAX (8)
+ *   keeps the automatic size modest on high-core systems where many
+ *   instances share a host.
  *
- * Synchronization:
+ *   parallel_configure() (-W / -A options, P9WL_WORKERS /
+ *   P9WL_WORKER_CPUS environment) overrides this; an explicit count
+ *   may go up to MAX_WORKERS.
  *
- *   pool.lock (mutex) protects:
- *     - fn, ctx (work function and context)
- *     - count (total work items)
- *     - next_idx (next unclaimed index)
- *     - done_count (completed items)
- *     - shutdown flag
+ * CPU Placement:
  *
- *   pool.work_cond:
- *     - Workers wait here when idle
- *     - Broadcast when new work arrives
- *     - Broadcast on shutdown
+ *   With a worker CPU list, worker i is pinned to the i-th CPU of the
+ *   list (wrapping), so instances given disjoint lists never share a
+ *   core's caches. "node:N" takes the list of NUMA node N from sysfs.
+ *   The send and drain threads call parallel_pin_io_thread() to pin
+ *   themselves to the separate I/O CPU list, if one was given.
  *
- *   pool.done_cond:
- *     - Caller waits here for completion
- *     - Signaled when done_count == count
+ *   There is one pool per process: the send thread's compression,
+ *   detect_scroll() and anything else use the same workers.
+ *
+ * Lazy Initialization:
  *
- * Serialization:
+ *   The thread pool is created on the first call to parallel_for(),
+ *   parallel_stream_start() or parallel_worker_count() (pthread_once,
+ *   so concurrent first calls are safe). Subsequent calls reuse the
+ *   pool with no allocation.
  *
- *   Only one parallel_for() can execute at a time. If multiple
- *   threads call parallel_for() concurrently, they are serialized
- *   by pool.lock. This is intentional - the pool is designed for
- *   a single producer (send thread) with parallel consumers.
+ * Streaming:
+ *
+ *   parallel_stream_start() publishes a job without waiting for it
+ *   and returns a handle. Completion is published per index (the
+ *   slot's ready[] flags), so the caller can consume items in order
+ *   with parallel_stream_wait() while the workers keep going.
  *
  * Work Function Requirements:
  *
@@ -84,9 +118,9 @@
  *
  * Performance Characteristics:
  *
- *   - Zero allocation per call (pool persists)
- *   - Minimal lock contention (workers unlock before fn())
- *   - Good load balancing (work-stealing via shared counter)
+ *   - Zero allocation per call (pool and slots persist)
+ *   - One atomic fetch_add per chunk, no lock on the hot path
+ *   - Good load balancing (shared claim counter, small chunks)
  *   - Low latency (workers stay warm, no thread creation)
  *
  *   Optimal for:
@@ -127,10 +161,61 @@
 /*
  * Maximum number of worker threads.
  *
- * Caps the pool size regardless of CPU count. 8 workers is sufficient
- * for typical tile compression workloads (hundreds of tiles).
+ * Hard cap for an explicitly configured pool size.
+ */
+#define MAX_WORKERS 32
+
+/*
+ * Cap for the automatic pool size. 8 workers is sufficient for
+ * typical tile compression workloads (hundreds of tiles).
+ */
+#define PARALLEL_AUTO_MAX 8
+
+/*
+ * Maximum number of jobs in flight at once (parallel_for calls plus
+ * open streaming jobs). Further jobs run inline on the caller.
+ */
+#define PARALLEL_MAX_JOBS 4
+
+/*
+ * Pool sizing and placement.
+ *
+ * nthreads:    worker count, 0 = automatic (see Thread Count)
+ * worker_cpus: CPU list for workers ("0-3,8" or "node:N"), NULL =
+ *              inherit the process affinity and do not pin
+ * io_cpus:     CPU list for the send and drain threads, NULL = no
+ *              pinning
+ */
+struct parallel_config {
+    int nthreads;
+    const char *worker_cpus;
+    const char *io_cpus;
+};
+
+/*
+ * Set pool sizing and placement.
+ *
+ * Must be called before the pool is first used (before the send
+ * thread starts); later calls do not resize a running pool. The
+ * strings are parsed immediately and need not outlive the call.
+ *
+ * Returns 0 on success, -1 if a CPU list could not be parsed.
  */
-#define MAX_WORKERS 8
+int parallel_configure(const struct parallel_config *cfg);
+
+/*
+ * Number of worker threads, starting the pool if needed.
+ *
+ * Returns 0 if no worker could be created (all jobs run inline).
+ */
+int parallel_worker_count(void);
+
+/*
+ * Pin the calling thread to the configured I/O CPU list.
+ *
+ * No-op without an I/O list. name is used for logging only.
+ */
+void parallel_pin_io_thread(const char *name);
 
 /*
  * Function signature for parallel work items.
@@ -151,8 +236,8 @@ typedef void (*parallel_fn)(void *ctx, int idx);
 /*
  * Execute a function in parallel for indices 0 to count-1.
  *
- * Distributes work across the thread pool. Workers claim indices
- * from a shared counter under mutex protection. Each index is
+ * Distributes work across the thread pool. Workers (and the caller)
+ * claim chunks of indices with an atomic counter. Each index is
  * processed exactly once. The call blocks until all work items
  * complete.
  *
@@ -165,21 +250,61 @@ typedef void (*parallel_fn)(void *ctx, int idx);
  *
  * Behavior:
  *   - If count <= 0, returns immediately without calling fn
- *   - If count == 1, still uses thread pool (no single-thread optimization)
+ *   - If count == 1, runs fn on the caller (no pool round trip)
  *   - Blocks until all indices are processed
  *
  * Thread-safety:
- *   - Multiple threads can call parallel_for(), but calls are serialized
- *   - Only one parallel_for() executes at a time (others block)
- *   - This is by design for the send thread use case
- *
- * Performance:
- *   - First call incurs thread creation overhead
- *   - Subsequent calls have minimal overhead (~microseconds)
- *   - Work distribution is dynamic (good load balancing)
+ *   - Any thread may call parallel_for(), also concurrently with
+ *     other parallel_for() calls and open streaming jobs
+ *   - If all PARALLEL_MAX_JOBS slots are busy, runs inline
  */
 void parallel_for(int count, parallel_fn fn, void *ctx);
 
+/* ============== Streaming ============== */
+
+/*
+ * Start a parallel job without waiting for it.
+ *
+ * Same work distribution as parallel_for(), but returns as soon as
+ * the job is published and the caller does not take part in it.
+ * Items are claimed one at a time in increasing order, so they
+ * complete roughly in index order, and each item publishes its
+ * completion in a per-index ready flag. The caller consumes results
+ * in order with parallel_stream_wait() while later items are still
+ * running — the send thread uses this to write batches while the
+ * rest of the frame compresses.
+ *
+ * count: number of work items
+ * fn:    function to call for each index (must be thread-safe)
+ * ctx:   context pointer passed to each fn invocation
+ *
+ * Returns a job handle (>= 0), or -1 if count <= 0, no slot is free
+ * or the ready flags could not be allocated (caller should run the
+ * items itself).
+ *
+ * Every successful start must be followed by parallel_stream_finish()
+ * on the returned handle.
+ */
+int parallel_stream_start(int count, parallel_fn fn, void *ctx);
+
+/*
+ * Non-blocking check: has item idx of streaming job `job` completed?
+ */
+int parallel_stream_ready(int job, int idx);
+
+/*
+ * Block until item idx of streaming job `job` has completed.
+ *
+ * Returns immediately if it already has. Otherwise spins briefly,
+ * then sleeps until the worker finishing idx wakes the caller.
+ */
+void parallel_stream_wait(int job, int idx);
+
+/*
+ * Wait for every item of streaming job `job` and release its slot.
+ */
+void parallel_stream_finish(int job);
+
 /*
  * Shutdown the thread pool and release resources.
  *
@@ -187,11 +312,10 @@ void parallel_for(int count, parallel_fn fn, void *ctx);
  *   1. Sets shutdown flag
  *   2. Broadcasts to wake all workers
  *   3. Joins all worker threads
- *   4. Destroys mutex and condition variables
- *   5. Clears initialized flag
+ *   4. Frees the streaming ready flags
  *
- * Any work in progress completes before threads exit.
- * After this call, the next parallel_for() will reinitialize the pool.
+ * Must not be called while jobs are in flight. After this call,
+ * parallel_for() runs every job inline on the caller.
  *
  * Safe to call even if pool was never initialized (no-op).
  * Safe to call multiple times (subsequent calls are no-ops).
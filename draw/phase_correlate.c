@@ -5,18 +5,34 @@
  *
  * Uses single-precision FFTW for performance.
  * Thread-local storage with automatic cleanup when threads exit.
+ * The windowing and cross-power loops have SIMD kernels selected at
+ * runtime, like tilecmp.c. Plans are measured once per thread, from
+ * saved wisdom when there is some.
  */
 
 #define _POSIX_C_SOURCE 200809L
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <math.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <fftw3.h>
 #include <wlr/util/log.h>
 
 #include "phase_correlate.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define PHASE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PHASE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Complex bins of an r2c transform */
+#define FFT_BINS ((FFT_SIZE / 2 + 1) * FFT_SIZE)
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -35,6 +51,192 @@ static void init_hann_lut(void) {
     pthread_once(&hann_once, init_hann_lut_internal);
 }
 
+static inline float pixel_to_gray(uint32_t pixel) {
+    uint8_t r = (pixel >> 16) & 0xFF;
+    uint8_t g = (pixel >> 8) & 0xFF;
+    uint8_t b = pixel & 0xFF;
+    return 0.299f * r + 0.587f * g + 0.114f * b;
+}
+
+/* ============== Kernels ============== */
+
+/*
+ * Row kernel: dst[x] = gray(src[x]) * wy * wx[x].
+ * Cross kernel: normalized cross-power spectrum of out1 and out2 into
+ * cross; if store is non-NULL, out1 is also copied there (store may
+ * alias out2, every bin is read before it is written).
+ *
+ * The vector kernels evaluate the same expressions in the same order
+ * as the scalar ones.
+ */
+
+static void window_row_scalar(float *dst, const uint32_t *src,
+                              const float *wx, float wy, int n) {
+    for (int x = 0; x < n; x++)
+        dst[x] = pixel_to_gray(src[x]) * wy * wx[x];
+}
+
+static void cross_scalar(const fftwf_complex *out1, const fftwf_complex *out2,
+                         fftwf_complex *cross, fftwf_complex *store,
+                         int start, int n) {
+    for (int i = start; i < n; i++) {
+        float re1 = out1[i][0], im1 = out1[i][1];
+        float re2 = out2[i][0], im2 = out2[i][1];
+        
+        float cross_re = re1 * re2 + im1 * im2;
+        float cross_im = im1 * re2 - re1 * im2;
+        
+        float mag = sqrtf(cross_re * cross_re + cross_im * cross_im);
+        
+        if (mag > 1e-10f) {
+            cross[i][0] = cross_re / mag;
+            cross[i][1] = cross_im / mag;
+        } else {
+            cross[i][0] = 0;
+            cross[i][1] = 0;
+        }
+        if (store) {
+            store[i][0] = re1;
+            store[i][1] = im1;
+        }
+    }
+}
+
+#ifdef PHASE_X86
+__attribute__((target("avx2")))
+static void window_row_avx2(float *dst, const uint32_t *src,
+                            const float *wx, float wy, int n) {
+    const __m256i m = _mm256_set1_epi32(0xFF);
+    const __m256 kr = _mm256_set1_ps(0.299f);
+    const __m256 kg = _mm256_set1_ps(0.587f);
+    const __m256 kb = _mm256_set1_ps(0.114f);
+    const __m256 vwy = _mm256_set1_ps(wy);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + x));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), m));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), m));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(v, m));
+        __m256 gray = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(kr, r),
+                                                  _mm256_mul_ps(kg, g)),
+                                    _mm256_mul_ps(kb, b));
+        gray = _mm256_mul_ps(_mm256_mul_ps(gray, vwy), _mm256_loadu_ps(wx + x));
+        _mm256_storeu_ps(dst + x, gray);
+    }
+    window_row_scalar(dst + x, src + x, wx + x, wy, n - x);
+}
+
+/*
+ * Four interleaved bins per step.  With p = a*b and q = a*swap(b):
+ * re = p0 + p1 and im = q1 - q0, formed in the even / odd lanes.
+ */
+__attribute__((target("avx2")))
+static void cross_avx2(const fftwf_complex *out1, const fftwf_complex *out2,
+                       fftwf_complex *cross, fftwf_complex *store,
+                       int start, int n) {
+    const __m256 eps = _mm256_set1_ps(1e-10f);
+    int i = start;
+    for (; i + 4 <= n; i += 4) {
+        __m256 a = _mm256_loadu_ps(&out1[i][0]);
+        __m256 b = _mm256_loadu_ps(&out2[i][0]);
+        __m256 p = _mm256_mul_ps(a, b);
+        __m256 q = _mm256_mul_ps(a, _mm256_permute_ps(b, 0xB1));
+        __m256 re = _mm256_add_ps(p, _mm256_permute_ps(p, 0xB1));
+        __m256 im = _mm256_sub_ps(q, _mm256_permute_ps(q, 0xB1));
+        __m256 c = _mm256_blend_ps(re, im, 0xAA);
+        __m256 sq = _mm256_mul_ps(c, c);
+        __m256 mag = _mm256_sqrt_ps(_mm256_add_ps(sq, _mm256_permute_ps(sq, 0xB1)));
+        __m256 ok = _mm256_cmp_ps(mag, eps, _CMP_GT_OQ);
+        _mm256_storeu_ps(&cross[i][0], _mm256_and_ps(_mm256_div_ps(c, mag), ok));
+        if (store) _mm256_storeu_ps(&store[i][0], a);
+    }
+    cross_scalar(out1, out2, cross, store, i, n);
+}
+
+/* Same as cross_avx2, two bins per step (x86 baseline) */
+__attribute__((target("sse2")))
+static void cross_sse2(const fftwf_complex *out1, const fftwf_complex *out2,
+                       fftwf_complex *cross, fftwf_complex *store,
+                       int start, int n) {
+    const __m128 eps = _mm_set1_ps(1e-10f);
+    const __m128 odd = _mm_castsi128_ps(_mm_set_epi32(-1, 0, -1, 0));
+    int i = start;
+    for (; i + 2 <= n; i += 2) {
+        __m128 a = _mm_loadu_ps(&out1[i][0]);
+        __m128 b = _mm_loadu_ps(&out2[i][0]);
+        __m128 p = _mm_mul_ps(a, b);
+        __m128 q = _mm_mul_ps(a, _mm_shuffle_ps(b, b, 0xB1));
+        __m128 re = _mm_add_ps(p, _mm_shuffle_ps(p, p, 0xB1));
+        __m128 im = _mm_sub_ps(q, _mm_shuffle_ps(q, q, 0xB1));
+        __m128 c = _mm_or_ps(_mm_andnot_ps(odd, re), _mm_and_ps(odd, im));
+        __m128 sq = _mm_mul_ps(c, c);
+        __m128 mag = _mm_sqrt_ps(_mm_add_ps(sq, _mm_shuffle_ps(sq, sq, 0xB1)));
+        __m128 ok = _mm_cmpgt_ps(mag, eps);
+        _mm_storeu_ps(&cross[i][0], _mm_and_ps(_mm_div_ps(c, mag), ok));
+        if (store) _mm_storeu_ps(&store[i][0], a);
+    }
+    cross_scalar(out1, out2, cross, store, i, n);
+}
+#endif
+
+#ifdef PHASE_NEON
+/* Four bins per step with de-interleaving loads */
+static void cross_neon(const fftwf_complex *out1, const fftwf_complex *out2,
+                       fftwf_complex *cross, fftwf_complex *store,
+                       int start, int n) {
+    const float32x4_t eps = vdupq_n_f32(1e-10f);
+    int i = start;
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t a = vld2q_f32(&out1[i][0]);
+        float32x4x2_t b = vld2q_f32(&out2[i][0]);
+        float32x4_t re = vaddq_f32(vmulq_f32(a.val[0], b.val[0]),
+                                   vmulq_f32(a.val[1], b.val[1]));
+        float32x4_t im = vsubq_f32(vmulq_f32(a.val[1], b.val[0]),
+                                   vmulq_f32(a.val[0], b.val[1]));
+        float32x4_t mag = vsqrtq_f32(vaddq_f32(vmulq_f32(re, re), vmulq_f32(im, im)));
+        uint32x4_t ok = vcgtq_f32(mag, eps);
+        float32x4x2_t c;
+        c.val[0] = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vdivq_f32(re, mag)), ok));
+        c.val[1] = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vdivq_f32(im, mag)), ok));
+        vst2q_f32(&cross[i][0], c);
+        if (store) vst2q_f32(&store[i][0], a);
+    }
+    cross_scalar(out1, out2, cross, store, i, n);
+}
+#endif
+
+typedef void (*window_row_fn)(float *, const uint32_t *, const float *, float, int);
+typedef void (*cross_fn)(const fftwf_complex *, const fftwf_complex *,
+                         fftwf_complex *, fftwf_complex *, int, int);
+
+static struct {
+    window_row_fn window_row;
+    cross_fn cross;
+    const char *name;
+} kernel = { window_row_scalar, cross_scalar, "scalar" };
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+#ifdef PHASE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel.window_row = window_row_avx2;
+        kernel.cross = cross_avx2;
+        kernel.name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel.cross = cross_sse2;
+        kernel.name = "sse2";
+    }
+#elif defined(PHASE_NEON)
+    kernel.cross = cross_neon;
+    kernel.name = "neon";
+#endif
+    wlr_log(WLR_INFO, "Phase correlation kernel: %s", kernel.name);
+}
+
+/* ============== Thread Resources ============== */
+
 /* Thread-local FFT resources */
 struct fft_thread_resources {
     float *fft_in1;
@@ -53,6 +255,50 @@ static pthread_key_t tls_key;
 static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 static pthread_mutex_t fftw_plan_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* ============== Saved Wisdom ============== */
+
+static pthread_once_t wisdom_once = PTHREAD_ONCE_INIT;
+static char wisdom_path[512];   /* "" when disabled */
+static int wisdom_loaded;       /* Our plans came from the file */
+static int wisdom_saved;
+
+/* $P9WL_FFTW_WISDOM, else under $XDG_CACHE_HOME or ~/.cache */
+static void wisdom_load(void) {
+    const char *env = getenv("P9WL_FFTW_WISDOM");
+    const char *dir;
+    if (env) {
+        snprintf(wisdom_path, sizeof(wisdom_path), "%s", env);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(wisdom_path, sizeof(wisdom_path), "%s/" FFT_WISDOM_FILE, dir);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(wisdom_path, sizeof(wisdom_path), "%s/.cache/" FFT_WISDOM_FILE, dir);
+    }
+
+    fftwf_import_system_wisdom();
+    if (wisdom_path[0] && fftwf_import_wisdom_from_filename(wisdom_path)) {
+        wisdom_loaded = 1;
+        wlr_log(WLR_INFO, "phase_correlate: FFTW wisdom from %s", wisdom_path);
+    }
+}
+
+/* After the first measured plans; caller holds fftw_plan_lock */
+static void wisdom_save(void) {
+    if (wisdom_loaded || wisdom_saved || !wisdom_path[0]) return;
+    wisdom_saved = 1;
+
+    /* Through a temporary, so a concurrent instance never reads half */
+    char tmp[sizeof(wisdom_path) + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%ld", wisdom_path, (long)getpid());
+    if (!fftwf_export_wisdom_to_filename(tmp) || rename(tmp, wisdom_path) < 0) {
+        unlink(tmp);
+        wlr_log(WLR_DEBUG, "phase_correlate: could not save FFTW wisdom to %s", wisdom_path);
+        return;
+    }
+    wlr_log(WLR_INFO, "phase_correlate: FFTW wisdom saved to %s", wisdom_path);
+}
+
+/* ============== Thread Resources ============== */
+
 static void free_thread_resources(void *arg) {
     struct fft_thread_resources *res = arg;
     if (!res) return;
@@ -88,13 +334,14 @@ static struct fft_thread_resources *get_thread_resources(void) {
     if (!res) return NULL;
     
     init_hann_lut();
+    pthread_once(&kernel_once, select_kernel);
     
     res->fft_in1 = fftwf_alloc_real(FFT_SIZE * FFT_SIZE);
     res->fft_in2 = fftwf_alloc_real(FFT_SIZE * FFT_SIZE);
     res->fft_corr = fftwf_alloc_real(FFT_SIZE * FFT_SIZE);
-    res->fft_out1 = fftwf_alloc_complex((FFT_SIZE/2 + 1) * FFT_SIZE);
-    res->fft_out2 = fftwf_alloc_complex((FFT_SIZE/2 + 1) * FFT_SIZE);
-    res->fft_cross = fftwf_alloc_complex((FFT_SIZE/2 + 1) * FFT_SIZE);
+    res->fft_out1 = fftwf_alloc_complex(FFT_BINS);
+    res->fft_out2 = fftwf_alloc_complex(FFT_BINS);
+    res->fft_cross = fftwf_alloc_complex(FFT_BINS);
     
     if (!res->fft_in1 || !res->fft_in2 || !res->fft_corr ||
         !res->fft_out1 || !res->fft_out2 || !res->fft_cross) {
@@ -103,9 +350,12 @@ static struct fft_thread_resources *get_thread_resources(void) {
     }
     
     pthread_mutex_lock(&fftw_plan_lock);
+    pthread_once(&wisdom_once, wisdom_load);
     res->plan_fwd1 = fftwf_plan_dft_r2c_2d(FFT_SIZE, FFT_SIZE, res->fft_in1, res->fft_out1, FFTW_MEASURE);
     res->plan_fwd2 = fftwf_plan_dft_r2c_2d(FFT_SIZE, FFT_SIZE, res->fft_in2, res->fft_out2, FFTW_MEASURE);
     res->plan_inv = fftwf_plan_dft_c2r_2d(FFT_SIZE, FFT_SIZE, res->fft_cross, res->fft_corr, FFTW_MEASURE);
+    if (res->plan_fwd1 && res->plan_fwd2 && res->plan_inv)
+        wisdom_save();
     pthread_mutex_unlock(&fftw_plan_lock);
     
     if (!res->plan_fwd1 || !res->plan_fwd2 || !res->plan_inv) {
@@ -117,12 +367,7 @@ static struct fft_thread_resources *get_thread_resources(void) {
     return res;
 }
 
-static inline float pixel_to_gray(uint32_t pixel) {
-    uint8_t r = (pixel >> 16) & 0xFF;
-    uint8_t g = (pixel >> 8) & 0xFF;
-    uint8_t b = pixel & 0xFF;
-    return 0.299f * r + 0.587f * g + 0.114f * b;
-}
+/* ============== Transform Steps ============== */
 
 static void extract_region_windowed(
     uint32_t *buf, int buf_width,
@@ -145,41 +390,18 @@ static void extract_region_windowed(
     float scale_x = (float)(FFT_SIZE - 1) / (copy_w - 1);
     float scale_y = (float)(FFT_SIZE - 1) / (copy_h - 1);
     
+    /* Column weights once per region instead of per pixel */
+    float wx[FFT_SIZE];
+    for (int x = 0; x < copy_w; x++)
+        wx[x] = hann_lut[(int)(x * scale_x)];
+    
     for (int y = 0; y < copy_h; y++) {
         int lut_y = (int)(y * scale_y);
         float wy = hann_lut[lut_y];
         float *row = &fft_buf[(y + off_y) * FFT_SIZE + off_x];
         uint32_t *src_row = &buf[(ry1 + y) * buf_width + rx1];
         
-        for (int x = 0; x < copy_w; x++) {
-            int lut_x = (int)(x * scale_x);
-            row[x] = pixel_to_gray(src_row[x]) * wy * hann_lut[lut_x];
-        }
-    }
-}
-
-static void compute_phase_correlation(
-    fftwf_complex *out1,
-    fftwf_complex *out2,
-    fftwf_complex *cross,
-    int n
-) {
-    for (int i = 0; i < n; i++) {
-        float re1 = out1[i][0], im1 = out1[i][1];
-        float re2 = out2[i][0], im2 = out2[i][1];
-        
-        float cross_re = re1 * re2 + im1 * im2;
-        float cross_im = im1 * re2 - re1 * im2;
-        
-        float mag = sqrtf(cross_re * cross_re + cross_im * cross_im);
-        
-        if (mag > 1e-10f) {
-            cross[i][0] = cross_re / mag;
-            cross[i][1] = cross_im / mag;
-        } else {
-            cross[i][0] = 0;
-            cross[i][1] = 0;
-        }
+        kernel.window_row(row, src_row, wx, wy, copy_w);
     }
 }
 
@@ -210,10 +432,18 @@ static void find_correlation_peak(
     *out_dy = peak_y;
 }
 
-struct phase_result phase_correlate_detect(
+/* Does spec hold a transform of exactly this region? */
+static inline int spectrum_matches(const struct phase_spectrum *spec,
+                                   int rx1, int ry1, int rx2, int ry2) {
+    return spec->valid && spec->data &&
+           spec->rx1 == rx1 && spec->ry1 == ry1 &&
+           spec->rx2 == rx2 && spec->ry2 == ry2;
+}
+
+struct phase_result phase_correlate_detect_cached(
     uint32_t *curr_buf, uint32_t *prev_buf, int buf_width,
     int rx1, int ry1, int rx2, int ry2,
-    int max_shift
+    int max_shift, struct phase_spectrum *spec
 ) {
     struct phase_result result = {0};
     
@@ -225,17 +455,39 @@ struct phase_result phase_correlate_detect(
     struct fft_thread_resources *res = get_thread_resources();
     if (!res) return result;
     
-    /* Extract regions with Hann windowing */
-    extract_region_windowed(curr_buf, buf_width, rx1, ry1, rx2, ry2, res->fft_in1);
-    extract_region_windowed(prev_buf, buf_width, rx1, ry1, rx2, ry2, res->fft_in2);
+    /* With a spectrum to keep, make sure it has storage */
+    if (spec && !spec->data) {
+        spec->data = fftwf_alloc_complex(FFT_BINS);
+        spec->valid = 0;
+    }
+    fftwf_complex *store = (spec && spec->data) ? spec->data : NULL;
     
-    /* Forward FFT */
+    /* Current region: window and transform */
+    extract_region_windowed(curr_buf, buf_width, rx1, ry1, rx2, ry2, res->fft_in1);
     fftwf_execute(res->plan_fwd1);
-    fftwf_execute(res->plan_fwd2);
     
-    /* Cross-power spectrum */
-    int fft_complex_size = (FFT_SIZE/2 + 1) * FFT_SIZE;
-    compute_phase_correlation(res->fft_out1, res->fft_out2, res->fft_cross, fft_complex_size);
+    /* Previous region: reuse last frame's current spectrum if it
+     * describes prev_buf, else transform prev_buf */
+    const fftwf_complex *prev_spec;
+    if (spec && spectrum_matches(spec, rx1, ry1, rx2, ry2)) {
+        prev_spec = spec->data;
+        result.cached = 1;
+    } else {
+        extract_region_windowed(prev_buf, buf_width, rx1, ry1, rx2, ry2, res->fft_in2);
+        fftwf_execute(res->plan_fwd2);
+        prev_spec = res->fft_out2;
+    }
+    
+    /* Cross-power spectrum; the current spectrum is saved in the
+     * same pass (over the previous one when it came from the cache) */
+    kernel.cross(res->fft_out1, prev_spec, res->fft_cross, store, 0, FFT_BINS);
+    if (store) {
+        spec->rx1 = rx1;
+        spec->ry1 = ry1;
+        spec->rx2 = rx2;
+        spec->ry2 = ry2;
+        spec->valid = 1;
+    }
     
     /* Inverse FFT to get correlation surface */
     fftwf_execute(res->plan_inv);
@@ -252,6 +504,20 @@ struct phase_result phase_correlate_detect(
     return result;
 }
 
+struct phase_result phase_correlate_detect(
+    uint32_t *curr_buf, uint32_t *prev_buf, int buf_width,
+    int rx1, int ry1, int rx2, int ry2,
+    int max_shift
+) {
+    return phase_correlate_detect_cached(curr_buf, prev_buf, buf_width,
+                                         rx1, ry1, rx2, ry2, max_shift, NULL);
+}
+
+void phase_spectrum_free(struct phase_spectrum *spec) {
+    if (spec->data) fftwf_free(spec->data);
+    memset(spec, 0, sizeof(*spec));
+}
+
 void phase_correlate_cleanup(void) {
     /* Resources are automatically freed when threads exit via pthread_key destructor.
      * This just cleans up FFTW global state. */
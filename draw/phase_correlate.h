@@ -48,6 +48,17 @@
  *     - Uses fftw_plan_lock mutex during plan creation
  *     - Plans are reused after creation (no per-call overhead)
  *
+ *   Saved wisdom:
+ *     - FFTW_MEASURE benchmarks candidate algorithms, tens of ms on
+ *       the first scroll check of each worker (nothing at startup;
+ *       plans are made on first use)
+ *     - The first plans import the system wisdom and the file
+ *       $P9WL_FFTW_WISDOM (default $XDG_CACHE_HOME/FFT_WISDOM_FILE,
+ *       or ~/.cache/); with wisdom for FFT_SIZE, planning is a lookup
+ *     - Without a usable file, the wisdom measured by the first
+ *       thread is written there (via a temporary and rename());
+ *       P9WL_FFTW_WISDOM="" disables both
+ *
  * Thread-Local Resources:
  *
  *   Each thread allocates via get_thread_resources():
@@ -61,6 +72,26 @@
  *
  *   Total per-thread allocation: ~1.5 MB for FFT_SIZE=256
  *
+ * Spectrum Cache:
+ *
+ *   The current frame's spectrum of a region is exactly the previous
+ *   spectrum of the next frame, as long as prev_framebuf ends up
+ *   holding what was in curr_buf. phase_correlate_detect_cached()
+ *   keeps the current spectrum in a caller-owned struct
+ *   phase_spectrum (saved during the cross-power pass, no extra
+ *   copy) and, when the caller says it still describes prev_buf,
+ *   uses it instead of windowing and transforming prev_buf. A frame
+ *   then costs one forward and one inverse transform instead of two
+ *   forward and one inverse. Invalidation is the caller's job (see
+ *   scroll.c): the cache knows only the region it was computed for.
+ *
+ * SIMD Kernels:
+ *
+ *   The row windowing (grayscale × Hann weights) and the normalized
+ *   cross-power loop have AVX2 / SSE2 / NEON versions, picked once
+ *   at runtime like tilecmp.c. Column weights are looked up once per
+ *   region rather than per pixel.
+ *
  * Accuracy vs Speed:
  *
  *   FFT_SIZE determines the accuracy/speed tradeoff:
@@ -80,7 +111,8 @@
  *   - Only detects pure translation (no rotation, scaling, or shear)
  *   - Region must be at least 16x16 pixels
  *   - Maximum detectable shift is limited by max_shift parameter
- *   - Requires pixel-accurate alignment (fails with fractional scaling)
+ *   - Finds whole-pixel shifts only; a fractional shift (fractional
+ *     output scale) gives the nearest whole peak, or a weak one
  *   - Content must have sufficient texture for correlation
  */
 
@@ -101,6 +133,9 @@
  */
 #define FFT_SIZE 256
 
+/* Saved FFTW wisdom, under the user's cache directory (see above) */
+#define FFT_WISDOM_FILE "p9wl-fftw-wisdom"
+
 /*
  * Maximum detectable scroll distance.
  *
@@ -126,6 +161,8 @@
  * valid: non-zero if detection succeeded
  *        0 if region was too small or resources unavailable
  *
+ * cached: non-zero if the previous spectrum came from the cache
+ *
  * Note: The shift describes how content moved, not the scroll direction.
  * To scroll content back, apply the inverse: copy from (x-dx, y-dy).
  */
@@ -133,6 +170,24 @@ struct phase_result {
     int dx;
     int dy;
     int valid;
+    int cached;
+};
+
+/*
+ * Cached forward spectrum of one region (see Spectrum Cache).
+ *
+ * data:  (FFT_SIZE/2 + 1) × FFT_SIZE fftwf_complex bins, allocated on
+ *        first use, NULL until then
+ * rx1..: region the spectrum was computed for
+ * valid: data holds a spectrum; clear it to stop the next call from
+ *        using it as the previous frame
+ *
+ * Zero-initialize before first use; release with phase_spectrum_free().
+ */
+struct phase_spectrum {
+    void *data;
+    int rx1, ry1, rx2, ry2;
+    int valid;
 };
 
 /* ============== API Functions ============== */
@@ -174,6 +229,25 @@ struct phase_result phase_correlate_detect(
     int max_shift
 );
 
+/*
+ * phase_correlate_detect() with a spectrum cache.
+ *
+ * If spec is valid for the same region, it is used as the spectrum of
+ * prev_buf (prev_buf is not read). Either way, on return spec holds
+ * the spectrum of curr_buf's region and is valid, unless its storage
+ * could not be allocated. spec may be NULL (no caching).
+ *
+ * Thread-safe across distinct spec structs.
+ */
+struct phase_result phase_correlate_detect_cached(
+    uint32_t *curr_buf, uint32_t *prev_buf, int buf_width,
+    int rx1, int ry1, int rx2, int ry2,
+    int max_shift, struct phase_spectrum *spec
+);
+
+/* Release a cached spectrum and zero the struct. */
+void phase_spectrum_free(struct phase_spectrum *spec);
+
 /*
  * Free global FFT resources.
  *
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <stdatomic.h>
 #include <wlr/util/log.h>
 
 #include "scroll.h"
@@ -13,19 +14,40 @@
 #include "compress.h"
 #include "parallel.h"
 #include "phase_correlate.h"
+#include "tilecmp.h"
+#include "timeline.h"
 #include "draw/draw_helpers.h"
 #include "types.h"
 #include "p9/p9.h"
 #include "draw/draw.h"
 
-static struct scroll_timing timing;
-
 struct scroll_ctx {
     struct server *s;
     uint32_t *send_buf;
 };
 
-static struct scroll_ctx current_ctx;
+/*
+ * Per-region spectra of the last analyzed frame (see phase_correlate.h,
+ * Spectrum Cache).  PENDING: they describe the send buffer of the frame
+ * in progress; VALID: that frame went out exactly, so they describe
+ * prev_framebuf.  Anything else that rewrites prev_framebuf drops back
+ * to NONE.  Owned by the send thread; workers only touch their own
+ * region's spectrum.
+ */
+enum { SPECTRA_NONE, SPECTRA_PENDING, SPECTRA_VALID };
+
+struct scroll_spectra {
+    struct phase_spectrum region[MAX_SCROLL_REGIONS];
+    int width, height;      /* Frame size the spectra belong to */
+    int state;
+    int use_prev;           /* This frame reads them as prev_framebuf */
+    atomic_int hits;        /* Regions that reused a spectrum, this frame */
+    atomic_int rowhash;     /* Regions decided by row hashes, this frame */
+};
+
+/* Damage-guided candidates: dirty tiles per frame, block edge in tiles */
+#define SCROLL_MIN_DIRTY_TILES  16
+#define SCROLL_MIN_BLOCK        4
 
 static inline double get_time_us(void) {
     struct timespec ts;
@@ -33,9 +55,208 @@ static inline double get_time_us(void) {
     return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
 }
 
+/* ============== Row-Hash Detection ============== */
+
+/*
+ * Vertical scrolls dominate (terminals, editors, browsers), and for
+ * those whole rows of the region reappear unchanged dy pixels away.
+ * Hashing each row segment of both frames and matching hashes finds
+ * dy in O(rows) without an FFT:
+ *
+ *   - rows whose hash occurs more than once in prev (blank lines,
+ *     uniform backgrounds) are ambiguous and do not vote
+ *   - every other current row found in prev votes for y - y_prev
+ *   - the winner must hold a clear majority of the votes
+ *
+ * Horizontal or 2D motion changes every row and leaves no votes;
+ * those regions (and split decisions) fall through to the FFT.
+ */
+#define ROWHASH_MAX_ROWS    1024    /* Taller regions go straight to FFT */
+#define ROWHASH_MIN_VOTES   8       /* Distinct rows needed for a decision */
+#define ROWHASH_TABLE_BITS  11      /* 2 × ROWHASH_MAX_ROWS slots */
+
+enum { ROWHASH_UNDECIDED, ROWHASH_STATIC, ROWHASH_SCROLL };
+
+struct rowhash_slot {
+    uint64_t hash;          /* 0 = empty (tilecmp_hash never returns 0) */
+    int row;                /* First row with this hash */
+    int count;
+};
+
+static int rowhash_detect(const uint32_t *curr, const uint32_t *prev, int stride,
+                          int rx1, int ry1, int rx2, int ry2, int max_shift,
+                          int *dy_out) {
+    int rw = rx2 - rx1, rh = ry2 - ry1;
+    if (rh <= 0 || rw <= 0 || rh > ROWHASH_MAX_ROWS) return ROWHASH_UNDECIDED;
+
+    struct rowhash_slot table[1 << ROWHASH_TABLE_BITS];
+    int votes[ROWHASH_MAX_ROWS + 1];
+    const unsigned mask = (1u << ROWHASH_TABLE_BITS) - 1;
+
+    memset(table, 0, sizeof(table));
+    for (int i = 0; i < rh; i++) {
+        uint64_t h = tilecmp_hash(prev, stride, rx1, ry1 + i, rw, 1);
+        unsigned k = (unsigned)(h >> 32) & mask;
+        while (table[k].hash && table[k].hash != h) k = (k + 1) & mask;
+        if (!table[k].hash) {
+            table[k].hash = h;
+            table[k].row = i;
+        }
+        table[k].count++;
+    }
+
+    /* votes[] is indexed by dy + max_shift */
+    if (max_shift > ROWHASH_MAX_ROWS / 2) max_shift = ROWHASH_MAX_ROWS / 2;
+    memset(votes, 0, (2 * max_shift + 1) * sizeof(int));
+
+    int voters = 0;
+    for (int i = 0; i < rh; i++) {
+        uint64_t h = tilecmp_hash(curr, stride, rx1, ry1 + i, rw, 1);
+        unsigned k = (unsigned)(h >> 32) & mask;
+        while (table[k].hash && table[k].hash != h) k = (k + 1) & mask;
+        if (!table[k].hash || table[k].count != 1) continue;
+        int dy = i - table[k].row;
+        if (dy < -max_shift || dy > max_shift) continue;
+        votes[dy + max_shift]++;
+        voters++;
+    }
+
+    if (voters < ROWHASH_MIN_VOTES) return ROWHASH_UNDECIDED;
+
+    int best = 0, best_votes = -1, second = 0;
+    for (int d = 0; d <= 2 * max_shift; d++) {
+        if (votes[d] > best_votes) {
+            second = best_votes < 0 ? 0 : best_votes;
+            best_votes = votes[d];
+            best = d - max_shift;
+        } else if (votes[d] > second) {
+            second = votes[d];
+        }
+    }
+
+    /* Clear majority, and no near-tie (two panes moving differently) */
+    if (best_votes * 2 <= voters || second * 2 > best_votes)
+        return ROWHASH_UNDECIDED;
+
+    *dy_out = best;
+    return best == 0 ? ROWHASH_STATIC : ROWHASH_SCROLL;
+}
+
+/* ============== Trial Reuse ============== */
+
+/*
+ * Verification compresses each changed tile of a region under both
+ * hypotheses. The results are kept (two slots per tile, stamped with
+ * the frame's seq) and the region records which hypothesis won, so
+ * the send thread can take a tile's compression instead of redoing
+ * it (scroll_trial_take).  Slots only hold payloads that compressed:
+ * compress_tile_data() never returns 3/4 of the raw size or more.
+ */
+enum { SCROLL_HYP_NONE, SCROLL_HYP_SCROLL };
+
+struct scroll_trial {
+    uint32_t seq;           /* trials->seq when stored, 0 = never */
+    int16_t size;           /* Payload size, 0 = did not compress */
+    uint8_t is_delta;
+    uint8_t trials;
+    uint8_t delta;          /* A reference was available */
+    uint8_t data[TILE_SIZE * TILE_SIZE * 3];
+};
+
+struct scroll_trials {
+    struct scroll_trial *slot;  /* [tile * 2 + SCROLL_HYP_*] */
+    uint8_t *chosen;            /* Winning hypothesis per tile */
+    int ntiles;
+    uint32_t seq;               /* Bumped by every detect_scroll() */
+    int effort;                 /* Of the frame being analyzed */
+};
+
+/* Per-window detection state (see scroll.h, "Lifecycle") */
+struct scroll_state {
+    struct scroll_timing timing;
+    struct scroll_ctx ctx;
+    struct scroll_spectra spectra;
+    int region_cell[MAX_SCROLL_REGIONS];    /* Grid cell of each analyzed region */
+    struct scroll_trials trials;
+};
+
+static void trials_ensure(const struct server *s) {
+    struct scroll_trials *trials = &s->scroll->trials;
+    int ntiles = s->tiles_x * s->tiles_y;
+    if (trials->slot && trials->ntiles == ntiles) return;
+    
+    free(trials->slot);
+    free(trials->chosen);
+    trials->ntiles = 0;
+    /* calloc: slots of tiles that are never verified stay untouched */
+    trials->slot = ntiles > 0 ? calloc((size_t)ntiles * 2, sizeof(*trials->slot)) : NULL;
+    trials->chosen = ntiles > 0 ? calloc(ntiles, 1) : NULL;
+    if (!trials->slot || !trials->chosen) {
+        free(trials->slot);
+        free(trials->chosen);
+        trials->slot = NULL;
+        trials->chosen = NULL;
+        return;
+    }
+    trials->ntiles = ntiles;
+}
+
+/*
+ * Compress one full tile for hypothesis hyp, keep the result, and
+ * return its cost in bytes (raw size if it does not compress).
+ */
+static int trial_compress(struct scroll_trials *trials, int idx, int hyp, uint32_t *pixels, int stride,
+                          uint32_t *prev, int prev_stride, int x1, int y1) {
+    struct tile_work w = {
+        .pixels = pixels + y1 * stride + x1, .stride = stride,
+        .prev_pixels = prev ? prev + y1 * prev_stride + x1 : NULL,
+        .prev_stride = prev_stride,
+        .x1 = x1, .y1 = y1, .w = TILE_SIZE, .h = TILE_SIZE,
+        .hint = COMPRESS_PATH_ANY, .verify = 1, .effort = trials->effort
+    };
+    _Alignas(ARENA_ALIGN) uint8_t payload[TILE_RESULT_MAX];
+    struct arena out;
+    arena_init_static(&out, payload, sizeof(payload));
+    w.out = &out;
+    struct tile_result r;
+    compress_tile_work(&w, &r);
+    
+    if (trials->slot && r.size < (int)sizeof(trials->slot[0].data)) {
+        struct scroll_trial *t = &trials->slot[idx * 2 + hyp];
+        t->size = (int16_t)r.size;
+        t->is_delta = (uint8_t)r.is_delta;
+        t->trials = r.trials;
+        t->delta = prev != NULL;
+        memcpy(t->data, r.data, r.size);
+        t->seq = trials->seq;
+    }
+    return r.size > 0 ? r.size : TILE_SIZE * TILE_SIZE * 4;
+}
+
+int scroll_trial_take(struct server *s, int tx, int ty, int delta_allowed,
+                      struct tile_result *r) {
+    struct scroll_trials *trials = &s->scroll->trials;
+    int idx = ty * s->tiles_x + tx;
+    if (!trials->slot || idx < 0 || idx >= trials->ntiles) return 0;
+    
+    struct scroll_trial *t = &trials->slot[idx * 2 + trials->chosen[idx]];
+    if (t->seq != trials->seq || t->delta != (delta_allowed != 0)) return 0;
+    
+    /* The slot stays put until the next detect_scroll(), after this
+     * frame is sent */
+    r->data = t->size > 0 ? t->data : NULL;
+    r->size = t->size;
+    r->is_delta = t->is_delta;
+    r->predicted = COMPRESS_PATH_ANY;
+    r->trials = t->trials;
+    return 1;
+}
+
 static void detect_region_scroll(void *ctx, int reg_idx) {
     struct scroll_ctx *sc = ctx;
     struct server *s = sc->s;
+    struct scroll_spectra *spectra = &s->scroll->spectra;
+    struct scroll_trials *trials = &s->scroll->trials;
     uint32_t *send_buf = sc->send_buf;
     uint32_t *prev_buf = s->prev_framebuf;
     int width = s->width;
@@ -53,18 +274,40 @@ static void detect_region_scroll(void *ctx, int reg_idx) {
     int max_scroll_y = (ry2 - ry1) / 2;
     int max_scroll = max_scroll_x < max_scroll_y ? max_scroll_x : max_scroll_y;
     
-    struct phase_result result = phase_correlate_detect(
-        send_buf, prev_buf, width, rx1, ry1, rx2, ry2, max_scroll);
+    struct phase_spectrum *spec = &spectra->region[s->scroll->region_cell[reg_idx]];
+    if (!spectra->use_prev) spec->valid = 0;
+    
+    int dx = 0, dy = 0;
+    const char *method = "FFT";
+    uint64_t t0 = timeline_now();
+    int rh = rowhash_detect(send_buf, prev_buf, width, rx1, ry1, rx2, ry2,
+                            max_scroll_y, &dy);
+    timeline_span("rowhash", t0);
+    if (rh != ROWHASH_UNDECIDED) {
+        /* The FFT is skipped, so this cell has no spectrum of send_buf */
+        spec->valid = 0;
+        atomic_fetch_add(&spectra->rowhash, 1);
+        if (rh == ROWHASH_STATIC) return;
+        method = "row hash";
+    } else {
+        t0 = timeline_now();
+        struct phase_result result = phase_correlate_detect_cached(
+            send_buf, prev_buf, width, rx1, ry1, rx2, ry2, max_scroll, spec);
+        timeline_span("fft", t0);
+        if (result.cached) atomic_fetch_add(&spectra->hits, 1);
+        dx = result.dx;
+        dy = result.dy;
+    }
     
-    if (result.dx == 0 && result.dy == 0) return;
+    if (dx == 0 && dy == 0) return;
     
-    int dx = result.dx, dy = result.dy;
     int abs_dx = dx < 0 ? -dx : dx;
     int abs_dy = dy < 0 ? -dy : dy;
     
     if (abs_dx >= max_scroll_x || abs_dy >= max_scroll_y) return;
     
-    wlr_log(WLR_INFO, "Region %d: FFT detected scroll dx=%d dy=%d", reg_idx, dx, dy);
+    wlr_log(WLR_INFO, "Region %d: %s detected scroll dx=%d dy=%d",
+            reg_idx, method, dx, dy);
     
     struct scroll_rects rects;
     compute_scroll_rects(rx1, ry1, rx2, ry2, dx, dy, &rects);
@@ -72,7 +315,6 @@ static void detect_region_scroll(void *ctx, int reg_idx) {
     
     int bytes_no_scroll = 0, bytes_with_scroll = 0;
     int tiles_identical_no = 0, tiles_identical_with = 0;
-    uint8_t comp_buf[TILE_SIZE * TILE_SIZE * 4 + 256];
     
     int tx1 = rx1 / TILE_SIZE, ty1 = ry1 / TILE_SIZE;
     int tx2 = rx2 / TILE_SIZE, ty2 = ry2 / TILE_SIZE;
@@ -82,17 +324,15 @@ static void detect_region_scroll(void *ctx, int reg_idx) {
             int x1, y1, w, h;
             tile_bounds(tx, ty, s->width, s->height, &x1, &y1, &w, &h);
             if (w != TILE_SIZE || h != TILE_SIZE) continue;
+            int idx = ty * s->tiles_x + tx;
             
             /* Check without scroll */
-            if (!tile_changed(send_buf, prev_buf, width, x1, y1, w, h)) {
+            if (!tilecmp_tile(send_buf, prev_buf, width, x1, y1, w, h)) {
                 tiles_identical_no++;
             } else {
-                int size = compress_tile_adaptive(comp_buf, sizeof(comp_buf),
-                                                   send_buf, width, prev_buf, width,
-                                                   x1, y1, w, h);
-                if (size < 0) size = -size;
-                if (size == 0) size = w * h * 4;
-                bytes_no_scroll += size;
+                bytes_no_scroll += trial_compress(trials, idx, SCROLL_HYP_NONE,
+                                                  send_buf, width, prev_buf, width,
+                                                  x1, y1);
             }
             
             /* Check with scroll */
@@ -125,39 +365,28 @@ static void detect_region_scroll(void *ctx, int reg_idx) {
                         memcpy(&shifted[row * TILE_SIZE],
                                &prev_buf[(src_y1 + row) * width + src_x1], w * 4);
                     
-                    int size = compress_tile_adaptive(comp_buf, sizeof(comp_buf),
-                                                       curr_tile, TILE_SIZE,
-                                                       shifted, TILE_SIZE,
-                                                       0, 0, w, h);
-                    if (size < 0) size = -size;
-                    if (size == 0) size = w * h * 4;
-                    bytes_with_scroll += size;
+                    /* shifted[] is what prev_framebuf holds here after
+                     * apply_scroll_to_prevbuf() */
+                    bytes_with_scroll += trial_compress(trials, idx, SCROLL_HYP_SCROLL,
+                                                        curr_tile, TILE_SIZE,
+                                                        shifted, TILE_SIZE, 0, 0);
                 }
             } else {
-                uint32_t curr_tile[TILE_SIZE * TILE_SIZE];
-                uint32_t prev_tile[TILE_SIZE * TILE_SIZE];
-                
-                for (int row = 0; row < h; row++)
-                    memcpy(&curr_tile[row * TILE_SIZE],
-                           &send_buf[(y1 + row) * width + x1], w * 4);
-                
-                for (int row = 0; row < h; row++)
-                    memcpy(&prev_tile[row * TILE_SIZE],
-                           &prev_buf[(y1 + row) * width + x1], w * 4);
-                
-                int size = compress_tile_adaptive(comp_buf, sizeof(comp_buf),
-                                                   curr_tile, TILE_SIZE,
-                                                   prev_tile, TILE_SIZE,
-                                                   0, 0, w, h);
-                if (size < 0) size = -size;
-                if (size == 0) size = w * h * 4;
-                bytes_with_scroll += size;
+                /* Exposed: marked invalid, so sent without delta */
+                bytes_with_scroll += trial_compress(trials, idx, SCROLL_HYP_SCROLL,
+                                                    send_buf, width, NULL, 0,
+                                                    x1, y1);
             }
         }
     }
     
+    int accept = bytes_no_scroll > 0 && bytes_with_scroll <= bytes_no_scroll;
+    for (int ty = ty1; ty < ty2 && trials->chosen; ty++)
+        memset(&trials->chosen[ty * s->tiles_x + tx1],
+               accept ? SCROLL_HYP_SCROLL : SCROLL_HYP_NONE, tx2 - tx1);
+    
     if (bytes_no_scroll == 0) return;
-    if (bytes_with_scroll > bytes_no_scroll) {
+    if (!accept) {
         wlr_log(WLR_INFO, "Region %d: REJECTED - scroll costs %d more bytes",
                 reg_idx, bytes_with_scroll - bytes_no_scroll);
         return;
@@ -172,14 +401,75 @@ static void detect_region_scroll(void *ctx, int reg_idx) {
     wlr_log(WLR_INFO, "Region %d: ACCEPTED - saves %d bytes (%d%%)", reg_idx, saved, pct);
 }
 
-void scroll_init(void) {
+int scroll_init(struct server *s) {
+    s->scroll = calloc(1, sizeof(*s->scroll));
+    return s->scroll ? 0 : -1;
 }
 
-void detect_scroll(struct server *s, uint32_t *send_buf) {
+/*
+ * Shrink a grid cell to the dirty block inside it.  Returns 0 if the
+ * cell holds no block worth correlating: fewer than SCROLL_MIN_BLOCK
+ * tiles on a side, or a bounding box less than half dirty (scattered
+ * small changes rather than moved content).
+ */
+static int cell_dirty_block(const struct server *s, const uint8_t *dirty,
+                            int *x1, int *y1, int *x2, int *y2) {
+    int tx1 = *x1 / TILE_SIZE, ty1 = *y1 / TILE_SIZE;
+    int tx2 = *x2 / TILE_SIZE, ty2 = *y2 / TILE_SIZE;
+    int bx1 = tx2, by1 = ty2, bx2 = tx1, by2 = ty1, n = 0;
+    
+    for (int ty = ty1; ty < ty2; ty++) {
+        const uint8_t *row = &dirty[ty * s->tiles_x];
+        for (int tx = tx1; tx < tx2; tx++) {
+            if (!row[tx]) continue;
+            n++;
+            if (tx < bx1) bx1 = tx;
+            if (tx >= bx2) bx2 = tx + 1;
+            if (ty < by1) by1 = ty;
+            if (ty >= by2) by2 = ty + 1;
+        }
+    }
+    if (bx2 - bx1 < SCROLL_MIN_BLOCK || by2 - by1 < SCROLL_MIN_BLOCK) return 0;
+    if (n * 2 < (bx2 - bx1) * (by2 - by1)) return 0;
+    
+    *x1 = bx1 * TILE_SIZE;
+    *y1 = by1 * TILE_SIZE;
+    *x2 = bx2 * TILE_SIZE;
+    *y2 = by2 * TILE_SIZE;
+    return 1;
+}
+
+void detect_scroll(struct server *s, uint32_t *send_buf, const uint8_t *dirty,
+                   int effort) {
     if (!send_buf || !s->prev_framebuf) return;
     
+    struct scroll_state *st = s->scroll;
+    struct scroll_timing *timing = &st->timing;
+    struct scroll_spectra *spectra = &st->spectra;
+    struct scroll_trials *trials = &st->trials;
     double t_start = get_time_us();
-    memset(&timing, 0, sizeof(timing));
+    memset(timing, 0, sizeof(*timing));
+    s->num_scroll_regions = 0;
+    
+    /* Trials of earlier frames no longer match; 0 marks empty slots */
+    if (++trials->seq == 0) trials->seq = 1;
+    trials_ensure(s);
+    trials->effort = effort;
+    
+    /* Small updates (carets, cursors, a few glyphs) are never scrolls */
+    int ntiles = s->tiles_x * s->tiles_y;
+    if (dirty) {
+        int n = 0;
+        for (int i = 0; i < ntiles && n < SCROLL_MIN_DIRTY_TILES; i++)
+            n += dirty[i] != 0;
+        if (n < SCROLL_MIN_DIRTY_TILES) {
+            timing->regions_skipped = 1;
+            for (int c = 0; c < MAX_SCROLL_REGIONS; c++)
+                spectra->region[c].valid = 0;
+            spectra->state = SPECTRA_PENDING;
+            return;
+        }
+    }
     
     int margin = TILE_SIZE;
     int cols = s->width / 256 > 0 ? s->width / 256 : 1;
@@ -192,13 +482,23 @@ void detect_scroll(struct server *s, uint32_t *send_buf) {
     
     s->scroll_regions_x = cols;
     s->scroll_regions_y = rows;
-    s->num_scroll_regions = 0;
     
     int max_x = (s->width / TILE_SIZE) * TILE_SIZE;
     int max_y = (s->height / TILE_SIZE) * TILE_SIZE;
     
+    /*
+     * Grid cells are the candidates; with a damage map, each cell is
+     * narrowed to its dirty block and skipped without one.  The cell
+     * index keys the spectrum cache, so a cell not analyzed this
+     * frame loses its spectrum.
+     */
     for (int ry = 0; ry < rows; ry++) {
         for (int rx = 0; rx < cols; rx++) {
+            int cell = ry * cols + rx;
+            if (cell >= MAX_SCROLL_REGIONS) break;
+            spectra->region[cell].valid &= spectra->width == s->width &&
+                                          spectra->height == s->height;
+            
             int x1 = (margin + rx * cell_w) / TILE_SIZE * TILE_SIZE;
             int y1 = (margin + ry * cell_h) / TILE_SIZE * TILE_SIZE;
             int x2 = (rx == cols - 1)
@@ -210,9 +510,15 @@ void detect_scroll(struct server *s, uint32_t *send_buf) {
             
             if (x2 > max_x) x2 = max_x;
             if (y2 > max_y) y2 = max_y;
-            if (x2 - x1 < 64 || y2 - y1 < 64) continue;
+            if (x2 - x1 < 64 || y2 - y1 < 64 ||
+                (dirty && !cell_dirty_block(s, dirty, &x1, &y1, &x2, &y2))) {
+                spectra->region[cell].valid = 0;
+                if (dirty) timing->regions_skipped++;
+                continue;
+            }
             
             int idx = s->num_scroll_regions++;
+            st->region_cell[idx] = cell;
             s->scroll_regions[idx].x1 = x1;
             s->scroll_regions[idx].y1 = y1;
             s->scroll_regions[idx].x2 = x2;
@@ -223,31 +529,46 @@ void detect_scroll(struct server *s, uint32_t *send_buf) {
         }
     }
     
+    /* Last frame's spectra stand in for prev_framebuf only if that
+     * frame was sent exactly and the geometry is unchanged */
+    spectra->use_prev = spectra->state == SPECTRA_VALID &&
+                       spectra->width == s->width && spectra->height == s->height;
+    spectra->width = s->width;
+    spectra->height = s->height;
+    atomic_store(&spectra->hits, 0);
+    atomic_store(&spectra->rowhash, 0);
+    
     if (s->num_scroll_regions > 0) {
-        current_ctx.s = s;
-        current_ctx.send_buf = send_buf;
-        parallel_for(s->num_scroll_regions, detect_region_scroll, &current_ctx);
+        st->ctx.s = s;
+        st->ctx.send_buf = send_buf;
+        parallel_for(s->num_scroll_regions, detect_region_scroll, &st->ctx);
     }
+    spectra->state = SPECTRA_PENDING;
     
     int detected_count = 0;
     for (int i = 0; i < s->num_scroll_regions; i++) {
         if (s->scroll_regions[i].detected) {
             detected_count++;
-            timing.regions_detected++;
+            timing->regions_detected++;
         }
     }
     
-    timing.total_us = get_time_us() - t_start;
-    timing.regions_processed = s->num_scroll_regions;
+    timing->total_us = get_time_us() - t_start;
+    timing->regions_processed = s->num_scroll_regions;
+    timing->regions_cached = atomic_load(&spectra->hits);
+    timing->regions_rowhash = atomic_load(&spectra->rowhash);
     
     if (detected_count > 0) {
-        wlr_log(WLR_INFO, "Scroll detected in %d/%d regions (%.1fus)",
-                detected_count, s->num_scroll_regions, timing.total_us);
+        wlr_log(WLR_INFO, "Scroll detected in %d/%d regions (%d by row hash, "
+                "%d cached spectra, %.1fus)",
+                detected_count, s->num_scroll_regions, timing->regions_rowhash,
+                timing->regions_cached, timing->total_us);
     }
 }
 
 int apply_scroll_to_prevbuf(struct server *s) {
     int scrolled_count = 0;
+    if (!s->prev_invalid) return 0;
     
     for (int i = 0; i < s->num_scroll_regions; i++) {
         if (!s->scroll_regions[i].detected) continue;
@@ -286,19 +607,19 @@ int apply_scroll_to_prevbuf(struct server *s) {
             }
         }
         
+        /* Exposed tiles have no reference; the send thread resends
+         * them without delta (see prev_invalid in types.h) */
+        int tx1 = rx1 / TILE_SIZE, tx2 = rx2 / TILE_SIZE;
+        int ty1 = ry1 / TILE_SIZE, ty2 = ry2 / TILE_SIZE;
+        uint8_t *inv = s->prev_invalid;
         if (r.exp_y2 > r.exp_y1) {
-            for (int y = r.exp_y1; y < r.exp_y2; y++) {
-                for (int x = rx1; x < rx2; x++) {
-                    s->prev_framebuf[y * s->width + x] = 0xDEADBEEF;
-                }
-            }
+            for (int ty = r.exp_y1 / TILE_SIZE; ty < r.exp_y2 / TILE_SIZE; ty++)
+                memset(&inv[ty * s->tiles_x + tx1], 1, tx2 - tx1);
         }
         if (r.exp_x2 > r.exp_x1) {
-            for (int y = ry1; y < ry2; y++) {
-                for (int x = r.exp_x1; x < r.exp_x2; x++) {
-                    s->prev_framebuf[y * s->width + x] = 0xDEADBEEF;
-                }
-            }
+            for (int ty = ty1; ty < ty2; ty++)
+                memset(&inv[ty * s->tiles_x + r.exp_x1 / TILE_SIZE], 1,
+                       (r.exp_x2 - r.exp_x1) / TILE_SIZE);
         }
         
         scrolled_count++;
@@ -344,11 +665,27 @@ int write_scroll_commands(struct server *s, uint8_t *batch, size_t max_size) {
     return off;
 }
 
-const struct scroll_timing *scroll_get_timing(void) {
-    return &timing;
+void scroll_frame_sent(struct server *s, int exact) {
+    struct scroll_spectra *spectra = &s->scroll->spectra;
+    spectra->state = (spectra->state == SPECTRA_PENDING && exact)
+        ? SPECTRA_VALID : SPECTRA_NONE;
+}
+
+void scroll_invalidate_spectra(struct server *s) {
+    s->scroll->spectra.state = SPECTRA_NONE;
+}
+
+const struct scroll_timing *scroll_get_timing(const struct server *s) {
+    return &s->scroll->timing;
 }
 
-void scroll_cleanup(void) {
-    parallel_cleanup();
-    phase_correlate_cleanup();
+void scroll_cleanup(struct server *s) {
+    struct scroll_state *st = s->scroll;
+    if (!st) return;
+    for (int i = 0; i < MAX_SCROLL_REGIONS; i++)
+        phase_spectrum_free(&st->spectra.region[i]);
+    free(st->trials.slot);
+    free(st->trials.chosen);
+    free(st);
+    s->scroll = NULL;
 }
@@ -14,7 +14,8 @@
  *           ├─► Divide frame into grid of regions
  *           │
  *           ├─► parallel_for() over regions
- *           │     └─► phase_correlate_detect() per region
+ *           │     └─► Row-hash match, else
+ *           │         phase_correlate_detect_cached() per region
  *           │     └─► Verify scroll benefit via compression test
  *           │
  *           └─► Store results in s->scroll_regions[]
@@ -22,7 +23,7 @@
  *     apply_scroll_to_prevbuf()
  *           │
  *           └─► Shift pixels in prev_framebuf to match scroll
- *               Mark exposed areas with 0xDEADBEEF
+ *               Mark exposed tiles in s->prev_invalid
  *
  *     write_scroll_commands()
  *           │
@@ -51,10 +52,46 @@
  *   vectors in different parts of the screen (e.g., two scrolling
  *   panes in a split-screen layout).
  *
+ * Damage-Guided Candidates:
+ *
+ *   A scroll re-renders the whole area that moved, so it shows up in
+ *   the frame's tile damage map as a large solid block. When the map
+ *   is available, detect_scroll() uses it to choose what to analyze:
+ *
+ *     - fewer than SCROLL_MIN_DIRTY_TILES (16) dirty tiles in the
+ *       frame: no detection at all (typing, carets, cursor blinks)
+ *     - per grid cell, the bounding box of its dirty tiles becomes
+ *       the region, if it is at least 4×4 tiles and at least half
+ *       dirty; other cells are skipped
+ *
+ *   Scattered small changes therefore never reach the FFT. Without a
+ *   damage map (first frame, allocation failure) every cell is
+ *   analyzed whole, as before. Cells stay the keys of the spectrum
+ *   cache, so a steadily scrolling pane reuses its spectrum.
+ *
+ * Row-Hash Fast Path:
+ *
+ *   Most scrolls are purely vertical, and then whole row segments of
+ *   the region reappear unchanged dy pixels away. Before the FFT, each
+ *   region's rows are hashed in both frames (tilecmp_hash, one row at
+ *   a time); every current row whose hash occurs exactly once in the
+ *   previous region votes for its displacement:
+ *
+ *     - winner dy != 0 with a clear majority: scroll (0, dy), no FFT
+ *     - winner dy == 0 with a clear majority: no scroll, no FFT
+ *     - fewer than 8 votes, no majority, or a close runner-up: FFT
+ *
+ *   Repeated rows (blank lines, flat backgrounds) never vote, so they
+ *   cannot produce a false match; horizontal and 2D motion change
+ *   every row and leave too few votes. A region decided by row hashes
+ *   has no fresh spectrum, so its cell's cached spectrum is dropped.
+ *   The compression verification below applies either way.
+ *
  * Phase Correlation:
  *
- *   For each region, phase_correlate_detect() computes the translation
- *   between the same region in current and previous frames:
+ *   For each region not decided by row hashes,
+ *   phase_correlate_detect_cached() computes the translation between
+ *   the same region in current and previous frames:
  *
  *     1. Extract region from both frames
  *     2. Apply Hann window to reduce edge effects
@@ -65,6 +102,17 @@
  *
  *   See phase_correlate.h for algorithm details.
  *
+ * Spectrum Reuse:
+ *
+ *   Each region's spectrum of send_buf is kept for the next frame,
+ *   where it stands in for the spectrum of prev_framebuf, so a region
+ *   costs one forward and one inverse FFT. The send thread reports
+ *   each frame's outcome with scroll_frame_sent(): the spectra are
+ *   only trusted if the frame was sent exactly (no lossy tiles left,
+ *   no background tiles held back, no write error), detection ran on
+ *   it, and the frame size is unchanged. prev_framebuf_poison() calls
+ *   scroll_invalidate_spectra().
+ *
  * Scroll Verification:
  *
  *   After detecting a scroll vector, the algorithm verifies it would
@@ -82,6 +130,21 @@
  *     - Scroll exists but content changed significantly
  *     - Compression artifacts make scroll not worthwhile
  *
+ *   Exposed tiles are costed without delta, as the send thread will
+ *   send them (their tiles are marked in s->prev_invalid).
+ *
+ * Trial Reuse:
+ *
+ *   Each trial is the same compress_tile_work() call the send thread
+ *   would make for that tile under that hypothesis, so the results
+ *   are kept per tile and hypothesis, and each verified region records
+ *   the one that won. While building its work list, the send thread
+ *   asks scroll_trial_take() for every changed tile; a tile with a
+ *   matching trial is not compressed again. A trial only matches in
+ *   the frame that produced it, on content that was not quantized by
+ *   pacing, and when the send thread's delta decision for the tile is
+ *   the one the trial assumed.
+ *
  * Scroll Rectangles:
  *
  *   compute_scroll_rects() (in draw_helpers.h) computes:
@@ -107,13 +170,15 @@
  *   scroll that will be applied server-side:
  *
  *     1. Shift pixels within prev_framebuf (using memmove)
- *     2. Mark exposed regions with 0xDEADBEEF marker
+ *     2. Mark exposed tiles in the per-tile s->prev_invalid map
  *
  *   This allows tile change detection to compare against the post-scroll
  *   state, enabling efficient delta encoding for the non-scrolled tiles.
  *
- *   The 0xDEADBEEF marker tells the tile encoder to skip delta encoding
- *   for those tiles (no valid reference exists).
+ *   The send thread resends every invalid tile, whatever its pixels,
+ *   and never delta-encodes it (no valid reference exists). A map
+ *   rather than a sentinel pixel value means real content can never
+ *   be mistaken for an exposed area, and nothing scans tile borders.
  *
  * Draw Commands:
  *
@@ -127,11 +192,27 @@
  * Scroll Disabling:
  *
  *   Scroll detection is disabled when:
- *     - s->scale has a fractional component (non-integer scaling)
  *     - s->prev_framebuf is NULL (first frame)
  *     - force_full_frame is set
  *
- *   Non-integer scaling breaks pixel-accurate phase correlation.
+ * Fractional Scales:
+ *
+ *   Detection and the prev_framebuf shift work in physical pixels at
+ *   every scale. At a fractional scale (e.g. 1.5) a logical scroll of
+ *   n pixels moves content by n × scale physical pixels:
+ *
+ *     - a whole number (n = 2 → 3 px): rows are resampled at the same
+ *       phase and match exactly, so the row-hash path finds the shift
+ *     - a fraction (n = 1 → 1.5 px): no row matches exactly; the FFT
+ *       peak gives the nearest whole shift and the shifted tiles are
+ *       close but not identical
+ *
+ *   Only whole shifts are ever applied. The cost verification above
+ *   measures the actual bytes both ways, so a rounded shift is kept
+ *   only when the XOR deltas against the shifted reference beat
+ *   sending the region unshifted. Correctness never depends on the
+ *   match being exact: every tile is still compared with the shifted
+ *   prev_framebuf.
  *
  * Timing Statistics:
  *
@@ -139,6 +220,10 @@
  *     - total_us: Total time for detect_scroll()
  *     - regions_processed: Number of regions analyzed
  *     - regions_detected: Number with detected scroll
+ *     - regions_cached: Number that reused last frame's spectrum
+ *     - regions_rowhash: Number decided by row hashes (no FFT)
+ *     - regions_skipped: Cells passed over for lack of damage (1 when
+ *       the whole frame was too small to analyze)
  *
  * Thread Safety:
  *
@@ -159,6 +244,7 @@
 
 /* Forward declarations */
 struct server;
+struct tile_result;
 
 /* ============== Constants ============== */
 
@@ -175,8 +261,10 @@ struct server;
  * the previous frame.
  *
  * Processing steps:
- *   1. Compute region grid based on frame dimensions
- *   2. For each region (in parallel):
+ *   1. Skip everything if the damage map shows only a small update
+ *   2. Compute region grid based on frame dimensions; with a damage
+ *      map, narrow each cell to its dirty block or skip it
+ *   3. For each region (in parallel):
  *      a. Run phase correlation to detect (dx, dy)
  *      b. Skip if dx=0 and dy=0
  *      c. Verify scroll benefit via compression cost comparison
@@ -190,12 +278,17 @@ struct server;
  *
  * s:        server state with prev_framebuf populated
  * send_buf: current frame pixel buffer (XRGB32)
+ * dirty:    tile damage map of send_buf (s->tiles_x × s->tiles_y),
+ *           NULL to analyze the whole grid
+ * effort:   the frame's COMPRESS_EFFORT_*, for the verification
+ *           trials (their results stand in for the tiles' own)
  *
  * Preconditions:
  *   - s->prev_framebuf must be valid and same size as send_buf
  *   - s->width, s->height must be set
  */
-void detect_scroll(struct server *s, uint32_t *send_buf);
+void detect_scroll(struct server *s, uint32_t *send_buf, const uint8_t *dirty,
+                   int effort);
 
 /*
  * Apply detected scroll to prev_framebuf.
@@ -205,11 +298,11 @@ void detect_scroll(struct server *s, uint32_t *send_buf);
  * on the server:
  *
  *   1. Shift pixels within prev_framebuf (memmove for overlap safety)
- *   2. Mark exposed areas with 0xDEADBEEF sentinel value
+ *   2. Mark exposed tiles in s->prev_invalid
  *
- * The 0xDEADBEEF marker indicates pixels that have no valid reference
- * for delta encoding. The tile encoder checks for this marker and
- * disables delta encoding for affected tiles.
+ * Invalid tiles have no valid reference for delta encoding; the send
+ * thread resends them without delta and clears their bits. Does
+ * nothing (returns 0) without an invalid map.
  *
  * Must be called AFTER detect_scroll() and BEFORE tile change detection.
  * This ensures tiles are compared against the post-scroll state.
@@ -245,6 +338,42 @@ int apply_scroll_to_prevbuf(struct server *s);
  */
 int write_scroll_commands(struct server *s, uint8_t *batch, size_t max_size);
 
+/*
+ * Report that the frame analyzed by the last detect_scroll() is done.
+ *
+ * exact: prev_framebuf now equals that frame's send buffer (every
+ *        changed tile sent losslessly, none held back by the
+ *        focus priority, no write error)
+ *
+ * Call once per frame, after the tiles have been written, whether or
+ * not detect_scroll() ran; without detection the spectra are dropped.
+ */
+void scroll_frame_sent(struct server *s, int exact);
+
+/*
+ * Forget the cached spectra (prev_framebuf was rewritten outside the
+ * normal frame path).
+ */
+void scroll_invalidate_spectra(struct server *s);
+
+/*
+ * Take the verification trial for a tile of the current frame.
+ *
+ * tx, ty:        tile coordinates in s's grid
+ * delta_allowed: the send thread would compress the tile against
+ *                prev_framebuf (after apply_scroll_to_prevbuf())
+ * r:             filled with the trial's payload, size and is_delta;
+ *                predicted is COMPRESS_PATH_ANY. data points into the
+ *                trial slot, valid until the next detect_scroll()
+ *
+ * Returns 1 if this frame's detect_scroll() compressed the tile under
+ * the hypothesis its region chose and with the same delta decision,
+ * 0 otherwise (compress the tile as usual). The caller must not have
+ * modified the tile's pixels since detect_scroll().
+ */
+int scroll_trial_take(struct server *s, int tx, int ty, int delta_allowed,
+                      struct tile_result *r);
+
 /* ============== Timing Statistics ============== */
 
 /*
@@ -257,41 +386,43 @@ struct scroll_timing {
     double total_us;         /* Total time for detect_scroll() */
     int regions_processed;   /* Number of regions analyzed */
     int regions_detected;    /* Number of regions with detected scroll */
+    int regions_cached;      /* Regions whose previous spectrum was reused */
+    int regions_rowhash;     /* Regions decided without the FFT */
+    int regions_skipped;     /* Grid cells without a dirty block */
 };
 
 /*
  * Get timing statistics from the last detect_scroll() call.
  *
- * Returns pointer to internal static struct. Valid until the next
- * detect_scroll() call. Do not free the returned pointer.
+ * Returns a pointer into s->scroll. Valid until the next
+ * detect_scroll() call on s. Do not free the returned pointer.
  *
  * Before detect_scroll() has been called, returns a pointer to a
  * zeroed struct (all fields are 0).
  */
-const struct scroll_timing *scroll_get_timing(void);
+const struct scroll_timing *scroll_get_timing(const struct server *s);
 
 /* ============== Lifecycle ============== */
 
 /*
- * Initialize scroll detection resources.
+ * Allocate s->scroll: spectra, trial slots and timing of one window.
  *
- * Currently a no-op - resources are initialized lazily by
- * detect_scroll() and phase_correlate_detect().
+ * Every send pipeline analyzes its own frames, so nothing here is
+ * shared between windows; the region workers come from the shared
+ * pool (parallel.h) and the FFT plans are per thread
+ * (phase_correlate.h). Called by send_init().
  *
- * Provided for API symmetry with scroll_cleanup().
+ * Returns 0 on success, -1 on allocation failure.
  */
-void scroll_init(void);
+int scroll_init(struct server *s);
 
 /*
- * Cleanup scroll detection resources.
- *
- * Shuts down resources used by scroll detection:
- *   - Calls parallel_cleanup() to stop worker threads
- *   - Calls phase_correlate_cleanup() to free FFT resources
+ * Free s->scroll and the spectra it holds.
  *
- * Safe to call even if scroll_init() was never called.
- * Call at program exit for clean shutdown.
+ * The worker pool and FFT resources are process-wide and outlive any
+ * one window; they are not touched. Safe if scroll_init() was never
+ * called. Called by send_cleanup().
  */
-void scroll_cleanup(void);
+void scroll_cleanup(struct server *s);
 
 #endif /* SCROLL_H */
@@ -12,6 +12,53 @@
  * - Replaced full-frame memcpy in send_frame() with pointer swap
  * - Added damage-based dirty tile tracking to skip unchanged tiles
  *   without pixel scanning (falls back to tile_changed on scroll/errors)
+ * - SIMD tile compare kernels (tilecmp.c) with per-tile-row scans
+ * - Per-tile content hashes so change detection skips prev_framebuf
+ * - Server-side tile cache: repeated tiles become image-to-image copies
+ * - Solid-color tile rectangles drawn as fills from a color palette
+ * - Adjacent changed tiles coalesced into larger loads (coalesce.c)
+ * - Streaming compression: batches are written band by band while
+ *   workers are still compressing the rest of the frame
+ * - Drain thread replaced by the draw connection's 9P tag reader;
+ *   Rwrite replies arrive through drain_complete()
+ * - Batches are queued (p9_write_queue) and written together when
+ *   the send thread would otherwise wait
+ * - In-flight window sized from measured RTT and delivery rate
+ *   instead of a fixed pending limit
+ * - Link-bound frame pacing with lossy degradation of fast-changing
+ *   tiles under pressure and lossless refinement when idle
+ * - Damage of dropped and superseded frames accumulates (dirty_accum)
+ *   instead of being lost
+ * - Compression effort per frame (-E), automatic from link throughput
+ * - Encoding path predicted per tile (changed fraction, last winner),
+ *   so most tiles run LZ77 once
+ * - Scroll detection reuses last frame's region spectra (scroll.c)
+ *   and only analyzes dirty blocks of the damage map
+ * - Vertical scrolls found by row-hash matching; FFT only for 2D or
+ *   ambiguous motion
+ * - Tiles compressed while verifying a scroll are not compressed again
+ * - Scroll-exposed and lost tiles tracked in a per-tile invalid map
+ *   (prev_invalid) instead of sentinel pixels in prev_framebuf
+ * - Under pressure, damage from background toplevels waits behind the
+ *   focused app and popups (damage classes in the dirty map)
+ * - Scroll detection also at fractional scales (whole physical-pixel
+ *   shifts, kept only when verification shows a saving)
+ * - Window moves and reshapes re-present image_id instead of resending
+ *   every tile; after a resize only newly exposed tiles are invalid
+ * - Per-tile tables in one huge-page arena; compact tile_result with
+ *   payloads packed into a per-frame output arena
+ * - Optional tile-major framebuffers (-B): per-tile kernels read one
+ *   contiguous block
+ * - Stage latency histograms and counters for the metrics endpoint
+ * - Frame trace capture (-T) in send_frame() for offline replay by
+ *   p9wl-bench
+ * - Timeline spans (-J) tagged with the output frame number
+ * - Pipeline state per server (send_init) instead of file statics, so
+ *   each Plan 9 window (-w) runs a send thread of its own
+ * - Effort level carried per tile (tile_work.effort) instead of a
+ *   process-wide setting, so windows (-w) no longer override each other
+ * - First frame out calls s->first_frame, which brings up the kbd and
+ *   snarf sessions the startup path no longer waits for
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -28,203 +75,623 @@
 #include <wlr/util/log.h>
 
 #include "send.h"
+#include "arena.h"
+#include "metrics.h"
+#include "trace.h"
+#include "timeline.h"
 #include "compress.h"
 #include "scroll.h"
+#include "tilecmp.h"
+#include "tilecache.h"
+#include "coalesce.h"
+#include "parallel.h"
 #include "draw/draw.h"
 #include "draw_helpers.h"
 #include "p9/p9.h"
 #include "types.h"
 #include "input/input.h"
 
-/* ============== Drain Thread ============== */
+/* ============== Drain ============== */
+
+/*
+ * Rwrite accounting for pipelined batches.  The draw connection is
+ * tag-multiplexed (p9_mux_start); its reader thread — the "drain
+ * thread" — reports every batch's reply through drain_complete().
+ */
+/*
+ * In-flight window, in batches.  Sized from the measured bandwidth-
+ * delay product (see drain_estimate); INIT is used until the first
+ * samples arrive.  MAX stays well below P9_MAX_TAGS.
+ */
+#define DRAIN_WINDOW_MIN    2
+#define DRAIN_WINDOW_INIT   8
+#define DRAIN_WINDOW_MAX    32
+#define DRAIN_RTT_EPOCH_US  10000000    /* Min-RTT filter length */
+#define DRAIN_RATE_MIN_US   20000       /* Shortest rate sample */
+#define DRAIN_RATE_SAMPLES  8           /* Max-bandwidth filter length */
 
 struct drain_ctx {
     struct p9conn *p9;
     atomic_int pending;
     atomic_int errors;
-    atomic_int running;
-    atomic_int paused;
     atomic_int broken;      /* Stream desynced — stop all I/O */
-    pthread_t thread;
+    atomic_int window;      /* Allowed pending batches */
     pthread_mutex_t lock;
-    pthread_cond_t cond;        /* Wakes drain thread when work available */
     pthread_cond_t done_cond;   /* Signaled when pending decreases (for throttle/pause) */
-    uint8_t *recv_buf;
+    
+    /* Window estimator, under lock */
+    uint32_t srtt_us;
+    uint32_t min_rtt_us, min_rtt_prev_us;   /* Current / previous epoch */
+    uint64_t epoch_start_us;
+    uint64_t rate_start_us;                 /* Start of this rate sample */
+    uint64_t rate_bytes;
+    double bw[DRAIN_RATE_SAMPLES];          /* Bytes per µs */
+    int bw_idx;
+    double avg_batch;                       /* Bytes per batch (EWMA) */
 };
 
-static struct drain_ctx drain;
-
-/* Wake drain thread */
-static inline void drain_wake(void) {
-    pthread_mutex_lock(&drain.lock);
-    pthread_cond_signal(&drain.cond);
-    pthread_mutex_unlock(&drain.lock);
+/* Bottleneck bandwidth estimate in bytes/µs, 0 if unknown. Caller holds drain->lock. */
+static double drain_bw_locked(const struct drain_ctx *drain) {
+    double bw = 0;
+    for (int i = 0; i < DRAIN_RATE_SAMPLES; i++)
+        if (drain->bw[i] > bw) bw = drain->bw[i];
+    return bw;
 }
 
-/* Read one Rwrite response.
+/*
+ * Update the window from one completed batch.
  *
- * If the 9P stream desyncs (invalid message length), we set broken=1
- * and force pending to 0.  This immediately unblocks drain_pause and
- * prevents any further reads on the corrupted stream.  Without this,
- * a partial read leaves message body bytes in the socket buffer;
- * the next read interprets them as a message header, producing
- * garbage lengths and an unrecoverable error cascade.
+ * Bottleneck bandwidth is the max of recent delivery-rate samples,
+ * each taken over at least one min RTT of busy pipe; the path delay
+ * is the min RTT over the last one to two epochs.  The window is
+ * twice their product in batches, so it keeps the pipe full with
+ * room to grow: while the link is not saturated, a bigger window
+ * yields a higher rate sample and the window doubles again.
+ * Queueing delay raises srtt but not min RTT, so a saturated
+ * link does not inflate the window.  Caller holds drain->lock.
  */
-static int drain_recv_one(void) {
-    uint8_t *buf = drain.recv_buf;
-    struct p9conn *p9 = drain.p9;
+static void drain_estimate(struct drain_ctx *drain, int bytes, uint32_t rtt_us) {
+    uint64_t now = now_us();
     
-    if (atomic_load(&drain.broken)) return -1;
+    drain->srtt_us = drain->srtt_us ? (7 * drain->srtt_us + rtt_us) / 8 : rtt_us;
+    drain->avg_batch = drain->avg_batch > 0
+        ? 0.875 * drain->avg_batch + 0.125 * bytes : bytes;
     
-    if (p9_read_full(p9, buf, 4) != 4) {
-        wlr_log(WLR_ERROR, "drain: failed to read message header");
-        atomic_store(&drain.broken, 1);
-        return -1;
-    }
-    uint32_t rxlen = GET32(buf);
-    if (rxlen < 7 || rxlen > p9->msize) {
-        wlr_log(WLR_ERROR, "drain: stream desynced (invalid length %u), halting I/O", rxlen);
-        atomic_store(&drain.broken, 1);
-        return -1;
-    }
-    if (p9_read_full(p9, buf + 4, rxlen - 4) != (int)(rxlen - 4)) {
-        wlr_log(WLR_ERROR, "drain: truncated message, halting I/O");
-        atomic_store(&drain.broken, 1);
-        return -1;
+    if (now - drain->epoch_start_us > DRAIN_RTT_EPOCH_US) {
+        drain->min_rtt_prev_us = drain->min_rtt_us;
+        drain->min_rtt_us = 0;
+        drain->epoch_start_us = now;
     }
+    if (!drain->min_rtt_us || rtt_us < drain->min_rtt_us) drain->min_rtt_us = rtt_us;
+    uint32_t min_rtt = drain->min_rtt_us;
+    if (drain->min_rtt_prev_us && drain->min_rtt_prev_us < min_rtt)
+        min_rtt = drain->min_rtt_prev_us;
     
-    int type = buf[4];
-    if (type == Rerror) {
-        uint16_t elen = GET16(buf + 7);
-        char errmsg[256];
-        int copylen = (elen < 255) ? elen : 255;
-        memcpy(errmsg, buf + 9, copylen);
-        errmsg[copylen] = '\0';
-        wlr_log(WLR_ERROR, "9P drain error: %s", errmsg);
-        if (strstr(errmsg, "unknown id")) atomic_store(&p9->unknown_id_error, 1);
-        if (strstr(errmsg, "short")) atomic_store(&p9->draw_error, 1);
-        return -1;
-    }
+    drain->rate_bytes += bytes;
+    uint64_t span = now - drain->rate_start_us;
+    if (span < DRAIN_RATE_MIN_US || span < min_rtt) return;
+    drain->bw[drain->bw_idx] = (double)drain->rate_bytes / span;
+    drain->bw_idx = (drain->bw_idx + 1) % DRAIN_RATE_SAMPLES;
+    drain->rate_start_us = now;
+    drain->rate_bytes = 0;
     
-    return (type == Rwrite) ? (int)GET32(buf + 7) : -1;
+    double bw = drain_bw_locked(drain);
+    int w = (int)ceil(2.0 * bw * min_rtt / drain->avg_batch);
+    if (w < DRAIN_WINDOW_MIN) w = DRAIN_WINDOW_MIN;
+    if (w > DRAIN_WINDOW_MAX) w = DRAIN_WINDOW_MAX;
+    atomic_store(&drain->window, w);
 }
 
-static void *drain_thread_func(void *arg) {
+/* Reader thread start: pin like the old drain thread */
+static void drain_reader_init(void *arg) {
     (void)arg;
     wlr_log(WLR_INFO, "Drain thread started");
+    timeline_thread_name("drain");
+    parallel_pin_io_thread("Drain");
+}
+
+/*
+ * One batch's Rwrite arrived (result >= 0) or failed.  Rerror flags
+ * (unknown id, short) were already set on p9 by the reader.  If the
+ * stream desynced, the reader fails every outstanding batch and we
+ * mark the drain broken so nothing more is sent.
+ */
+static void drain_complete(void *arg, int result, uint32_t rtt_us) {
+    struct drain_ctx *drain = arg;
+    if (result < 0) {
+        metrics_add(METRIC_WRITE_ERRORS, 1);
+        atomic_fetch_add(&drain->errors, 1);
+        if (atomic_load(&drain->p9->mux.broken) && !atomic_exchange(&drain->broken, 1))
+            wlr_log(WLR_ERROR, "drain: stream broke, failing pending writes");
+    }
+    if (rtt_us > 0) {
+        metrics_observe(METRIC_RWRITE, rtt_us);
+        timeline_span_dur("rwrite", now_us() - rtt_us, rtt_us);
+    }
+    pthread_mutex_lock(&drain->lock);
+    if (result > 0 && rtt_us > 0) drain_estimate(drain, result, rtt_us);
+    atomic_fetch_sub(&drain->pending, 1);
+    pthread_cond_broadcast(&drain->done_cond);
+    pthread_mutex_unlock(&drain->lock);
+}
+
+static int drain_start(struct drain_ctx *drain, struct p9conn *p9) {
+    atomic_store(&drain->pending, 0);
+    atomic_store(&drain->errors, 0);
+    atomic_store(&drain->broken, 0);
+    atomic_store(&drain->window, DRAIN_WINDOW_INIT);
+    drain->srtt_us = drain->min_rtt_us = drain->min_rtt_prev_us = 0;
+    drain->epoch_start_us = drain->rate_start_us = now_us();
+    drain->rate_bytes = 0;
+    memset(drain->bw, 0, sizeof(drain->bw));
+    drain->bw_idx = 0;
+    drain->avg_batch = 0;
+    drain->p9 = p9;
+    pthread_mutex_init(&drain->lock, NULL);
+    pthread_cond_init(&drain->done_cond, NULL);
     
-    while (atomic_load(&drain.running)) {
-        pthread_mutex_lock(&drain.lock);
-        while (atomic_load(&drain.pending) == 0 && atomic_load(&drain.running)) {
-            pthread_cond_wait(&drain.cond, &drain.lock);
-        }
-        pthread_mutex_unlock(&drain.lock);
-        
-        if (!atomic_load(&drain.running)) break;
-        if (atomic_load(&drain.paused) && atomic_load(&drain.pending) == 0) continue;
-        
-        if (atomic_load(&drain.broken)) {
-            /* Stream is dead — flush all pending without reading */
-            int rem = atomic_exchange(&drain.pending, 0);
-            if (rem > 0) {
-                wlr_log(WLR_INFO, "drain: flushed %d pending (stream broken)", rem);
-                pthread_mutex_lock(&drain.lock);
-                pthread_cond_broadcast(&drain.done_cond);
-                pthread_mutex_unlock(&drain.lock);
-            }
-            continue;
-        }
-        
-        if (atomic_load(&drain.pending) > 0) {
-            if (drain_recv_one() < 0) atomic_fetch_add(&drain.errors, 1);
-            if (atomic_load(&drain.broken)) {
-                /* Just became broken — flush remaining pending */
-                int rem = atomic_exchange(&drain.pending, 0);
-                wlr_log(WLR_ERROR, "drain: stream broke, flushed %d remaining", rem);
-                pthread_mutex_lock(&drain.lock);
-                pthread_cond_broadcast(&drain.done_cond);
-                pthread_mutex_unlock(&drain.lock);
-            } else {
-                atomic_fetch_sub(&drain.pending, 1);
-                /* Wake drain_throttle / drain_pause */
-                pthread_mutex_lock(&drain.lock);
-                pthread_cond_broadcast(&drain.done_cond);
-                pthread_mutex_unlock(&drain.lock);
-            }
-        }
+    struct p9mux_hooks hooks = {
+        .reader_init = drain_reader_init,
+        .write_done = drain_complete,
+        .arg = drain,
+    };
+    return p9_mux_start(p9, &hooks);
+}
+
+/* Wait until every sent batch has been answered */
+static void drain_pause(struct drain_ctx *drain) {
+    p9_flush(drain->p9);     /* Queued batches cannot be answered */
+    pthread_mutex_lock(&drain->lock);
+    while (atomic_load(&drain->pending) > 0 && !atomic_load(&drain->broken)) {
+        pthread_cond_wait(&drain->done_cond, &drain->lock);
     }
+    pthread_mutex_unlock(&drain->lock);
+}
+
+/* The reader outlives the send thread (until p9_disconnect) */
+static void drain_stop(struct drain_ctx *drain) {
+    drain_pause(drain);
+    pthread_mutex_destroy(&drain->lock);
+    pthread_cond_destroy(&drain->done_cond);
+}
+
+/* Count a batch before sending it: its reply may arrive first */
+static int drain_notify(struct drain_ctx *drain) {
+    if (atomic_load(&drain->broken)) return 0;
+    if (atomic_fetch_add(&drain->pending, 1) == 0) {
+        /* Pipe was idle: start a fresh rate sample so idle time
+         * does not count against the bandwidth estimate */
+        pthread_mutex_lock(&drain->lock);
+        drain->rate_start_us = now_us();
+        drain->rate_bytes = 0;
+        pthread_mutex_unlock(&drain->lock);
+    }
+    return 1;
+}
+
+static void drain_throttle(struct drain_ctx *drain, int max_pending) {
+    if (atomic_load(&drain->pending) <= max_pending) return;
+    uint64_t t0 = now_us();
+    p9_flush(drain->p9);
+    pthread_mutex_lock(&drain->lock);
+    while (atomic_load(&drain->pending) > max_pending && !atomic_load(&drain->broken)) {
+        pthread_cond_wait(&drain->done_cond, &drain->lock);
+    }
+    pthread_mutex_unlock(&drain->lock);
+    timeline_span("drain_throttle", t0);
+}
+
+/* ============== Frame Pacing ============== */
+
+/*
+ * Link-bound pacing (see send.h, "Frame Pacing").  next_us and the
+ * deferral counters are shared with the output thread; everything
+ * else belongs to the send thread.
+ */
+#define PACE_LEAD_US        16667       /* Render one frame ahead of the link */
+#define PACE_BUSY_MS        4           /* Re-check interval while both buffers are busy */
+#define PACE_MAX_DELAY_MS   250         /* Longest single deferral */
+#define PACE_PRESSURE_US    500000      /* Degrade this long after a deferral */
+#define PACE_REFINE_US      250000      /* Quiet time before lossless refinement */
+#define PACE_BACKLOG_US     PACE_PRESSURE_US    /* Most link time owed at once */
+
+/*
+ * Reduced precision for tiles that keep changing under pressure:
+ * 4 bits per channel.  Quantized pixels repeat far more often, so the
+ * LZ77 encoder finds long matches in video and animations.
+ */
+#define PACE_LOSSY_MASK     0xFFF0F0F0u
+
+struct pace_state {
+    _Atomic uint64_t next_us;       /* Earliest useful render, 0 = now */
+    _Atomic uint64_t deferred_us;   /* Last time a render was deferred */
+    atomic_int deferrals;           /* Since the last stats line */
     
-    wlr_log(WLR_INFO, "Drain thread exiting");
-    return NULL;
+    uint64_t link_free_us;          /* When the link drains what was sent */
+    uint64_t last_frame_us;
+    uint8_t *lossy;                 /* Tiles Plan 9 holds at reduced precision */
+    uint32_t *changed_seq;          /* Frame number each tile last changed in */
+    int tiles_x, tiles_y;
+    int lossy_count;
+    uint32_t seq;
+    int refine_requested;           /* Refine frame asked of the output */
+};
+
+/* Renders were deferred recently: the link cannot keep up */
+static int pace_pressure(struct pace_state *pace, uint64_t now) {
+    uint64_t t = atomic_load(&pace->deferred_us);
+    return t && now - t < PACE_PRESSURE_US;
+}
+
+/*
+ * Account a sent frame against the link and publish the time at
+ * which the output should render the next one.  Without a bandwidth
+ * estimate there is no pacing.  link_free_us only ever grows by
+ * bytes / bw, so a low estimate early on (or a link that sped up)
+ * would leave it ever further ahead; it is held to PACE_BACKLOG_US
+ * from now, past which the drain throttle holds the sender back.
+ */
+static void pace_frame_sent(struct pace_state *pace, struct drain_ctx *drain,
+                            size_t bytes, uint64_t start_us) {
+    pthread_mutex_lock(&drain->lock);
+    double bw = drain_bw_locked(drain);
+    pthread_mutex_unlock(&drain->lock);
+    
+    uint64_t now = now_us();
+    pace->last_frame_us = now;
+    if (bw <= 0 || bytes == 0) {
+        atomic_store(&pace->next_us, 0);
+        return;
+    }
+    if (pace->link_free_us < start_us) pace->link_free_us = start_us;
+    pace->link_free_us += (uint64_t)(bytes / bw);
+    if (pace->link_free_us > now + PACE_BACKLOG_US)
+        pace->link_free_us = now + PACE_BACKLOG_US;
+    atomic_store(&pace->next_us, pace->link_free_us > PACE_LEAD_US
+                 ? pace->link_free_us - PACE_LEAD_US : 0);
 }
 
-static int drain_start(struct p9conn *p9) {
-    atomic_store(&drain.pending, 0);
-    atomic_store(&drain.errors, 0);
-    atomic_store(&drain.running, 1);
-    atomic_store(&drain.paused, 0);
-    atomic_store(&drain.broken, 0);
-    drain.p9 = p9;
-    pthread_mutex_init(&drain.lock, NULL);
-    pthread_cond_init(&drain.cond, NULL);
-    pthread_cond_init(&drain.done_cond, NULL);
+/* Size the per-tile maps to the tile grid; a new grid has no lossy tiles */
+static int pace_tiles_ensure(struct pace_state *pace, const struct server *s) {
+    if (pace->lossy && pace->tiles_x == s->tiles_x && pace->tiles_y == s->tiles_y)
+        return 0;
     
-    drain.recv_buf = malloc(p9->msize);
-    if (!drain.recv_buf) return -1;
+    free(pace->lossy);
+    free(pace->changed_seq);
+    pace->lossy = NULL;
+    pace->changed_seq = NULL;
+    pace->tiles_x = pace->tiles_y = 0;
+    pace->lossy_count = 0;
     
-    if (pthread_create(&drain.thread, NULL, drain_thread_func, NULL) != 0) {
-        free(drain.recv_buf);
+    int ntiles = s->tiles_x * s->tiles_y;
+    if (ntiles <= 0) return -1;
+    pace->lossy = calloc(ntiles, 1);
+    pace->changed_seq = calloc(ntiles, sizeof(uint32_t));
+    if (!pace->lossy || !pace->changed_seq) {
+        free(pace->lossy);
+        free(pace->changed_seq);
+        pace->lossy = NULL;
+        pace->changed_seq = NULL;
         return -1;
     }
+    pace->tiles_x = s->tiles_x;
+    pace->tiles_y = s->tiles_y;
+    pace->seq = 1;       /* changed_seq 0 must not look like the last frame */
+    return 0;
+}
+
+static void pace_set_lossy(struct pace_state *pace, int idx, int lossy) {
+    if (pace->lossy[idx] == lossy) return;
+    pace->lossy[idx] = (uint8_t)lossy;
+    pace->lossy_count += lossy ? 1 : -1;
+}
+
+/* Reduce a tile of buf to PACE_LOSSY_MASK precision in place */
+static void pace_quantize(uint32_t *buf, int stride, int x1, int y1, int w, int h) {
+    for (int y = y1; y < y1 + h; y++) {
+        uint32_t *row = &buf[y * stride + x1];
+        for (int x = 0; x < w; x++) row[x] &= PACE_LOSSY_MASK;
+    }
+}
+
+/*
+ * Absolute CLOCK_REALTIME deadline (for send_cond) at which lossy
+ * tiles should be refined: PACE_REFINE_US after both the last frame
+ * and the end of pressure.
+ */
+static struct timespec pace_refine_deadline(const struct pace_state *pace) {
+    uint64_t now = now_us();
+    uint64_t due = pace->last_frame_us + PACE_REFINE_US;
+    uint64_t calm = atomic_load(&pace->deferred_us) + PACE_PRESSURE_US;
+    if (calm > due) due = calm;
+    uint64_t wait = due > now ? due - now : 0;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += wait / 1000000;
+    ts.tv_nsec += (long)(wait % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* ============== Compression Effort ============== */
+
+/*
+ * Link throughput thresholds for automatic effort (-E auto), in
+ * bytes/µs (= MB/s).  A fast link is not worth the CPU of a better
+ * ratio; a slow one is.
+ */
+#define EFFORT_FAST_BW      100.0
+#define EFFORT_HIGH_BW      10.0
+
+/* Effort for this frame: fixed by -E, else from the drain's estimate */
+static int frame_effort(struct server *s, struct drain_ctx *drain) {
+    if (s->compress_effort >= 0) return s->compress_effort;
+    
+    pthread_mutex_lock(&drain->lock);
+    double bw = drain_bw_locked(drain);
+    pthread_mutex_unlock(&drain->lock);
+    
+    if (bw <= 0) return COMPRESS_EFFORT_DEFAULT;
+    if (bw >= EFFORT_FAST_BW) return COMPRESS_EFFORT_FAST;
+    if (bw < EFFORT_HIGH_BW) return COMPRESS_EFFORT_HIGH;
+    return COMPRESS_EFFORT_DEFAULT;
+}
+
+/* ============== Path Prediction ============== */
+
+/* Every tile runs both encoding paths once per this many frames */
+#define PREDICT_VERIFY_FRAMES   16
+
+/*
+ * Last winning encoding path per tile (COMPRESS_PATH_*), fed back to
+ * compress_tile_work() as the hint, and the predictor's hit rate over
+ * the verified tiles.  Owned by the send thread.
+ */
+struct predict_state {
+    uint8_t *last;
+    int tiles_x, tiles_y;
+    uint32_t seq;
+    int checks, hits;       /* Verified tiles with a prediction / correct */
+    int skipped;            /* LZ77 passes saved */
+};
+
+/* Size the winner map to the tile grid; a new grid starts unknown */
+static int predict_tiles_ensure(struct predict_state *predict, const struct server *s) {
+    if (predict->last && predict->tiles_x == s->tiles_x && predict->tiles_y == s->tiles_y)
+        return 0;
+    
+    free(predict->last);
+    predict->tiles_x = predict->tiles_y = 0;
+    int ntiles = s->tiles_x * s->tiles_y;
+    predict->last = ntiles > 0 ? calloc(ntiles, 1) : NULL;
+    if (!predict->last) return -1;
+    predict->tiles_x = s->tiles_x;
+    predict->tiles_y = s->tiles_y;
     return 0;
 }
 
-static void drain_stop(void) {
-    atomic_store(&drain.running, 0);
-    drain_wake();
-    pthread_join(drain.thread, NULL);
+/* Account one compressed tile and remember its winner */
+static void predict_record(struct predict_state *predict, const struct tile_work *w,
+                           const struct tile_result *r) {
+    if (!w->prev_pixels || r->trials == 0) return;
+    int path = r->is_delta ? COMPRESS_PATH_DELTA : COMPRESS_PATH_DIRECT;
     
-    if (!atomic_load(&drain.broken)) {
-        while (atomic_load(&drain.pending) > 0) {
-            drain_recv_one();
-            atomic_fetch_sub(&drain.pending, 1);
+    if (w->verify && r->trials == 2) {
+        if (r->predicted != COMPRESS_PATH_ANY) {
+            predict->checks++;
+            if (r->predicted == path) predict->hits++;
         }
+    } else if (r->predicted != COMPRESS_PATH_ANY && r->trials == 1) {
+        predict->skipped++;
     }
+    predict->last[(w->y1 / TILE_SIZE) * predict->tiles_x + w->x1 / TILE_SIZE] = (uint8_t)path;
+}
+
+/* ============== Damage Priority ============== */
+
+/*
+ * Under link pressure, tiles damaged only by background toplevels
+ * (DAMAGE_BACKGROUND without DAMAGE_FOREGROUND, see types.h) are held
+ * back for up to PRIO_MAX_HOLD frames in a row, so the focused app
+ * and its popups get the link first.  A held tile keeps its old hash
+ * and is forced into the next frame's candidates.  Owned by the send
+ * thread.
+ */
+#define PRIO_MAX_HOLD   8
+
+struct prio_state {
+    uint8_t *held;          /* Consecutive frames each tile was held */
+    int tiles_x, tiles_y;
+    int held_count;         /* Tiles held in the last frame */
+    int held_total;         /* Tile holds since the last stats line */
+};
+
+/* Size the hold map to the tile grid; a new grid holds nothing */
+static int prio_tiles_ensure(struct prio_state *prio, const struct server *s) {
+    if (prio->held && prio->tiles_x == s->tiles_x && prio->tiles_y == s->tiles_y)
+        return 0;
     
-    free(drain.recv_buf);
-    drain.recv_buf = NULL;
-    pthread_mutex_destroy(&drain.lock);
-    pthread_cond_destroy(&drain.cond);
-    pthread_cond_destroy(&drain.done_cond);
+    free(prio->held);
+    prio->tiles_x = prio->tiles_y = 0;
+    prio->held_count = 0;
+    int ntiles = s->tiles_x * s->tiles_y;
+    prio->held = ntiles > 0 ? calloc(ntiles, 1) : NULL;
+    if (!prio->held) return -1;
+    prio->tiles_x = s->tiles_x;
+    prio->tiles_y = s->tiles_y;
+    return 0;
 }
 
-static void drain_pause(void) {
-    atomic_store(&drain.paused, 1);
-    drain_wake();
-    pthread_mutex_lock(&drain.lock);
-    while (atomic_load(&drain.pending) > 0 && !atomic_load(&drain.broken)) {
-        pthread_cond_wait(&drain.done_cond, &drain.lock);
+/* Hold tile idx this frame?  cls is its dirty byte (0 = unknown) */
+static int prio_hold(struct prio_state *prio, int idx, uint8_t cls) {
+    if ((cls & (DAMAGE_FOREGROUND | DAMAGE_BACKGROUND)) != DAMAGE_BACKGROUND ||
+        prio->held[idx] >= PRIO_MAX_HOLD) {
+        prio->held[idx] = 0;
+        return 0;
     }
-    pthread_mutex_unlock(&drain.lock);
+    prio->held[idx]++;
+    prio->held_count++;
+    prio->held_total++;
+    return 1;
+}
+
+/* ============== Tile Cache ============== */
+
+struct cache_hit {
+    int x1, y1;     /* Tile position in image_id */
+    int slot;       /* Cache slot holding the content */
+};
+
+/* Top-left pixel of a cache slot in the cache image */
+static inline void cache_slot_xy(const struct draw_state *draw, int slot,
+                                 int *sx, int *sy) {
+    *sx = (slot % draw->cache_cols) * TILE_SIZE;
+    *sy = (slot / draw->cache_cols) * TILE_SIZE;
 }
 
-static void drain_resume(void) {
-    atomic_store(&drain.paused, 0);
-    drain_wake();
+/* ============== Fill Palette ============== */
+
+/*
+ * Colors currently loaded into the 1x1 replicated fill images
+ * (draw->fill_id_base + i).  Owned by the send thread.
+ */
+struct fill_palette {
+    uint32_t color[FILL_PALETTE_SIZE];
+    uint8_t valid[FILL_PALETTE_SIZE];
+    uint32_t last_use[FILL_PALETTE_SIZE];
+    uint32_t clock;
+};
+
+/* Forget palette contents (a reload may have been lost) */
+static void fill_palette_reset(struct fill_palette *palette) {
+    memset(palette, 0, sizeof(*palette));
 }
 
-static void drain_notify(void) {
-    if (atomic_load(&drain.broken)) return;
-    atomic_fetch_add(&drain.pending, 1);
-    drain_wake();
+/* Bytes of a palette reload: 'y' header + one XRGB32 pixel */
+#define FILL_RELOAD_SIZE (21 + 4)
+
+/*
+ * Return the fill image holding color, first reloading the least
+ * recently used entry with a 'y' command if no entry has it.
+ * Appends at most FILL_RELOAD_SIZE bytes to buf.
+ */
+
+static uint32_t fill_palette_get(struct fill_palette *palette,
+                                 const struct draw_state *draw, uint32_t color,
+                                 uint8_t *buf, size_t *off) {
+    int victim = 0;
+    palette->clock++;
+    for (int i = 0; i < draw->fill_count; i++) {
+        if (palette->valid[i] && palette->color[i] == color) {
+            palette->last_use[i] = palette->clock;
+            return draw->fill_id_base + i;
+        }
+        if (palette->valid[victim] &&
+            (!palette->valid[i] || palette->last_use[i] < palette->last_use[victim]))
+            victim = i;
+    }
+    
+    uint32_t id = draw->fill_id_base + victim;
+    *off += cmd_loadraw_hdr(buf + *off, id, 0, 0, 1, 1);
+    memcpy(buf + *off, &color, 4);
+    *off += 4;
+    
+    palette->color[victim] = color;
+    palette->valid[victim] = 1;
+    palette->last_use[victim] = palette->clock;
+    return id;
 }
 
-static void drain_throttle(int max_pending) {
-    pthread_mutex_lock(&drain.lock);
-    while (atomic_load(&drain.pending) > max_pending && !atomic_load(&drain.broken)) {
-        pthread_cond_wait(&drain.done_cond, &drain.lock);
+/* ============== Pipeline State ============== */
+
+/*
+ * Everything the send thread keeps between frames, one per window
+ * (see send.h, "Pipelines").  Created by send_init() before the
+ * thread starts.
+ */
+struct send_state {
+    struct drain_ctx drain;
+    struct pace_state pace;
+    struct predict_state predict;
+    struct prio_state prio;
+    /* Index of tiles held in draw->cache_id (see tilecache.h);
+     * nslots == 0 when the cache is disabled */
+    struct tile_cache cache;
+    struct fill_palette palette;
+};
+
+int send_init(struct server *s) {
+    s->send = calloc(1, sizeof(*s->send));
+    if (!s->send) return -1;
+    if (scroll_init(s) < 0) {
+        free(s->send);
+        s->send = NULL;
+        return -1;
     }
-    pthread_mutex_unlock(&drain.lock);
+    return 0;
+}
+
+void send_cleanup(struct server *s) {
+    struct send_state *st = s->send;
+    if (!st) return;
+    scroll_cleanup(s);
+    free(st->pace.lossy);
+    free(st->pace.changed_seq);
+    free(st->predict.last);
+    free(st->prio.held);
+    free(st);
+    s->send = NULL;
+}
+
+int send_pace_delay_ms(struct server *s) {
+    struct pace_state *pace = &s->send->pace;
+    uint64_t now = now_us();
+    uint64_t next = atomic_load(&pace->next_us);
+    
+    /* With a frame queued and another being sent, a render now would
+     * find no free buffer */
+    pthread_mutex_lock(&s->send_lock);
+    int busy = (s->pending_buf >= 0 && s->active_buf >= 0);
+    pthread_mutex_unlock(&s->send_lock);
+    
+    int ms = 0;
+    if (next > now) ms = (int)((next - now + 999) / 1000);
+    if (ms > PACE_MAX_DELAY_MS) ms = PACE_MAX_DELAY_MS;
+    if (busy && ms < PACE_BUSY_MS) ms = PACE_BUSY_MS;
+    if (ms > 0) atomic_fetch_add(&pace->deferrals, 1);
+    /* Only the link counts as pressure, not a busy send thread */
+    if (next > now) atomic_store(&pace->deferred_us, now);
+    return ms;
+}
+
+/* ============== Streaming Compression ============== */
+
+/*
+ * One worker job per frame covers both tiles and merge candidates.
+ * tasks[t] >= 0 is a work index; tasks[t] < 0 is candidate -tasks[t]-1.
+ * Tasks are ordered band by band (tiles, then that band's candidates)
+ * so the send thread can emit band b once tasks up to its end are done.
+ */
+struct compress_job {
+    struct tile_work *work;
+    struct tile_result *results;
+    const uint8_t *reused;      /* Result taken from scroll verification */
+    struct coalesce_ctx *coalesce;
+    int *tasks;
+};
+
+static void compress_task(void *arg, int t) {
+    struct compress_job *job = arg;
+    int v = job->tasks[t];
+    if (v >= 0) {
+        if (!job->reused || !job->reused[v])
+            compress_tile_work(&job->work[v], &job->results[v]);
+    } else
+        coalesce_compress(job->coalesce, -v - 1);
 }
 
 /* ============== Frame Sending ============== */
@@ -237,6 +704,29 @@ void send_frame(struct server *s) {
         return;
     }
 
+    /* Before any drop decision: the trace records what was rendered
+     * (the root's window only, a trace has one geometry) */
+    if (!s->root)
+        trace_capture(s);
+
+    /*
+     * Accumulate this frame's damage before deciding anything: if the
+     * frame is dropped below, its damage must still reach the next
+     * frame that is handed over.
+     */
+    int ntiles = s->tiles_x * s->tiles_y;
+    if (!s->dirty_accum && ntiles > 0) {
+        s->dirty_accum = calloc(1, ntiles);
+        s->dirty_accum_valid = 0;   /* Earlier damage is unknown */
+    }
+    if (s->dirty_staging_valid && s->dirty_accum && ntiles > 0) {
+        const uint8_t *damage = s->dirty_staging;
+        for (int i = 0; i < ntiles; i++) s->dirty_accum[i] |= damage[i];
+    } else {
+        s->dirty_accum_valid = 0;
+    }
+    s->dirty_staging_valid = 0;
+
     /* Find a free buffer */
     int buf = -1;
     for (int i = 0; i < 2; i++) {
@@ -247,6 +737,8 @@ void send_frame(struct server *s) {
     }
     
     if (buf < 0) {
+        /* Dropped: the framebuf stays current, the damage stays in
+         * dirty_accum */
         pthread_mutex_unlock(&s->send_lock);
         return;
     }
@@ -263,28 +755,300 @@ void send_frame(struct server *s) {
     s->send_buf[buf]  = s->framebuf;
     s->framebuf       = tmp;
 
-    /* Copy dirty tile bitmap from staging area if available */
-    if (s->dirty_staging_valid) {
-        int ntiles = s->tiles_x * s->tiles_y;
-        if (!s->dirty_tiles[buf] && ntiles > 0)
-            s->dirty_tiles[buf] = calloc(1, ntiles);
-        if (s->dirty_tiles[buf] && ntiles > 0) {
-            memcpy(s->dirty_tiles[buf], s->dirty_staging, ntiles);
-            s->dirty_valid[buf] = 1;
+    /* Stale maps describe physical buffers, so they swap too */
+    uint8_t *tmp_stale   = s->send_stale[buf];
+    s->send_stale[buf]   = s->fb_stale;
+    s->fb_stale          = tmp_stale;
+
+    /*
+     * Hand the accumulated damage over with the buffer.  A pending
+     * frame that the send thread never took is superseded by this
+     * one, so its damage is carried over too.  The send thread then
+     * sees every change since the frame it last took, exactly.
+     */
+    int old = s->pending_buf;
+    if (old >= 0 && s->dirty_accum && ntiles > 0) {
+        if (s->dirty_valid[old] && s->dirty_tiles[old]) {
+            const uint8_t *prev = s->dirty_tiles[old];
+            for (int i = 0; i < ntiles; i++) s->dirty_accum[i] |= prev[i];
         } else {
-            s->dirty_valid[buf] = 0;
+            s->dirty_accum_valid = 0;
         }
-        s->dirty_staging_valid = 0;
+    }
+    if (!s->dirty_tiles[buf] && ntiles > 0)
+        s->dirty_tiles[buf] = calloc(1, ntiles);
+    if (s->dirty_accum_valid && s->dirty_accum && s->dirty_tiles[buf] && ntiles > 0) {
+        memcpy(s->dirty_tiles[buf], s->dirty_accum, ntiles);
+        s->dirty_valid[buf] = 1;
     } else {
         s->dirty_valid[buf] = 0;
     }
+    if (s->dirty_accum) memset(s->dirty_accum, 0, ntiles);
+    s->dirty_accum_valid = 1;
 
     s->pending_buf = buf;
+    s->send_seq[buf] = s->frame_seq;
     if (s->force_full_frame) s->send_full = 1;
     pthread_cond_signal(&s->send_cond);
     pthread_mutex_unlock(&s->send_lock);
 }
 
+/* ============== Tile Hash Tracking ============== */
+
+/*
+ * Move a per-tile map of elem-sized entries from an old_tx × old_ty
+ * grid to tx × ty.  Resize keeps the top-left of prev_framebuf (and of
+ * the Plan 9 image) in place, so entries of the tiles within keep_tx ×
+ * keep_ty stay valid; the rest are set to bytes of fill.  Returns the
+ * new map or NULL; the old one is left to the caller.
+ */
+static void *tile_map_regrid(const void *old, int old_tx, int old_ty,
+                             int keep_tx, int keep_ty,
+                             int tx, int ty, size_t elem, int fill) {
+    uint8_t *map = malloc((size_t)tx * ty * elem);
+    if (!map) return NULL;
+    memset(map, fill, (size_t)tx * ty * elem);
+    if (old) {
+        int cw = old_tx < tx ? old_tx : tx;
+        int ch = old_ty < ty ? old_ty : ty;
+        if (keep_tx < cw) cw = keep_tx;
+        if (keep_ty < ch) ch = keep_ty;
+        for (int y = 0; y < ch; y++)
+            memcpy(map + (size_t)y * tx * elem,
+                   (const uint8_t *)old + (size_t)y * old_tx * elem, cw * elem);
+    }
+    return map;
+}
+
+/*
+ * Make sure s->tile_hash matches the current tile grid.  A new array
+ * starts all-unknown; after a resize the hashes of the overlapping
+ * tiles carry over.  Returns 0 on success, -1 if the allocation failed
+ * (callers fall back to pixel comparison).
+ */
+static int tile_hash_ensure(struct server *s) {
+    if (s->tile_hash && s->tile_hash_tx == s->tiles_x &&
+        s->tile_hash_ty == s->tiles_y)
+        return 0;
+    
+    uint64_t *map = NULL;
+    if (s->tiles_x > 0 && s->tiles_y > 0)
+        map = tile_map_regrid(s->tile_hash, s->tile_hash_tx, s->tile_hash_ty,
+                              s->tile_hash_tx, s->tile_hash_ty,
+                              s->tiles_x, s->tiles_y, sizeof(uint64_t), 0);
+    free(s->tile_hash);
+    s->tile_hash = map;
+    s->tile_hash_tx = map ? s->tiles_x : 0;
+    s->tile_hash_ty = map ? s->tiles_y : 0;
+    return map ? 0 : -1;
+}
+
+/*
+ * Same for s->prev_invalid; a new map marks every tile invalid, a
+ * resized one only the newly exposed tiles.  Returns -1 if the
+ * allocation failed (callers send full frames and do not scroll).
+ */
+static int prev_invalid_ensure(struct server *s) {
+    if (s->prev_invalid && s->prev_invalid_tx == s->tiles_x &&
+        s->prev_invalid_ty == s->tiles_y)
+        return 0;
+    
+    uint8_t *map = NULL;
+    if (s->tiles_x > 0 && s->tiles_y > 0)
+        map = tile_map_regrid(s->prev_invalid, s->prev_invalid_tx, s->prev_invalid_ty,
+                              s->prev_invalid_tx, s->prev_invalid_ty,
+                              s->tiles_x, s->tiles_y, 1, 1);
+    free(s->prev_invalid);
+    s->prev_invalid = map;
+    s->prev_invalid_tx = map ? s->tiles_x : 0;
+    s->prev_invalid_ty = map ? s->tiles_y : 0;
+    return map ? 0 : -1;
+}
+
+/*
+ * After resizes: regrid tile_hash and prev_invalid over the overlap
+ * that every restride since the last call kept (keep_tx × keep_ty),
+ * even if the grid itself ended up unchanged.  A map that cannot be
+ * regridded is dropped and starts over all-unknown / all-invalid.
+ */
+static void tile_maps_resized(struct server *s) {
+    pthread_mutex_lock(&s->send_lock);
+    int pending = s->regrid_pending;
+    int keep_tx = s->keep_tx, keep_ty = s->keep_ty;
+    s->regrid_pending = 0;
+    pthread_mutex_unlock(&s->send_lock);
+    if (!pending) return;
+    
+    uint64_t *hash = NULL;
+    if (s->tile_hash && s->tiles_x > 0 && s->tiles_y > 0)
+        hash = tile_map_regrid(s->tile_hash, s->tile_hash_tx, s->tile_hash_ty,
+                               keep_tx, keep_ty, s->tiles_x, s->tiles_y,
+                               sizeof(uint64_t), 0);
+    free(s->tile_hash);
+    s->tile_hash = hash;
+    s->tile_hash_tx = hash ? s->tiles_x : 0;
+    s->tile_hash_ty = hash ? s->tiles_y : 0;
+    
+    uint8_t *inv = NULL;
+    if (s->prev_invalid && s->tiles_x > 0 && s->tiles_y > 0)
+        inv = tile_map_regrid(s->prev_invalid, s->prev_invalid_tx, s->prev_invalid_ty,
+                              keep_tx, keep_ty, s->tiles_x, s->tiles_y, 1, 1);
+    free(s->prev_invalid);
+    s->prev_invalid = inv;
+    s->prev_invalid_tx = inv ? s->tiles_x : 0;
+    s->prev_invalid_ty = inv ? s->tiles_y : 0;
+}
+
+/* Forget all tile hashes (prev_framebuf no longer matches them) */
+static void tile_hash_invalidate_all(struct server *s) {
+    if (s->tile_hash)
+        memset(s->tile_hash, 0, s->tile_hash_tx * s->tile_hash_ty * sizeof(uint64_t));
+}
+
+/* Forget hashes of tiles covered by regions that scrolled this frame */
+static void tile_hash_invalidate_scrolled(struct server *s) {
+    if (!s->tile_hash) return;
+    for (int i = 0; i < s->num_scroll_regions; i++) {
+        if (!s->scroll_regions[i].detected) continue;
+        int tx1 = s->scroll_regions[i].x1 / TILE_SIZE;
+        int ty1 = s->scroll_regions[i].y1 / TILE_SIZE;
+        int tx2 = (s->scroll_regions[i].x2 + TILE_SIZE - 1) / TILE_SIZE;
+        int ty2 = (s->scroll_regions[i].y2 + TILE_SIZE - 1) / TILE_SIZE;
+        if (tx2 > s->tile_hash_tx) tx2 = s->tile_hash_tx;
+        if (ty2 > s->tile_hash_ty) ty2 = s->tile_hash_ty;
+        for (int ty = ty1; ty < ty2; ty++)
+            for (int tx = tx1; tx < tx2; tx++)
+                s->tile_hash[ty * s->tile_hash_tx + tx] = TILE_HASH_UNKNOWN;
+    }
+}
+
+/* ============== Framebuffer Tiles ============== */
+
+/*
+ * Zero the right and bottom padding of a framebuffer, in either
+ * layout (see fb_tile() in types.h).
+ */
+static void fb_clear_padding(const struct server *s, uint32_t *buf) {
+    int vis_w = s->visible_width, vis_h = s->visible_height;
+    
+    if (!s->tile_major) {
+        /* Right-edge strip, then the bottom rows in full */
+        if (vis_w < s->width) {
+            int pad = s->width - vis_w;
+            for (int y = 0; y < vis_h; y++)
+                memset(&buf[y * s->width + vis_w], 0, pad * sizeof(uint32_t));
+        }
+        if (vis_h < s->height)
+            memset(&buf[vis_h * s->width], 0,
+                   (size_t)(s->height - vis_h) * s->width * sizeof(uint32_t));
+        return;
+    }
+    
+    /* Tile-major: only the last tile column and rows hold padding */
+    for (int ty = 0; ty < s->tiles_y; ty++) {
+        int y0 = ty * TILE_SIZE;
+        int tx0 = (y0 + TILE_SIZE > vis_h) ? 0 : vis_w / TILE_SIZE;
+        for (int tx = tx0; tx < s->tiles_x; tx++) {
+            int x0 = tx * TILE_SIZE;
+            int keep_w = vis_w - x0, keep_h = vis_h - y0;
+            if (keep_w < 0) keep_w = 0;
+            if (keep_h < 0) keep_h = 0;
+            if (keep_w >= TILE_SIZE && keep_h >= TILE_SIZE) continue;
+            
+            uint32_t *tile = fb_tile(s, buf, tx, ty);
+            for (int y = 0; y < TILE_SIZE; y++) {
+                int from = (y < keep_h) ? keep_w : 0;
+                if (from < TILE_SIZE)
+                    memset(tile + y * TILE_SIZE + from, 0,
+                           (TILE_SIZE - from) * sizeof(uint32_t));
+            }
+        }
+    }
+}
+
+/* Copy the w × h pixels of tile (tx, ty) from src to dst */
+static inline void fb_tile_copy(const struct server *s, uint32_t *dst, uint32_t *src,
+                                int tx, int ty, int w, int h) {
+    uint32_t *d = fb_tile(s, dst, tx, ty);
+    const uint32_t *p = fb_tile(s, src, tx, ty);
+    int stride = fb_tile_stride(s);
+    if (s->tile_major && w == TILE_SIZE) {
+        memcpy(d, p, (size_t)h * TILE_SIZE * sizeof(uint32_t));
+        return;
+    }
+    for (int row = 0; row < h; row++)
+        memcpy(d + row * stride, p + row * stride, w * sizeof(uint32_t));
+}
+
+/*
+ * Mark all of prev_framebuf invalid after a lost write or drain error
+ * so every tile is resent without delta, and drop the hashes that
+ * described it.
+ */
+static void prev_framebuf_poison(struct server *s) {
+    if (s->prev_invalid)
+        memset(s->prev_invalid, 1, s->prev_invalid_tx * s->prev_invalid_ty);
+    tile_hash_invalidate_all(s);
+    scroll_invalidate_spectra(s);
+    /* Cache fills and palette reloads in the lost batch may not have landed */
+    tile_cache_reset(&s->send->cache);
+    fill_palette_reset(&s->send->palette);
+}
+
+/* Write out queued batches, timing the socket write */
+static void send_flush(struct p9conn *p9) {
+    uint64_t t0 = now_us();
+    p9_flush(p9);
+    metrics_observe(METRIC_WRITE, now_us() - t0);
+    timeline_span("write", t0);
+}
+
+/*
+ * Queue the current batch and start a new one.  Queued batches go out
+ * together (one syscall, full TLS records) when the send thread is
+ * about to wait, or at the end of the frame.
+ */
+static void batch_flush(struct server *s, struct p9conn *p9, uint32_t fid,
+                        uint8_t *batch, size_t *off, int *batch_count) {
+    struct drain_ctx *drain = &s->send->drain;
+    
+    /* Keep at most one window of batches in flight */
+    int window = atomic_load(&drain->window);
+    if (atomic_load(&drain->pending) >= window) drain_throttle(drain, window - 1);
+    
+    int counted = drain_notify(drain);
+    metrics_add(METRIC_BATCHES, 1);
+    if (p9_write_queue(p9, fid, 0, batch, *off) < 0) {
+        metrics_add(METRIC_WRITE_ERRORS, 1);
+        if (counted) drain_complete(drain, 0, 0);
+        prev_framebuf_poison(s);
+        s->send_full = 1;
+    }
+    (*batch_count)++;
+    *off = 0;
+}
+
+/*
+ * Copy image_id to the window and flush, with no tile loads.  After a
+ * move or reshape rio has a new window image, but image_id still holds
+ * the last frame, so this is all the window needs to show it again.
+ */
+static void send_present(struct server *s, struct p9conn *p9, uint8_t *batch) {
+    struct draw_state *draw = &s->draw;
+    size_t off = 0;
+    int batch_count = 0;
+    
+    off += cmd_copy(batch + off, draw->screen_id, draw->image_id,
+                   draw->opaque_id,
+                   draw->win_minx, draw->win_miny,
+                   draw->win_minx + draw->visible_width,
+                   draw->win_miny + draw->visible_height,
+                   0, 0);
+    off += cmd_flush(batch + off);
+    batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+    send_flush(p9);
+}
+
 int send_timer_callback(void *data) {
     struct server *s = data;
     if (!s->frame_dirty) return 0;
@@ -293,21 +1057,26 @@ int send_timer_callback(void *data) {
     return 0;
 }
 
-static int scroll_disabled(struct server *s) {
-    double floor_val;
-    return (modf(s->scale, &floor_val) != 0.0);
-}
-
 void *send_thread_func(void *arg) {
     struct server *s = arg;
     struct draw_state *draw = &s->draw;
     struct p9conn *p9 = draw->p9;
-    static int send_count = 0;
+    struct send_state *st = s->send;
+    struct drain_ctx *drain = &st->drain;
+    struct pace_state *pace = &st->pace;
+    struct predict_state *predict = &st->predict;
+    struct prio_state *prio = &st->prio;
+    struct tile_cache *cache = &st->cache;
+    struct fill_palette *palette = &st->palette;
+    int send_count = 0;
     
     wlr_log(WLR_INFO, "Send thread started");
+    parallel_pin_io_thread("Send");
+    timeline_thread_name("send");
     
-    if (scroll_disabled(s)) {
-        wlr_log(WLR_INFO, "Scroll optimization disabled (fractional scale: %.2f)", s->scale);
+    if (s->scale != floorf(s->scale)) {
+        wlr_log(WLR_INFO, "Fractional scale %.2f: scrolls detected as whole physical pixels",
+                s->scale);
     }
     
     /* Determine max batch size from iounit */
@@ -319,18 +1088,49 @@ void *send_thread_func(void *arg) {
     uint8_t *batch = malloc(max_batch);
     if (!batch) return NULL;
     
-    if (drain_start(p9) < 0) {
+    if (drain_start(drain, p9) < 0) {
         free(batch);
         return NULL;
     }
     
-    /* Initialize parallel compression */
-    int nthreads = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+    /* Pick SIMD tile compare kernel for this CPU */
+    tilecmp_init();
+    
+    /* Initialize parallel compression on the shared pool (-W / -A) */
+    int nthreads = parallel_worker_count();
     if (compress_pool_init(nthreads) < 0) nthreads = 0;
     
+    /*
+     * Per-tile tables, carved from one huge-page arena; pages are only
+     * committed as far as frames actually reach.  Compressed payloads
+     * go to frame_out, reset every frame (see arena.h).
+     */
     int max_tiles = (4096 / TILE_SIZE) * (4096 / TILE_SIZE);
-    struct tile_work *work = malloc(max_tiles * sizeof(*work));
-    struct tile_result *results = malloc(max_tiles * sizeof(*results));
+    struct arena tables, frame_out;
+    arena_init(&tables,
+               ARENA_SIZE(max_tiles * sizeof(struct tile_work)) +
+               ARENA_SIZE(max_tiles * sizeof(struct tile_result)) +
+               ARENA_SIZE(max_tiles * sizeof(int)) * 3 +
+               ARENA_SIZE(max_tiles * sizeof(struct cache_hit)) +
+               ARENA_SIZE(max_tiles) * 2 +
+               ARENA_SIZE(2 * max_tiles * sizeof(int)) +
+               ARENA_SIZE(max_tiles * sizeof(uint32_t)));
+    arena_init(&frame_out, (size_t)max_tiles * TILE_OUT_MAX);
+    struct tile_work *work = arena_bump(&tables, max_tiles * sizeof(*work));
+    struct tile_result *results = arena_bump(&tables, max_tiles * sizeof(*results));
+    int *work_slot = arena_bump(&tables, max_tiles * sizeof(*work_slot));
+    struct cache_hit *hits = arena_bump(&tables, max_tiles * sizeof(*hits));
+    int *work_rect = arena_bump(&tables, max_tiles * sizeof(*work_rect));
+    uint8_t *work_reused = arena_bump(&tables, max_tiles);
+    int *tasks = arena_bump(&tables, 2 * max_tiles * sizeof(*tasks));
+    uint8_t *solid_map = arena_bump(&tables, max_tiles);
+    uint32_t *solid_color = arena_bump(&tables, max_tiles * sizeof(*solid_color));
+    
+    /* Tile cache index over the server-side cache image */
+    if (draw->cache_id && hits && work_slot &&
+        tile_cache_init(cache, draw->cache_cols * draw->cache_rows) == 0) {
+        wlr_log(WLR_INFO, "Tile cache: %d slots", cache->nslots);
+    }
     
     /*
      * After a failed relookup, suppress frame sending to avoid the
@@ -338,16 +1138,37 @@ void *send_thread_func(void *arg) {
      * Cleared on next successful relookup or new window_changed event.
      */
     int draw_suspended = 0;
-    if (!work || !results) nthreads = 0;
     
-    const size_t comp_buf_size = TILE_SIZE * TILE_SIZE * 4 + 256;
-    uint8_t *comp_buf = malloc(comp_buf_size);
+    /* Window changed since the last copy-to-screen */
+    int present_pending = 0;
+    if (!work || !results || !work_slot || !hits) nthreads = 0;
+    
+    /* Merged-load state (see coalesce.h) */
+    struct coalesce_ctx coalesce = {0};
+    int use_coalesce = (work_rect != NULL && tasks != NULL && !s->tile_major);
+    
+    /* Tiles taken from scroll verification, since the last stats log */
+    int reused_tiles = 0;
     
     while (s->running) {
         /* Wait for work — woken by send_frame() or mouse thread (resize) */
         pthread_mutex_lock(&s->send_lock);
         while (s->pending_buf < 0 && !s->window_changed && s->running) {
-            pthread_cond_wait(&s->send_cond, &s->send_lock);
+            if ((pace->lossy_count == 0 && prio->held_count == 0) ||
+                pace->refine_requested) {
+                pthread_cond_wait(&s->send_cond, &s->send_lock);
+                continue;
+            }
+            /* Lossy or held tiles on screen: once things calm down, ask
+             * the output for a frame to send them in */
+            struct timespec due = pace_refine_deadline(pace);
+            if (pthread_cond_timedwait(&s->send_cond, &s->send_lock, &due) == ETIMEDOUT &&
+                !pace_pressure(pace, now_us())) {
+                pace->refine_requested = 1;
+                s->refine_pending = 1;
+                struct input_event wakeup = { .type = INPUT_WAKEUP };
+                input_queue_push(&s->input_queue, &wakeup);
+            }
         }
         pthread_mutex_unlock(&s->send_lock);
         if (!s->running) break;
@@ -358,6 +1179,7 @@ void *send_thread_func(void *arg) {
         if (got_frame) {
             s->active_buf = current_buf;
             s->pending_buf = -1;
+            timeline_publish_frame(s->send_seq[current_buf]);
         }
         int do_full = s->send_full;
         s->send_full = 0;
@@ -369,28 +1191,15 @@ void *send_thread_func(void *arg) {
          * Clear padding strips to ensure deterministic edge tiles.
          *
          * The compositor renders visible_width × visible_height into the
-         * top-left of a buffer with stride = width (padded to TILE_SIZE).
-         * The right and bottom padding strips may contain stale data from
-         * a previous frame (buffers are recycled via pointer swap).
-         * Zero them so edge-tile compression sees stable black pixels
-         * instead of random changes.
+         * top-left of a buffer padded to TILE_SIZE.  The right and bottom
+         * padding strips may contain stale data from a previous frame
+         * (buffers are recycled via pointer swap).  Zero them so
+         * edge-tile compression sees stable black pixels instead of
+         * random changes.
          */
         if (send_buf &&
-            (s->visible_width < s->width || s->visible_height < s->height)) {
-            /* Right-edge padding strip */
-            if (s->visible_width < s->width) {
-                int pad = s->width - s->visible_width;
-                for (int y = 0; y < s->visible_height; y++)
-                    memset(&send_buf[y * s->width + s->visible_width], 0,
-                           pad * sizeof(uint32_t));
-            }
-            /* Bottom padding strip (full row width including right padding) */
-            if (s->visible_height < s->height) {
-                memset(&send_buf[s->visible_height * s->width], 0,
-                       (s->height - s->visible_height) * s->width
-                       * sizeof(uint32_t));
-            }
-        }
+            (s->visible_width < s->width || s->visible_height < s->height))
+            fb_clear_padding(s, send_buf);
         
         /* Handle errors and window changes */
         
@@ -401,7 +1210,7 @@ void *send_thread_func(void *arg) {
          * frame and wait.  Recovery requires reconnecting, which is
          * outside the send thread's scope.
          */
-        if (atomic_load(&drain.broken)) {
+        if (atomic_load(&drain->broken)) {
             if (!draw_suspended) {
                 draw_suspended = 1;
                 wlr_log(WLR_ERROR, "send: 9P draw stream broken, shutting down");
@@ -414,7 +1223,7 @@ void *send_thread_func(void *arg) {
             atomic_store(&p9->draw_error, 0);
             atomic_store(&p9->unknown_id_error, 0);
             s->window_changed = 0;
-            atomic_exchange(&drain.errors, 0);
+            atomic_exchange(&drain->errors, 0);
             if (got_frame) {
                 pthread_mutex_lock(&s->send_lock);
                 s->active_buf = -1;
@@ -425,26 +1234,33 @@ void *send_thread_func(void *arg) {
         
         if (atomic_exchange(&p9->draw_error, 0)) {
             draw->xor_enabled = 0;
-            memset(s->prev_framebuf, 0, s->width * s->height * 4);
+            prev_framebuf_poison(s);
             do_full = 1;
         }
         
-        int drain_errs = atomic_exchange(&drain.errors, 0);
+        int drain_errs = atomic_exchange(&drain->errors, 0);
         if (drain_errs > 0) {
-            memset(s->prev_framebuf, 0xDE, s->width * s->height * 4);
+            prev_framebuf_poison(s);
             do_full = 1;
         }
         
         if (s->window_changed) {
             s->window_changed = 0;
-            drain_pause();
-            if (relookup_window(s) == 0) {
+            drain_pause(drain);
+            uint64_t t0 = now_us();
+            int rc = relookup_window(s);
+            timeline_span("relookup_window", t0);
+            if (rc == 0) {
                 draw_suspended = 0;
+                /* image_id survives the move or reshape: copy it to the
+                 * new window image now, before output_frame may touch it
+                 * for a resize, and again with the first frame after */
+                send_present(s, p9, batch);
+                present_pending = 1;
             } else {
                 draw_suspended = 1;
                 wlr_log(WLR_INFO, "send: draw suspended until next window change");
             }
-            drain_resume();
             /*
              * Wake main loop so output_frame fires.  For resize,
              * output_frame consumes resize_pending.  For move,
@@ -461,7 +1277,6 @@ void *send_thread_func(void *arg) {
                 pthread_mutex_unlock(&s->send_lock);
                 continue;
             }
-            do_full = 1;
         }
         
         if (atomic_exchange(&p9->unknown_id_error, 0)) {
@@ -469,14 +1284,16 @@ void *send_thread_func(void *arg) {
                 /* Already suspended — don't hammer relookup, just wait
                  * for the next window_changed event to try again. */
             } else {
-                drain_pause();
-                if (relookup_window(s) == 0) {
+                drain_pause(drain);
+                uint64_t t0 = now_us();
+                int rc = relookup_window(s);
+                timeline_span("relookup_window", t0);
+                if (rc == 0) {
                     draw_suspended = 0;
                 } else {
                     draw_suspended = 1;
                     wlr_log(WLR_INFO, "send: draw suspended until next window change");
                 }
-                drain_resume();
             }
             struct input_event wakeup = { .type = INPUT_WAKEUP };
             input_queue_push(&s->input_queue, &wakeup);
@@ -501,13 +1318,55 @@ void *send_thread_func(void *arg) {
             s->force_full_frame = 0;
         }
         
+        uint64_t frame_start_us = now_us();
+        int effort = frame_effort(s, drain);     /* For this window's tiles only */
+        
+        /* Without the invalid map, what prev_framebuf lacks is unknown */
+        tile_maps_resized(s);
+        uint8_t *prev_invalid = (prev_invalid_ensure(s) == 0) ? s->prev_invalid : NULL;
+        if (!prev_invalid) do_full = 1;
+        
         /* Detect and apply scroll */
-        int scrolled_regions = 0;
-        if (!do_full && !scroll_disabled(s)) {
-            detect_scroll(s, send_buf);
+        int scrolled_regions = 0, use_trials = 0;
+        if (!do_full && !s->tile_major) {
+            uint64_t t0 = now_us();
+            detect_scroll(s, send_buf, s->dirty_valid[current_buf]
+                                       ? s->dirty_tiles[current_buf] : NULL, effort);
             scrolled_regions = apply_scroll_to_prevbuf(s);
+            use_trials = (work_reused != NULL);
+            metrics_observe(METRIC_SCROLL, now_us() - t0);
+            timeline_span("scroll", t0);
+            metrics_add(METRIC_SCROLLS, scrolled_regions);
         }
         
+        /*
+         * Pacing state for this frame.  Under pressure, tiles that
+         * changed in the previous frame too are sent at reduced
+         * precision; without pressure, every lossy tile is refined.
+         */
+        int use_pace = (pace_tiles_ensure(pace, s) == 0);
+        int degrade = use_pace && pace_pressure(pace, frame_start_us);
+        int refine = use_pace && !degrade && pace->lossy_count > 0;
+        pace->refine_requested = 0;
+        pace->seq++;
+        if (use_pace && scrolled_regions > 0 && pace->lossy_count > 0) {
+            /* Lossy content moved with the scroll: refine everywhere */
+            memset(pace->lossy, 1, pace->tiles_x * pace->tiles_y);
+            pace->lossy_count = pace->tiles_x * pace->tiles_y;
+        }
+        
+        /* Damage classes of this frame, for holding background tiles */
+        int use_prio = (prio_tiles_ensure(prio, s) == 0);
+        const uint8_t *damage_class = (use_prio && s->dirty_valid[current_buf])
+                                      ? s->dirty_tiles[current_buf] : NULL;
+        int hold = degrade && !do_full && damage_class != NULL;
+        
+        /* Tile hashes: resize resets them; scroll moved prev_framebuf
+         * content under them */
+        uint64_t *tile_hash = (tile_hash_ensure(s) == 0) ? s->tile_hash : NULL;
+        if (tile_hash && scrolled_regions > 0)
+            tile_hash_invalidate_scrolled(s);
+        
         /* Build batch */
         size_t off = 0;
         if (scrolled_regions > 0) {
@@ -515,9 +1374,11 @@ void *send_thread_func(void *arg) {
         }
         
         int tile_count = 0, batch_count = 0;
-        int comp_tiles = 0, delta_tiles = 0;
+        int comp_tiles = 0, delta_tiles = 0, merged_rects = 0;
         size_t bytes_raw = 0, bytes_sent = 0;
         int can_delta = draw->xor_enabled && !do_full && s->prev_framebuf;
+        int use_predict = (predict_tiles_ensure(predict, s) == 0);
+        predict->seq++;
         
         /*
          * Use damage-based dirty map when available.  Tiles outside the
@@ -525,12 +1386,12 @@ void *send_thread_func(void *arg) {
          * inside the damage region are assumed changed — the compositor
          * determined these regions were re-rendered, and we track actual
          * content changes via scene_dirty in output_frame so the damage
-         * is reliable.  This eliminates the expensive tile_changed()
-         * memcmp that was previously the main CPU cost.
+         * is reliable.  Damaged tiles are still verified (by hash, see
+         * below) since the damage is tile-granular.
          *
-         * Falls back to tile_changed() pixel scanning only when no
-         * damage info is available (scroll modified prev_framebuf,
-         * errors, or allocation failure).
+         * Falls back to scanning every tile only when no damage info
+         * is available (scroll modified prev_framebuf, errors, or
+         * allocation failure).
          */
         uint8_t *dirty_map = NULL;
         if (!do_full && scrolled_regions == 0 &&
@@ -538,151 +1399,501 @@ void *send_thread_func(void *arg) {
             dirty_map = s->dirty_tiles[current_buf];
         }
         
-        /* Collect changed tiles */
-        int work_count = 0;
-        for (int ty = 0; ty < s->tiles_y; ty++) {
+        /*
+         * Refinement: lossy tiles become candidates with an unknown
+         * hash, so the pixel compare against prev_framebuf (which
+         * holds the quantized content) resends them losslessly.
+         */
+        if (refine) {
+            int n = pace->tiles_x * pace->tiles_y;
+            for (int i = 0; i < n; i++) {
+                if (!pace->lossy[i]) continue;
+                if (tile_hash) tile_hash[i] = TILE_HASH_UNKNOWN;
+                if (dirty_map) dirty_map[i] = 1;
+            }
+            memset(pace->lossy, 0, n);
+            pace->lossy_count = 0;
+        }
+        
+        /* Tiles held last frame are candidates again (their hash is
+         * still that of what Plan 9 shows) */
+        if (use_prio && prio->held_count > 0 && dirty_map) {
+            int n = prio->tiles_x * prio->tiles_y;
+            for (int i = 0; i < n; i++)
+                if (prio->held[i]) dirty_map[i] |= DAMAGE_DIRTY;
+        }
+        if (use_prio) prio->held_count = 0;
+        int frame_lossy = 0;
+        
+        /*
+         * Collect changed tiles.
+         *
+         * For each candidate tile we hash the new content and compare
+         * with the stored hash of what Plan 9 holds, so prev_framebuf
+         * is not read at all.  Tiles with an unknown hash (after
+         * resize, scroll or errors) are batched per tile row into the
+         * SIMD tilecmp_row() scan against prev_framebuf.  Either way
+         * the new hash is recorded, since after this frame Plan 9 and
+         * prev_framebuf hold exactly that content.
+         */
+        uint64_t collect_start_us = now_us();
+        int work_count = 0, hit_count = 0, solid_count = 0, miss_count = 0;
+        arena_reset(&frame_out);    /* Last frame's payloads are sent */
+        int use_cache = (cache->nslots > 0 && tile_hash != NULL);
+        if (use_cache) tile_cache_begin_frame(cache);
+        int ntiles = s->tiles_x * s->tiles_y;
+        int use_fill = (draw->fill_count > 0 && solid_map && solid_color &&
+                        ntiles <= max_tiles);
+        if (use_fill) memset(solid_map, 0, ntiles);
+        int fb_stride = fb_tile_stride(s);
+        uint8_t row_changed[MAX_SCREEN_DIM / TILE_SIZE];
+        uint8_t row_need_cmp[MAX_SCREEN_DIM / TILE_SIZE];
+        uint8_t row_cmp[MAX_SCREEN_DIM / TILE_SIZE];
+        uint64_t row_hash[MAX_SCREEN_DIM / TILE_SIZE];
+        for (int ty = 0; ty < s->tiles_y && work_count + hit_count < max_tiles; ty++) {
+            int row_y1 = ty * TILE_SIZE;
+            int row_h = s->height - row_y1;
+            if (row_h > TILE_SIZE) row_h = TILE_SIZE;
+            if (row_h <= 0) continue;
+            
+            const uint8_t *cand = dirty_map ? &dirty_map[ty * s->tiles_x] : NULL;
+            const uint8_t *inv = prev_invalid ? &prev_invalid[ty * s->tiles_x] : NULL;
+            uint64_t *hash_row = tile_hash ? &tile_hash[ty * s->tiles_x] : NULL;
+            int need_cmp = 0;
+            
             for (int tx = 0; tx < s->tiles_x; tx++) {
+                row_changed[tx] = 0;
+                row_need_cmp[tx] = 0;
+                if (cand && !cand[tx] && !(inv && inv[tx])) continue;
+                
+                int w = s->width - tx * TILE_SIZE;
+                if (w > TILE_SIZE) w = TILE_SIZE;
+                if (hash_row)
+                    row_hash[tx] = tilecmp_hash(fb_tile(s, send_buf, tx, ty), fb_stride,
+                                                0, 0, w, row_h);
+                
+                /* An invalid reference is resent whatever it holds */
+                if (do_full || (inv && inv[tx])) {
+                    row_changed[tx] = 1;
+                } else if (hash_row && hash_row[tx] != TILE_HASH_UNKNOWN) {
+                    row_changed[tx] = (row_hash[tx] != hash_row[tx]);
+                } else {
+                    row_need_cmp[tx] = 1;
+                    need_cmp++;
+                }
+            }
+            
+            if (need_cmp > 0 && s->tile_major) {
+                /* Tiles are whole blocks: compare each on its own, over
+                 * the visible part only (fills leave their colour in
+                 * prev_framebuf's padding, send_buf's is zeroed) */
+                int vis_h = s->visible_height - row_y1;
+                if (vis_h > row_h) vis_h = row_h;
+                for (int tx = 0; tx < s->tiles_x; tx++) {
+                    if (!row_need_cmp[tx]) continue;
+                    int vis_w = s->visible_width - tx * TILE_SIZE;
+                    if (vis_w > TILE_SIZE) vis_w = TILE_SIZE;
+                    row_changed[tx] = vis_w > 0 && vis_h > 0 &&
+                        tilecmp_tile(fb_tile(s, send_buf, tx, ty),
+                                     fb_tile(s, s->prev_framebuf, tx, ty),
+                                     TILE_SIZE, 0, 0, vis_w, vis_h);
+                }
+            } else if (need_cmp > 0) {
+                tilecmp_row(send_buf, s->prev_framebuf, s->width,
+                            row_y1, row_h, s->tiles_x, row_need_cmp, row_cmp);
+                for (int tx = 0; tx < s->tiles_x; tx++)
+                    if (row_need_cmp[tx]) row_changed[tx] = row_cmp[tx];
+            }
+            
+            for (int tx = 0; tx < s->tiles_x; tx++) {
+                if (cand && !cand[tx] && !(inv && inv[tx])) continue;
+                if (!row_changed[tx]) {
+                    if (hash_row) hash_row[tx] = row_hash[tx];
+                    /* Back to what Plan 9 shows: no longer held */
+                    if (use_prio) prio->held[ty * s->tiles_x + tx] = 0;
+                    continue;
+                }
+                
                 int x1, y1, w, h;
                 tile_bounds(tx, ty, s->width, s->height, &x1, &y1, &w, &h);
                 if (w <= 0 || h <= 0) continue;
                 
-                int changed;
-                if (dirty_map) {
-                    /* Skip tiles outside damaged region (no memory read) */
-                    if (!dirty_map[ty * s->tiles_x + tx])
-                        continue;
-                    /* Verify damaged tiles actually changed — the headless
-                     * backend reports full-screen damage on every frame,
-                     * so many "damaged" tiles are pixel-identical to
-                     * prev_framebuf (e.g. a cursor blink marks the whole
-                     * screen dirty but only ~2 tiles differ). */
-                    changed = tile_changed(send_buf, s->prev_framebuf,
-                                           s->width, x1, y1, w, h);
-                } else {
-                    /* Fallback: check every tile */
-                    changed = do_full || tile_changed(send_buf, s->prev_framebuf,
-                                                       s->width, x1, y1, w, h);
+                if (work_count + hit_count >= max_tiles) break;
+                
+                /* Background-only damage waits while the link is busy */
+                int idx = ty * s->tiles_x + tx;
+                if (use_prio && !(inv && inv[tx]) &&
+                    prio_hold(prio, idx, hold ? damage_class[idx] : 0))
+                    continue;
+                if (hash_row) hash_row[tx] = row_hash[tx];
+                
+                /* Whichever way it goes out, prev_framebuf gets it below */
+                int ref_invalid = prev_invalid && prev_invalid[idx];
+                if (prev_invalid) prev_invalid[idx] = 0;
+                
+                /* Fast-changing tile: changed in the previous frame too */
+                int lossy = 0;
+                if (use_pace) {
+                    lossy = degrade && pace->changed_seq[idx] == pace->seq - 1;
+                    pace->changed_seq[idx] = pace->seq;
                 }
-                if (!changed) continue;
                 
-                if (work_count >= max_tiles) break;
+                /* Solid tiles are merged into fill rectangles below */
+                uint32_t *tile_px = fb_tile(s, send_buf, tx, ty);
+                uint32_t color;
+                if (use_fill &&
+                    tile_solid_color(tile_px, fb_stride, 0, 0, w, h, &color)) {
+                    solid_map[idx] = 1;
+                    solid_color[idx] = color;
+                    solid_count++;
+                    if (use_pace) pace_set_lossy(pace, idx, 0);
+                    continue;
+                }
                 
-                /* Check for scroll-exposed region (marked 0xDEADBEEF) */
-                int use_delta = can_delta;
-                if (use_delta) {
-                    int x2m1 = x1 + w - 1, y2m1 = y1 + h - 1;
-                    for (int x = x1; x < x1 + w && use_delta; x++) {
-                        if (s->prev_framebuf[y1 * s->width + x] == 0xDEADBEEF ||
-                            s->prev_framebuf[y2m1 * s->width + x] == 0xDEADBEEF)
-                            use_delta = 0;
-                    }
-                    for (int y = y1; y <= y2m1 && use_delta; y++) {
-                        if (s->prev_framebuf[y * s->width + x1] == 0xDEADBEEF ||
-                            s->prev_framebuf[y * s->width + x2m1] == 0xDEADBEEF)
-                            use_delta = 0;
+                /*
+                 * Reduced precision: quantize in place, so compression,
+                 * raw loads and prev_framebuf all see what Plan 9 gets.
+                 * The hash stays that of the real content; the lossy
+                 * bit is what brings the tile back for refinement.
+                 * Lossy tiles bypass the cache, whose slots are keyed
+                 * by real content.
+                 */
+                if (use_pace) pace_set_lossy(pace, idx, lossy);
+                if (lossy) {
+                    pace_quantize(tile_px, fb_stride, 0, 0, w, h);
+                    frame_lossy++;
+                }
+                
+                /* Tile cache: a hit replaces compression + load with a
+                 * copy; a miss reserves a slot to fill after the load */
+                int slot = -1;
+                if (use_cache && !lossy && w == TILE_SIZE && h == TILE_SIZE) {
+                    if (tile_cache_lookup_or_insert(cache, row_hash[tx], &slot)
+                            == TILE_CACHE_HIT) {
+                        hits[hit_count++] = (struct cache_hit){ x1, y1, slot };
+                        continue;
                     }
+                    miss_count++;
                 }
                 
+                /* No delta against a scroll-exposed or lost reference */
+                int use_delta = can_delta && !ref_invalid;
+                
                 work[work_count] = (struct tile_work){
-                    .pixels = send_buf, .stride = s->width,
-                    .prev_pixels = use_delta ? s->prev_framebuf : NULL,
-                    .prev_stride = s->width,
-                    .x1 = x1, .y1 = y1, .w = w, .h = h
+                    .pixels = tile_px, .stride = fb_stride,
+                    .prev_pixels = use_delta ? fb_tile(s, s->prev_framebuf, tx, ty) : NULL,
+                    .prev_stride = fb_stride,
+                    .x1 = x1, .y1 = y1, .w = w, .h = h,
+                    .hint = use_predict ? predict->last[idx] : COMPRESS_PATH_ANY,
+                    .verify = !use_predict ||
+                              (idx + predict->seq) % PREDICT_VERIFY_FRAMES == 0,
+                    .effort = effort,
+                    .out = &frame_out
                 };
+                work_slot[work_count] = slot;
+                
+                /* Verification already compressed it against this
+                 * reference (pixels untouched unless quantized) */
+                if (work_reused) {
+                    work_reused[work_count] = use_trials && !lossy &&
+                        scroll_trial_take(s, tx, ty, use_delta,
+                                          &results[work_count]);
+                    reused_tiles += work_reused[work_count];
+                }
                 work_count++;
             }
         }
         
-        /* Compress tiles in parallel */
-        if (work_count > 0 && nthreads > 0) {
-            compress_tiles_parallel(work, results, work_count);
+        metrics_observe(METRIC_COLLECT, now_us() - collect_start_us);
+        timeline_span("collect", collect_start_us);
+        
+        /*
+         * Quantized tiles no longer match the render: mark them stale
+         * in this buffer so the output recopies them before the buffer
+         * is sent again.  A NULL map is already all-stale.
+         */
+        if (frame_lossy > 0) {
+            pthread_mutex_lock(&s->send_lock);
+            uint8_t *stale = s->send_stale[current_buf];
+            for (int i = 0; stale && i < work_count; i++) {
+                int idx = (work[i].y1 / TILE_SIZE) * s->tiles_x + work[i].x1 / TILE_SIZE;
+                if (pace->lossy[idx]) stale[idx] = 1;
+            }
+            pthread_mutex_unlock(&s->send_lock);
+        }
+        
+        /*
+         * Pick merge candidates and lay out the compression job band
+         * by band.  Without a band table (coalescing unavailable) the
+         * whole frame is one band of tiles.
+         */
+        struct coalesce_band whole = { work_count, 0 };
+        struct coalesce_band *bands = &whole;
+        int nbands = 1;
+        if (use_coalesce && work_count > 0) {
+            coalesce_plan(&coalesce, send_buf, s->width, work, work_count,
+                          s->tiles_x, s->tiles_y, max_batch, work_rect);
+            if (coalesce.band_count > 0) {
+                bands = coalesce.bands;
+                nbands = coalesce.band_count;
+            }
+        }
+        
+        struct compress_job job = {
+            .work = work, .results = results, .reused = work_reused,
+            .coalesce = &coalesce, .tasks = tasks
+        };
+        int ntasks = 0;
+        if (tasks) {
+            int wi = 0, ri = 0;
+            for (int b = 0; b < nbands; b++) {
+                for (; wi < bands[b].work_end; wi++) tasks[ntasks++] = wi;
+                for (; ri < bands[b].rect_end; ri++) tasks[ntasks++] = -ri - 1;
+            }
+        }
+        
+        /*
+         * Start compressing without waiting: the loads below consume
+         * results band by band while later bands are still running,
+         * so socket writes overlap compression.
+         */
+        uint64_t compress_start_us = now_us();
+        int stream = (nthreads > 0 && ntasks > 0)
+            ? parallel_stream_start(ntasks, compress_task, &job) : -1;
+        int streaming = (stream >= 0);
+        if (!streaming) {
+            if (tasks) {
+                for (int t = 0; t < ntasks; t++) compress_task(&job, t);
+            } else {
+                for (int i = 0; i < work_count; i++)
+                    if (!work_reused || !work_reused[i])
+                        compress_tile_work(&work[i], &results[i]);
+            }
+            metrics_observe(METRIC_COMPRESS, now_us() - compress_start_us);
+            timeline_span("compress", compress_start_us);
         }
+        uint64_t batch_start_us = now_us();
         
-        drain_throttle(2);
+        /* Don't build a frame behind more than a window of backlog */
+        drain_throttle(drain, atomic_load(&drain->window));
+        
+        /*
+         * Cache hits first: copy from cache slots before any fill in
+         * this frame can overwrite a slot that LRU just evicted.
+         */
+        int cached_tiles = 0;
+        for (int i = 0; i < hit_count; i++) {
+            struct cache_hit *hit = &hits[i];
+            int sx, sy;
+            cache_slot_xy(draw, hit->slot, &sx, &sy);
+            
+            if (off + 45 > max_batch && off > 0)
+                batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+            off += cmd_copy(batch + off, draw->image_id, draw->cache_id,
+                           draw->opaque_id, hit->x1, hit->y1,
+                           hit->x1 + TILE_SIZE, hit->y1 + TILE_SIZE, sx, sy);
+            
+            fb_tile_copy(s, s->prev_framebuf, send_buf, hit->x1 / TILE_SIZE,
+                         hit->y1 / TILE_SIZE, TILE_SIZE, TILE_SIZE);
+            bytes_raw += TILE_SIZE * TILE_SIZE * 4;
+            bytes_sent += 45;
+            cached_tiles++;
+            tile_count++;
+        }
+        
+        /*
+         * Solid tiles: grow each rectangle right over same-color tiles,
+         * then down while the whole span matches, and draw it with a
+         * single fill.  A full-screen clear becomes one command.
+         */
+        int solid_tiles = 0, fill_rects = 0;
+        for (int ty = 0; ty < s->tiles_y && solid_count > 0; ty++) {
+            for (int tx = 0; tx < s->tiles_x; tx++) {
+                int idx = ty * s->tiles_x + tx;
+                if (!solid_map[idx]) continue;
+                uint32_t color = solid_color[idx];
+                
+                int tx2 = tx + 1;
+                while (tx2 < s->tiles_x && solid_map[ty * s->tiles_x + tx2] &&
+                       solid_color[ty * s->tiles_x + tx2] == color)
+                    tx2++;
+                int ty2 = ty + 1;
+                for (; ty2 < s->tiles_y; ty2++) {
+                    int i = tx;
+                    while (i < tx2 && solid_map[ty2 * s->tiles_x + i] &&
+                           solid_color[ty2 * s->tiles_x + i] == color)
+                        i++;
+                    if (i < tx2) break;
+                }
+                for (int y = ty; y < ty2; y++)
+                    memset(&solid_map[y * s->tiles_x + tx], 0, tx2 - tx);
+                
+                int x1 = tx * TILE_SIZE, y1 = ty * TILE_SIZE;
+                int x2 = tx2 * TILE_SIZE, y2 = ty2 * TILE_SIZE;
+                if (x2 > s->width) x2 = s->width;
+                if (y2 > s->height) y2 = s->height;
+                
+                if (off + FILL_RELOAD_SIZE + 45 > max_batch && off > 0)
+                    batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+                size_t start = off;
+                uint32_t fill_id = fill_palette_get(palette, draw, color, batch, &off);
+                off += cmd_fill(batch + off, draw->image_id, fill_id,
+                               draw->opaque_id, x1, y1, x2, y2);
+                
+                if (s->tile_major) {
+                    for (int y = ty; y < ty2; y++)
+                        for (int x = tx; x < tx2; x++) {
+                            uint32_t *p = fb_tile(s, s->prev_framebuf, x, y);
+                            for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++) p[i] = color;
+                        }
+                } else {
+                    for (int y = y1; y < y2; y++) {
+                        uint32_t *row = &s->prev_framebuf[y * s->width];
+                        for (int x = x1; x < x2; x++) row[x] = color;
+                    }
+                }
+                int n = (tx2 - tx) * (ty2 - ty);
+                bytes_raw += (size_t)(x2 - x1) * (y2 - y1) * 4;
+                bytes_sent += off - start;
+                solid_tiles += n;
+                tile_count += n;
+                fill_rects++;
+            }
+        }
         
         /* Build and send batches */
+        int merged_tiles = 0;
+        int band = -1, band_work_end = 0, tasks_waited = 0;
         for (int i = 0; i < work_count; i++) {
+            if (i >= band_work_end) {
+                /* Next band: wait for its tiles and candidates, then
+                 * decide which candidates replace their tiles */
+                do band++; while (bands[band].work_end <= i);
+                int task_end = bands[band].work_end + bands[band].rect_end;
+                if (streaming) {
+                    /* Let the wire work while we wait on the workers */
+                    if (tasks_waited < task_end &&
+                        !parallel_stream_ready(stream, task_end - 1))
+                        send_flush(p9);
+                    for (; tasks_waited < task_end; tasks_waited++)
+                        parallel_stream_wait(stream, tasks_waited);
+                }
+                if (use_coalesce) {
+                    int rect_start = band > 0 ? bands[band - 1].rect_end : 0;
+                    merged_tiles += coalesce_accept(&coalesce, rect_start,
+                                                    bands[band].rect_end,
+                                                    work, results, work_rect);
+                }
+                band_work_end = bands[band].work_end;
+            }
+            
             struct tile_work *tw = &work[i];
             struct tile_result *r = &results[i];
             int x1 = tw->x1, y1 = tw->y1;
             int x2 = x1 + tw->w, y2 = y1 + tw->h;
             int raw_size = tw->w * tw->h * 4;
-            
-            /* Single-threaded fallback */
-            if (nthreads == 0) {
-                int res = compress_tile_adaptive(comp_buf, comp_buf_size,
-                                                  tw->pixels, tw->stride,
-                                                  tw->prev_pixels, tw->prev_stride,
-                                                  x1, y1, tw->w, tw->h);
-                r->is_delta = (res > 0);
-                r->size = (res > 0) ? res : (res < 0) ? -res : 0;
-                if (r->size > 0) memcpy(r->data, comp_buf, r->size);
-            }
+            int rect_idx = use_coalesce ? work_rect[i] : -1;
             
             bytes_raw += raw_size;
+            if (use_predict) predict_record(predict, tw, r);
             
-            size_t tile_size = (r->size > 0)
-                ? (21 + r->size + (r->is_delta ? ALPHA_DELTA_OVERHEAD : 0))
-                : (21 + raw_size);
-            
-            /* Flush if batch full */
-            if (off + tile_size > max_batch && off > 0) {
-                if (p9_write_send(p9, draw->drawdata_fid, 0, batch, off) < 0) {
-                    memset(s->prev_framebuf, 0xDE, s->width * s->height * 4);
-                    s->send_full = 1;
+            if (rect_idx >= 0) {
+                /* Covered by a merged load, emitted with its first tile */
+                struct coalesce_rect *cr = &coalesce.rects[rect_idx];
+                if (cr->first == i) {
+                    int rect_raw = cr->w * cr->h * 4;
+                    size_t rect_size = 21 + (cr->size > 0 ? cr->size : rect_raw);
+                    if (off + rect_size > max_batch && off > 0)
+                        batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+                    if (cr->size > 0) {
+                        off += cmd_load_hdr(batch + off, draw->image_id, cr->x1, cr->y1,
+                                            cr->x1 + cr->w, cr->y1 + cr->h);
+                        memcpy(batch + off, cr->data, cr->size);
+                        off += cr->size;
+                        bytes_sent += cr->size;
+                    } else {
+                        off += cmd_loadraw_hdr(batch + off, draw->image_id, cr->x1, cr->y1,
+                                               cr->x1 + cr->w, cr->y1 + cr->h);
+                        for (int row = 0; row < cr->h; row++) {
+                            memcpy(batch + off,
+                                   &send_buf[(cr->y1 + row) * s->width + cr->x1], cr->w * 4);
+                            off += cr->w * 4;
+                        }
+                        bytes_sent += rect_raw;
+                    }
+                    merged_rects++;
                 }
-                drain_notify();
-                batch_count++;
-                off = 0;
-            }
-            
-            /* Write tile command */
-            if (r->size > 0) {
-                uint32_t img_id = r->is_delta ? draw->delta_id : draw->image_id;
-                off += cmd_load_hdr(batch + off, img_id, x1, y1, x2, y2);
-                memcpy(batch + off, r->data, r->size);
-                off += r->size;
+                if (work_slot[i] >= 0 && off + 45 > max_batch && off > 0)
+                    batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+            } else {
+                size_t tile_size = (r->size > 0)
+                    ? (21 + r->size + (r->is_delta ? ALPHA_DELTA_OVERHEAD : 0))
+                    : (21 + raw_size);
+                if (work_slot[i] >= 0) tile_size += 45;  /* cache fill */
+                
+                /* Flush if batch full */
+                if (off + tile_size > max_batch && off > 0)
+                    batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
                 
-                if (r->is_delta) {
-                    /* Composite delta onto image */
-                    off += cmd_draw(batch + off, draw->image_id, draw->delta_id,
-                                   draw->delta_id, x1, y1, x2, y2, x1, y1, x1, y1);
-                    bytes_sent += r->size + ALPHA_DELTA_OVERHEAD;
-                    delta_tiles++;
+                /* Write tile command */
+                if (r->size > 0) {
+                    uint32_t img_id = r->is_delta ? draw->delta_id : draw->image_id;
+                    off += cmd_load_hdr(batch + off, img_id, x1, y1, x2, y2);
+                    memcpy(batch + off, r->data, r->size);
+                    off += r->size;
+                
+                    if (r->is_delta) {
+                        /* Composite delta onto image */
+                        off += cmd_draw(batch + off, draw->image_id, draw->delta_id,
+                                       draw->delta_id, x1, y1, x2, y2, x1, y1, x1, y1);
+                        bytes_sent += r->size + ALPHA_DELTA_OVERHEAD;
+                        delta_tiles++;
+                    } else {
+                        bytes_sent += r->size;
+                        comp_tiles++;
+                    }
                 } else {
-                    bytes_sent += r->size;
-                    comp_tiles++;
-                }
-            } else {
-                /* Uncompressed */
-                off += cmd_loadraw_hdr(batch + off, draw->image_id, x1, y1, x2, y2);
-                for (int row = 0; row < tw->h; row++) {
-                    memcpy(batch + off, &send_buf[(y1 + row) * s->width + x1], tw->w * 4);
-                    off += tw->w * 4;
+                    /* Uncompressed */
+                    off += cmd_loadraw_hdr(batch + off, draw->image_id, x1, y1, x2, y2);
+                    for (int row = 0; row < tw->h; row++) {
+                        memcpy(batch + off, tw->pixels + row * tw->stride, tw->w * 4);
+                        off += tw->w * 4;
+                    }
+                    bytes_sent += raw_size;
                 }
-                bytes_sent += raw_size;
             }
             
-            /* Update prev_framebuf */
-            for (int row = 0; row < tw->h; row++) {
-                memcpy(&s->prev_framebuf[(y1 + row) * s->width + x1],
-                       &send_buf[(y1 + row) * s->width + x1], tw->w * 4);
+            /* Fill the reserved cache slot from the freshly loaded tile */
+            if (work_slot[i] >= 0) {
+                int sx, sy;
+                cache_slot_xy(draw, work_slot[i], &sx, &sy);
+                off += cmd_copy(batch + off, draw->cache_id, draw->image_id,
+                               draw->opaque_id, sx, sy,
+                               sx + TILE_SIZE, sy + TILE_SIZE, x1, y1);
             }
+            
+            /* Update prev_framebuf */
+            fb_tile_copy(s, s->prev_framebuf, send_buf, x1 / TILE_SIZE, y1 / TILE_SIZE,
+                         tw->w, tw->h);
             tile_count++;
         }
+        if (streaming) {
+            parallel_stream_finish(stream);
+            metrics_observe(METRIC_COMPRESS, now_us() - compress_start_us);
+            timeline_span("compress", compress_start_us);
+        }
+        
+        /* prev_framebuf now matches send_buf unless tiles went lossy
+         * or were held back; only then may scroll detection reuse this
+         * frame's spectra */
+        scroll_frame_sent(s, pace->lossy_count == 0 && prio->held_count == 0);
         
         /* Final batch with copy-to-screen + flush */
-        if (tile_count > 0 || scrolled_regions > 0) {
+        if (tile_count > 0 || scrolled_regions > 0 || present_pending) {
+            present_pending = 0;
             size_t footer_size = 45 + 1;  /* copy-to-screen + flush */
-            if (off + footer_size > max_batch && off > 0) {
-                if (p9_write_send(p9, draw->drawdata_fid, 0, batch, off) < 0) {
-                    memset(s->prev_framebuf, 0xDE, s->width * s->height * 4);
-                    s->send_full = 1;
-                }
-                drain_notify();
-                batch_count++;
-                off = 0;
-            }
+            if (off + footer_size > max_batch && off > 0)
+                batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
             
             /* Copy visible area to window — Plan 9 clips the rest */
             off += cmd_copy(batch + off, draw->screen_id, draw->image_id,
@@ -695,12 +1906,28 @@ void *send_thread_func(void *arg) {
             /* Flush */
             off += cmd_flush(batch + off);
             
-            if (p9_write_send(p9, draw->drawdata_fid, 0, batch, off) < 0) {
-                memset(s->prev_framebuf, 0xDE, s->width * s->height * 4);
-                s->send_full = 1;
+            batch_flush(s, p9, draw->drawdata_fid, batch, &off, &batch_count);
+            pace_frame_sent(pace, drain, bytes_sent, frame_start_us);
+            metrics_observe(METRIC_BATCH, now_us() - batch_start_us);
+            timeline_span("batch", batch_start_us);
+            
+            metrics_add(METRIC_FRAMES, 1);
+            metrics_add(METRIC_TILES, tile_count);
+            metrics_add(METRIC_TILES_COMPRESSED, comp_tiles);
+            metrics_add(METRIC_TILES_DELTA, delta_tiles);
+            metrics_add(METRIC_TILES_MERGED, merged_tiles);
+            metrics_add(METRIC_TILES_SOLID, solid_tiles);
+            metrics_add(METRIC_TILES_RAW, tile_count - comp_tiles - delta_tiles -
+                                          merged_tiles - solid_tiles - cached_tiles);
+            metrics_add(METRIC_CACHE_HITS, cached_tiles);
+            metrics_add(METRIC_CACHE_MISSES, miss_count);
+            metrics_add(METRIC_BYTES_RAW, bytes_raw);
+            metrics_add(METRIC_BYTES_SENT, bytes_sent);
+            if (!s->root) {     /* Gauges are the root window's (metrics.h) */
+                metrics_set(METRIC_DRAIN_WINDOW, atomic_load(&drain->window));
+                metrics_set(METRIC_DRAIN_PENDING, atomic_load(&drain->pending));
+                metrics_set(METRIC_EFFORT, effort);
             }
-            drain_notify();
-            batch_count++;
             
             if (!draw->xor_enabled && tile_count > 0) {
                 draw->xor_enabled = 1;
@@ -708,24 +1935,64 @@ void *send_thread_func(void *arg) {
             }
             
             send_count++;
+            if (send_count == 1 && s->first_frame)
+                s->first_frame(s);
             if (send_count % 30 == 0) {
                 int ratio = bytes_raw > 0 ? (int)(bytes_sent * 100 / bytes_raw) : 100;
-                wlr_log(WLR_INFO, "Send #%d: %d tiles (%d comp, %d delta) %zu->%zu (%d%%) [%d batches]",
-                        send_count, tile_count, comp_tiles, delta_tiles,
+                wlr_log(WLR_INFO, "Send #%d: %d tiles (%d comp, %d delta, %d cached, %d solid in %d fills, %d merged in %d loads) %zu->%zu (%d%%) [%d batches]",
+                        send_count, tile_count, comp_tiles, delta_tiles, cached_tiles,
+                        solid_tiles, fill_rects, merged_tiles, merged_rects,
                         bytes_raw, bytes_sent, ratio, batch_count);
+                pthread_mutex_lock(&drain->lock);
+                wlr_log(WLR_INFO, "Drain: window %d, srtt %.1fms, min rtt %.1fms, %.1f MB/s, effort %d%s",
+                        atomic_load(&drain->window), drain->srtt_us / 1000.0,
+                        drain->min_rtt_us / 1000.0, drain_bw_locked(drain),
+                        effort, s->compress_effort < 0 ? " (auto)" : "");
+                pthread_mutex_unlock(&drain->lock);
+                if (predict->checks > 0 || predict->skipped > 0) {
+                    wlr_log(WLR_INFO, "Predict: %d%% of %d verified tiles, %d LZ77 passes skipped",
+                            predict->checks > 0 ? predict->hits * 100 / predict->checks : 0,
+                            predict->checks, predict->skipped);
+                    predict->checks = predict->hits = predict->skipped = 0;
+                }
+                if (reused_tiles > 0) {
+                    wlr_log(WLR_INFO, "Scroll: %d tiles reused verification trials",
+                            reused_tiles);
+                    reused_tiles = 0;
+                }
+                wlr_log(WLR_INFO, "Pace: %d renders deferred, %d lossy tiles%s",
+                        atomic_exchange(&pace->deferrals, 0), pace->lossy_count,
+                        degrade ? " (degraded)" : "");
+                if (prio->held_total > 0) {
+                    wlr_log(WLR_INFO, "Priority: %d background tile updates held",
+                            prio->held_total);
+                    prio->held_total = 0;
+                }
+                if (cache->nslots > 0) {
+                    wlr_log(WLR_INFO, "Tile cache: %llu hits, %llu misses, %llu evictions",
+                            (unsigned long long)cache->hits,
+                            (unsigned long long)cache->misses,
+                            (unsigned long long)cache->evictions);
+                }
             }
         }
         
+        /* Nothing of this frame may stay queued */
+        send_flush(p9);
+        metrics_observe(METRIC_FRAME, now_us() - frame_start_us);
+        timeline_span("frame", frame_start_us);
+        
         pthread_mutex_lock(&s->send_lock);
         s->active_buf = -1;
         pthread_mutex_unlock(&s->send_lock);
     }
     
-    drain_stop();
+    drain_stop(drain);
     compress_pool_shutdown();
-    free(work);
-    free(results);
-    free(comp_buf);
+    tile_cache_free(cache);
+    coalesce_free(&coalesce);
+    arena_fini(&tables);
+    arena_fini(&frame_out);
     free(batch);
     wlr_log(WLR_INFO, "Send thread exiting");
     return NULL;
@@ -22,9 +22,11 @@
  *       - Updates s->prev_framebuf for delta encoding
  *
  *     Drain Thread (I/O helper):
- *       - Reads 9P Rwrite responses asynchronously
- *       - Allows pipelined writes without blocking
- *       - Handles error detection and recovery
+ *       - The reader thread of the draw connection's 9P tag table
+ *         (p9_mux_start, see p9.h), started by the send thread
+ *       - Dispatches Rwrite responses by tag to drain_complete()
+ *       - Allows pipelined writes without blocking, and lets other
+ *         threads issue synchronous RPCs on the same connection
  *       - Signals done_cond after each completed response to wake
  *         drain_throttle() and drain_pause() without polling
  *
@@ -63,12 +65,13 @@
  *     1. output_frame() checks scene_dirty flag — if scene hasn't
  *        changed, skips rendering entirely (no build_state, no copy)
  *     2. When rendering occurs, extracts ostate.damage into dirty_staging
- *     3. Full-frame copy from wlroots buffer to framebuf (always full
- *        because pointer swap recycles buffers with stale data)
- *     4. send_frame() swaps framebuf pointer with send_buf, copies
- *        dirty_staging into dirty_tiles[buf]
+ *     3. Damage-only copy from wlroots buffer to framebuf: tiles in
+ *        dirty_staging ∪ s->fb_stale.  The stale map carries forward
+ *        the damage of frames this recycled buffer missed.
+ *     4. send_frame() swaps framebuf pointer with send_buf (and the
+ *        matching stale maps), copies dirty_staging into dirty_tiles[buf]
  *     5. Send thread uses dirty_tiles to skip undamaged tiles entirely
- *        (no memory read). Damaged tiles are verified with tile_changed()
+ *        (no memory read). Damaged tiles are verified with tilecmp_row()
  *        to confirm they actually differ from prev_framebuf, since the
  *        headless backend reports full-screen damage on every frame
  *        and many "damaged" tiles may be pixel-identical.
@@ -81,25 +84,104 @@
  *
  *   Fallback: when no damage info is available (scroll modified
  *   prev_framebuf, errors, or allocation failure), the send thread
- *   falls back to tile_changed() pixel comparison for all tiles.
+ *   falls back to tilecmp_row() pixel comparison for all tiles.
  *
  * Pipelined I/O:
  *
  *   To maximize throughput, writes are pipelined:
  *
- *     1. Send thread calls p9_write_send() (non-blocking)
- *     2. drain_notify() signals drain thread
- *     3. Drain thread reads Rwrite response asynchronously
- *     4. Drain thread signals done_cond after each completed response to wake
- *        drain_throttle() and drain_pause() without polling
+ *     1. drain_notify() counts the batch as pending
+ *     2. Send thread calls p9_write_send() (non-blocking, takes a tag)
+ *     3. Drain thread reads the Rwrite for that tag asynchronously
+ *     4. drain_complete() decrements pending and signals done_cond to
+ *        wake drain_throttle() and drain_pause() without polling
  *     5. Send thread continues with next batch
  *
+ *   An Rerror fails only its own batch (drain.errors, plus the
+ *   unknown id / short flags on p9). Only a framing desync marks the
+ *   stream broken.
+ *
  *   The drain_throttle() function prevents unbounded pipelining
- *   by waiting on done_cond when too many responses are pending.
+ *   by waiting on done_cond when more than a window of batches is
+ *   pending.
  *   Similarly, drain_pause() waits on done_cond until all pending
  *   responses are drained. Both use condvar waits rather than
  *   polling, so they consume zero CPU while blocked.
  *
+ * In-Flight Window:
+ *
+ *   The window (drain.window, DRAIN_WINDOW_MIN..MAX batches) follows
+ *   the link's bandwidth-delay product instead of a fixed depth:
+ *
+ *     window = 2 × max(delivery rate) × min(RTT) / average batch
+ *
+ *   RTT is measured per Twrite from the moment it reaches the socket
+ *   (p9 stamps it at writev time, not at queue time), so batches
+ *   waiting in the send queue do not count as path delay. Delivery
+ *   rate is sampled over at least one min RTT while batches are
+ *   outstanding. The 2× gain lets the window grow until the rate
+ *   stops rising; on a LAN it settles near the minimum, on a
+ *   long-haul link it opens enough to keep the pipe full.
+ *
+ * Frame Pacing:
+ *
+ *   On a link slower than the render rate, sending every frame would
+ *   only queue stale frames behind the drain throttle. Instead the
+ *   send thread tracks when the link will have delivered what it was
+ *   given:
+ *
+ *     link_free += frame bytes / bandwidth    (drain estimate)
+ *     next      = link_free - one frame time
+ *
+ *   with link_free at most 500 ms ahead of now, so an estimate that
+ *   was too low cannot keep rendering deferred after it recovers.
+ *
+ *   and output_frame() asks send_pace_delay_ms() before rendering.
+ *   A deferred render leaves the scene dirty, so wlroots merges the
+ *   damage of every skipped frame into the next one. The floor set
+ *   by FRAME_INTERVAL_MS still applies.
+ *
+ *   Degradation: within 500 ms of a deferral the link is considered
+ *   under pressure. Tiles that changed in the previous frame as well
+ *   (video, animation) are then quantized to 4 bits per channel
+ *   before compression, in the send buffer itself so prev_framebuf
+ *   matches Plan 9, and marked stale so the output recopies them.
+ *   They stay in a per-tile lossy map and skip the tile cache.
+ *
+ *   Refinement: once pressure is over and no frame came for
+ *   250 ms, the send thread sets s->refine_pending and wakes the
+ *   output for one more frame. Lossy tiles get an unknown hash and
+ *   are forced into the dirty map, so the pixel compare against the
+ *   quantized prev_framebuf resends them losslessly. A scroll while
+ *   lossy tiles exist marks every tile for refinement, since the
+ *   lossy content moved.
+ *
+ * Damage Priority:
+ *
+ *   Commit listeners tag damage with the kind of surface that caused
+ *   it (DAMAGE_FOREGROUND: focused toplevel, its subsurfaces, popups;
+ *   DAMAGE_BACKGROUND: other toplevels), and the tags travel in the
+ *   dirty map bytes (see output.h, "Damage sources"). Under pressure,
+ *   a tile damaged only by background surfaces is held: not sent, its
+ *   hash left as is, and forced into the next frame's candidates. A
+ *   tile is held at most 8 frames in a row, so background animation
+ *   still updates, just at a fraction of the rate, while input in the
+ *   active app is not queued behind it. Held tiles keep the send
+ *   thread asking for a frame, like lossy ones, once pressure ends.
+ *
+ * Compression Effort:
+ *
+ *   Before compressing a frame the send thread picks its effort level
+ *   and hands it to the workers in each tile_work (compress.h), so
+ *   with -w every window compresses at its own link's level. With -E
+ *   it is fixed; in auto mode (the default) it follows the window's
+ *   drain bandwidth estimate:
+ *
+ *     >= 100 MB/s    1 fast      (CPU is the bottleneck)
+ *     10..100 MB/s   2 default
+ *     < 10 MB/s      3 high      (bytes are the bottleneck)
+ *     no estimate    2 default
+ *
  * Frame Processing Pipeline:
  *
  *   For each frame, the send thread:
@@ -111,7 +193,8 @@
  *        - On error: invalidate prev_framebuf, force full frame
  *
  *     2. Window Updates:
- *        - If window_changed, pause drain and relookup window
+ *        - If window_changed, pause drain, relookup window and copy
+ *          image_id to the new window image (no tile resend)
  *        - If resize_pending after relookup, skip frame
  *
  *     3. Scroll Detection (if enabled):
@@ -121,23 +204,47 @@
  *
  *     4. Tile Change Detection:
  *        - If dirty tile bitmap is available and no scroll occurred,
- *          skip undamaged tiles without any memory read, then verify
- *          damaged tiles with tile_changed() to confirm actual changes
- *        - Otherwise fall back to comparing send_buf vs prev_framebuf
- *          for every tile via tile_changed()
- *        - Build list of changed tiles (struct tile_work)
+ *          skip undamaged tiles without any memory read; otherwise
+ *          every tile is a candidate
+ *        - Hash each candidate (tilecmp_hash) and compare with
+ *          s->tile_hash, the hash of what Plan 9 holds; prev_framebuf
+ *          is not read
+ *        - Tiles with unknown hashes (exposed by resize, scrolled, error
+ *          recovery) are compared against prev_framebuf via the SIMD
+ *          tilecmp_row() scan (see tilecmp.h)
+ *        - Set aside single-color tiles (tile_solid_color) for fills
+ *        - Look up full-size changed tiles in the tile cache
+ *          (tilecache.h); hits are set aside as cache copies
+ *        - Build list of remaining changed tiles (struct tile_work)
  *        - Skip tiles in scroll-exposed regions for delta encoding
  *
- *     5. Parallel Compression:
- *        - Call compress_tiles_parallel() on changed tiles
+ *     5. Streaming Compression:
+ *        - coalesce_plan() picks aligned 64×64 blocks / 64×16 rows of
+ *          changed tiles as merge candidates (coalesce.h)
+ *        - parallel_stream_start() compresses tiles and candidates in
+ *          bands of 4 tile rows without blocking the send thread
  *        - Each tile tries both direct and alpha-delta encoding
  *        - Result indicates which encoding was smaller
  *
- *     6. Batch Building:
+ *     6. Batch Building (overlaps step 5):
+ *        - Cache hits and solid fills need no compression and are
+ *          emitted while the workers run
+ *        - Before band b's loads, wait for its tasks in order
+ *          (parallel_stream_wait) and coalesce_accept() its candidates
+ *        - Full batches are written immediately, so the first pixels
+ *          hit the wire before the last band is compressed
+ *
+ *        Commands, in order:
+ *        - Emit 'd' copies cache_id → image_id for cache hits first
+ *        - Merge same-color solid tiles into rectangles and emit one
+ *          'd' fill per rectangle from a 1x1 palette image, reloading
+ *          the least recently used palette entry with 'y' as needed
  *        - Collect compressed tiles into batch buffer
  *        - Flush batch when full (max_batch bytes)
  *        - Use 'Y' command for compressed, 'y' for raw
+ *        - Merged rectangles are loaded once, at their first tile
  *        - For delta tiles: load to delta_id, composite to image_id
+ *        - For cache misses: 'd' copy image_id → cache slot after load
  *
  *     7. Final Batch:
  *        - 'd' command to copy image_id to screen_id
@@ -171,6 +278,21 @@
  *   the destination rectangle to the window bounds, so the padding
  *   pixels are never visible.  No border drawing is needed.
  *
+ * Tile-Major Layout:
+ *
+ *   With -B (s->tile_major) the same buffers store each tile as one
+ *   contiguous 16×16 block (1 KiB), tiles in row order.  The output
+ *   thread converts while copying out of the wlroots buffer, which it
+ *   does anyway; after that hashing, comparison, solid detection,
+ *   compression, raw loads and the prev_framebuf update each walk one
+ *   block instead of 16 rows a frame width apart.  fb_tile() in
+ *   types.h gives a tile's first pixel and row stride in either
+ *   layout.
+ *
+ *   Scroll detection and merged loads (coalesce.h) work on pixel rows
+ *   across tiles and are off in this layout; it suits large screens
+ *   whose damage is scattered rather than scrolled.
+ *
  * Alpha-Delta Mode:
  *
  *   After the first successful frame, draw->xor_enabled is set to 1,
@@ -181,14 +303,15 @@
  *     - Uses 'd' command to composite onto image_id
  *     - Significantly reduces bandwidth for small changes
  *
- *   The 0xDEADBEEF marker in prev_framebuf indicates scroll-exposed
- *   regions where delta encoding should be disabled (no valid reference).
+ *   Tiles marked in s->prev_invalid (scroll-exposed, or everything
+ *   after a lost write) are always resent and never delta encoded,
+ *   since prev_framebuf holds no valid reference for them.
  *
- * Scroll Disabling:
+ * Fractional Scales:
  *
- *   Scroll detection is disabled when s->scale has a fractional
- *   component (non-integer scaling). This is because phase correlation
- *   requires pixel-accurate alignment that fractional scaling breaks.
+ *   Scroll detection runs at every scale. At fractional scales only
+ *   whole physical-pixel shifts are applied, and only where the cost
+ *   verification shows a saving (see "Fractional Scales" in scroll.h).
  *
  * Thread Safety:
  *
@@ -213,17 +336,19 @@
  *   only under s->send_lock in send_frame(), so no additional
  *   synchronization is needed for the staging buffer itself.
  *
- *   drain.lock protects drain.cond and drain.done_cond:
- *     - drain.cond: signaled by drain_wake() (called from drain_notify
- *       and drain_resume) to wake the drain thread when work is available
- *     - drain.done_cond: broadcast by the drain thread after each
- *       completed response; waited on by drain_throttle() and
- *       drain_pause() to sleep until pending count drops
- *
- *   The drain thread uses atomic operations (via <stdatomic.h>) for
- *   its counters: pending, errors, running, paused. This allows the
- *   send thread to read these counters without acquiring drain.lock,
- *   reducing contention on the hot path.
+ *   All drain and pacing state lives in s->send (send_init), so the
+ *   names below refer to one window's pipeline.
+ *
+ *   drain.lock protects drain.done_cond: broadcast by drain_complete()
+ *   (on the drain thread) after each completed response; waited on by
+ *   drain_throttle() and drain_pause() to sleep until pending count
+ *   drops.
+ *
+ *   The drain uses atomic operations (via <stdatomic.h>) for its
+ *   counters: pending, errors, broken, window. This allows the send
+ *   thread to read these counters without acquiring drain.lock,
+ *   reducing contention on the hot path. The estimator state behind
+ *   the window is only touched under drain.lock.
  */
 
 #ifndef SEND_H
@@ -247,17 +372,25 @@ struct server;
  * Swaps the current framebuffer pointer (s->framebuf) with a free send
  * buffer and signals the send thread. This is a zero-copy handoff: the
  * send thread gets the just-rendered frame and the compositor gets a
- * recycled buffer for the next frame. Also copies the dirty tile bitmap
- * from staging (s->dirty_staging) into the per-buffer slot so the send
- * thread knows which tiles changed without pixel scanning.
+ * recycled buffer for the next frame. Also ORs the dirty tile bitmap
+ * from staging (s->dirty_staging) into s->dirty_accum and moves the
+ * accumulated map into the per-buffer slot, so the send thread knows
+ * which tiles changed since the frame it last took without pixel
+ * scanning, and swaps
+ * s->fb_stale with s->send_stale[buf] so each stale map stays attached
+ * to the buffer it describes.
  *
  * Buffer selection:
  *   - Finds a buffer that is neither pending nor active
- *   - If no buffer is free, the frame is dropped (throttling)
+ *   - If no buffer is free, the frame is dropped (throttling); its
+ *     damage stays in dirty_accum for the next handoff
+ *   - A pending buffer the send thread never took is superseded, and
+ *     its dirty map is merged into the new one
  *
  * Flags copied:
  *   - If s->force_full_frame is set, s->send_full is set
- *   - If s->dirty_staging_valid is set, dirty_tiles[buf] is populated
+ *   - dirty_tiles[buf] is valid only if every frame merged into it
+ *     had valid damage (dirty_staging_valid)
  *
  * This function returns immediately after the swap; actual transmission
  * happens asynchronously in the send thread.
@@ -291,13 +424,50 @@ void send_frame(struct server *s);
  */
 int send_timer_callback(void *data);
 
+/* ============== Frame Pacing ============== */
+
+/*
+ * How long the output should wait before rendering the next frame.
+ *
+ * Called by output_frame() on the compositor thread. Returns 0 to
+ * render now, or a delay in milliseconds (at most 250): the link is
+ * still delivering earlier frames, or both send buffers are busy.
+ * A deferral because of the link puts the send thread under pressure
+ * (see "Frame Pacing" above).
+ *
+ * Thread-safe: takes s->send_lock briefly.
+ */
+int send_pace_delay_ms(struct server *s);
+
+/* ============== Pipeline State ============== */
+
+/*
+ * Allocate the send thread's state between frames (s->send): drain
+ * window, pacing, path prediction, damage priority, tile cache index,
+ * fill palette, and scroll detection (scroll_init()).
+ *
+ * Call before starting send_thread_func() on s. Each server has its
+ * own, so several send threads can run side by side, one per Plan 9
+ * window (see window.h); only the worker pool is shared.
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int send_init(struct server *s);
+
+/*
+ * Free s->send and s->scroll. Call after the send thread has been
+ * joined. Safe if send_init() failed or was never called.
+ */
+void send_cleanup(struct server *s);
+
 /* ============== Send Thread ============== */
 
 /*
  * Send thread main function.
  *
- * Runs in a dedicated thread, processing queued frames. Starts the
- * drain thread for asynchronous I/O and allocates compression buffers.
+ * Runs in a dedicated thread, processing queued frames. Multiplexes
+ * the draw connection (starting the drain thread for asynchronous
+ * I/O) and allocates compression buffers.
  *
  * Main loop behavior:
  *
@@ -317,7 +487,8 @@ int send_timer_callback(void *data);
  *   - Fatal 9P connection error
  *
  * Cleanup on exit:
- *   - Stops drain thread
+ *   - Waits for outstanding writes (the reader stays until
+ *     p9_disconnect)
  *   - Shuts down compression pool
  *   - Frees work arrays and buffers
  *
@@ -0,0 +1,160 @@
+/*
+ * tilecache.c - Content-addressed cache of tiles held by the Plan 9 server
+ *
+ * Hash table with linear probing and backward-shift deletion, plus an
+ * array-based LRU list. See tilecache.h for the per-frame protocol.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tilecache.h"
+
+/* ============== Internal Helpers ============== */
+
+static inline uint32_t bucket_of(const struct tile_cache *tc, uint64_t hash) {
+    return (uint32_t)(hash ^ (hash >> 32)) & tc->table_mask;
+}
+
+static void lru_unlink(struct tile_cache *tc, int32_t n) {
+    int32_t p = tc->lru_prev[n], x = tc->lru_next[n];
+    if (p >= 0) tc->lru_next[p] = x; else tc->lru_head = x;
+    if (x >= 0) tc->lru_prev[x] = p; else tc->lru_tail = p;
+    tc->lru_prev[n] = tc->lru_next[n] = -1;
+}
+
+static void lru_push_front(struct tile_cache *tc, int32_t n) {
+    tc->lru_prev[n] = -1;
+    tc->lru_next[n] = tc->lru_head;
+    if (tc->lru_head >= 0) tc->lru_prev[tc->lru_head] = n;
+    tc->lru_head = n;
+    if (tc->lru_tail < 0) tc->lru_tail = n;
+}
+
+/* Find bucket holding hash, or -1 */
+static int32_t table_find(const struct tile_cache *tc, uint64_t hash) {
+    uint32_t b = bucket_of(tc, hash);
+    for (;;) {
+        int32_t n = tc->table[b];
+        if (n < 0) return -1;
+        if (tc->slot_hash[n] == hash) return (int32_t)b;
+        b = (b + 1) & tc->table_mask;
+    }
+}
+
+static void table_insert(struct tile_cache *tc, uint64_t hash, int32_t slot) {
+    uint32_t b = bucket_of(tc, hash);
+    while (tc->table[b] >= 0)
+        b = (b + 1) & tc->table_mask;
+    tc->table[b] = slot;
+}
+
+/* Remove the entry in bucket b, shifting later probes back */
+static void table_remove_bucket(struct tile_cache *tc, uint32_t b) {
+    uint32_t hole = b;
+    uint32_t i = b;
+    for (;;) {
+        i = (i + 1) & tc->table_mask;
+        int32_t n = tc->table[i];
+        if (n < 0) break;
+        uint32_t home = bucket_of(tc, tc->slot_hash[n]);
+        /* Move n into the hole if its home is not in (hole, i] */
+        if (((i - home) & tc->table_mask) >= ((i - hole) & tc->table_mask)) {
+            tc->table[hole] = n;
+            hole = i;
+        }
+    }
+    tc->table[hole] = -1;
+}
+
+/* ============== Public API ============== */
+
+int tile_cache_init(struct tile_cache *tc, int nslots) {
+    memset(tc, 0, sizeof(*tc));
+    if (nslots <= 0) return -1;
+
+    /* Table at >= 2x slots keeps probe chains short */
+    uint32_t tsize = 1;
+    while (tsize < (uint32_t)nslots * 2) tsize <<= 1;
+
+    tc->slot_hash = calloc(nslots, sizeof(uint64_t));
+    tc->slot_gen = calloc(nslots, sizeof(uint32_t));
+    tc->lru_prev = malloc(nslots * sizeof(int32_t));
+    tc->lru_next = malloc(nslots * sizeof(int32_t));
+    tc->table = malloc(tsize * sizeof(int32_t));
+    if (!tc->slot_hash || !tc->slot_gen || !tc->lru_prev ||
+        !tc->lru_next || !tc->table) {
+        tile_cache_free(tc);
+        return -1;
+    }
+
+    tc->nslots = nslots;
+    tc->table_mask = tsize - 1;
+    tile_cache_reset(tc);
+    return 0;
+}
+
+void tile_cache_free(struct tile_cache *tc) {
+    free(tc->slot_hash);
+    free(tc->slot_gen);
+    free(tc->lru_prev);
+    free(tc->lru_next);
+    free(tc->table);
+    memset(tc, 0, sizeof(*tc));
+}
+
+void tile_cache_reset(struct tile_cache *tc) {
+    if (tc->nslots <= 0) return;
+
+    memset(tc->slot_hash, 0, tc->nslots * sizeof(uint64_t));
+    memset(tc->slot_gen, 0, tc->nslots * sizeof(uint32_t));
+    memset(tc->table, 0xFF, (tc->table_mask + 1) * sizeof(int32_t));
+
+    /* Chain all slots head→tail as n-1 ... 0; slot 0 is reused first */
+    for (int i = 0; i < tc->nslots; i++) {
+        tc->lru_next[i] = i - 1;
+        tc->lru_prev[i] = (i + 1 < tc->nslots) ? i + 1 : -1;
+    }
+    tc->lru_head = tc->nslots - 1;
+    tc->lru_tail = 0;
+    tc->gen = 1;
+}
+
+void tile_cache_begin_frame(struct tile_cache *tc) {
+    tc->gen++;
+    if (tc->gen == 0) tc->gen = 1;
+}
+
+enum tile_cache_result tile_cache_lookup_or_insert(struct tile_cache *tc,
+                                                   uint64_t hash, int *slot) {
+    int32_t b = table_find(tc, hash);
+    if (b >= 0) {
+        int32_t n = tc->table[b];
+        if (tc->slot_gen[n] == tc->gen) {
+            *slot = -1;
+            return TILE_CACHE_PENDING;
+        }
+        lru_unlink(tc, n);
+        lru_push_front(tc, n);
+        tc->hits++;
+        *slot = n;
+        return TILE_CACHE_HIT;
+    }
+
+    /* Evict least recently used slot */
+    int32_t n = tc->lru_tail;
+    if (tc->slot_hash[n] != 0) {
+        int32_t old = table_find(tc, tc->slot_hash[n]);
+        if (old >= 0) table_remove_bucket(tc, (uint32_t)old);
+        tc->evictions++;
+    }
+    lru_unlink(tc, n);
+    lru_push_front(tc, n);
+
+    tc->slot_hash[n] = hash;
+    tc->slot_gen[n] = tc->gen;
+    table_insert(tc, hash, n);
+    tc->misses++;
+    *slot = n;
+    return TILE_CACHE_MISS;
+}
@@ -0,0 +1,106 @@
+/*
+ * tilecache.h - Content-addressed cache of tiles held by the Plan 9 server
+ *
+ * Many frames repeat tiles that were already uploaded: toolbar icons,
+ * alternating list rows, glyph cells in terminals. The tile cache
+ * remembers recently uploaded tiles in a dedicated server-side image
+ * (draw->cache_id) so a repeat costs one 45-byte 'd' copy instead of
+ * a compressed load.
+ *
+ * Server-Side Layout:
+ *
+ *   The cache image is an XRGB32 image of cache_cols × cache_rows
+ *   slots, each TILE_SIZE × TILE_SIZE pixels, allocated by init_draw()
+ *   next to image_id and delta_id. Its size is bounded by the -C
+ *   option (MiB of server memory, 0 disables the cache).
+ *
+ *     slot n  →  x = (n % cols) * TILE_SIZE,  y = (n / cols) * TILE_SIZE
+ *
+ * Client-Side Index:
+ *
+ *   struct tile_cache maps 64-bit tile hashes (tilecmp_hash) to slots
+ *   with an open-addressing table (linear probing, backward-shift
+ *   deletion) and keeps slots on an intrusive LRU list. Everything is
+ *   preallocated at init; lookups and inserts never allocate.
+ *
+ * Per-Frame Protocol (send thread):
+ *
+ *   tile_cache_begin_frame()       bump frame generation
+ *   tile_cache_lookup_or_insert()  per changed full-size tile:
+ *
+ *     TILE_CACHE_HIT      slot holds the content; emit
+ *                         cmd_copy(image_id ← cache_id) and skip the
+ *                         tile's compression and load entirely
+ *     TILE_CACHE_MISS     slot was (re)assigned; send the tile normally
+ *                         and then emit cmd_copy(cache_id ← image_id)
+ *                         to fill the slot
+ *     TILE_CACHE_PENDING  same hash was inserted earlier this frame and
+ *                         is not filled yet; send normally, no fill
+ *
+ *   Hit copies are emitted before any load or fill of the frame, so a
+ *   slot evicted later in the same frame is still intact when read.
+ *
+ * Invalidation:
+ *
+ *   tile_cache_reset() forgets every slot. The send thread calls it
+ *   whenever a batch may have been lost (write or drain errors), since
+ *   a lost fill would leave a slot with undefined content.
+ */
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <stdint.h>
+
+enum tile_cache_result {
+    TILE_CACHE_HIT,
+    TILE_CACHE_MISS,
+    TILE_CACHE_PENDING
+};
+
+struct tile_cache {
+    int nslots;
+    uint64_t *slot_hash;    /* Hash stored in each slot (0 = empty) */
+    uint32_t *slot_gen;     /* Frame generation of last insert */
+    int32_t *lru_prev;      /* LRU list links (-1 = none) */
+    int32_t *lru_next;
+    int32_t lru_head;       /* Most recently used */
+    int32_t lru_tail;       /* Least recently used (next victim) */
+    int32_t *table;         /* Hash → slot index (-1 = empty bucket) */
+    uint32_t table_mask;
+    uint32_t gen;           /* Current frame generation */
+
+    /* Statistics (reset by caller as needed) */
+    uint64_t hits, misses, evictions;
+};
+
+/*
+ * Allocate an index for nslots cache slots.
+ *
+ * Returns 0 on success, -1 on allocation failure or nslots <= 0.
+ * On failure tc is left zeroed (tc->nslots == 0 means "disabled").
+ */
+int tile_cache_init(struct tile_cache *tc, int nslots);
+
+/* Release the index. Safe on a zeroed or already freed cache. */
+void tile_cache_free(struct tile_cache *tc);
+
+/* Forget all cached tiles (server image content is now undefined). */
+void tile_cache_reset(struct tile_cache *tc);
+
+/* Start a new frame; entries inserted before this are fillable hits. */
+void tile_cache_begin_frame(struct tile_cache *tc);
+
+/*
+ * Look up a tile hash, inserting it on miss.
+ *
+ * tc:    cache index (must be initialized)
+ * hash:  tile content hash (non-zero)
+ * slot:  output - slot index for HIT and MISS, -1 for PENDING
+ *
+ * Returns TILE_CACHE_HIT, TILE_CACHE_MISS or TILE_CACHE_PENDING.
+ */
+enum tile_cache_result tile_cache_lookup_or_insert(struct tile_cache *tc,
+                                                   uint64_t hash, int *slot);
+
+#endif /* TILECACHE_H */
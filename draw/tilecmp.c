@@ -0,0 +1,277 @@
+/*
+ * tilecmp.c - SIMD tile comparison kernels with runtime dispatch
+ *
+ * Every kernel is generated from a 64-byte row compare (one TILE_SIZE
+ * row of XRGB32 pixels) by DEFINE_TILECMP_KERNEL. x86 kernels carry
+ * per-function target attributes so the file builds without -mavx2.
+ *
+ * See tilecmp.h for the dispatch and row-scan design.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <pthread.h>
+#include <wlr/util/log.h>
+
+#include "tilecmp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TILECMP_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define TILECMP_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Pixels per tile row handled by the vector kernels */
+#define ROW_PIXELS 16
+
+/* changed[] scan states (final output is 0 or 1) */
+#define TILE_SAME     0
+#define TILE_DIFF     1
+#define TILE_PENDING  2
+
+/* ============== Row Compare Primitives ============== */
+
+static inline int row16_scalar(const uint32_t *a, const uint32_t *b) {
+    return memcmp(a, b, ROW_PIXELS * 4) != 0;
+}
+
+#ifdef TILECMP_X86
+__attribute__((target("avx2")))
+static inline int row16_avx2(const uint32_t *a, const uint32_t *b) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)a);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(a + 8));
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)b);
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + 8));
+    __m256i x = _mm256_or_si256(_mm256_xor_si256(a0, b0),
+                                _mm256_xor_si256(a1, b1));
+    return !_mm256_testz_si256(x, x);
+}
+
+__attribute__((target("sse4.1")))
+static inline int row16_sse41(const uint32_t *a, const uint32_t *b) {
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a),
+                               _mm_loadu_si128((const __m128i *)b));
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 4)),
+                               _mm_loadu_si128((const __m128i *)(b + 4)));
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 8)),
+                               _mm_loadu_si128((const __m128i *)(b + 8)));
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 12)),
+                               _mm_loadu_si128((const __m128i *)(b + 12)));
+    __m128i x = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+    return !_mm_testz_si128(x, x);
+}
+#endif
+
+#ifdef TILECMP_NEON
+static inline int row16_neon(const uint32_t *a, const uint32_t *b) {
+    uint32x4_t x0 = veorq_u32(vld1q_u32(a),      vld1q_u32(b));
+    uint32x4_t x1 = veorq_u32(vld1q_u32(a + 4),  vld1q_u32(b + 4));
+    uint32x4_t x2 = veorq_u32(vld1q_u32(a + 8),  vld1q_u32(b + 8));
+    uint32x4_t x3 = veorq_u32(vld1q_u32(a + 12), vld1q_u32(b + 12));
+    uint32x4_t x = vorrq_u32(vorrq_u32(x0, x1), vorrq_u32(x2, x3));
+    return vmaxvq_u32(x) != 0;
+}
+#endif
+
+/* ============== Generic (any width) Tile Compare ============== */
+
+static int tile_generic(const uint32_t *curr, const uint32_t *prev, int stride,
+                        int x1, int y1, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        if (memcmp(&curr[(y1 + y) * stride + x1],
+                   &prev[(y1 + y) * stride + x1], w * 4) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* ============== Kernel Generator ============== */
+
+/*
+ * Generate tile_<name>() and row_<name>() from a row16 primitive.
+ *
+ * tile_<name>: compare one tile; full-width tiles use row16, partial
+ *              tiles fall back to tile_generic.
+ * row_<name>:  scan a tile row scanline by scanline, dropping tiles
+ *              from the scan once a difference is found.
+ */
+#define DEFINE_TILECMP_KERNEL(name, attr, row16)                              \
+attr static int tile_##name(const uint32_t *curr, const uint32_t *prev,      \
+                            int stride, int x1, int y1, int w, int h) {      \
+    if (w != ROW_PIXELS)                                                      \
+        return tile_generic(curr, prev, stride, x1, y1, w, h);               \
+    const uint32_t *c = curr + y1 * stride + x1;                              \
+    const uint32_t *p = prev + y1 * stride + x1;                              \
+    for (int y = 0; y < h; y++, c += stride, p += stride)                     \
+        if (row16(c, p)) return 1;                                            \
+    return 0;                                                                 \
+}                                                                             \
+attr static int row_##name(const uint32_t *curr, const uint32_t *prev,       \
+                           int stride, int y1, int h, int tiles_x,            \
+                           uint8_t *changed, int pending) {                   \
+    int nfull = stride / ROW_PIXELS;                                          \
+    if (nfull > tiles_x) nfull = tiles_x;                                     \
+    int found = 0;                                                            \
+    for (int y = 0; y < h && pending > 0; y++) {                              \
+        const uint32_t *c = curr + (y1 + y) * stride;                         \
+        const uint32_t *p = prev + (y1 + y) * stride;                         \
+        for (int tx = 0; tx < nfull; tx++) {                                  \
+            if (changed[tx] != TILE_PENDING) continue;                        \
+            if (row16(c + tx * ROW_PIXELS, p + tx * ROW_PIXELS)) {            \
+                changed[tx] = TILE_DIFF;                                      \
+                found++;                                                      \
+                if (--pending == 0) break;                                    \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+    return found;                                                             \
+}
+
+DEFINE_TILECMP_KERNEL(scalar, , row16_scalar)
+#ifdef TILECMP_X86
+DEFINE_TILECMP_KERNEL(avx2, __attribute__((target("avx2"))), row16_avx2)
+DEFINE_TILECMP_KERNEL(sse41, __attribute__((target("sse4.1"))), row16_sse41)
+#endif
+#ifdef TILECMP_NEON
+DEFINE_TILECMP_KERNEL(neon, , row16_neon)
+#endif
+
+/* ============== Dispatch ============== */
+
+typedef int (*tile_kernel_fn)(const uint32_t *, const uint32_t *, int,
+                              int, int, int, int);
+typedef int (*row_kernel_fn)(const uint32_t *, const uint32_t *, int,
+                             int, int, int, uint8_t *, int);
+
+static struct {
+    tile_kernel_fn tile;
+    row_kernel_fn row;
+    const char *name;
+} kernel = { tile_scalar, row_scalar, "scalar" };
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+#if TILE_SIZE == ROW_PIXELS
+#ifdef TILECMP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel.tile = tile_avx2;
+        kernel.row = row_avx2;
+        kernel.name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernel.tile = tile_sse41;
+        kernel.row = row_sse41;
+        kernel.name = "sse4.1";
+    }
+#elif defined(TILECMP_NEON)
+    kernel.tile = tile_neon;
+    kernel.row = row_neon;
+    kernel.name = "neon";
+#endif
+#endif
+    wlr_log(WLR_INFO, "Tile compare kernel: %s", kernel.name);
+}
+
+void tilecmp_init(void) {
+    pthread_once(&init_once, select_kernel);
+}
+
+const char *tilecmp_kernel_name(void) {
+    return kernel.name;
+}
+
+/* ============== Public API ============== */
+
+int tilecmp_tile(const uint32_t *curr, const uint32_t *prev, int stride,
+                 int x1, int y1, int w, int h) {
+    return kernel.tile(curr, prev, stride, x1, y1, w, h);
+}
+
+int tilecmp_row(const uint32_t *curr, const uint32_t *prev, int stride,
+                int y1, int h, int tiles_x,
+                const uint8_t *candidates, uint8_t *changed) {
+    int pending = 0;
+    for (int tx = 0; tx < tiles_x; tx++) {
+        int cand = candidates ? candidates[tx] : 1;
+        changed[tx] = cand ? TILE_PENDING : TILE_SAME;
+        pending += cand ? 1 : 0;
+    }
+    if (pending == 0) return 0;
+
+    /* Vector scan over full-width tiles (kernels assume 16-pixel tiles) */
+    int vector_ok = (TILE_SIZE == ROW_PIXELS);
+    int found = vector_ok
+        ? kernel.row(curr, prev, stride, y1, h, tiles_x, changed, pending)
+        : 0;
+
+    /* Resolve any partial right-edge tile, then clear leftover pending */
+    int nfull = vector_ok ? stride / ROW_PIXELS : 0;
+    for (int tx = 0; tx < tiles_x; tx++) {
+        if (changed[tx] != TILE_PENDING) continue;
+        if (tx >= nfull) {
+            int x1 = tx * TILE_SIZE;
+            int w = stride - x1;
+            if (w > TILE_SIZE) w = TILE_SIZE;
+            if (w > 0 && tile_generic(curr, prev, stride, x1, y1, w, h)) {
+                changed[tx] = TILE_DIFF;
+                found++;
+                continue;
+            }
+        }
+        changed[tx] = TILE_SAME;
+    }
+    return found;
+}
+
+/* ============== Tile Hashing ============== */
+
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define HASH_P3 0x165667B19E3779F9ULL
+
+static inline uint64_t rotl64(uint64_t v, int r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t v) {
+    return rotl64(acc + v * HASH_P2, 31) * HASH_P1;
+}
+
+static inline uint64_t load64(const uint32_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t tilecmp_hash(const uint32_t *pixels, int stride,
+                      int x1, int y1, int w, int h) {
+    uint64_t a0 = HASH_P1 + HASH_P2, a1 = HASH_P2, a2 = 0, a3 = -HASH_P1;
+    const uint32_t *row = pixels + y1 * stride + x1;
+
+    for (int y = 0; y < h; y++, row += stride) {
+        int x = 0;
+        for (; x + 8 <= w; x += 8) {
+            a0 = hash_round(a0, load64(row + x));
+            a1 = hash_round(a1, load64(row + x + 2));
+            a2 = hash_round(a2, load64(row + x + 4));
+            a3 = hash_round(a3, load64(row + x + 6));
+        }
+        for (; x + 2 <= w; x += 2)
+            a0 = hash_round(a0, load64(row + x));
+        if (x < w)
+            a1 = hash_round(a1, row[x]);
+    }
+
+    uint64_t hv = rotl64(a0, 1) + rotl64(a1, 7) + rotl64(a2, 12) + rotl64(a3, 18);
+    hv ^= ((uint64_t)w << 32 | (uint32_t)h) * HASH_P3;
+    hv ^= hv >> 33;
+    hv *= HASH_P2;
+    hv ^= hv >> 29;
+    hv *= HASH_P3;
+    hv ^= hv >> 32;
+    return hv ? hv : 1;
+}
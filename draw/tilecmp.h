@@ -0,0 +1,134 @@
+/*
+ * tilecmp.h - SIMD tile comparison kernels with runtime dispatch
+ *
+ * Provides vectorized replacements for the scalar tile_changed()
+ * helper in draw_helpers.h. The send thread uses these to turn a
+ * row of candidate tiles into a changed-tile bitmap in one pass.
+ *
+ * Kernels:
+ *
+ *   Each kernel compares a full TILE_SIZE × TILE_SIZE XRGB32 tile
+ *   (64 bytes per row) between the current and previous framebuffer:
+ *
+ *     avx2    2 × 32-byte loads per row, XOR-accumulate, vptest
+ *     sse4.1  4 × 16-byte loads per row, XOR-accumulate, ptest
+ *     neon    4 × 16-byte loads per row, XOR-accumulate, vmaxvq
+ *     scalar  memcmp per row (reference implementation)
+ *
+ *   Partial tiles (w or h < TILE_SIZE) always use the scalar path.
+ *   With padded framebuffers (TILE_ALIGN_UP) every tile is full, so
+ *   in practice the vector path handles all tiles.
+ *
+ * Dispatch:
+ *
+ *   tilecmp_init() probes the CPU once (via __builtin_cpu_supports on
+ *   x86) and installs the best kernel. Before initialization the
+ *   scalar kernel is used, so calling the compare functions early is
+ *   safe. The x86 kernels are compiled with per-function target
+ *   attributes, so no global -mavx2 flag is required and the binary
+ *   still runs on older CPUs. NEON is baseline on aarch64.
+ *
+ * Row Scan:
+ *
+ *   tilecmp_row() walks the TILE_SIZE pixel rows of a tile row in
+ *   order and, for each row, compares every candidate tile that has
+ *   not yet been found changed. This keeps memory access sequential
+ *   (whole scanlines) instead of jumping between tiles, and a tile
+ *   drops out of the scan as soon as its first differing row is seen.
+ *
+ * Hashing:
+ *
+ *   tilecmp_hash() gives a 64-bit fingerprint of one tile. The send
+ *   thread keeps one per tile for the content Plan 9 currently holds
+ *   (s->tile_hash), so change detection reads only the new frame;
+ *   prev_framebuf is touched only for tiles whose stored hash is
+ *   unknown or that take the alpha-delta path.
+ *
+ * Usage:
+ *
+ *   tilecmp_init();    // once, at send thread startup
+ *
+ *   uint8_t changed[MAX_TILES_X];
+ *   int n = tilecmp_row(curr, prev, stride, ty * TILE_SIZE, h,
+ *                       tiles_x, dirty_row, changed);
+ */
+
+#ifndef TILECMP_H
+#define TILECMP_H
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Select the best comparison kernel for this CPU.
+ *
+ * Safe to call multiple times; only the first call probes.
+ * Logs the selected kernel at WLR_INFO.
+ */
+void tilecmp_init(void);
+
+/*
+ * Name of the active kernel ("avx2", "sse4.1", "neon", "scalar").
+ */
+const char *tilecmp_kernel_name(void);
+
+/*
+ * Check if a tile has changed between two buffers.
+ *
+ * Drop-in replacement for tile_changed() using the dispatched kernel.
+ *
+ * curr, prev: pixel buffers to compare (XRGB32 format)
+ * stride:     buffer stride in pixels
+ * x1, y1:     top-left corner of tile
+ * w, h:       tile dimensions
+ *
+ * Returns non-zero if any pixel differs.
+ */
+int tilecmp_tile(const uint32_t *curr, const uint32_t *prev, int stride,
+                 int x1, int y1, int w, int h);
+
+/*
+ * Build a changed-tile bitmap for one tile row.
+ *
+ * curr, prev: pixel buffers to compare (XRGB32 format)
+ * stride:     buffer stride in pixels (also the frame width)
+ * y1:         first pixel row of the tile row
+ * h:          tile row height (may be < TILE_SIZE at the bottom edge)
+ * tiles_x:    number of tiles in the row
+ * candidates: per-tile candidate flags, or NULL to test every tile
+ * changed:    output, tiles_x bytes; 1 if tile differs, else 0
+ *
+ * Returns the number of changed tiles.
+ */
+int tilecmp_row(const uint32_t *curr, const uint32_t *prev, int stride,
+                int y1, int h, int tiles_x,
+                const uint8_t *candidates, uint8_t *changed);
+
+/* ============== Tile Hashing ============== */
+
+/*
+ * Reserved hash value meaning "unknown" in per-tile hash arrays.
+ * tilecmp_hash() never returns it.
+ */
+#define TILE_HASH_UNKNOWN 0
+
+/*
+ * Compute a 64-bit content hash of a tile.
+ *
+ * Uses four independent xxh64-style accumulator lanes over the tile's
+ * 8-byte words, so throughput is bound by loads rather than multiply
+ * latency. The tile dimensions are mixed into the result. Identical
+ * pixel content always yields the same hash; distinct content collides
+ * with probability ~2^-64, which is treated as never.
+ *
+ * pixels: pixel buffer (XRGB32 format)
+ * stride: buffer stride in pixels
+ * x1, y1: top-left corner of tile
+ * w, h:   tile dimensions
+ *
+ * Returns a non-zero hash (never TILE_HASH_UNKNOWN).
+ */
+uint64_t tilecmp_hash(const uint32_t *pixels, int stride,
+                      int x1, int y1, int w, int h);
+
+#endif /* TILECMP_H */
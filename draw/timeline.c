@@ -0,0 +1,199 @@
+/*
+ * timeline.c - Per-frame trace spans in Chrome trace JSON
+ *
+ * Per-thread span buffers, written out under one file lock when full
+ * and at timeline_stop(). See timeline.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <wlr/util/log.h>
+
+#include "timeline.h"
+
+#ifdef P9WL_NO_TIMELINE
+
+int timeline_start(const char *path) {
+    wlr_log(WLR_ERROR, "timeline: built with P9WL_NO_TIMELINE, not writing %s", path);
+    return -1;
+}
+
+void timeline_stop(void) {
+}
+
+#else
+
+#define TL_BUF_EVENTS   4096        /* Spans per thread between writes */
+#define TL_NAME_MAX     32
+
+struct tl_event {
+    const char *name;
+    uint64_t ts_us;
+    uint64_t dur_us;
+    uint32_t frame;
+};
+
+struct tl_thread {
+    struct tl_thread *next;
+    pthread_mutex_t lock;           /* Owner appends, stop drains */
+    int tid;
+    int n;
+    struct tl_event ev[TL_BUF_EVENTS];
+};
+
+atomic_int timeline_on;
+
+/* Frame published by the send thread (timeline_publish_frame) */
+static atomic_uint published_frame;
+
+static _Thread_local struct tl_thread *self;
+static _Thread_local char self_name[TL_NAME_MAX];
+static _Thread_local uint32_t self_frame;      /* 0 = use published_frame */
+
+static struct {
+    pthread_mutex_t lock;           /* File, thread list */
+    FILE *f;
+    struct tl_thread *threads;
+    int next_tid;
+    int pid;
+    int first;                      /* No event written yet */
+    uint64_t t0_us;
+} tl = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* ============== Writing ============== */
+
+/* Under tl.lock */
+static void write_sep(void) {
+    if (!tl.first) fputs(",\n", tl.f);
+    tl.first = 0;
+}
+
+/* Write and empty a thread's buffer. Under t->lock and tl.lock. */
+static void write_events(struct tl_thread *t) {
+    if (!tl.f) {
+        t->n = 0;
+        return;
+    }
+    for (int i = 0; i < t->n; i++) {
+        const struct tl_event *e = &t->ev[i];
+        uint64_t ts = e->ts_us > tl.t0_us ? e->ts_us - tl.t0_us : 0;
+        write_sep();
+        fprintf(tl.f, "{\"name\":\"%s\",\"cat\":\"p9wl\",\"ph\":\"X\",\"ts\":%llu,"
+                      "\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%u}}",
+                e->name, (unsigned long long)ts, (unsigned long long)e->dur_us,
+                tl.pid, t->tid, e->frame);
+    }
+    t->n = 0;
+}
+
+/* First span of this thread: buffer, list entry and name event */
+static struct tl_thread *thread_register(void) {
+    struct tl_thread *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_mutex_lock(&tl.lock);
+    t->tid = ++tl.next_tid;
+    t->next = tl.threads;
+    tl.threads = t;
+    if (tl.f) {
+        write_sep();
+        fprintf(tl.f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                      "\"args\":{\"name\":\"%s\"}}",
+                tl.pid, t->tid, self_name[0] ? self_name : "thread");
+    }
+    pthread_mutex_unlock(&tl.lock);
+    return t;
+}
+
+/* ============== Recording ============== */
+
+void timeline_record(const char *name, uint64_t start_us, uint64_t dur_us) {
+    struct tl_thread *t = self;
+    if (!t && !(t = self = thread_register())) return;
+
+    pthread_mutex_lock(&t->lock);
+    struct tl_event *e = &t->ev[t->n++];
+    e->name = name;
+    e->ts_us = start_us;
+    e->dur_us = dur_us;
+    e->frame = self_frame ? self_frame
+                          : atomic_load_explicit(&published_frame, memory_order_relaxed);
+    if (t->n == TL_BUF_EVENTS) {
+        pthread_mutex_lock(&tl.lock);
+        write_events(t);
+        pthread_mutex_unlock(&tl.lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+void timeline_thread_name(const char *name) {
+    snprintf(self_name, sizeof(self_name), "%s", name);
+}
+
+void timeline_set_frame(uint32_t frame) {
+    self_frame = frame;
+}
+
+void timeline_publish_frame(uint32_t frame) {
+    self_frame = frame;
+    atomic_store_explicit(&published_frame, frame, memory_order_relaxed);
+}
+
+/* ============== Start / Stop ============== */
+
+int timeline_start(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        wlr_log(WLR_ERROR, "timeline: cannot create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    pthread_mutex_lock(&tl.lock);
+    tl.f = f;
+    tl.pid = (int)getpid();
+    tl.first = 1;
+    tl.t0_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    fputs("[\n", f);
+    pthread_mutex_unlock(&tl.lock);
+
+    atomic_store(&timeline_on, 1);
+    wlr_log(WLR_INFO, "timeline: recording spans to %s", path);
+    return 0;
+}
+
+void timeline_stop(void) {
+    if (!atomic_exchange(&timeline_on, 0)) return;
+
+    /*
+     * A span site that saw timeline_on just before may still append;
+     * the buffer locks order that against the final write, and a span
+     * recorded after it is dropped with the file closed.
+     */
+    pthread_mutex_lock(&tl.lock);
+    struct tl_thread *list = tl.threads;
+    pthread_mutex_unlock(&tl.lock);
+    for (struct tl_thread *t = list; t; t = t->next) {
+        pthread_mutex_lock(&t->lock);
+        pthread_mutex_lock(&tl.lock);
+        write_events(t);
+        pthread_mutex_unlock(&tl.lock);
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    pthread_mutex_lock(&tl.lock);
+    fputs("\n]\n", tl.f);
+    if (fclose(tl.f) != 0)
+        wlr_log(WLR_ERROR, "timeline: error writing trace");
+    tl.f = NULL;
+    pthread_mutex_unlock(&tl.lock);
+}
+
+#endif /* P9WL_NO_TIMELINE */
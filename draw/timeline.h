@@ -0,0 +1,127 @@
+/*
+ * timeline.h - Per-frame trace spans in Chrome trace JSON
+ *
+ * The metrics histograms say how long each stage takes in general;
+ * they cannot say why one particular frame took 200 ms. The timeline
+ * records every span of every thread involved — output render, damage,
+ * framebuffer copy, scroll detection and FFT on the workers, change
+ * collection, compression, batch building, drain_throttle() waits,
+ * relookup_window() stalls, socket writes, Rwrite round trips — tagged
+ * with the frame they belong to, and writes them in the Chrome trace
+ * event format that chrome://tracing, Perfetto (ui.perfetto.dev) and
+ * speedscope load directly.
+ *
+ * Switches:
+ *
+ *   Runtime: timeline_start(path) (main.c, -J <file> or
+ *   $P9WL_TIMELINE) enables recording until timeline_stop(). When off,
+ *   each span site is one relaxed atomic load.
+ *
+ *   Compile time: building with -DP9WL_NO_TIMELINE ("make
+ *   NO_TIMELINE=1") turns every span call into an empty inline, and
+ *   timeline_start() only reports that spans were compiled out.
+ *
+ * Frames:
+ *
+ *   The output thread numbers its frames (server.frame_seq) and calls
+ *   timeline_set_frame() at the start of each; send_frame() hands the
+ *   number over with the buffer (server.send_seq), and the send thread
+ *   publishes it with timeline_publish_frame() when it takes the
+ *   buffer. Threads that never set a frame of their own, the pool
+ *   workers and the drain thread, tag spans with the published one,
+ *   so a worker's compression span carries the frame it compressed.
+ *   Rwrite spans carry the frame being sent when the reply arrived,
+ *   which for a deep pipeline can be one later than the batch's own.
+ *
+ *   In the viewer, args.frame of any span finds the same frame on
+ *   every thread.
+ *
+ * Recording:
+ *
+ *   Spans go to a per-thread buffer; a full buffer is written to the
+ *   file by its own thread under the file lock, which is the only
+ *   time a span site blocks. Names must be string literals (only the
+ *   pointer is stored). Buffers stay allocated until exit, so threads
+ *   may finish at any time.
+ *
+ * Output:
+ *
+ *   JSON array format: "[", one complete event ("ph":"X", ts and dur
+ *   in microseconds since timeline_start) per span, thread_name
+ *   metadata events for named threads, "]". A file cut short by a
+ *   crash still loads in all three viewers.
+ */
+
+#ifndef P9WL_TIMELINE_H
+#define P9WL_TIMELINE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* Start recording spans to a Chrome trace JSON file. Returns 0 or -1. */
+int timeline_start(const char *path);
+
+/* Write outstanding spans and close the file. Safe if never started. */
+void timeline_stop(void);
+
+#ifdef P9WL_NO_TIMELINE
+
+static inline uint64_t timeline_now(void) { return 0; }
+static inline void timeline_thread_name(const char *name) { (void)name; }
+static inline void timeline_set_frame(uint32_t frame) { (void)frame; }
+static inline void timeline_publish_frame(uint32_t frame) { (void)frame; }
+static inline void timeline_span(const char *name, uint64_t start_us) {
+    (void)name; (void)start_us;
+}
+static inline void timeline_span_dur(const char *name, uint64_t start_us, uint64_t dur_us) {
+    (void)name; (void)start_us; (void)dur_us;
+}
+
+#else
+
+extern atomic_int timeline_on;
+
+void timeline_record(const char *name, uint64_t start_us, uint64_t dur_us);
+
+/* Name the calling thread in the viewer. Call once, at thread start. */
+void timeline_thread_name(const char *name);
+
+/* Frame of the calling thread's following spans. */
+void timeline_set_frame(uint32_t frame);
+
+/* Frame for threads without their own (workers, drain); also sets it
+ * for the caller. */
+void timeline_publish_frame(uint32_t frame);
+
+/* Span start for code without now_us() (same clock); 0 when off */
+static inline uint64_t timeline_now(void) {
+    if (!atomic_load_explicit(&timeline_on, memory_order_relaxed)) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Record a span from start_us (now_us() clock) to now.
+ * name must be a string literal. A start of 0 (timeline_now() while
+ * off) records nothing.
+ */
+static inline void timeline_span(const char *name, uint64_t start_us) {
+    if (atomic_load_explicit(&timeline_on, memory_order_relaxed) && start_us) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        timeline_record(name, start_us, now > start_us ? now - start_us : 0);
+    }
+}
+
+/* Record a span of known duration (e.g. an RTT ending now). */
+static inline void timeline_span_dur(const char *name, uint64_t start_us, uint64_t dur_us) {
+    if (atomic_load_explicit(&timeline_on, memory_order_relaxed))
+        timeline_record(name, start_us, dur_us);
+}
+
+#endif /* P9WL_NO_TIMELINE */
+
+#endif /* P9WL_TIMELINE_H */
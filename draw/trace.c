@@ -0,0 +1,361 @@
+/*
+ * trace.c - Frame trace capture and replay
+ *
+ * Tiles compared against a shadow image, stored LZ77 compressed with
+ * compress_tile_data(), and decoded again on replay. See trace.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <wlr/util/log.h>
+
+#include "trace.h"
+#include "arena.h"
+#include "compress.h"
+#include "types.h"
+
+#define TILE_PIXELS     (TILE_SIZE * TILE_SIZE)
+#define TILE_BYTES      (TILE_PIXELS * 4)
+
+struct trace_writer {
+    FILE *f;
+    struct trace_geom geom;
+    int tiles_x, tiles_y;
+    uint32_t *shadow;           /* Last frame written, row-major */
+    size_t shadow_size;
+    uint32_t *changed;          /* Tile indices of the current frame */
+    uint8_t *payload;           /* Encoded tiles of the current frame */
+    uint64_t t0;
+    int frames;
+    int error;
+};
+
+struct trace_reader {
+    FILE *f;
+    struct trace_geom geom;
+    int tiles_x, tiles_y;
+};
+
+/* ============== Encoding Helpers ============== */
+
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put_u32(uint8_t *p, uint32_t v) { put_u16(p, v); put_u16(p + 2, v >> 16); }
+static void put_u64(uint8_t *p, uint64_t v) { put_u32(p, v); put_u32(p + 4, v >> 32); }
+
+static uint16_t get_u16(const uint8_t *p) { return p[0] | (uint16_t)p[1] << 8; }
+static uint32_t get_u32(const uint8_t *p) { return get_u16(p) | (uint32_t)get_u16(p + 2) << 16; }
+static uint64_t get_u64(const uint8_t *p) { return get_u32(p) | (uint64_t)get_u32(p + 4) << 32; }
+
+static int geom_ok(const struct trace_geom *g) {
+    return g->width > 0 && g->height > 0 &&
+           g->width <= MAX_SCREEN_DIM && g->height <= MAX_SCREEN_DIM &&
+           g->width % TILE_SIZE == 0 && g->height % TILE_SIZE == 0 &&
+           g->visible_width > 0 && g->visible_width <= g->width &&
+           g->visible_height > 0 && g->visible_height <= g->height;
+}
+
+/* First pixel of tile (tx, ty) in a buffer of either layout */
+static inline const uint32_t *tile_at(const uint32_t *buf, int width, int tiles_x,
+                                      int tile_major, int tx, int ty) {
+    if (tile_major)
+        return buf + (size_t)(ty * tiles_x + tx) * TILE_PIXELS;
+    return buf + (size_t)ty * TILE_SIZE * width + tx * TILE_SIZE;
+}
+
+/*
+ * Plan 9 compressed-image token stream (see compress.h): 0x80|(n-1)
+ * then n literal bytes, or a two-byte back-reference of 3..34 bytes
+ * up to 1024 back.  Returns 0 if data decodes to exactly out_len.
+ */
+static int lz77_decode(const uint8_t *src, int len, uint8_t *out, int out_len) {
+    int i = 0, o = 0;
+    while (i < len) {
+        uint8_t b = src[i++];
+        if (b & 0x80) {
+            int n = (b & 0x7F) + 1;
+            if (i + n > len || o + n > out_len) return -1;
+            memcpy(out + o, src + i, n);
+            i += n;
+            o += n;
+        } else {
+            if (i >= len) return -1;
+            int n = ((b >> 2) & 0x1F) + 3;
+            int off = (((b & 3) << 8) | src[i++]) + 1;
+            if (off > o || o + n > out_len) return -1;
+            for (int k = 0; k < n; k++, o++)    /* May overlap */
+                out[o] = out[o - off];
+        }
+    }
+    return o == out_len ? 0 : -1;
+}
+
+/* ============== Writing ============== */
+
+struct trace_writer *trace_writer_open(const char *path, const struct trace_geom *geom) {
+    if (!geom_ok(geom)) {
+        wlr_log(WLR_ERROR, "trace: bad geometry %dx%d (visible %dx%d)",
+                geom->width, geom->height, geom->visible_width, geom->visible_height);
+        return NULL;
+    }
+    struct trace_writer *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->geom = *geom;
+    w->tiles_x = geom->width / TILE_SIZE;
+    w->tiles_y = geom->height / TILE_SIZE;
+    int ntiles = w->tiles_x * w->tiles_y;
+
+    /* The shadow starts black, like a fresh framebuffer */
+    w->shadow_size = (size_t)geom->width * geom->height * 4;
+    w->shadow = arena_map(w->shadow_size);
+    w->changed = malloc((size_t)ntiles * sizeof(*w->changed));
+    w->payload = malloc((size_t)ntiles * (6 + TILE_BYTES));
+    w->f = fopen(path, "wb");
+    if (!w->shadow || !w->changed || !w->payload || !w->f) {
+        wlr_log(WLR_ERROR, "trace: cannot create %s: %s", path,
+                w->f ? "out of memory" : strerror(errno));
+        if (w->f) fclose(w->f);
+        arena_unmap(w->shadow, w->shadow_size);
+        free(w->changed);
+        free(w->payload);
+        free(w);
+        return NULL;
+    }
+    w->t0 = UINT64_MAX;
+
+    uint8_t hdr[8 + 16];
+    memcpy(hdr, TRACE_MAGIC, 8);
+    put_u32(hdr + 8, geom->width);
+    put_u32(hdr + 12, geom->height);
+    put_u32(hdr + 16, geom->visible_width);
+    put_u32(hdr + 20, geom->visible_height);
+    if (fwrite(hdr, sizeof(hdr), 1, w->f) != 1) w->error = 1;
+    return w;
+}
+
+/* Damage map as (run, value) pairs */
+static void write_damage(struct trace_writer *w, const uint8_t *damage, int ntiles) {
+    uint8_t rec[3];
+    for (int i = 0; i < ntiles; ) {
+        uint8_t v = damage ? damage[i] : 0;
+        int run = 1;
+        while (i + run < ntiles && run < 0xFFFF && (damage ? damage[i + run] : 0) == v)
+            run++;
+        put_u16(rec, run);
+        rec[2] = v;
+        if (fwrite(rec, 3, 1, w->f) != 1) w->error = 1;
+        i += run;
+    }
+}
+
+int trace_writer_frame(struct trace_writer *w, uint64_t t_us,
+                       const uint32_t *pixels, int tile_major,
+                       const uint8_t *damage) {
+    int ntiles = w->tiles_x * w->tiles_y;
+    int width = w->geom.width;
+    if (w->t0 == UINT64_MAX) w->t0 = t_us;
+
+    /* Gather changed tiles and encode them */
+    uint8_t *p = w->payload;
+    int nchanged = 0;
+    uint32_t tile[TILE_PIXELS];
+    for (int ty = 0; ty < w->tiles_y; ty++) {
+        for (int tx = 0; tx < w->tiles_x; tx++) {
+            int idx = ty * w->tiles_x + tx;
+            if (damage && !damage[idx]) continue;
+            const uint32_t *src = tile_at(pixels, width, w->tiles_x, tile_major, tx, ty);
+            int stride = tile_major ? TILE_SIZE : width;
+            uint32_t *sh = w->shadow + (size_t)ty * TILE_SIZE * width + tx * TILE_SIZE;
+            int differs = 0;
+            for (int row = 0; row < TILE_SIZE; row++) {
+                memcpy(tile + row * TILE_SIZE, src + (size_t)row * stride, TILE_SIZE * 4);
+                if (!differs && memcmp(tile + row * TILE_SIZE, sh + (size_t)row * width,
+                                       TILE_SIZE * 4) != 0)
+                    differs = 1;
+            }
+            if (!differs) continue;
+            for (int row = 0; row < TILE_SIZE; row++)
+                memcpy(sh + (size_t)row * width, tile + row * TILE_SIZE, TILE_SIZE * 4);
+
+            int n = compress_tile_data(p + 6, TILE_BYTES, (uint8_t *)tile, TILE_SIZE * 4,
+                                       TILE_SIZE, COMPRESS_EFFORT_DEFAULT);
+            put_u32(p, idx);
+            if (n > 0 && n < TILE_BYTES) {
+                put_u16(p + 4, n);
+            } else {
+                put_u16(p + 4, 0);
+                memcpy(p + 6, tile, TILE_BYTES);
+                n = TILE_BYTES;
+            }
+            p += 6 + n;
+            w->changed[nchanged++] = idx;
+        }
+    }
+
+    uint8_t rec[13];
+    put_u64(rec, t_us - w->t0);
+    rec[8] = damage ? TRACE_DAMAGE_VALID : 0;
+    if (fwrite(rec, 9, 1, w->f) != 1) w->error = 1;
+    write_damage(w, damage, ntiles);
+    put_u32(rec, nchanged);
+    if (fwrite(rec, 4, 1, w->f) != 1) w->error = 1;
+    if (p > w->payload && fwrite(w->payload, p - w->payload, 1, w->f) != 1)
+        w->error = 1;
+    w->frames++;
+    return w->error ? -1 : 0;
+}
+
+int trace_writer_close(struct trace_writer *w) {
+    if (!w) return 0;
+    int err = w->error;
+    if (fclose(w->f) != 0) err = 1;
+    arena_unmap(w->shadow, w->shadow_size);
+    free(w->changed);
+    free(w->payload);
+    free(w);
+    return err ? -1 : 0;
+}
+
+/* ============== Reading ============== */
+
+struct trace_reader *trace_reader_open(const char *path, struct trace_geom *geom) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        wlr_log(WLR_ERROR, "trace: cannot open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    uint8_t hdr[8 + 16];
+    if (fread(hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr, TRACE_MAGIC, 8) != 0) {
+        wlr_log(WLR_ERROR, "trace: %s is not a p9wl trace", path);
+        fclose(f);
+        return NULL;
+    }
+    struct trace_geom g = {
+        .width = get_u32(hdr + 8),
+        .height = get_u32(hdr + 12),
+        .visible_width = get_u32(hdr + 16),
+        .visible_height = get_u32(hdr + 20),
+    };
+    if (!geom_ok(&g)) {
+        wlr_log(WLR_ERROR, "trace: %s has bad geometry %dx%d", path, g.width, g.height);
+        fclose(f);
+        return NULL;
+    }
+    struct trace_reader *r = calloc(1, sizeof(*r));
+    if (!r) {
+        fclose(f);
+        return NULL;
+    }
+    r->f = f;
+    r->geom = g;
+    r->tiles_x = g.width / TILE_SIZE;
+    r->tiles_y = g.height / TILE_SIZE;
+    *geom = g;
+    return r;
+}
+
+int trace_reader_next(struct trace_reader *r, uint32_t *image, uint8_t *damage,
+                      int *damage_valid, uint64_t *t_us) {
+    int ntiles = r->tiles_x * r->tiles_y;
+    int width = r->geom.width;
+    uint8_t rec[9];
+
+    size_t got = fread(rec, 1, 9, r->f);
+    if (got == 0 && feof(r->f)) return 0;
+    if (got != 9) return -1;
+    *t_us = get_u64(rec);
+    *damage_valid = (rec[8] & TRACE_DAMAGE_VALID) != 0;
+
+    for (int i = 0; i < ntiles; ) {
+        if (fread(rec, 3, 1, r->f) != 1) return -1;
+        int run = get_u16(rec);
+        if (run == 0 || i + run > ntiles) return -1;
+        memset(damage + i, rec[2], run);
+        i += run;
+    }
+
+    if (fread(rec, 4, 1, r->f) != 1) return -1;
+    uint32_t nchanged = get_u32(rec);
+    if (nchanged > (uint32_t)ntiles) return -1;
+
+    uint8_t data[TILE_BYTES];
+    uint32_t tile[TILE_PIXELS];
+    for (uint32_t k = 0; k < nchanged; k++) {
+        if (fread(rec, 6, 1, r->f) != 1) return -1;
+        uint32_t idx = get_u32(rec);
+        int size = get_u16(rec + 4);
+        if (idx >= (uint32_t)ntiles || size > TILE_BYTES) return -1;
+        if (size == 0) {
+            if (fread(tile, TILE_BYTES, 1, r->f) != 1) return -1;
+        } else {
+            if (fread(data, size, 1, r->f) != 1) return -1;
+            if (lz77_decode(data, size, (uint8_t *)tile, TILE_BYTES) < 0) return -1;
+        }
+        int tx = idx % r->tiles_x, ty = idx / r->tiles_x;
+        uint32_t *dst = image + (size_t)ty * TILE_SIZE * width + tx * TILE_SIZE;
+        for (int row = 0; row < TILE_SIZE; row++)
+            memcpy(dst + (size_t)row * width, tile + row * TILE_SIZE, TILE_SIZE * 4);
+    }
+    return 1;
+}
+
+void trace_reader_close(struct trace_reader *r) {
+    if (!r) return;
+    fclose(r->f);
+    free(r);
+}
+
+/* ============== Capture ============== */
+
+static struct {
+    struct trace_writer *w;
+    char *path;
+    struct trace_geom geom;
+} capture;
+
+int trace_capture_start(const char *path, const struct server *s) {
+    struct trace_geom g = {
+        .width = s->width,
+        .height = s->height,
+        .visible_width = s->visible_width,
+        .visible_height = s->visible_height,
+    };
+    capture.w = trace_writer_open(path, &g);
+    if (!capture.w) return -1;
+    capture.path = strdup(path);
+    capture.geom = g;
+    wlr_log(WLR_INFO, "trace: capturing %dx%d frames to %s", g.width, g.height, path);
+    return 0;
+}
+
+void trace_capture(const struct server *s) {
+    if (!capture.w) return;
+    if (s->width != capture.geom.width || s->height != capture.geom.height ||
+        s->visible_width != capture.geom.visible_width ||
+        s->visible_height != capture.geom.visible_height) {
+        wlr_log(WLR_INFO, "trace: output resized, capture stopped");
+        trace_capture_stop();
+        return;
+    }
+    const uint8_t *damage = (s->dirty_staging_valid && s->dirty_staging) ?
+                            s->dirty_staging : NULL;
+    if (trace_writer_frame(capture.w, now_us(), s->framebuf, s->tile_major, damage) < 0) {
+        wlr_log(WLR_ERROR, "trace: write to %s failed, capture stopped", capture.path);
+        trace_capture_stop();
+    }
+}
+
+void trace_capture_stop(void) {
+    if (!capture.w) return;
+    int frames = capture.w->frames;
+    if (trace_writer_close(capture.w) < 0)
+        wlr_log(WLR_ERROR, "trace: error closing %s", capture.path);
+    else
+        wlr_log(WLR_INFO, "trace: %d frames written to %s", frames, capture.path);
+    capture.w = NULL;
+    free(capture.path);
+    capture.path = NULL;
+}
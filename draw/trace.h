@@ -0,0 +1,133 @@
+/*
+ * trace.h - Frame trace capture and replay
+ *
+ * Performance problems in the send path depend on what is on screen:
+ * a terminal scrolling, a browser page, video, a blinking caret. A
+ * trace records what arrives at send_frame() so that the same frames
+ * can be replayed offline by p9wl-bench (bench/bench.c), without a
+ * Plan 9 server, and compared between builds.
+ *
+ * Capture:
+ *
+ *   trace_capture_start(path) (main.c, -T <file>) opens a trace for
+ *   the current output size. send_frame() then calls trace_capture()
+ *   with every frame the output hands over, including frames that are
+ *   dropped for lack of a free buffer: the trace holds what the
+ *   compositor produced, not what the link could carry. Capture stops
+ *   (with a log line) when the output is resized, since a trace has
+ *   one geometry.
+ *
+ *   Capture runs on the output thread and compares damaged tiles
+ *   against a shadow copy, so it costs about one extra framebuffer
+ *   pass per frame. It is a diagnostic mode, not for everyday use.
+ *
+ * File Format (little-endian):
+ *
+ *   header:  "P9WLTRC1"  u32 width  u32 height
+ *            u32 visible_width  u32 visible_height
+ *
+ *   frame:   u64 t_us                  time since the first frame
+ *            u8  flags                 TRACE_DAMAGE_VALID
+ *            damage map                tiles_x * tiles_y bytes, as
+ *                                      (u16 run, u8 value) pairs
+ *            u32 ntiles                tiles that changed
+ *            ntiles * { u32 index  u16 size  data }
+ *
+ *   width and height are padded (multiples of TILE_SIZE). Tile data is
+ *   always row-major TILE_SIZE × TILE_SIZE XRGB32, whatever layout the
+ *   framebuffers use (-B): LZ77 in the Plan 9 token stream of
+ *   compress_tile_data() when size > 0, else 1024 raw bytes. The
+ *   damage map is dirty_staging as send_frame() saw it (damage class
+ *   bits, see types.h); without TRACE_DAMAGE_VALID the frame had no
+ *   damage information and the map is all zero. A tile is stored only
+ *   when its pixels differ from the previous frame, so a trace of a
+ *   mostly idle desktop stays small.
+ *
+ * Replay:
+ *
+ *   trace_reader_next() rebuilds each frame in a row-major image of
+ *   width × height pixels owned by the caller; tiles not in the frame
+ *   keep the previous frame's pixels.
+ *
+ * Threading:
+ *
+ *   Writers and readers are single-threaded objects. The capture
+ *   state is static and only touched from send_frame()'s caller.
+ */
+
+#ifndef P9WL_TRACE_H
+#define P9WL_TRACE_H
+
+#include <stdint.h>
+
+struct server;
+
+#define TRACE_MAGIC         "P9WLTRC1"
+#define TRACE_DAMAGE_VALID  0x01
+
+struct trace_geom {
+    int width, height;                  /* Padded, multiples of TILE_SIZE */
+    int visible_width, visible_height;
+};
+
+struct trace_writer;
+struct trace_reader;
+
+/* ============== Writing ============== */
+
+/* Create a trace file. Returns NULL on error (logged). */
+struct trace_writer *trace_writer_open(const char *path, const struct trace_geom *geom);
+
+/*
+ * Append one frame.
+ *
+ * t_us:       frame time (the first frame's is subtracted)
+ * pixels:     width × height XRGB32, row-major or tile-major
+ * tile_major: layout of pixels (see fb_tile() in types.h)
+ * damage:     per-tile damage map, or NULL if unknown; only tiles
+ *             marked are compared unless NULL
+ *
+ * Returns 0 on success, -1 on write error.
+ */
+int trace_writer_frame(struct trace_writer *w, uint64_t t_us,
+                       const uint32_t *pixels, int tile_major,
+                       const uint8_t *damage);
+
+/* Flush and close. Returns 0 on success, -1 if any write failed. */
+int trace_writer_close(struct trace_writer *w);
+
+/* ============== Reading ============== */
+
+/* Open a trace and read its header. Returns NULL on error (logged). */
+struct trace_reader *trace_reader_open(const char *path, struct trace_geom *geom);
+
+/*
+ * Decode the next frame.
+ *
+ * image:        width × height row-major pixels, updated in place
+ * damage:       tiles_x * tiles_y bytes, overwritten
+ * damage_valid: set to 1 if the frame carried damage information
+ * t_us:         frame time
+ *
+ * Returns 1 for a frame, 0 at end of trace, -1 on a corrupt trace.
+ */
+int trace_reader_next(struct trace_reader *r, uint32_t *image, uint8_t *damage,
+                      int *damage_valid, uint64_t *t_us);
+
+void trace_reader_close(struct trace_reader *r);
+
+/* ============== Capture ============== */
+
+/* Start capturing the output's frames to path. Returns 0 or -1. */
+int trace_capture_start(const char *path, const struct server *s);
+
+/*
+ * Record s->framebuf and s->dirty_staging as send_frame() is about to
+ * take them. Called with send_lock held. No-op when not capturing.
+ */
+void trace_capture(const struct server *s);
+
+/* Finish the capture file. Safe if never started. */
+void trace_capture_stop(void);
+
+#endif /* P9WL_TRACE_H */
@@ -4,12 +4,18 @@
  * Syncs the Wayland clipboard with Plan 9's /dev/snarf:
  * - When a Wayland client copies, write to /dev/snarf
  * - When a Wayland client pastes, read from /dev/snarf (lazily, on demand)
- * - Polls snarf qid.vers to detect Plan 9-side changes
+ * - Polls snarf qid.vers to detect Plan 9-side changes, backing off
+ *   while idle and polling promptly on activity hints
  *
  * IMPORTANT: All 9P I/O is done off the Wayland event loop to avoid
  * blocking frame delivery and input processing. Paste reads use a
  * detached thread; snarf version polling runs in a dedicated thread
  * that signals the event loop via a pipe when a change is detected.
+ * A second thread blocks on /dev/wctl reads and turns window
+ * current/notcurrent transitions into poll hints.
+ *
+ * p9_snarf connects after the first frame (sessions.h); until
+ * clipboard_connected() the Wayland side works on its own.
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -21,6 +27,8 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include <wayland-server-core.h>
@@ -34,11 +42,17 @@
 #include "../p9/p9.h"
 
 #define SNARF_MAX_SIZE (1024 * 1024)  /* 1MB max clipboard */
-#define SNARF_POLL_MS  500            /* Poll interval for snarf changes */
+#define SNARF_STREAM_DEPTH     8      /* Treads/Twrites in flight per transfer */
+#define SNARF_POLL_MIN_MS      250    /* Interval right after activity */
+#define SNARF_POLL_MAX_MS      4000   /* Idle cap while our window is current */
+#define SNARF_POLL_AWAY_MS     30000  /* Idle cap while another window is */
 
 /* Forward declarations */
 static void snarf_to_wayland_register(struct server *s);
 
+/* p9_snarf is up (clipboard_connected); event loop only */
+static bool snarf_connected;
+
 /* ─────────────────────────────────────────────────────────────────────────────
  * Snarf polling state
  *
@@ -48,6 +62,13 @@ static void snarf_to_wayland_register(struct server *s);
  * event loop handler then calls snarf_to_wayland_register() on the
  * main thread (required because wlr_seat_set_selection is not
  * thread-safe).
+ *
+ * The interval doubles after every unchanged stat, from
+ * SNARF_POLL_MIN_MS up to a cap, and drops back to the minimum on a
+ * change or a hint (clipboard_poll_hint(), window becoming current).
+ * The cap is SNARF_POLL_AWAY_MS while rio reports another window as
+ * current: the user cannot paste into us then, and coming back is
+ * itself a hint.
  * ───────────────────────────────────────────────────────────────────────────── */
 
 static struct {
@@ -58,7 +79,20 @@ static struct {
     volatile bool active;
     int pipe_fd[2];           /* [0]=read (event loop), [1]=write (thread) */
     struct wl_event_source *pipe_source;
-} snarf_poll;
+    
+    /* Adaptive interval; lock/cond wake the thread early on a hint */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int interval_ms;
+    bool hinted;              /* Poll now, interval back to minimum */
+    bool away;                /* rio says another window is current */
+
+    pthread_t wctl_thread;    /* wctl_watch_thread_func, joined at cleanup */
+    bool wctl_started;
+} snarf_poll = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .interval_ms = SNARF_POLL_MIN_MS,
+};
 
 /* ─────────────────────────────────────────────────────────────────────────────
  * Mime type handling
@@ -107,69 +141,106 @@ static const char *find_text_mime_type(struct wl_array *mime_types) {
  * 
  * Ownership dance:
  *   1. Client copies  → Wayland makes client the "selection owner"
- *   2. We read data   → async via event loop fd, then write to snarf
+ *   2. We stream data → a thread pipes the client's fd into snarf
  *   3. We reclaim     → register ourselves as owner again
  *   4. Future pastes  → all go through snarf, even Wayland-to-Wayland
  *
  * This keeps snarf as the single source of truth for the clipboard.
+ *
+ * The copy thread reads the client's pipe with blocking reads and
+ * feeds p9_write_stream() chunk by chunk, so several Twrites are in
+ * flight while the client is still producing data and nothing is
+ * buffered beyond the request window.  When it is done it pokes the
+ * notification pipe; the event loop handler reclaims ownership on
+ * the main thread.
+ *
+ * Rio keeps one snarf buffer in progress (OWRITE resets it, every
+ * Twrite appends), so transfers must not overlap and the newest copy
+ * must commit last.  Each copy takes a generation; transfers run one
+ * at a time under snarf_copy.lock, and one that a newer copy has
+ * superseded stops (or never starts) and does not reclaim.  Until the
+ * newest transfer is done, the pipe handler does not re-register us
+ * either, so the copying client stays owner meanwhile.
  * ───────────────────────────────────────────────────────────────────────────── */
 
-/* State for async transfer from Wayland client to snarf */
+static struct {
+    pthread_mutex_t lock;     /* Held for a whole transfer */
+    atomic_uint gen;          /* Last copy started (event loop) */
+    atomic_uint done;         /* Last copy finished while newest */
+} snarf_copy = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* State for the copy thread */
 struct wayland_to_snarf_state {
     struct server *server;
-    struct wl_event_source *event_source;
-    int fd;
-    char *buf;
-    size_t len;
-    size_t capacity;
+    int fd;                   /* Read end of the client's pipe */
+    size_t len;               /* Bytes taken so far */
+    unsigned gen;             /* snarf_copy.gen of this copy */
 };
 
-static int wayland_to_snarf_read_handler(int fd, uint32_t mask, void *data) {
-    struct wayland_to_snarf_state *state = data;
-    
-    if (mask & WL_EVENT_READABLE) {
-        char tmp[8192];
-        ssize_t n = read(fd, tmp, sizeof(tmp));
-        if (n > 0) {
-            if (state->len + n < state->capacity) {
-                memcpy(state->buf + state->len, tmp, n);
-                state->len += n;
-            }
-            return 0;  /* Keep listening */
-        }
-        /* n == 0 (EOF) or error - fall through to cleanup */
+static bool copy_superseded(const struct wayland_to_snarf_state *state) {
+    return atomic_load(&snarf_copy.gen) != state->gen;
+}
+
+/* p9_stream_source: next chunk from the client, truncated at SNARF_MAX_SIZE */
+static int wayland_to_snarf_source(void *arg, uint8_t *data, uint32_t max) {
+    struct wayland_to_snarf_state *state = arg;
+    
+    for (;;) {
+        if (copy_superseded(state)) return -1;
+        if (state->len >= SNARF_MAX_SIZE) return 0;
+        if (max > SNARF_MAX_SIZE - state->len) max = SNARF_MAX_SIZE - state->len;
+        ssize_t n = read(state->fd, data, max);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        state->len += n;
+        return (int)n;
     }
-    
-    /* Step 2: Write captured data to snarf */
-    if (state->len > 0) {
-        state->buf[state->len] = '\0';
-        int ret = p9_write_file(&state->server->p9_snarf, "snarf", 
-                                state->buf, state->len);
-        if (ret < 0) {
-            wlr_log(WLR_ERROR, "wayland_to_snarf: write failed");
-        } else {
-            wlr_log(WLR_INFO, "wayland_to_snarf: copied %zu bytes", state->len);
-
-            /*
-             * The poll thread will see the version bump on its next
-             * cycle and may redundantly re-register us as selection
-             * owner.  That's harmless and avoids a blocking p9_stat
-             * here on the event loop.
-             */
-        }
+}
+
+static void *wayland_to_snarf_thread(void *arg) {
+    struct wayland_to_snarf_state *state = arg;
+    
+    /* Step 2: Stream the client's data into snarf, one copy at a time */
+    pthread_mutex_lock(&snarf_copy.lock);
+    int ret = -1;
+    if (!copy_superseded(state))
+        ret = p9_write_stream(&state->server->p9_snarf, "snarf",
+                              SNARF_STREAM_DEPTH, wayland_to_snarf_source, state);
+    bool newest = !copy_superseded(state);
+    if (newest)
+        atomic_store(&snarf_copy.done, state->gen);
+    pthread_mutex_unlock(&snarf_copy.lock);
+    
+    if (!newest) {
+        wlr_log(WLR_DEBUG, "wayland_to_snarf: superseded after %zu bytes", state->len);
+    } else if (ret < 0) {
+        wlr_log(WLR_ERROR, "wayland_to_snarf: write failed");
+    } else {
+        wlr_log(WLR_INFO, "wayland_to_snarf: copied %zu bytes", state->len);
+
+        /*
+         * The poll thread will see the version bump on its next
+         * cycle and may redundantly re-register us as selection
+         * owner.  That's harmless and avoids another p9_stat here.
+         * The hint makes that cycle soon, so the baseline is current
+         * for later changes.
+         */
+        clipboard_poll_hint();
     }
     
-    struct server *s = state->server;
-    
-    wl_event_source_remove(state->event_source);
     close(state->fd);
-    free(state->buf);
     free(state);
     
-    /* Step 3: Reclaim ownership so future pastes go through snarf */
-    snarf_to_wayland_register(s);
-    
-    return 0;
+    /* Step 3: Reclaim ownership (on the event loop) so future pastes
+     * go through snarf; the newer copy does that for a superseded one.
+     * Without the poll pipe the client stays owner. */
+    if (newest && snarf_poll.active) {
+        char c = 1;
+        if (write(snarf_poll.pipe_fd[1], &c, 1) < 0) { /* ignore */ }
+    }
+    return NULL;
 }
 
 /* Signal handler: Wayland client requests to set selection (copy) */
@@ -182,7 +253,7 @@ static void on_wayland_copy(struct wl_listener *listener, void *data) {
     /* Step 1: Let client become selection owner (Wayland protocol requirement) */
     wlr_seat_set_selection(s->seat, event->source, event->serial);
     
-    if (!event->source) {
+    if (!event->source || !snarf_connected) {
         return;
     }
     
@@ -201,37 +272,27 @@ static void on_wayland_copy(struct wl_listener *listener, void *data) {
         return;
     }
     
-    /* Set read end non-blocking */
-    fcntl(fds[0], F_SETFL, O_NONBLOCK);
-    
-    /* Set up async transfer state */
     struct wayland_to_snarf_state *state = calloc(1, sizeof(*state));
     if (!state) {
         close(fds[0]);
         close(fds[1]);
         return;
     }
-    
     state->server = s;
     state->fd = fds[0];
-    state->capacity = SNARF_MAX_SIZE;
-    state->buf = malloc(state->capacity);
-    if (!state->buf) {
-        free(state);
-        close(fds[0]);
-        close(fds[1]);
-        return;
-    }
-    state->len = 0;
+    state->gen = atomic_fetch_add(&snarf_copy.gen, 1) + 1;
     
-    /* Add to event loop */
-    state->event_source = wl_event_loop_add_fd(
-        wl_display_get_event_loop(s->display),
-        fds[0], WL_EVENT_READABLE,
-        wayland_to_snarf_read_handler, state);
-    
-    if (!state->event_source) {
-        free(state->buf);
+    /* Spawn detached thread for the blocking reads and 9P writes */
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, wayland_to_snarf_thread, state);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        wlr_log(WLR_ERROR, "on_wayland_copy: failed to create thread: %s",
+                strerror(err));
+        atomic_store(&snarf_copy.done, state->gen);     /* Nothing in flight */
         free(state);
         close(fds[0]);
         close(fds[1]);
@@ -284,33 +345,36 @@ struct snarf_to_wayland_source {
 struct snarf_read_thread_args {
     struct p9conn *p9;  /* The snarf 9P connection */
     int fd;             /* fd to write to (from wlr_data_source_send) */
+    long sent;          /* Bytes written to fd so far */
 };
 
-/* Thread function: read from snarf and write to client fd */
-static void *snarf_read_thread(void *arg) {
+/* p9_stream_sink: pass a chunk straight on to the client */
+static int snarf_read_sink(void *arg, const uint8_t *data, uint32_t n) {
     struct snarf_read_thread_args *args = arg;
     
-    char *buf = malloc(SNARF_MAX_SIZE);
-    if (buf) {
-        int len = p9_read_file(args->p9, "snarf", buf, SNARF_MAX_SIZE);
-        if (len > 0) {
-            /* Write all data to fd - may need multiple writes */
-            ssize_t total = 0;
-            while (total < len) {
-                ssize_t n = write(args->fd, buf + total, len - total);
-                if (n <= 0) {
-                    if (n < 0 && errno == EINTR) continue;
-                    break;  /* Error or would block */
-                }
-                total += n;
-            }
-            wlr_log(WLR_INFO, "snarf_to_wayland: sent %zd/%d bytes", total, len);
-        } else {
-            wlr_log(WLR_DEBUG, "snarf_to_wayland: snarf empty or read failed");
+    uint32_t total = 0;
+    while (total < n) {
+        ssize_t w = write(args->fd, data + total, n - total);
+        if (w <= 0) {
+            if (w < 0 && errno == EINTR) continue;
+            return -1;  /* Client went away: stop reading */
         }
-        free(buf);
+        total += w;
+    }
+    args->sent += n;
+    return 0;
+}
+
+/* Thread function: stream snarf to the client fd as chunks arrive */
+static void *snarf_read_thread(void *arg) {
+    struct snarf_read_thread_args *args = arg;
+    
+    int len = p9_read_stream(args->p9, "snarf", SNARF_STREAM_DEPTH,
+                             SNARF_MAX_SIZE, snarf_read_sink, args);
+    if (len > 0) {
+        wlr_log(WLR_INFO, "snarf_to_wayland: sent %ld/%d bytes", args->sent, len);
     } else {
-        wlr_log(WLR_ERROR, "snarf_to_wayland: failed to allocate read buffer");
+        wlr_log(WLR_DEBUG, "snarf_to_wayland: snarf empty or read failed");
     }
     
     close(args->fd);
@@ -346,6 +410,10 @@ static void snarf_to_wayland_send(struct wlr_data_source *source,
     
     args->p9 = &sts->server->p9_snarf;
     args->fd = fd;
+    args->sent = 0;
+    
+    /* Clipboard in use: check for Plan 9-side changes promptly */
+    clipboard_poll_hint();
     
     /* Spawn detached thread to do the blocking 9P read */
     pthread_t thread;
@@ -399,24 +467,62 @@ static void snarf_to_wayland_register(struct server *s) {
 /* ─────────────────────────────────────────────────────────────────────────────
  * Snarf Version Polling (thread-based)
  *
- * A dedicated thread polls /dev/snarf's qid.vers via Tstat every 500ms.
- * The blocking 9P RPC runs in the thread so the Wayland event loop is
- * never stalled.  When the version changes, the thread writes a byte
- * to a pipe; the read end is monitored by the event loop which calls
- * snarf_to_wayland_register() on the main thread.
+ * A dedicated thread polls /dev/snarf's qid.vers via Tstat, at an
+ * interval that backs off while nothing changes (see the state block
+ * above).  The blocking 9P RPC runs in the thread so the Wayland event
+ * loop is never stalled.  When the version changes, the thread writes
+ * a byte to a pipe; the read end is monitored by the event loop which
+ * calls snarf_to_wayland_register() on the main thread.
  * ───────────────────────────────────────────────────────────────────────────── */
 
+/* Poll soon: reset the interval and wake the thread */
+static void snarf_poll_kick(void) {
+    pthread_mutex_lock(&snarf_poll.lock);
+    snarf_poll.hinted = true;
+    snarf_poll.interval_ms = SNARF_POLL_MIN_MS;
+    pthread_cond_signal(&snarf_poll.cond);
+    pthread_mutex_unlock(&snarf_poll.lock);
+}
+
+/* Sleep for the current interval, or until kicked or stopped */
+static void snarf_poll_wait(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    
+    pthread_mutex_lock(&snarf_poll.lock);
+    long ns = deadline.tv_nsec + (long)(snarf_poll.interval_ms % 1000) * 1000000L;
+    deadline.tv_sec += snarf_poll.interval_ms / 1000 + ns / 1000000000L;
+    deadline.tv_nsec = ns % 1000000000L;
+    while (snarf_poll.active && !snarf_poll.hinted) {
+        if (pthread_cond_timedwait(&snarf_poll.cond, &snarf_poll.lock,
+                                   &deadline) == ETIMEDOUT)
+            break;
+    }
+    snarf_poll.hinted = false;
+    pthread_mutex_unlock(&snarf_poll.lock);
+}
+
+/* Unchanged stat: double the interval up to the current cap */
+static void snarf_poll_backoff(void) {
+    pthread_mutex_lock(&snarf_poll.lock);
+    int cap = snarf_poll.away ? SNARF_POLL_AWAY_MS : SNARF_POLL_MAX_MS;
+    snarf_poll.interval_ms *= 2;
+    if (snarf_poll.interval_ms > cap) snarf_poll.interval_ms = cap;
+    pthread_mutex_unlock(&snarf_poll.lock);
+}
+
 static void *snarf_poll_thread_func(void *arg) {
     (void)arg;
 
     while (snarf_poll.active) {
-        usleep(SNARF_POLL_MS * 1000);
+        snarf_poll_wait();
         if (!snarf_poll.active)
             break;
 
         uint32_t vers;
         if (p9_stat(&snarf_poll.server->p9_snarf, snarf_poll.snarf_fid, &vers) < 0) {
             wlr_log(WLR_DEBUG, "snarf_poll: stat failed, skipping");
+            snarf_poll_backoff();
             continue;
         }
 
@@ -426,6 +532,12 @@ static void *snarf_poll_thread_func(void *arg) {
             snarf_poll.last_version = vers;
             char c = 1;
             if (write(snarf_poll.pipe_fd[1], &c, 1) < 0) { /* ignore */ }
+            
+            pthread_mutex_lock(&snarf_poll.lock);
+            snarf_poll.interval_ms = SNARF_POLL_MIN_MS;
+            pthread_mutex_unlock(&snarf_poll.lock);
+        } else {
+            snarf_poll_backoff();
         }
     }
 
@@ -433,6 +545,61 @@ static void *snarf_poll_thread_func(void *arg) {
     return NULL;
 }
 
+/* ─────────────────────────────────────────────────────────────────────────────
+ * Window State Hints (/dev/wctl)
+ *
+ * Reads of rio's /dev/wctl block until the window changes (size,
+ * position, current/notcurrent, hidden/visible) and return its state
+ * line.  The watch thread uses it as a free long-poll on p9_wctl: a
+ * transition to current kicks the snarf poll (the user is back, maybe
+ * with something copied elsewhere), and while another window is
+ * current the poll backs off to SNARF_POLL_AWAY_MS.
+ *
+ * Its read only returns on a window change, so cleanup clears
+ * snarf_poll.active and p9_shutdown()s p9_wctl to fail the read, then
+ * joins the thread before server_cleanup() disconnects the session.
+ * With -m that ends the whole shared carrier, which shutdown is about
+ * to disconnect anyway.  If /dev/wctl cannot be opened, polling
+ * simply runs without hints.
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void *wctl_watch_thread_func(void *arg) {
+    struct p9conn *p9 = arg;
+    uint32_t fid = p9->next_fid++;
+    const char *wnames[] = { "wctl" };
+    
+    if (p9_walk(p9, p9->root_fid, fid, 1, wnames) < 0 ||
+        p9_open(p9, fid, OREAD, NULL) < 0) {
+        wlr_log(WLR_INFO, "wctl_watch: /dev/wctl unavailable, no poll hints");
+        return NULL;
+    }
+    
+    int was_current = -1;
+    uint8_t buf[128];
+    while (snarf_poll.active) {
+        int n = p9_read(p9, fid, 0, sizeof(buf) - 1, buf);
+        if (n <= 0) break;
+        buf[n] = '\0';
+        
+        /* "minx miny maxx maxy current|notcurrent visible|hidden" */
+        int current = strstr((char *)buf, "notcurrent") == NULL &&
+                      strstr((char *)buf, "current") != NULL;
+        if (current == was_current) continue;
+        
+        pthread_mutex_lock(&snarf_poll.lock);
+        snarf_poll.away = !current;
+        pthread_mutex_unlock(&snarf_poll.lock);
+        if (current && was_current == 0) {
+            wlr_log(WLR_DEBUG, "wctl_watch: window current, polling snarf");
+            snarf_poll_kick();
+        }
+        was_current = current;
+    }
+    
+    wlr_log(WLR_INFO, "wctl_watch: thread exiting");
+    return NULL;
+}
+
 /* Called on the main event loop when the poll thread detects a change */
 static int snarf_poll_pipe_handler(int fd, uint32_t mask, void *data) {
     (void)mask;
@@ -442,6 +609,10 @@ static int snarf_poll_pipe_handler(int fd, uint32_t mask, void *data) {
     char buf[16];
     while (read(fd, buf, sizeof(buf)) > 0) {}
 
+    /* A copy is still on its way to snarf: its thread pokes again */
+    if (atomic_load(&snarf_copy.done) != atomic_load(&snarf_copy.gen))
+        return 0;
+
     wlr_log(WLR_INFO, "snarf_poll: re-registering as selection owner");
     snarf_to_wayland_register(snarf_poll.server);
     return 0;
@@ -491,6 +662,13 @@ static int snarf_poll_init(struct server *s) {
         return -1;
     }
 
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&snarf_poll.cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    snarf_poll.interval_ms = SNARF_POLL_MIN_MS;
+
     snarf_poll.active = true;
 
     /* Start poll thread */
@@ -498,6 +676,7 @@ static int snarf_poll_init(struct server *s) {
         wlr_log(WLR_ERROR, "snarf_poll_init: failed to create thread: %s",
                 strerror(errno));
         snarf_poll.active = false;
+        pthread_cond_destroy(&snarf_poll.cond);
         wl_event_source_remove(snarf_poll.pipe_source);
         close(snarf_poll.pipe_fd[0]);
         close(snarf_poll.pipe_fd[1]);
@@ -505,8 +684,15 @@ static int snarf_poll_init(struct server *s) {
         return -1;
     }
 
-    wlr_log(WLR_INFO, "snarf_poll: started (interval=%dms, initial version=%u)",
-            SNARF_POLL_MS, snarf_poll.last_version);
+    /* Window state hints are optional */
+    if (pthread_create(&snarf_poll.wctl_thread, NULL, wctl_watch_thread_func,
+                       &s->p9_wctl) == 0)
+        snarf_poll.wctl_started = true;
+    else
+        wlr_log(WLR_ERROR, "snarf_poll_init: no wctl watch thread, polling without hints");
+
+    wlr_log(WLR_INFO, "snarf_poll: started (interval=%d-%dms, initial version=%u)",
+            SNARF_POLL_MIN_MS, SNARF_POLL_MAX_MS, snarf_poll.last_version);
     return 0;
 }
 
@@ -514,7 +700,10 @@ static void snarf_poll_cleanup(struct server *s) {
     if (!snarf_poll.active)
         return;
 
+    pthread_mutex_lock(&snarf_poll.lock);
     snarf_poll.active = false;
+    pthread_cond_signal(&snarf_poll.cond);
+    pthread_mutex_unlock(&snarf_poll.lock);
     pthread_join(snarf_poll.thread, NULL);
 
     if (snarf_poll.pipe_source) {
@@ -525,6 +714,13 @@ static void snarf_poll_cleanup(struct server *s) {
     close(snarf_poll.pipe_fd[1]);
 
     p9_clunk(&s->p9_snarf, snarf_poll.snarf_fid);
+
+    /* Last: with -m this stops p9_snarf's carrier too */
+    if (snarf_poll.wctl_started) {
+        p9_shutdown(&s->p9_wctl);
+        pthread_join(snarf_poll.wctl_thread, NULL);
+        snarf_poll.wctl_started = false;
+    }
 }
 
 /* ─────────────────────────────────────────────────────────────────────────────
@@ -541,8 +737,19 @@ int clipboard_init(struct server *s) {
     wl_signal_add(&s->seat->events.request_set_primary_selection, 
                   &s->wayland_to_snarf_primary);
     
-    /* Snarf → Wayland: register as selection owner (reads lazily on paste) */
-    snarf_to_wayland_register(s);
+    wlr_log(WLR_INFO, "clipboard: initialized");
+    return 0;
+}
+
+int clipboard_connected(struct server *s) {
+    /* Snarf → Wayland: register as selection owner (reads lazily on
+     * paste), unless a client copied before snarf was up */
+    if (!s->seat->selection_source)
+        snarf_to_wayland_register(s);
+
+    /* Tags let transfers pipeline and run alongside the poll's Tstat */
+    if (p9_mux_start(&s->p9_snarf, NULL) < 0)
+        wlr_log(WLR_ERROR, "clipboard: snarf not multiplexed, transfers unpipelined");
 
     /* Start polling snarf for Plan 9-side changes */
     if (snarf_poll_init(s) < 0) {
@@ -551,10 +758,17 @@ int clipboard_init(struct server *s) {
          * and Plan9->Wayland on first paste after init */
     }
     
-    wlr_log(WLR_INFO, "clipboard: initialized");
+    /* Only now: copies before this had no session to write to */
+    snarf_connected = true;
+    wlr_log(WLR_INFO, "clipboard: snarf connected");
     return 0;
 }
 
+void clipboard_poll_hint(void) {
+    if (snarf_poll.active)
+        snarf_poll_kick();
+}
+
 void clipboard_cleanup(struct server *s) {
     snarf_poll_cleanup(s);
     wl_list_remove(&s->wayland_to_snarf.link);
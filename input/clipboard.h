@@ -23,10 +23,11 @@
  *   When a Wayland client sets the selection (copies):
  *     1. on_wayland_copy() handler is called
  *     2. Client becomes selection owner (protocol requirement)
- *     3. Async read via Wayland event loop fd
- *     4. Data written to /dev/snarf via p9_write_file()
- *     5. Snarf poll version updated to avoid false change detection
- *     6. Compositor reclaims selection ownership
+ *     3. A detached thread reads the client's pipe (blocking)
+ *     4. Chunks go to /dev/snarf via p9_write_stream() as they arrive
+ *     5. Snarf poll is hinted so its version baseline catches up
+ *     6. Compositor reclaims selection ownership (via the poll pipe,
+ *        on the event loop)
  *     7. Future pastes (even Wayland-to-Wayland) go through snarf
  *
  * Snarf -> Wayland (Paste):
@@ -35,18 +36,34 @@
  *   come to us:
  *     1. Client requests paste via wlr_data_source_send()
  *     2. snarf_to_wayland_send() spawns detached thread
- *     3. Thread reads from /dev/snarf (blocking OK in thread)
- *     4. Thread writes to client fd and closes it
+ *     3. Thread streams /dev/snarf with p9_read_stream()
+ *     4. Each chunk is written to the client fd as it arrives; the
+ *        fd is closed at EOF
  *
  *   This async approach prevents blocking the compositor on 9P I/O.
  *
+ * Streaming:
+ *
+ *   p9_snarf is multiplexed (p9_mux_start), so a transfer keeps
+ *   SNARF_STREAM_DEPTH (8) iounit-sized requests in flight: a large
+ *   paste over a WAN link costs one round trip per window rather than
+ *   per chunk, and the client sees data from the first reply on.
+ *   Transfers are capped at SNARF_MAX_SIZE in both directions. A copy
+ *   opens /dev/snarf before the client has finished writing, so a
+ *   client that fails midway leaves the part it did send.
+ *
+ *   Copies are serialized: rio has one snarf buffer in progress, so
+ *   one transfer runs at a time, and a copy superseded by a newer one
+ *   stops and does not reclaim ownership. Paste, copy and poll
+ *   threads share p9_snarf; its fid allocation is atomic.
+ *
  * Snarf Version Polling:
  *
  *   Rio's /dev/snarf exposes a version counter via qid.vers that
  *   increments on each write. A dedicated thread polls this with
- *   Tstat every 500ms to detect Plan 9-side clipboard changes
- *   (e.g., user copies text in a rio window). When a change is
- *   detected, the thread signals the main event loop via a pipe:
+ *   Tstat to detect Plan 9-side clipboard changes (e.g., user copies
+ *   text in a rio window). When a change is detected, the thread
+ *   signals the main event loop via a pipe:
  *
  *     1. Poll thread: Tstat returns new qid.vers
  *     2. Poll thread writes to pipe
@@ -58,6 +75,25 @@
  *   The blocking Tstat RPC runs entirely in the poll thread, so the
  *   Wayland event loop is never stalled by 9P I/O.
  *
+ * Adaptive Interval:
+ *
+ *   /dev/snarf has no blocking read, so it must be polled, but an idle
+ *   clipboard need not cost a round trip every half second:
+ *
+ *     interval   250ms after a change or hint, doubling after every
+ *                unchanged stat
+ *     cap        4s while our rio window is current, 30s while
+ *                another window is
+ *     hints      clipboard_poll_hint() (keyboard focus changes,
+ *                paste requests, our own copies) and our window
+ *                becoming current reset the interval and poll now
+ *
+ *   Window state comes from /dev/wctl, whose reads block until the
+ *   window changes: a thread on s->p9_wctl long-polls it, and
+ *   clipboard_cleanup() shuts p9_wctl down to end it.
+ *   Without /dev/wctl the cap stays at 4s and only the other hints
+ *   apply.
+ *
  * Primary Selection:
  *
  *   Primary selection (highlight-to-copy, middle-click paste) is NOT
@@ -65,14 +101,27 @@
  *   on every text highlight, which would overwrite the clipboard
  *   unexpectedly. Only explicit Ctrl+C copies go to snarf.
  *
+ * Late Connection:
+ *
+ *   p9_snarf is connected after the first frame has gone out
+ *   (sessions.h). clipboard_init() only hooks the seat; until
+ *   clipboard_connected() copies stay between Wayland clients and
+ *   nothing polls snarf. A selection a client set in the meantime is
+ *   kept, and snarf takes over ownership at the next copy or
+ *   Plan 9-side change.
+ *
  * Usage:
  *
- *   Initialize during server setup (after seat and p9_snarf are ready):
+ *   Initialize during server setup (after the seat is ready):
  *
  *     if (clipboard_init(server) < 0) {
  *         // handle error
  *     }
  *
+ *   Once p9_snarf is connected, on the event loop:
+ *
+ *     clipboard_connected(server);
+ *
  *   Clean up during shutdown:
  *
  *     clipboard_cleanup(server);
@@ -91,8 +140,21 @@ struct server;
  * Sets up:
  *   - Listener for Wayland copy events (request_set_selection)
  *   - Listener for primary selection (not synced to snarf)
- *   - Initial registration as selection owner
- *   - Snarf version polling thread (500ms interval)
+ *
+ * s: server instance (must have seat initialized)
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int clipboard_init(struct server *s);
+
+/*
+ * Start syncing with /dev/snarf once p9_snarf is connected.
+ *
+ * Sets up:
+ *   - Registration as selection owner (if no client owns it)
+ *   - Tag multiplexing on p9_snarf
+ *   - Snarf version polling thread (adaptive interval) and the
+ *     /dev/wctl watch thread that feeds it hints
  *
  * The snarf poll walks to /dev/snarf once (without opening) and
  * keeps the fid for periodic Tstat calls in a background thread.
@@ -100,18 +162,32 @@ struct server;
  * still works for Wayland->Plan9 copies and the first Plan9->Wayland
  * paste.
  *
- * s: server instance (must have seat and p9_snarf initialized)
+ * Call on the event loop thread, after clipboard_init().
  *
- * Returns 0 on success, -1 on failure.
+ * s: server instance (p9_snarf connected)
+ *
+ * Returns 0.
  */
-int clipboard_init(struct server *s);
+int clipboard_connected(struct server *s);
+
+/*
+ * Hint that the clipboard may be used soon.
+ *
+ * Resets the snarf poll interval to its minimum and wakes the poll
+ * thread, so a Plan 9-side change is seen promptly. Cheap and safe
+ * from any thread; a no-op when polling is not running.
+ */
+void clipboard_poll_hint(void);
 
 /*
  * Clean up clipboard resources.
  *
  * Stops the snarf polling thread, closes the notification pipe,
- * clunks the stat fid, and removes Wayland event listeners. Any
- * in-flight async paste threads will complete independently.
+ * clunks the stat fid, shuts p9_wctl down (p9_shutdown(), the whole
+ * carrier with -m) and joins the wctl watch thread, and removes
+ * Wayland event listeners. Call before server_cleanup() and after
+ * cursor_cleanup(). Any in-flight async paste threads will complete
+ * independently.
  *
  * s: server instance
  */
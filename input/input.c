@@ -13,6 +13,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <sys/eventfd.h>
 #include <linux/input-event-codes.h>
 
 #include <wlr/util/log.h>
@@ -170,39 +171,106 @@ uint32_t keymapmod(int rune) {
 
 /* ============== Input Queue ============== */
 
+/* Ring of the thread that produces this event type (see types.h) */
+static inline struct input_ring *input_ring_for(struct input_queue *q, int type) {
+    switch (type) {
+    case INPUT_MOUSE: return &q->rings[INPUT_SRC_MOUSE];
+    case INPUT_KEY:   return &q->rings[INPUT_SRC_KBD];
+    default:          return &q->rings[INPUT_SRC_SEND];
+    }
+}
+
 void input_queue_init(struct input_queue *q) {
-    q->head = q->tail = 0;
-    pthread_mutex_init(&q->lock, NULL);
-    if (pipe(q->pipe_fd) < 0) {
-        wlr_log(WLR_ERROR, "pipe failed: %s", strerror(errno));
-        q->pipe_fd[0] = q->pipe_fd[1] = -1;
+    memset(q, 0, sizeof(*q));
+    q->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->event_fd < 0)
+        wlr_log(WLR_ERROR, "eventfd failed: %s", strerror(errno));
+}
+
+void input_queue_push(struct input_queue *q, struct input_event *ev) {
+    struct input_ring *r = input_ring_for(q, ev->type);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+    
+    /* Drop the event if the ring buffer is full */
+    if (tail - head >= INPUT_QUEUE_SIZE) {
+        unsigned n = atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed) + 1;
+        if ((n & (n - 1)) == 0)
+            wlr_log(WLR_DEBUG, "Input queue full: %u events dropped", n);
+        return;
     }
-    fcntl(q->pipe_fd[0], F_SETFL, O_NONBLOCK);
     
+    unsigned slot = tail & (INPUT_QUEUE_SIZE - 1);
+    r->events[slot] = *ev;
+    r->seq[slot] = atomic_fetch_add_explicit(&q->next_seq, 1, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    input_queue_wake(q);
 }
 
-void input_queue_push(struct input_queue *q, struct input_event *ev) {
-    pthread_mutex_lock(&q->lock);
-    int next = (q->tail + 1) % INPUT_QUEUE_SIZE;
-    if (next != q->head) {
-        q->events[q->tail] = *ev;
-        q->tail = next;
-        char c = 1;
-        if (write(q->pipe_fd[1], &c, 1) < 0) { /* ignore */ }
+void input_queue_wake(struct input_queue *q) {
+    /* Wake the main loop only on the first time since its last drain */
+    if (!atomic_exchange(&q->signaled, 1)) {
+        uint64_t one = 1;
+        if (write(q->event_fd, &one, sizeof(one)) < 0) { /* ignore */ }
     }
-    /* Drop the event if the ring buffer is full */
-    pthread_mutex_unlock(&q->lock);
+}
+
+void input_queue_ack(struct input_queue *q) {
+    uint64_t count;
+    if (read(q->event_fd, &count, sizeof(count)) < 0) { /* ignore */ }
+    /* Pushes from here on signal again; earlier ones are popped next */
+    atomic_store(&q->signaled, 0);
+}
+
+/* Ring holding the oldest pending event, or NULL if all are empty */
+static struct input_ring *input_ring_oldest(struct input_queue *q, unsigned *slot_out) {
+    struct input_ring *best = NULL;
+    uint32_t best_seq = 0;
+    unsigned best_slot = 0;
+    
+    for (int i = 0; i < INPUT_SRC_COUNT; i++) {
+        struct input_ring *r = &q->rings[i];
+        unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head == tail) continue;
+        unsigned slot = head & (INPUT_QUEUE_SIZE - 1);
+        if (!best || (int32_t)(r->seq[slot] - best_seq) < 0) {
+            best = r;
+            best_seq = r->seq[slot];
+            best_slot = slot;
+        }
+    }
+    *slot_out = best_slot;
+    return best;
+}
+
+static inline void input_ring_advance(struct input_ring *r) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* Would `next` replace `ev` without losing anything? */
+static inline int input_mergeable(const struct input_event *ev,
+                                 const struct input_event *next) {
+    if (next->type != ev->type) return 0;
+    if (ev->type == INPUT_WAKEUP) return 1;
+    return ev->type == INPUT_MOUSE && next->mouse.buttons == ev->mouse.buttons;
 }
 
 int input_queue_pop(struct input_queue *q, struct input_event *ev) {
-    pthread_mutex_lock(&q->lock);
-    if (q->head == q->tail) {
-        pthread_mutex_unlock(&q->lock);
-        return 0;
+    unsigned slot;
+    struct input_ring *r = input_ring_oldest(q, &slot);
+    if (!r) return 0;
+    *ev = r->events[slot];
+    input_ring_advance(r);
+    
+    /* Motion with unchanged buttons (and repeated wakeups) only matters
+     * as its latest state: fold the run into one event */
+    if (ev->type == INPUT_KEY) return 1;
+    while ((r = input_ring_oldest(q, &slot)) && input_mergeable(ev, &r->events[slot])) {
+        *ev = r->events[slot];
+        input_ring_advance(r);
     }
-    *ev = q->events[q->head];
-    q->head = (q->head + 1) % INPUT_QUEUE_SIZE;
-    pthread_mutex_unlock(&q->lock);
     return 1;
 }
 
@@ -237,7 +305,12 @@ void *mouse_thread_func(void *arg) {
     while (s->running) {
         int n = p9_read(p9, mouse_fid, 0, sizeof(buf) - 1, buf);
         if (n <= 0) {
-            if (s->running) wlr_log(WLR_ERROR, "Mouse thread: read failed");
+            if (s->running) {
+                /* Its rio window was most likely deleted */
+                wlr_log(WLR_ERROR, "Mouse thread: read failed");
+                atomic_store(&s->input_lost, 1);
+                input_queue_wake(&s->input_queue);
+            }
             break;
         }
         
@@ -255,8 +328,8 @@ void *mouse_thread_func(void *arg) {
             }
         } else if (buf[0] == 'r') {
             wlr_log(WLR_INFO, "Mouse: resize notification");
+            /* The send thread re-presents image_id; no full resend */
             s->window_changed = 1;
-            s->force_full_frame = 1;
             s->scene_dirty = 1;
             
             pthread_mutex_lock(&s->send_lock);
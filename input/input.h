@@ -5,7 +5,8 @@
  *   - Keyboard input: Reading from /dev/kbd, translating Plan 9 runes
  *     to Linux keycodes, and injecting into Wayland
  *   - Mouse input: Reading from /dev/mouse and forwarding to Wayland
- *   - Input queue: Thread-safe queue for passing events to main loop
+ *   - Input queue: lock-free per-thread rings for passing events to
+ *     the main loop
  *
  * Key Translation:
  *
@@ -118,13 +119,35 @@ int utf8_decode(const unsigned char *p, const unsigned char *end, int *rune);
 
 /* ============== Input Queue ============== */
 
+/*
+ * Input Queue:
+ *
+ *   One lock-free single-producer ring per producer thread (mouse,
+ *   keyboard, send), drained by the main loop:
+ *
+ *     mouse thread ──► rings[MOUSE] ─┐
+ *     kbd thread   ──► rings[KBD]   ─┼─► input_queue_pop() ─► handlers
+ *     send thread  ──► rings[SEND]  ─┘   (oldest first, by seq)
+ *
+ *   A push is a slot copy, one relaxed fetch_add for the queue-wide
+ *   sequence number and a release store of the ring's tail; no lock.
+ *   event_fd is written only when the queue goes from "drained" to
+ *   "has events" (the `signaled` flag), so a motion burst costs one
+ *   wakeup instead of one write per event.
+ *
+ *   input_queue_pop() folds a run of consecutive INPUT_MOUSE events
+ *   with unchanged buttons into the last one (and a run of
+ *   INPUT_WAKEUPs into one): the main loop handles only the latest
+ *   position, however many arrived since it last ran. Button
+ *   changes and key events are never merged or reordered.
+ */
+
 /*
  * Initialize an input queue.
  *
- * Initializes the mutex and creates a notification pipe (read end
- * set non-blocking). The caller is responsible for adding the pipe
- * read fd to the Wayland event loop via wl_event_loop_add_fd().
- * Must be called before any push/pop.
+ * Zeroes the rings and creates the non-blocking eventfd. The caller
+ * is responsible for adding q->event_fd to the Wayland event loop via
+ * wl_event_loop_add_fd(). Must be called before any push/pop.
  *
  * q: queue to initialize
  */
@@ -133,7 +156,9 @@ void input_queue_init(struct input_queue *q);
 /*
  * Push an event onto the input queue.
  *
- * Thread-safe. Events are silently dropped if queue is full.
+ * Lock-free. Each event type must only be pushed from its one
+ * producer thread (see enum input_source). Events are dropped (and
+ * counted in q->dropped) if that thread's ring is full.
  *
  * q:  queue to push to
  * ev: event to copy into queue
@@ -141,9 +166,24 @@ void input_queue_init(struct input_queue *q);
 void input_queue_push(struct input_queue *q, struct input_event *ev);
 
 /*
- * Pop an event from the input queue.
+ * Wake the main loop without pushing an event, for state a producer
+ * publishes elsewhere (s->input_lost). Safe from any thread.
+ */
+void input_queue_wake(struct input_queue *q);
+
+/*
+ * Acknowledge a wakeup: clear event_fd and re-arm signalling.
+ *
+ * Call from the event_fd handler before popping, so that any event
+ * pushed after the last pop raises a new wakeup.
+ */
+void input_queue_ack(struct input_queue *q);
+
+/*
+ * Pop the oldest event from the input queue.
  *
- * Thread-safe. Non-blocking - returns immediately if empty.
+ * Main loop only. Non-blocking - returns immediately if empty. Runs
+ * of mergeable events are returned as one (see "Input Queue").
  *
  * q:  queue to pop from
  * ev: output - event copied from queue
@@ -46,8 +46,14 @@
 #include "p9/p9_tls.h"
 #include "input/input.h"
 #include "input/clipboard.h"
+#include "draw/arena.h"
 #include "draw/draw.h"
+#include "draw/metrics.h"
+#include "draw/trace.h"
+#include "draw/timeline.h"
 #include "draw/send.h"
+#include "draw/compress.h"
+#include "draw/parallel.h"
 #include "wayland/wayland.h"
 
 static void print_usage(const char *prog) {
@@ -57,9 +63,26 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  -f <fp>        SHA256 fingerprint of server certificate (hex)\n");
     fprintf(stderr, "  -k             Insecure mode: skip certificate verification\n");
     fprintf(stderr, "  -u <user>      9P username (default: $P9USER, $USER, or 'glenda')\n");
+    fprintf(stderr, "  -K             Kernel TLS offload for the draw connection (if supported)\n");
+    fprintf(stderr, "  -m             Share one connection among all sessions but draw (2 handshakes, not 6)\n");
     fprintf(stderr, "\nDisplay options:\n");
     fprintf(stderr, "  -S <scale>     Output scale factor (1.0-4.0, default: 1.0)\n");
+    fprintf(stderr, "  -C <MiB>       Server-side tile cache size (0-%d, 0 disables, default: %d)\n",
+            TILE_CACHE_MAX_MB, TILE_CACHE_DEFAULT_MB);
+    fprintf(stderr, "  -E <level>     Compression effort: 0 raw, 1 fast, 2 default, 3 high,\n");
+    fprintf(stderr, "                 or auto from link throughput (default: auto, $P9WL_EFFORT)\n");
+    fprintf(stderr, "  -X             Keep the Plan 9 cursor, ignore client cursor images\n");
+    fprintf(stderr, "  -B             Tile-major framebuffers (no scroll detection or merged loads)\n");
+    fprintf(stderr, "  -w             One rio window per application window, each with its own pipeline\n");
+    fprintf(stderr, "\nThreading options:\n");
+    fprintf(stderr, "  -W <n>         Compression worker threads (1-%d, default: auto, $P9WL_WORKERS)\n",
+            MAX_WORKERS);
+    fprintf(stderr, "  -A <cpus>      Pin workers to CPUs, e.g. 4-7,12 or node:1 ($P9WL_WORKER_CPUS)\n");
+    fprintf(stderr, "  -P <cpus>      Pin send and drain threads to CPUs ($P9WL_IO_CPUS)\n");
     fprintf(stderr, "\nLogging options:\n");
+    fprintf(stderr, "  -M <path>      Serve metrics (Prometheus text) on a Unix socket ($P9WL_METRICS)\n");
+    fprintf(stderr, "  -T <file>      Capture frames to a trace for p9wl-bench (stops on resize)\n");
+    fprintf(stderr, "  -J <file>      Record per-frame spans as Chrome trace JSON for Perfetto ($P9WL_TIMELINE)\n");
     fprintf(stderr, "  -q             Quiet mode (errors only, default)\n");
     fprintf(stderr, "  -v             Verbose mode (info + errors)\n");
     fprintf(stderr, "  -d             Debug mode (all messages)\n");
@@ -80,97 +103,183 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "\n");
 }
 
-static int parse_args(int argc, char *argv[], const char **host, int *port,
-                      const char **uname, float *scale,
-                      enum wlr_log_importance *log_level,
-                      struct tls_config *tls_cfg,  
-                      char ***exec_argv, int *exec_argc) {
+/* Effort level from "0".."3" or "auto" (-1); -2 if invalid */
+static int parse_effort(const char *str) {
+    if (strcmp(str, "auto") == 0) return -1;
+    char *end;
+    long level = strtol(str, &end, 10);
+    if (end == str || *end || level < COMPRESS_EFFORT_RAW || level > COMPRESS_EFFORT_HIGH)
+        return -2;
+    return (int)level;
+}
+
+/* Command line and environment settings, filled in by parse_args() */
+struct options {
+    const char *host;
+    int port;
+    const char *uname;
+    float scale;
+    int cache_mb;
+    int effort;                 /* COMPRESS_EFFORT_*, -1 = auto */
+    int cursor_offload;
+    int tile_major;
+    int multi_window;
+    int share_conns;
+    const char *metrics_path;
+    const char *trace_path;
+    const char *timeline_path;
+    enum wlr_log_importance log_level;
+    struct tls_config tls;
+    struct parallel_config pool;
+    char **exec_argv;           /* Command to run, exec_argc words */
+    int exec_argc;
+};
+
+static int parse_args(int argc, char *argv[], struct options *o) {
     static char host_buf[256];  /* Static: lifetime matches program, not reentrant */
 
-    *host = NULL;
-    *port = -1;
-    *uname = NULL;
-    *scale = 1.0f;
-    *log_level = WLR_ERROR;
-    memset(tls_cfg, 0, sizeof(*tls_cfg));
-    *exec_argv = NULL;
-    *exec_argc = 0;
+    memset(o, 0, sizeof(*o));
+    o->port = -1;
+    o->scale = 1.0f;
+    o->cache_mb = TILE_CACHE_DEFAULT_MB;
+    o->effort = -1;
+    o->cursor_offload = 1;
+    o->metrics_path = getenv("P9WL_METRICS");
+    o->timeline_path = getenv("P9WL_TIMELINE");
+    o->log_level = WLR_ERROR;
+
+    /* Environment first so that options override it */
+    const char *env = getenv("P9WL_WORKERS");
+    if (env) o->pool.nthreads = atoi(env);
+    o->pool.worker_cpus = getenv("P9WL_WORKER_CPUS");
+    o->pool.io_cpus = getenv("P9WL_IO_CPUS");
+    env = getenv("P9WL_EFFORT");
+    if (env && (o->effort = parse_effort(env)) < -1) {
+        fprintf(stderr, "Warning: ignoring invalid P9WL_EFFORT '%s'\n", env);
+        o->effort = -1;
+    }
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
-            tls_cfg->cert_file = argv[++i];
+            o->tls.cert_file = argv[++i];
         } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
-            tls_cfg->cert_fingerprint = argv[++i];
+            o->tls.cert_fingerprint = argv[++i];
         } else if (strcmp(argv[i], "-k") == 0) {
-            tls_cfg->insecure = 1;
+            o->tls.insecure = 1;
+        } else if (strcmp(argv[i], "-K") == 0) {
+            o->tls.ktls = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            o->share_conns = 1;
         } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
-            *uname = argv[++i];
+            o->uname = argv[++i];
         } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
-            *scale = strtof(argv[++i], NULL);
-            if (*scale < 1.0f) *scale = 1.0f;
-            if (*scale > 4.0f) *scale = 4.0f;
+            o->scale = strtof(argv[++i], NULL);
+            if (o->scale < 1.0f) o->scale = 1.0f;
+            if (o->scale > 4.0f) o->scale = 4.0f;
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            o->cache_mb = atoi(argv[++i]);
+            if (o->cache_mb < 0) o->cache_mb = 0;
+            if (o->cache_mb > TILE_CACHE_MAX_MB) o->cache_mb = TILE_CACHE_MAX_MB;
+        } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+            o->effort = parse_effort(argv[++i]);
+            if (o->effort < -1) {
+                fprintf(stderr, "Invalid effort level: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-X") == 0) {
+            o->cursor_offload = 0;
+        } else if (strcmp(argv[i], "-B") == 0) {
+            o->tile_major = 1;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            o->multi_window = 1;
+        } else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            o->pool.nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            o->pool.worker_cpus = argv[++i];
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            o->pool.io_cpus = argv[++i];
+        } else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            o->metrics_path = argv[++i];
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            o->trace_path = argv[++i];
+        } else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc) {
+            o->timeline_path = argv[++i];
         } else if (strcmp(argv[i], "-q") == 0) {
-            *log_level = WLR_ERROR;
+            o->log_level = WLR_ERROR;
         } else if (strcmp(argv[i], "-v") == 0) {
-            *log_level = WLR_INFO;
+            o->log_level = WLR_INFO;
         } else if (strcmp(argv[i], "-d") == 0) {
-            *log_level = WLR_DEBUG;
+            o->log_level = WLR_DEBUG;
         } else if (strcmp(argv[i], "-h") == 0) {
             return -1;
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             return -1;
-        } else if (!*host) {
-            *host = argv[i];
+        } else if (!o->host) {
+            o->host = argv[i];
             char *colon = strchr(argv[i], ':');
             if (colon) {
-                *port = atoi(colon + 1);
+                o->port = atoi(colon + 1);
                 size_t len = colon - argv[i];
                 if (len >= sizeof(host_buf)) len = sizeof(host_buf) - 1;
                 memcpy(host_buf, argv[i], len);
                 host_buf[len] = '\0';
-                *host = host_buf;
+                o->host = host_buf;
             }
         } else {
-            *exec_argv = &argv[i];
-            *exec_argc = argc - i;
+            o->exec_argv = &argv[i];
+            o->exec_argc = argc - i;
             break;
         }
     }
 
-    if (!*host)
+    if (!o->host)
         return -1;
 
-    if (*port < 0)
-        *port = (tls_cfg->cert_file || tls_cfg->cert_fingerprint || tls_cfg->insecure)
+    if (o->pool.nthreads < 0) o->pool.nthreads = 0;
+    if (o->pool.nthreads > MAX_WORKERS) o->pool.nthreads = MAX_WORKERS;
+
+    if (o->port < 0)
+        o->port = (o->tls.cert_file || o->tls.cert_fingerprint || o->tls.insecure)
                 ? P9_TLS_PORT : P9_PORT;
 
-    if (tls_cfg->insecure && (tls_cfg->cert_file || tls_cfg->cert_fingerprint)) {
+    if (o->tls.ktls && !(o->tls.cert_file || o->tls.cert_fingerprint || o->tls.insecure)) {
+        fprintf(stderr, "Warning: -K (kernel TLS) has no effect without TLS\n");
+        o->tls.ktls = 0;
+    }
+
+    if (o->tls.insecure && (o->tls.cert_file || o->tls.cert_fingerprint)) {
         fprintf(stderr, "Warning: -k (insecure) ignores -c and -f options\n");
-        tls_cfg->cert_file = NULL;
-        tls_cfg->cert_fingerprint = NULL;
+        o->tls.cert_file = NULL;
+        o->tls.cert_fingerprint = NULL;
     }
 
     return 0;
 }
 
-/* Connect all six 9P sessions, rolling back on failure. */
+/*
+ * Connect the sessions the first frame needs, concurrently, rolling
+ * back on failure.  kbd and snarf follow after it (sessions.h).  With
+ * -m only draw and p9_shared are TCP connections; the rest are
+ * channels of p9_shared (p9.h, "Shared Connections").
+ */
 static int connect_9p_sessions(struct server *s, struct tls_config *tls_cfg) {
-    struct p9conn *conns[] = {
-        &s->p9_draw, &s->p9_relookup, &s->p9_mouse, &s->p9_kbd, &s->p9_wctl, &s->p9_snarf
+    /* kTLS only pays off on the bulk draw stream */
+    struct tls_config side_cfg = *tls_cfg;
+    side_cfg.ktls = 0;
+    struct p9conn *carrier = s->share_conns ? &s->p9_shared : NULL;
+
+    struct p9_connect_req reqs[] = {
+        { .p9 = &s->p9_draw,     .name = "draw",     .tls = tls_cfg,   .carrier = NULL },
+        { .p9 = &s->p9_relookup, .name = "relookup", .tls = &side_cfg, .carrier = carrier },
+        { .p9 = &s->p9_mouse,    .name = "mouse",    .tls = &side_cfg, .carrier = carrier },
+        { .p9 = &s->p9_wctl,     .name = "wctl",     .tls = &side_cfg, .carrier = carrier },
+        { .p9 = &s->p9_shared,   .name = "shared",   .tls = &side_cfg, .carrier = NULL },
     };
-    const char *names[] = { "draw", "relookup", "mouse", "kbd", "wctl", "snarf" };
-    int n = sizeof(conns) / sizeof(conns[0]);
-
-    for (int i = 0; i < n; i++) {
-        if (p9_connect(conns[i], s->host, s->port, tls_cfg) < 0) {
-            wlr_log(WLR_ERROR, "Failed to connect (%s)", names[i]);
-            for (int j = 0; j < i; j++)
-                p9_disconnect(conns[j]);
-            return -1;
-        }
-    }
-    return 0;
+    int n = sizeof(reqs) / sizeof(reqs[0]);
+    if (!s->share_conns) n--;
+
+    return p9_connect_parallel(s->host, s->port, reqs, n);
 }
 
 /*
@@ -292,39 +401,38 @@ static const char *setup_socket(struct server *s) {
 }
 
 int main(int argc, char *argv[]) {
-    const char *host, *uname;
-    int port, exec_argc, ret = 1;
-    float scale;
-    enum wlr_log_importance log_level;
-    struct tls_config tls_cfg;
-    char **exec_argv;
+    struct options o;
+    int ret = 1;
 
-    if (parse_args(argc, argv, &host, &port, &uname, &scale, &log_level,
-                   &tls_cfg, &exec_argv, &exec_argc) < 0) {
+    if (parse_args(argc, argv, &o) < 0) {
         print_usage(argv[0]);
         return 1;
     }
 
-    if (uname)
-        setenv("P9USER", uname, 1);
+    if (o.uname)
+        setenv("P9USER", o.uname, 1);
 
     signal(SIGPIPE, SIG_IGN);
-    wlr_log_init(log_level, NULL);
+    wlr_log_init(o.log_level, NULL);
+
+    /* Before any thread touches the worker pool */
+    if (parallel_configure(&o.pool) < 0)
+        return 1;
 
-    int using_tls = tls_cfg.cert_file || tls_cfg.cert_fingerprint || tls_cfg.insecure;
+    int using_tls = o.tls.cert_file || o.tls.cert_fingerprint || o.tls.insecure;
     if (using_tls) {
         if (tls_init() < 0) {
             wlr_log(WLR_ERROR, "Failed to initialize TLS");
             return 1;
         }
-        if (tls_cfg.cert_file) {
-            wlr_log(WLR_INFO, "TLS mode: certificate pinning (file: %s)", tls_cfg.cert_file);
+        if (o.tls.cert_file) {
+            wlr_log(WLR_INFO, "TLS mode: certificate pinning (file: %s)", o.tls.cert_file);
             char fp[65];
-            if (tls_cert_file_fingerprint(tls_cfg.cert_file, fp, sizeof(fp)) == 0)
+            if (tls_cert_file_fingerprint(o.tls.cert_file, fp, sizeof(fp)) == 0)
                 wlr_log(WLR_INFO, "Pinned certificate fingerprint: %s", fp);
-        } else if (tls_cfg.cert_fingerprint) {
+        } else if (o.tls.cert_fingerprint) {
             wlr_log(WLR_INFO, "TLS mode: fingerprint pinning");
-        } else if (tls_cfg.insecure) {
+        } else if (o.tls.insecure) {
             wlr_log(WLR_ERROR, "WARNING: TLS certificate verification disabled (vulnerable to MITM)");
         }
     }
@@ -332,21 +440,30 @@ int main(int argc, char *argv[]) {
     struct server s = {0};
     wl_list_init(&s.toplevels);
     focus_manager_init(&s.focus, &s);
-    s.host = host;
-    s.port = port;
+    s.host = o.host;
+    s.port = o.port;
     s.running = 1;
     s.use_tls = using_tls;
-    s.scale = scale;
-    s.log_level = log_level;
-    if (tls_cfg.cert_file)
-        s.tls_cert_file = strdup(tls_cfg.cert_file);
-    if (tls_cfg.cert_fingerprint)
-        s.tls_fingerprint = strdup(tls_cfg.cert_fingerprint);
-    s.tls_insecure = tls_cfg.insecure;
-
-    wlr_log(WLR_INFO, "Connecting to %s:%d", host, port);
-
-    if (connect_9p_sessions(&s, &tls_cfg) < 0)
+    s.scale = o.scale;
+    s.tile_cache_mb = o.cache_mb;
+    s.compress_effort = o.effort;
+    s.cursor_offload = o.cursor_offload;
+    s.tile_major = o.tile_major;
+    s.multi_window = o.multi_window;
+    if (o.multi_window)
+        wl_list_init(&s.windows);
+    s.log_level = o.log_level;
+    if (o.tls.cert_file)
+        s.tls_cert_file = strdup(o.tls.cert_file);
+    if (o.tls.cert_fingerprint)
+        s.tls_fingerprint = strdup(o.tls.cert_fingerprint);
+    s.tls_insecure = o.tls.insecure;
+    s.tls_ktls = o.tls.ktls;
+    s.share_conns = o.share_conns;
+
+    wlr_log(WLR_INFO, "Connecting to %s:%d", o.host, o.port);
+
+    if (connect_9p_sessions(&s, &o.tls) < 0)
         goto cleanup;
 
     if (init_draw(&s) < 0) {
@@ -368,10 +485,12 @@ int main(int argc, char *argv[]) {
                 focus_phys_to_logical(s.visible_height, s.scale));
     }
 
-    s.framebuf = calloc(s.width * s.height, 4);
-    s.prev_framebuf = calloc(s.width * s.height, 4);
-    s.send_buf[0] = calloc(s.width * s.height, 4);
-    s.send_buf[1] = calloc(s.width * s.height, 4);
+    /* Huge-page backed, zeroed (see draw/arena.h) */
+    s.fb_cap = (size_t)s.width * s.height;
+    s.framebuf = arena_map(s.fb_cap * 4);
+    s.prev_framebuf = arena_map(s.fb_cap * 4);
+    s.send_buf[0] = arena_map(s.fb_cap * 4);
+    s.send_buf[1] = arena_map(s.fb_cap * 4);
     if (!s.framebuf || !s.prev_framebuf || !s.send_buf[0] || !s.send_buf[1]) {
         wlr_log(WLR_ERROR, "Memory allocation failed");
         goto cleanup;
@@ -383,36 +502,50 @@ int main(int argc, char *argv[]) {
     s.active_buf = -1;
     pthread_mutex_init(&s.send_lock, NULL);
     pthread_cond_init(&s.send_cond, NULL);
+    if (send_init(&s) < 0) {
+        wlr_log(WLR_ERROR, "Memory allocation failed");
+        goto cleanup;
+    }
 
     input_queue_init(&s.input_queue);
 
+    if (o.metrics_path && *o.metrics_path)
+        metrics_start(o.metrics_path);
+    if (o.trace_path)
+        trace_capture_start(o.trace_path, &s);
+    timeline_thread_name("output");
+    if (o.timeline_path && *o.timeline_path)
+        timeline_start(o.timeline_path);
+
     pthread_create(&s.mouse_thread, NULL, mouse_thread_func, &s);
-    pthread_create(&s.kbd_thread, NULL, kbd_thread_func, &s); 
     pthread_create(&s.send_thread, NULL, send_thread_func, &s);
 
     if (init_wayland(&s) < 0)
         goto cleanup;
 
+    cursor_init(&s);
     clipboard_init(&s);
+    if (sessions_late_start(&s) < 0)
+        goto cleanup;
 
     if (!setup_socket(&s))
         goto cleanup;
 
-    if (exec_argc > 0) {
+    if (o.exec_argc > 0) {
         pid_t pid = fork();
         if (pid < 0) {
             wlr_log(WLR_ERROR, "fork: %s", strerror(errno));
             goto cleanup;
         } else if (pid == 0) {
-            execvp(exec_argv[0], exec_argv);
-            fprintf(stderr, "exec %s: %s\n", exec_argv[0], strerror(errno));
+            execvp(o.exec_argv[0], o.exec_argv);
+            fprintf(stderr, "exec %s: %s\n", o.exec_argv[0], strerror(errno));
             _exit(1);
         }
-        wlr_log(WLR_INFO, "Spawned child %d: %s", pid, exec_argv[0]);
+        wlr_log(WLR_INFO, "Spawned child %d: %s", pid, o.exec_argv[0]);
     }
 
     s.input_event = wl_event_loop_add_fd(wl_display_get_event_loop(s.display),
-                                          s.input_queue.pipe_fd[0],
+                                          s.input_queue.event_fd,
                                           WL_EVENT_READABLE,
                                           handle_input_events, &s);
     s.send_timer = wl_event_loop_add_timer(wl_display_get_event_loop(s.display),
@@ -429,10 +562,16 @@ int main(int argc, char *argv[]) {
 
 cleanup:
     if (s.display) {
+        window_destroy_all(&s);
+        cursor_cleanup(&s);
+        sessions_late_stop(&s);
         clipboard_cleanup(&s);
         wl_display_destroy(s.display);
     }
+    trace_capture_stop();
     server_cleanup(&s);
+    metrics_stop();
+    timeline_stop();
     if (using_tls)
         tls_cleanup();
     return ret;
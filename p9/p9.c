@@ -4,6 +4,12 @@
  * Refactored:
  * - Extracted p9_walk_open() helper for common walk+open pattern
  * - Simplified p9_read_file/p9_write_file using the helper
+ * - Optional tag multiplexing with a reader thread (p9_mux_start)
+ * - Pipelined Twrites gathered with writev / packed into one SSL_write,
+ *   and an optional send queue (p9_write_queue + p9_flush)
+ * - Streaming file transfers with several Treads/Twrites in flight
+ *   (p9_read_stream / p9_write_stream)
+ * - Channels sharing one multiplexed connection (p9_channel_open)
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -12,7 +18,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -22,11 +31,12 @@
 #include "p9.h"
 #include "p9_tls.h"
 
-/* Write full buffer - TLS or plaintext */
+/* Write full buffer - TLS or plaintext (kTLS: kernel encrypts) */
 int p9_write_full(struct p9conn *p9, const uint8_t *buf, int len) {
-    if (p9->ssl) {
+    if (p9->ssl && !p9->ktls_tx) {
         int r = tls_write_full(p9->ssl, buf, len);
         if (r < 0) {
+            if (atomic_load(&p9->mux.stopping)) return -1;  /* p9_shutdown() */
             wlr_log(WLR_ERROR, "Connection lost - exiting");
             exit(1);
         }
@@ -38,10 +48,12 @@ int p9_write_full(struct p9conn *p9, const uint8_t *buf, int len) {
         ssize_t w = write(p9->fd, buf + total, len - total);
         if (w < 0) {
             if (errno == EINTR) continue;
+            if (atomic_load(&p9->mux.stopping)) return -1;
             wlr_log(WLR_ERROR, "9P write error: %s - exiting", strerror(errno));
             exit(1);
         }
         if (w == 0) {
+            if (atomic_load(&p9->mux.stopping)) return -1;
             wlr_log(WLR_ERROR, "9P write: connection closed - exiting");
             exit(1);
         }
@@ -55,6 +67,7 @@ int p9_read_full(struct p9conn *p9, uint8_t *buf, int n) {
     if (p9->ssl) {
         int r = tls_read_full(p9->ssl, buf, n);
         if (r < 0) {
+            if (atomic_load(&p9->mux.stopping)) return -1;  /* p9_shutdown() */
             wlr_log(WLR_ERROR, "Connection lost - exiting");
             exit(1);
         }
@@ -66,10 +79,12 @@ int p9_read_full(struct p9conn *p9, uint8_t *buf, int n) {
         ssize_t r = read(p9->fd, buf + total, n - total);
         if (r < 0) {
             if (errno == EINTR) continue;
+            if (atomic_load(&p9->mux.stopping)) return -1;
             wlr_log(WLR_ERROR, "9P read error: %s - exiting", strerror(errno));
             exit(1);
         }
         if (r == 0) {
+            if (atomic_load(&p9->mux.stopping)) return -1;
             wlr_log(WLR_ERROR, "9P read: connection closed - exiting");
             exit(1);
         }
@@ -97,6 +112,31 @@ static void handle_9p_error(struct p9conn *p9, const char *errmsg) {
     }
 }
 
+/* Check a complete response: Rerror and type mismatch fail */
+static int check_response(struct p9conn *p9, const uint8_t *buf,
+                          uint32_t rxlen, int expected_type) {
+    int type = buf[4];
+    if (type == Rerror) {
+        uint16_t elen = rxlen >= 9 ? GET16(buf + 7) : 0;
+        char errmsg[256];
+        int copylen = (elen < 255) ? elen : 255;
+        if (copylen > (int)rxlen - 9) copylen = rxlen > 9 ? (int)rxlen - 9 : 0;
+        memcpy(errmsg, buf + 9, copylen);
+        errmsg[copylen] = '\0';
+        
+        handle_9p_error(p9, errmsg);
+        return -1;
+    }
+
+    if (type != expected_type) {
+        wlr_log(WLR_ERROR, "9P unexpected response: got %d, expected %d",
+                type, expected_type);
+        return -1;
+    }
+
+    return rxlen;
+}
+
 /* Send a 9P message and receive response (caller must hold lock) */
 int p9_rpc_locked(struct p9conn *p9, int txlen, int expected_type) {
     uint8_t *buf = p9->buf;
@@ -121,32 +161,292 @@ int p9_rpc_locked(struct p9conn *p9, int txlen, int expected_type) {
         return -1;
     }
 
-    int type = buf[4];
-    if (type == Rerror) {
-        uint16_t elen = GET16(buf + 7);
-        char errmsg[256];
-        int copylen = (elen < 255) ? elen : 255;
-        memcpy(errmsg, buf + 9, copylen);
-        errmsg[copylen] = '\0';
-        
-        handle_9p_error(p9, errmsg);
-        return -1;
+    return check_response(p9, buf, rxlen, expected_type);
+}
+
+int p9_rpc(struct p9conn *p9, int txlen, int expected_type) {
+    pthread_mutex_lock(&p9->lock);
+    int r = p9_rpc_locked(p9, txlen, expected_type);
+    pthread_mutex_unlock(&p9->lock);
+    return r;
+}
+
+/* ============== Tag Multiplexing ============== */
+
+enum { REQ_FREE, REQ_WAIT, REQ_DONE };
+
+/* The connection owning the socket and tag table: a channel's carrier */
+static inline struct p9conn *wire(struct p9conn *p9) {
+    return p9->carrier ? p9->carrier : p9;
+}
+
+static inline uint16_t req_tag(struct p9conn *p9, struct p9req *rq) {
+    return (uint16_t)(rq - wire(p9)->mux.reqs);
+}
+
+static uint64_t mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Record the send time of a pipelined Twrite (before it is written) */
+static inline void tx_stamp(struct p9conn *p9, uint16_t tag, uint64_t now) {
+    if (atomic_load(&p9->mux.active) && tag < P9_MAX_TAGS)
+        atomic_store(&p9->mux.reqs[tag].sent_us, now);
+}
+
+/* Reader-side read: returns -1 instead of exiting (disconnect, desync) */
+static int mux_read_full(struct p9conn *p9, uint8_t *buf, int n) {
+    if (p9->ssl) return tls_read_full(p9->ssl, buf, n);
+
+    int total = 0;
+    while (total < n) {
+        ssize_t r = read(p9->fd, buf + total, n - total);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        total += r;
     }
+    return total;
+}
 
-    if (type != expected_type) {
-        wlr_log(WLR_ERROR, "9P unexpected response: got %d, expected %d",
-                type, expected_type);
-        return -1;
+/* Take a free tag; synchronous requests also get a buffer */
+static struct p9req *mux_alloc(struct p9conn *p9, int async) {
+    struct p9mux *m = &wire(p9)->mux;
+    struct p9req *rq = NULL;
+
+    pthread_mutex_lock(&m->lock);
+    while (!rq && !atomic_load(&m->broken)) {
+        int nobuf = 0;
+        for (int i = 0; i < P9_MAX_TAGS && !rq; i++) {
+            struct p9req *r = &m->reqs[i];
+            if (r->state != REQ_FREE) continue;
+            if (!async && !r->buf && !(r->buf = malloc(p9->msize))) {
+                nobuf = 1;
+                continue;
+            }
+            rq = r;
+        }
+        if (!rq && nobuf) break;
+        if (!rq) pthread_cond_wait(&m->cond, &m->lock);
+    }
+    if (rq) {
+        rq->state = REQ_WAIT;
+        rq->async = async;
+        rq->rxlen = -1;
+        atomic_store(&rq->sent_us, 0);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return rq;
+}
+
+static void mux_free(struct p9conn *p9, struct p9req *rq) {
+    struct p9mux *m = &wire(p9)->mux;
+    pthread_mutex_lock(&m->lock);
+    rq->state = REQ_FREE;
+    pthread_cond_broadcast(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+}
+
+/* Stream lost: fail every outstanding request */
+static void mux_fail_all(struct p9conn *p9) {
+    struct p9mux *m = &p9->mux;
+    int async_failed = 0;
+
+    pthread_mutex_lock(&m->lock);
+    atomic_store(&m->broken, 1);
+    for (int i = 0; i < P9_MAX_TAGS; i++) {
+        struct p9req *rq = &m->reqs[i];
+        if (rq->state != REQ_WAIT) continue;
+        if (rq->async) {
+            rq->state = REQ_FREE;
+            async_failed++;
+        } else {
+            rq->rxlen = -1;
+            rq->state = REQ_DONE;
+        }
     }
+    pthread_cond_broadcast(&m->cond);
+    pthread_mutex_unlock(&m->lock);
 
-    return rxlen;
+    while (async_failed-- > 0 && m->hooks.write_done)
+        m->hooks.write_done(m->hooks.arg, -1, 0);
 }
 
-int p9_rpc(struct p9conn *p9, int txlen, int expected_type) {
+static void *mux_reader(void *arg) {
+    struct p9conn *p9 = arg;
+    struct p9mux *m = &p9->mux;
+    uint8_t hdr[7];
+    int desync = 0;
+
+    if (m->hooks.reader_init) m->hooks.reader_init(m->hooks.arg);
+
+    for (;;) {
+        if (mux_read_full(p9, hdr, 7) != 7) break;
+        uint32_t rxlen = GET32(hdr);
+        if (rxlen < 7 || rxlen > p9->msize) {
+            wlr_log(WLR_ERROR, "9P stream desynced (invalid length %u), halting I/O", rxlen);
+            desync = 1;
+            break;
+        }
+        uint16_t tag = GET16(hdr + 5);
+
+        pthread_mutex_lock(&m->lock);
+        struct p9req *rq = (tag < P9_MAX_TAGS && m->reqs[tag].state == REQ_WAIT)
+                         ? &m->reqs[tag] : NULL;
+        pthread_mutex_unlock(&m->lock);
+
+        /* The message body must be consumed even if nobody wants it */
+        uint8_t *dst = (rq && !rq->async) ? rq->buf : m->rx;
+        memcpy(dst, hdr, 7);
+        if (rxlen > 7 && mux_read_full(p9, dst + 7, rxlen - 7) != (int)(rxlen - 7))
+            break;
+
+        if (!rq) {
+            wlr_log(WLR_ERROR, "9P response for unknown tag %u (type %d), dropped",
+                    tag, hdr[4]);
+            continue;
+        }
+
+        if (rq->async) {
+            int r = check_response(p9, dst, rxlen, Rwrite);
+            if (r >= 0) r = (rxlen >= 11) ? (int)GET32(dst + 7) : -1;
+            uint64_t sent = atomic_load(&rq->sent_us);
+            uint64_t now = mono_us();
+            uint32_t rtt = (sent && now > sent) ? (uint32_t)(now - sent) : 0;
+            mux_free(p9, rq);
+            if (m->hooks.write_done) m->hooks.write_done(m->hooks.arg, r, rtt);
+        } else {
+            pthread_mutex_lock(&m->lock);
+            rq->rxlen = rxlen;
+            rq->state = REQ_DONE;
+            pthread_cond_broadcast(&m->cond);
+            pthread_mutex_unlock(&m->lock);
+        }
+    }
+
+    /* Same policy as p9_read_full(): a lost connection is fatal; a
+     * desync only breaks this stream */
+    if (!desync && !atomic_load(&m->stopping)) {
+        wlr_log(WLR_ERROR, "Connection lost - exiting");
+        exit(1);
+    }
+    mux_fail_all(p9);
+    return NULL;
+}
+
+/* Send a synchronous request on its tag without waiting */
+static void mux_send(struct p9conn *p9, struct p9req *rq, int txlen) {
+    struct p9conn *w = wire(p9);
+    uint8_t *buf = rq->buf;
+
+    PUT32(buf, txlen);
+    PUT16(buf + 5, req_tag(p9, rq));
+    pthread_mutex_lock(&w->wlock);
+    p9_write_full(w, buf, txlen);
+    pthread_mutex_unlock(&w->wlock);
+}
+
+/* Wait for the response to a request sent with mux_send(); error
+ * flags go to p9 (the channel, not its carrier) */
+static int mux_wait(struct p9conn *p9, struct p9req *rq, int expected_type) {
+    struct p9mux *m = &wire(p9)->mux;
+
+    pthread_mutex_lock(&m->lock);
+    while (rq->state == REQ_WAIT)
+        pthread_cond_wait(&m->cond, &m->lock);
+    pthread_mutex_unlock(&m->lock);
+
+    if (rq->rxlen < 0) return -1;
+    return check_response(p9, rq->buf, rq->rxlen, expected_type);
+}
+
+/* Send a synchronous request on its tag and wait for the response */
+static int mux_rpc(struct p9conn *p9, struct p9req *rq, int txlen, int expected_type) {
+    mux_send(p9, rq, txlen);
+    return mux_wait(p9, rq, expected_type);
+}
+
+int p9_mux_start(struct p9conn *p9, const struct p9mux_hooks *hooks) {
+    struct p9mux *m = &p9->mux;
+    if (p9->carrier) return 0;
+    if (atomic_load(&m->active)) return 0;
+
+    m->rx = malloc(p9->msize);
+    if (!m->rx) return -1;
+    if (hooks) m->hooks = *hooks;
+    atomic_store(&m->broken, 0);
+    atomic_store(&m->stopping, 0);
+
+    /* Buffers of synchronous requests are allocated on first use */
+    for (int i = 0; i < P9_MAX_TAGS; i++) m->reqs[i].state = REQ_FREE;
+
+    /* p9->lock: let an unmultiplexed RPC still in flight finish first */
     pthread_mutex_lock(&p9->lock);
-    int r = p9_rpc_locked(p9, txlen, expected_type);
+    atomic_store(&m->active, 1);
+    int err = pthread_create(&m->reader, NULL, mux_reader, p9);
+    if (err) atomic_store(&m->active, 0);
     pthread_mutex_unlock(&p9->lock);
-    return r;
+    if (err) {
+        free(m->rx);
+        m->rx = NULL;
+        return -1;
+    }
+    wlr_log(WLR_INFO, "9P fd %d: multiplexed, %d tags", p9->fd, P9_MAX_TAGS);
+    return 0;
+}
+
+static void mux_stop(struct p9conn *p9) {
+    struct p9mux *m = &p9->mux;
+    if (!atomic_load(&m->active)) return;
+
+    /* Unblock the reader; the connection is going away anyway */
+    atomic_store(&m->stopping, 1);
+    shutdown(p9->fd, SHUT_RDWR);
+    pthread_join(m->reader, NULL);
+    atomic_store(&m->active, 0);
+
+    for (int i = 0; i < P9_MAX_TAGS; i++) {
+        free(m->reqs[i].buf);
+        m->reqs[i].buf = NULL;
+    }
+    free(m->rx);
+    m->rx = NULL;
+}
+
+/* ============== Request Helpers ============== */
+
+/*
+ * Every synchronous operation builds its T-message in the buffer
+ * returned by rpc_begin() (from buf[4]; size and tag are filled in
+ * by rpc_call()), parses the response from the same buffer, and
+ * finishes with rpc_end().  Unmultiplexed, this is p9->buf under
+ * p9->lock; multiplexed (always, for a channel), a per-tag buffer and
+ * no connection lock.
+ */
+static struct p9req *rpc_begin(struct p9conn *p9) {
+    if (atomic_load(&wire(p9)->mux.active))
+        return mux_alloc(p9, 0);
+    if (p9->carrier) return NULL;   /* Carrier gone */
+
+    pthread_mutex_lock(&p9->lock);
+    p9->sync_req.buf = p9->buf;
+    return &p9->sync_req;
+}
+
+static int rpc_call(struct p9conn *p9, struct p9req *rq, int txlen, int expected_type) {
+    if (rq == &p9->sync_req) {
+        PUT16(rq->buf + 5, p9->tag++);
+        return p9_rpc_locked(p9, txlen, expected_type);
+    }
+    return mux_rpc(p9, rq, txlen, expected_type);
+}
+
+static void rpc_end(struct p9conn *p9, struct p9req *rq) {
+    if (rq == &p9->sync_req)
+        pthread_mutex_unlock(&p9->lock);
+    else
+        mux_free(p9, rq);
 }
 
 /* Tversion */
@@ -177,8 +477,6 @@ int p9_version(struct p9conn *p9) {
 
 /* Tattach */
 int p9_attach(struct p9conn *p9, uint32_t fid, const char *aname) {
-    uint8_t *buf = p9->buf;
-
     /* Use P9USER env var, fallback to glenda */
     const char *uname = getenv("P9USER");
     if (!uname || !*uname) uname = "glenda";
@@ -187,9 +485,10 @@ int p9_attach(struct p9conn *p9, uint32_t fid, const char *aname) {
 
     wlr_log(WLR_INFO, "9P attach: uname='%s'", uname);
 
-    pthread_mutex_lock(&p9->lock);
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
     buf[4] = Tattach;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
     PUT32(buf + 11, P9_NOFID);  /* afid - no auth */
     PUT16(buf + 15, ulen);
@@ -197,8 +496,8 @@ int p9_attach(struct p9conn *p9, uint32_t fid, const char *aname) {
     PUT16(buf + 17 + ulen, alen);
     if (alen > 0) memcpy(buf + 19 + ulen, aname, alen);
 
-    int r = p9_rpc_locked(p9, 19 + ulen + alen, Rattach);
-    pthread_mutex_unlock(&p9->lock);
+    int r = rpc_call(p9, rq, 19 + ulen + alen, Rattach);
+    rpc_end(p9, rq);
 
     if (r < 0) return -1;
     wlr_log(WLR_INFO, "9P attached as '%s'", uname);
@@ -208,12 +507,12 @@ int p9_attach(struct p9conn *p9, uint32_t fid, const char *aname) {
 /* Twalk */
 int p9_walk(struct p9conn *p9, uint32_t fid, uint32_t newfid,
             int nwname, const char **wnames) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     int off = 7;
     buf[4] = Twalk;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + off, fid); off += 4;
     PUT32(buf + off, newfid); off += 4;
     PUT16(buf + off, nwname); off += 2;
@@ -224,22 +523,22 @@ int p9_walk(struct p9conn *p9, uint32_t fid, uint32_t newfid,
         memcpy(buf + off, wnames[i], len); off += len;
     }
 
-    int r = p9_rpc_locked(p9, off, Rwalk);
-    pthread_mutex_unlock(&p9->lock);
+    int r = rpc_call(p9, rq, off, Rwalk);
+    rpc_end(p9, rq);
     return r >= 0 ? 0 : -1;
 }
 
 /* Topen - returns iounit via pointer (0 from server means use msize-24) */
 int p9_open(struct p9conn *p9, uint32_t fid, uint8_t mode, uint32_t *iounit) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     buf[4] = Topen;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
     buf[11] = mode;
 
-    int r = p9_rpc_locked(p9, 12, Ropen);
+    int r = rpc_call(p9, rq, 12, Ropen);
     if (r >= 0 && iounit) {
         /* Ropen: size[4] type[1] tag[2] qid[13] iounit[4] */
         /* iounit is at offset 7 + 13 = 20 */
@@ -249,25 +548,25 @@ int p9_open(struct p9conn *p9, uint32_t fid, uint8_t mode, uint32_t *iounit) {
         }
         wlr_log(WLR_INFO, "9P open fid %u: iounit=%u", fid, *iounit);
     }
-    pthread_mutex_unlock(&p9->lock);
+    rpc_end(p9, rq);
     return r >= 0 ? 0 : -1;
 }
 
 /* Tread */
 int p9_read(struct p9conn *p9, uint32_t fid, uint64_t offset,
             uint32_t count, uint8_t *data) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     buf[4] = Tread;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
     PUT64(buf + 11, offset);
     PUT32(buf + 19, count);
 
-    int rxlen = p9_rpc_locked(p9, 23, Rread);
+    int rxlen = rpc_call(p9, rq, 23, Rread);
     if (rxlen < 0) {
-        pthread_mutex_unlock(&p9->lock);
+        rpc_end(p9, rq);
         return -1;
     }
 
@@ -276,7 +575,7 @@ int p9_read(struct p9conn *p9, uint32_t fid, uint64_t offset,
     if (data && rcount > 0) {
         memcpy(data, buf + 11, rcount);
     }
-    pthread_mutex_unlock(&p9->lock);
+    rpc_end(p9, rq);
 
     return rcount;
 }
@@ -284,57 +583,57 @@ int p9_read(struct p9conn *p9, uint32_t fid, uint64_t offset,
 /* Twrite (synchronous) */
 int p9_write(struct p9conn *p9, uint32_t fid, uint64_t offset,
              const uint8_t *data, uint32_t count) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     if (count + 23 > p9->msize) {
         count = p9->msize - 23;
     }
 
     buf[4] = Twrite;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
     PUT64(buf + 11, offset);
     PUT32(buf + 19, count);
     memcpy(buf + 23, data, count);
 
-    int rxlen = p9_rpc_locked(p9, 23 + count, Rwrite);
+    int rxlen = rpc_call(p9, rq, 23 + count, Rwrite);
     if (rxlen < 0) {
-        pthread_mutex_unlock(&p9->lock);
+        rpc_end(p9, rq);
         return -1;
     }
 
     int written = GET32(buf + 7);
-    pthread_mutex_unlock(&p9->lock);
+    rpc_end(p9, rq);
     return written;
 }
 
 /* Tclunk */
 int p9_clunk(struct p9conn *p9, uint32_t fid) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     buf[4] = Tclunk;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
 
-    int r = p9_rpc_locked(p9, 11, Rclunk);
-    pthread_mutex_unlock(&p9->lock);
+    int r = rpc_call(p9, rq, 11, Rclunk);
+    rpc_end(p9, rq);
     return r >= 0 ? 0 : -1;
 }
 
 /* Tstat - get file metadata, extract qid.vers */
 int p9_stat(struct p9conn *p9, uint32_t fid, uint32_t *qid_vers) {
-    uint8_t *buf = p9->buf;
+    struct p9req *rq = rpc_begin(p9);
+    if (!rq) return -1;
+    uint8_t *buf = rq->buf;
 
-    pthread_mutex_lock(&p9->lock);
     buf[4] = Tstat;
-    PUT16(buf + 5, p9->tag++);
     PUT32(buf + 7, fid);
 
-    int rxlen = p9_rpc_locked(p9, 11, Rstat);
+    int rxlen = rpc_call(p9, rq, 11, Rstat);
     if (rxlen < 0) {
-        pthread_mutex_unlock(&p9->lock);
+        rpc_end(p9, rq);
         return -1;
     }
 
@@ -346,7 +645,7 @@ int p9_stat(struct p9conn *p9, uint32_t fid, uint32_t *qid_vers) {
      */
     if (rxlen < 22) {
         wlr_log(WLR_ERROR, "p9_stat: response too short (%d bytes)", rxlen);
-        pthread_mutex_unlock(&p9->lock);
+        rpc_end(p9, rq);
         return -1;
     }
 
@@ -354,7 +653,23 @@ int p9_stat(struct p9conn *p9, uint32_t fid, uint32_t *qid_vers) {
         *qid_vers = GET32(buf + 18);
     }
 
-    pthread_mutex_unlock(&p9->lock);
+    rpc_end(p9, rq);
+    return 0;
+}
+
+int p9_chdir(struct p9conn *p9, int nwname, const char **wnames) {
+    uint32_t fid = p9->next_fid++;
+    
+    /* A partial Rwalk creates no fid, so check the result with a stat */
+    if (p9_walk(p9, p9->attach_fid, fid, nwname, wnames) < 0 ||
+        p9_stat(p9, fid, NULL) < 0) {
+        wlr_log(WLR_ERROR, "p9_chdir: walk to '%s...' failed",
+                nwname > 0 ? wnames[0] : "");
+        return -1;
+    }
+    if (p9->root_fid != p9->attach_fid)
+        p9_clunk(p9, p9->root_fid);
+    p9->root_fid = fid;
     return 0;
 }
 
@@ -362,11 +677,11 @@ int p9_stat(struct p9conn *p9, uint32_t fid, uint32_t *qid_vers) {
 
 /*
  * Walk to a single-component path and open it.
- * On success, returns 0 and sets *fid_out.
+ * On success, returns 0 and sets *fid_out (and *iounit, if non-NULL).
  * On failure, returns -1 (fid is automatically clunked on open failure).
  */
 static int p9_walk_open(struct p9conn *p9, const char *path, 
-                        uint8_t mode, uint32_t *fid_out) {
+                        uint8_t mode, uint32_t *fid_out, uint32_t *iounit) {
     uint32_t fid = p9->next_fid++;
     const char *wnames[] = { path };
     
@@ -375,7 +690,7 @@ static int p9_walk_open(struct p9conn *p9, const char *path,
         return -1;
     }
     
-    if (p9_open(p9, fid, mode, NULL) < 0) {
+    if (p9_open(p9, fid, mode, iounit) < 0) {
         wlr_log(WLR_ERROR, "p9_walk_open: open '%s' failed", path);
         p9_clunk(p9, fid);
         return -1;
@@ -390,7 +705,7 @@ static int p9_walk_open(struct p9conn *p9, const char *path,
 int p9_read_file(struct p9conn *p9, const char *path, char *data, size_t bufsize) {
     uint32_t fid;
     
-    if (p9_walk_open(p9, path, OREAD, &fid) < 0) {
+    if (p9_walk_open(p9, path, OREAD, &fid, NULL) < 0) {
         return -1;
     }
     
@@ -420,7 +735,7 @@ int p9_read_file(struct p9conn *p9, const char *path, char *data, size_t bufsize
 int p9_write_file(struct p9conn *p9, const char *path, const char *data, size_t len) {
     uint32_t fid;
     
-    if (p9_walk_open(p9, path, OWRITE, &fid) < 0) {
+    if (p9_walk_open(p9, path, OWRITE, &fid, NULL) < 0) {
         return -1;
     }
     
@@ -444,35 +759,369 @@ int p9_write_file(struct p9conn *p9, const char *path, const char *data, size_t
     return 0;
 }
 
-/* Pipelined write - send Twrite without waiting for response */
-int p9_write_send(struct p9conn *p9, uint32_t fid, uint64_t offset,
-                  const uint8_t *data, uint32_t count) {
-    uint8_t header[23];
+/* ============== Streaming Transfers ============== */
+
+/*
+ * A window of up to `depth` requests on consecutive offsets, consumed
+ * in offset order.  Each slot owns a tag (and its buffer) from
+ * mux_alloc() until its response has been handled.
+ */
+struct stream_win {
+    struct p9req *rq[P9_STREAM_DEPTH_MAX];
+    uint64_t off[P9_STREAM_DEPTH_MAX];
+    uint32_t len[P9_STREAM_DEPTH_MAX];
+    int head, count;
+};
+
+/* Usable depth: 1 (lock-step) unless the connection is multiplexed */
+static int stream_depth(struct p9conn *p9, int depth) {
+    if (!atomic_load(&wire(p9)->mux.active)) return 1;
+    if (depth < 1) depth = 1;
+    if (depth > P9_STREAM_DEPTH_MAX) depth = P9_STREAM_DEPTH_MAX;
+    return depth;
+}
+
+/* Largest payload per request: iounit, bounded by msize */
+static uint32_t stream_chunk(struct p9conn *p9, uint32_t iounit) {
+    uint32_t max = p9->msize - 24;
+    return (iounit && iounit < max) ? iounit : max;
+}
+
+/* Wait for and release every request still in the window */
+static void stream_drain(struct p9conn *p9, struct stream_win *w, int expected_type) {
+    while (w->count > 0) {
+        struct p9req *rq = w->rq[w->head];
+        mux_wait(p9, rq, expected_type);
+        mux_free(p9, rq);
+        w->head = (w->head + 1) % P9_STREAM_DEPTH_MAX;
+        w->count--;
+    }
+}
+
+int p9_read_stream(struct p9conn *p9, const char *path, int depth,
+                   size_t max, p9_stream_sink sink, void *arg) {
+    uint32_t fid, iounit = 0;
+    if (p9_walk_open(p9, path, OREAD, &fid, &iounit) < 0)
+        return -1;
+
+    uint32_t chunk = stream_chunk(p9, iounit);
+    depth = stream_depth(p9, depth);
+    long total = 0;
+    int err = 0;
+
+    if (depth == 1) {
+        /* Unmultiplexed: one round trip per chunk */
+        uint8_t *tmp = malloc(chunk);
+        if (!tmp) err = 1;
+        while (!err && (size_t)total < max) {
+            uint32_t want = chunk;
+            if (want > max - total) want = max - total;
+            int n = p9_read(p9, fid, total, want, tmp);
+            if (n < 0) { err = 1; break; }
+            if (n == 0) break;
+            if (sink(arg, tmp, n) < 0) break;
+            total += n;
+        }
+        free(tmp);
+    } else {
+        struct stream_win w = {0};
+        uint64_t next = 0;      /* Offset of the next Tread to issue */
+
+        while (!err) {
+            /* Keep the window full */
+            while (w.count < depth && next < max) {
+                struct p9req *rq = mux_alloc(p9, 0);
+                if (!rq) { err = 1; break; }
+                uint32_t want = chunk;
+                if (want > max - next) want = (uint32_t)(max - next);
+                rq->buf[4] = Tread;
+                PUT32(rq->buf + 7, fid);
+                PUT64(rq->buf + 11, next);
+                PUT32(rq->buf + 19, want);
+                mux_send(p9, rq, 23);
+                int slot = (w.head + w.count) % P9_STREAM_DEPTH_MAX;
+                w.rq[slot] = rq;
+                w.off[slot] = next;
+                w.len[slot] = want;
+                w.count++;
+                next += want;
+            }
+            if (w.count == 0) break;
+
+            struct p9req *rq = w.rq[w.head];
+            uint64_t off = w.off[w.head];
+            uint32_t want = w.len[w.head];
+            w.head = (w.head + 1) % P9_STREAM_DEPTH_MAX;
+            w.count--;
+
+            int rxlen = mux_wait(p9, rq, Rread);
+            uint32_t n = (rxlen >= 11) ? GET32(rq->buf + 7) : 0;
+            if (n > want) n = want;
+            int stop = 0;
+            if (rxlen < 0) err = 1;
+            else if (n > 0 && sink(arg, rq->buf + 11, n) < 0) stop = 1;
+            mux_free(p9, rq);
+            if (err || stop) break;
+            total += n;
+
+            if (n == 0) break;      /* EOF */
+            if (n < want) {
+                /* Short read: the reads behind it assumed a full one.
+                 * Discard them and carry on from where this one ended */
+                stream_drain(p9, &w, Rread);
+                next = off + n;
+            }
+        }
+        stream_drain(p9, &w, Rread);
+    }
 
+    p9_clunk(p9, fid);
+    if (err) {
+        wlr_log(WLR_ERROR, "p9_read_stream: read '%s' failed after %ld bytes", path, total);
+        return -1;
+    }
+    wlr_log(WLR_DEBUG, "p9_read_stream: read %ld bytes from '%s' (depth %d)",
+            total, path, depth);
+    return (int)total;
+}
+
+int p9_write_stream(struct p9conn *p9, const char *path, int depth,
+                    p9_stream_source source, void *arg) {
+    uint32_t fid, iounit = 0;
+    if (p9_walk_open(p9, path, OWRITE, &fid, &iounit) < 0)
+        return -1;
+
+    uint32_t chunk = stream_chunk(p9, iounit);
+    if (chunk > p9->msize - 23) chunk = p9->msize - 23;
+    depth = stream_depth(p9, depth);
+    long total = 0;
+    int err = 0, done = 0;
+
+    if (depth == 1) {
+        uint8_t *tmp = malloc(chunk);
+        if (!tmp) err = 1;
+        while (!err) {
+            int n = source(arg, tmp, chunk);
+            if (n < 0) { err = 1; break; }
+            if (n == 0) break;
+            for (int off = 0; off < n; ) {
+                int w = p9_write(p9, fid, total + off, tmp + off, n - off);
+                if (w <= 0) { err = 1; break; }
+                off += w;
+            }
+            total += n;
+        }
+        free(tmp);
+    } else {
+        struct stream_win w = {0};
+
+        while (!err && (!done || w.count > 0)) {
+            /* Fill the window as far as the source has data */
+            while (!done && w.count < depth) {
+                struct p9req *rq = mux_alloc(p9, 0);
+                if (!rq) { err = 1; break; }
+                int n = source(arg, rq->buf + 23, chunk);
+                if (n <= 0) {
+                    mux_free(p9, rq);
+                    if (n < 0) err = 1;
+                    done = 1;
+                    break;
+                }
+                rq->buf[4] = Twrite;
+                PUT32(rq->buf + 7, fid);
+                PUT64(rq->buf + 11, (uint64_t)total);
+                PUT32(rq->buf + 19, (uint32_t)n);
+                mux_send(p9, rq, 23 + n);
+                int slot = (w.head + w.count) % P9_STREAM_DEPTH_MAX;
+                w.rq[slot] = rq;
+                w.off[slot] = total;
+                w.len[slot] = n;
+                w.count++;
+                total += n;
+            }
+            if (err || w.count == 0) break;
+
+            /* Retire the oldest; a short write cannot be repaired behind
+             * requests already sent, so it fails the transfer */
+            struct p9req *rq = w.rq[w.head];
+            uint32_t want = w.len[w.head];
+            w.head = (w.head + 1) % P9_STREAM_DEPTH_MAX;
+            w.count--;
+            int rxlen = mux_wait(p9, rq, Rwrite);
+            if (rxlen < 11 || GET32(rq->buf + 7) != want) err = 1;
+            mux_free(p9, rq);
+        }
+        stream_drain(p9, &w, Rwrite);
+    }
+
+    p9_clunk(p9, fid);
+    if (err) {
+        wlr_log(WLR_ERROR, "p9_write_stream: write '%s' failed", path);
+        return -1;
+    }
+    wlr_log(WLR_DEBUG, "p9_write_stream: wrote %ld bytes to '%s' (depth %d)",
+            total, path, depth);
+    return 0;
+}
+
+/* ============== Pipelined Writes ============== */
+
+/* Write a gather list completely (plaintext); errors are fatal */
+static void write_iov_full(struct p9conn *p9, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(p9->fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            wlr_log(WLR_ERROR, "9P write error: %s - exiting", strerror(errno));
+            exit(1);
+        }
+        if (w == 0) {
+            wlr_log(WLR_ERROR, "9P write: connection closed - exiting");
+            exit(1);
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+}
+
+/*
+ * Take a tag for a pipelined Twrite and fill in its 23-byte header.
+ * Returns the (clamped) payload size, or -1 if the stream is broken.
+ */
+static int twrite_begin(struct p9conn *p9, uint8_t *header, uint32_t fid,
+                        uint64_t offset, uint32_t count) {
     if (count + 23 > p9->msize) {
         count = p9->msize - 23;
     }
 
-    uint32_t txlen = 23 + count;
+    /* Multiplexed: the reply goes to hooks.write_done by tag */
+    struct p9req *rq = NULL;
+    if (atomic_load(&p9->mux.active)) {
+        rq = mux_alloc(p9, 1);
+        if (!rq) return -1;
+    }
 
-    PUT32(header, txlen);
+    PUT32(header, 23 + count);
     header[4] = Twrite;
-    PUT16(header + 5, p9->tag++);
+    PUT16(header + 5, rq ? req_tag(p9, rq) : p9->tag++);
     PUT32(header + 7, fid);
     PUT64(header + 11, offset);
     PUT32(header + 19, count);
+    return count;
+}
 
-    /* Send header then data */
-    if (p9_write_full(p9, header, 23) != 23) return -1;
-    if (p9_write_full(p9, data, count) != (int)count) return -1;
+/* Make room for len more bytes in the send buffer (caller holds wlock) */
+static int tx_reserve(struct p9conn *p9, size_t len) {
+    if (!p9->txbuf) {
+        p9->txcap = (size_t)P9_TX_MSGS * p9->msize;
+        p9->txbuf = malloc(p9->txcap);
+        if (!p9->txbuf) return -1;
+    }
+    return (p9->txlen + len <= p9->txcap) ? 0 : -1;
+}
 
-    return count;
+/* Send everything queued (caller holds wlock) */
+static void tx_flush_locked(struct p9conn *p9) {
+    if (p9->txlen == 0) return;
+    uint64_t now = mono_us();
+    for (int i = 0; i < p9->txcount; i++) tx_stamp(p9, p9->txtags[i], now);
+    p9_write_full(p9, p9->txbuf, p9->txlen);
+    p9->txlen = 0;
+    p9->txcount = 0;
+}
+
+static void tx_append(struct p9conn *p9, const uint8_t *header,
+                      const uint8_t *data, uint32_t count) {
+    memcpy(p9->txbuf + p9->txlen, header, 23);
+    memcpy(p9->txbuf + p9->txlen + 23, data, count);
+    p9->txlen += 23 + count;
+    p9->txtags[p9->txcount++] = GET16(header + 5);
+}
+
+/* Pipelined write - send Twrite without waiting for response */
+int p9_write_send(struct p9conn *p9, uint32_t fid, uint64_t offset,
+                  const uint8_t *data, uint32_t count) {
+    p9 = wire(p9);
+    uint8_t header[23];
+    int n = twrite_begin(p9, header, fid, offset, count);
+    if (n < 0) return -1;
+
+    pthread_mutex_lock(&p9->wlock);
+    if (!p9->ssl || p9->ktls_tx) {
+        /* Queue, header and payload in one writev */
+        struct iovec iov[3];
+        int niov = 0;
+        uint64_t now = mono_us();
+        for (int i = 0; i < p9->txcount; i++) tx_stamp(p9, p9->txtags[i], now);
+        tx_stamp(p9, GET16(header + 5), now);
+        if (p9->txlen > 0)
+            iov[niov++] = (struct iovec){ p9->txbuf, p9->txlen };
+        iov[niov++] = (struct iovec){ header, 23 };
+        iov[niov++] = (struct iovec){ (void *)data, n };
+        write_iov_full(p9, iov, niov);
+        p9->txlen = 0;
+        p9->txcount = 0;
+    } else {
+        /* TLS: one SSL_write, so the header shares the payload's record */
+        if (p9->txcount >= P9_TX_MSGS_MAX || tx_reserve(p9, 23 + n) < 0)
+            tx_flush_locked(p9);
+        if (tx_reserve(p9, 23 + n) == 0) {
+            tx_append(p9, header, data, n);
+            tx_flush_locked(p9);
+        } else {
+            tx_stamp(p9, GET16(header + 5), mono_us());
+            p9_write_full(p9, header, 23);
+            p9_write_full(p9, data, n);
+        }
+    }
+    pthread_mutex_unlock(&p9->wlock);
+
+    return n;
+}
+
+int p9_write_queue(struct p9conn *p9, uint32_t fid, uint64_t offset,
+                   const uint8_t *data, uint32_t count) {
+    p9 = wire(p9);
+    uint8_t header[23];
+    int n = twrite_begin(p9, header, fid, offset, count);
+    if (n < 0) return -1;
+
+    pthread_mutex_lock(&p9->wlock);
+    if (p9->txcount >= P9_TX_MSGS_MAX || tx_reserve(p9, 23 + n) < 0)
+        tx_flush_locked(p9);
+    if (tx_reserve(p9, 23 + n) == 0) {
+        tx_append(p9, header, data, n);
+    } else {
+        /* No send buffer: write through */
+        tx_stamp(p9, GET16(header + 5), mono_us());
+        p9_write_full(p9, header, 23);
+        p9_write_full(p9, data, n);
+    }
+    pthread_mutex_unlock(&p9->wlock);
+
+    return n;
+}
+
+void p9_flush(struct p9conn *p9) {
+    p9 = wire(p9);
+    pthread_mutex_lock(&p9->wlock);
+    tx_flush_locked(p9);
+    pthread_mutex_unlock(&p9->wlock);
 }
 
 /* Collect one Rwrite response from pipelined writes */
 int p9_write_recv(struct p9conn *p9) {
     uint8_t *buf = p9->buf;
 
+    if (p9->carrier || atomic_load(&p9->mux.active)) return -1;
+
     /* Read length */
     if (p9_read_full(p9, buf, 4) != 4) return -1;
     uint32_t rxlen = GET32(buf);
@@ -481,23 +1130,7 @@ int p9_write_recv(struct p9conn *p9) {
     /* Read rest of message */
     if (p9_read_full(p9, buf + 4, rxlen - 4) != (int)(rxlen - 4)) return -1;
 
-    int type = buf[4];
-    if (type == Rerror) {
-        uint16_t elen = GET16(buf + 7);
-        char errmsg[256];
-        int copylen = (elen < 255) ? elen : 255;
-        memcpy(errmsg, buf + 9, copylen);
-        errmsg[copylen] = '\0';
-        
-        handle_9p_error(p9, errmsg);
-        return -1;
-    }
-
-    if (type != Rwrite) {
-        wlr_log(WLR_ERROR, "9P unexpected response: got %d, expected Rwrite", type);
-        return -1;
-    }
-
+    if (check_response(p9, buf, rxlen, Rwrite) < 0) return -1;
     return GET32(buf + 7);
 }
 
@@ -507,17 +1140,81 @@ int p9_should_shutdown(struct p9conn *p9) {
 }
 
 /* Connect to 9P server with optional TLS */
-int p9_connect(struct p9conn *p9, const char *host, int port,
-               struct tls_config *tls_cfg) {
+/* Zero p9 and set up its locks; no socket yet */
+static void p9_conn_init(struct p9conn *p9) {
     memset(p9, 0, sizeof(*p9));
     pthread_mutex_init(&p9->lock, NULL);
+    pthread_mutex_init(&p9->wlock, NULL);
+    pthread_mutex_init(&p9->mux.lock, NULL);
+    pthread_cond_init(&p9->mux.cond, NULL);
     p9->fd = -1;
     p9->ssl = NULL;
+}
+
+/* Undo p9_conn_init() after a failed connect; p9_disconnect() is then a no-op */
+static void p9_conn_fail(struct p9conn *p9) {
+    pthread_mutex_destroy(&p9->lock);
+    pthread_mutex_destroy(&p9->wlock);
+    pthread_mutex_destroy(&p9->mux.lock);
+    pthread_cond_destroy(&p9->mux.cond);
+    p9->carrier = NULL;
+    p9->fd = -1;
+    p9->buf = NULL;
+}
+
+/*
+ * Version and attach over an established (and, if configured,
+ * encrypted) stream.  Closes the stream on failure.
+ */
+static int p9_handshake(struct p9conn *p9) {
+    /* Allocate message buffer */
+    p9->msize = P9_MSIZE;
+    p9->tag = 1;
+    p9->buf = malloc(p9->msize);
+    if (!p9->buf) {
+        wlr_log(WLR_ERROR, "Failed to allocate message buffer");
+        if (p9->ssl) tls_disconnect(p9->ssl);
+        close(p9->fd);
+        p9_conn_fail(p9);
+        return -1;
+    }
+
+    p9->root_fid = 0;
+    p9->attach_fid = 0;
+    p9->next_fid = 1;
+
+    /* 9P version handshake */
+    if (p9_version(p9) < 0) {
+        wlr_log(WLR_ERROR, "9P version handshake failed");
+        free(p9->buf);
+        if (p9->ssl) tls_disconnect(p9->ssl);
+        close(p9->fd);
+        p9_conn_fail(p9);
+        return -1;
+    }
+
+    /* Attach to root */
+    if (p9_attach(p9, p9->root_fid, NULL) < 0) {
+        wlr_log(WLR_ERROR, "9P attach failed");
+        free(p9->buf);
+        if (p9->ssl) tls_disconnect(p9->ssl);
+        close(p9->fd);
+        p9_conn_fail(p9);
+        return -1;
+    }
+
+    return 0;
+}
+
+int p9_connect(struct p9conn *p9, const char *host, int port,
+               struct tls_config *tls_cfg) {
+    p9_conn_init(p9);
 
     /* Create socket */
     p9->fd = socket(AF_INET, SOCK_STREAM, 0);
     if (p9->fd < 0) {
         wlr_log(WLR_ERROR, "socket: %s", strerror(errno));
+        p9_conn_fail(p9);
         return -1;
     }
 
@@ -534,6 +1231,7 @@ int p9_connect(struct p9conn *p9, const char *host, int port,
     if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
         wlr_log(WLR_ERROR, "Invalid address: %s", host);
         close(p9->fd);
+        p9_conn_fail(p9);
         return -1;
     }
 
@@ -542,6 +1240,7 @@ int p9_connect(struct p9conn *p9, const char *host, int port,
     if (connect(p9->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         wlr_log(WLR_ERROR, "connect %s:%d: %s", host, port, strerror(errno));
         close(p9->fd);
+        p9_conn_fail(p9);
         return -1;
     }
 
@@ -553,51 +1252,151 @@ int p9_connect(struct p9conn *p9, const char *host, int port,
         if (tls_connect(p9->fd, &p9->ssl, tls_cfg) < 0) {
             wlr_log(WLR_ERROR, "TLS connection failed");
             close(p9->fd);
+            p9_conn_fail(p9);
             return -1;
         }
+        p9->ktls_tx = tls_ktls_send(p9->ssl);
     } else if (tls_cfg == NULL || (!tls_cfg->cert_file &&
                                     !tls_cfg->cert_fingerprint &&
                                     !tls_cfg->insecure)) {
         wlr_log(WLR_INFO, "Using plaintext connection (no TLS)");
     }
 
-    /* Allocate message buffer */
-    p9->msize = P9_MSIZE;
-    p9->tag = 1;
-    p9->buf = malloc(p9->msize);
-    if (!p9->buf) {
-        wlr_log(WLR_ERROR, "Failed to allocate message buffer");
-        if (p9->ssl) tls_disconnect(p9->ssl);
-        close(p9->fd);
-        return -1;
-    }
+    return p9_handshake(p9);
+}
 
-    p9->root_fid = 0;
-    p9->next_fid = 1;
+int p9_connect_fd(struct p9conn *p9, int fd) {
+    p9_conn_init(p9);
+    p9->fd = fd;
+    return p9_handshake(p9);
+}
 
-    /* 9P version handshake */
-    if (p9_version(p9) < 0) {
-        wlr_log(WLR_ERROR, "9P version handshake failed");
-        free(p9->buf);
-        if (p9->ssl) tls_disconnect(p9->ssl);
-        close(p9->fd);
+int p9_channel_open(struct p9conn *p9, struct p9conn *carrier) {
+    p9_conn_init(p9);
+    if (carrier->carrier) {
+        wlr_log(WLR_ERROR, "9P fd %d: a channel cannot carry channels", carrier->fd);
+        p9_conn_fail(p9);
         return -1;
     }
-
-    /* Attach to root */
-    if (p9_attach(p9, p9->root_fid, NULL) < 0) {
-        wlr_log(WLR_ERROR, "9P attach failed");
-        free(p9->buf);
-        if (p9->ssl) tls_disconnect(p9->ssl);
-        close(p9->fd);
+    if (p9_mux_start(carrier, NULL) < 0 || !atomic_load(&carrier->mux.active)) {
+        wlr_log(WLR_ERROR, "9P fd %d: channel needs a multiplexed carrier", carrier->fd);
+        p9_conn_fail(p9);
         return -1;
     }
 
+    uint32_t n = atomic_fetch_add(&carrier->nchannels, 1) + 1;
+    if (n > P9_CHANNELS_MAX) {
+        wlr_log(WLR_ERROR, "9P fd %d: cannot open another channel", carrier->fd);
+        goto fail;
+    }
+    p9->carrier = carrier;
+    p9->fd = carrier->fd;
+    p9->msize = carrier->msize;
+    p9->next_fid = n << P9_CHANNEL_FID_SHIFT;
+
+    /* Own attach root: a zero-name walk clones the carrier's */
+    p9->attach_fid = p9->next_fid++;
+    if (p9_walk(p9, carrier->attach_fid, p9->attach_fid, 0, NULL) < 0) {
+        wlr_log(WLR_ERROR, "9P fd %d: channel %u: root clone failed", carrier->fd, n);
+        goto fail;
+    }
+    p9->root_fid = p9->attach_fid;
+
+    wlr_log(WLR_INFO, "9P fd %d: channel %u open", carrier->fd, n);
     return 0;
+
+fail:
+    /* Give the number back unless a later channel took the next one */
+    atomic_compare_exchange_strong(&carrier->nchannels, &n, n - 1);
+    p9_conn_fail(p9);
+    return -1;
+}
+
+/* ============== Parallel Setup ============== */
+
+static void *connect_thread(void *arg) {
+    struct p9_connect_req *rq = arg;
+    rq->result = rq->carrier ? p9_channel_open(rq->p9, rq->carrier)
+                             : p9_connect(rq->p9, rq->host, rq->port, rq->tls);
+    if (rq->result < 0)
+        wlr_log(WLR_ERROR, "Failed to connect (%s)", rq->name);
+    return NULL;
+}
+
+/* Run the requests of one phase (channels or not) side by side */
+static void connect_phase(struct p9_connect_req *reqs, int n, int channels) {
+    pthread_t threads[n];
+    int started[n];
+
+    for (int i = 0; i < n; i++) {
+        started[i] = 0;
+        if (!reqs[i].carrier != !channels) continue;
+        if (pthread_create(&threads[i], NULL, connect_thread, &reqs[i]) == 0)
+            started[i] = 1;
+        else
+            connect_thread(&reqs[i]);   /* No thread: connect inline */
+    }
+    for (int i = 0; i < n; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+}
+
+int p9_connect_parallel(const char *host, int port, struct p9_connect_req *reqs, int n) {
+    for (int i = 0; i < n; i++) {
+        reqs[i].host = host;
+        reqs[i].port = port;
+        reqs[i].result = -1;
+    }
+
+    connect_phase(reqs, n, 0);
+    int failed = 0;
+    for (int i = 0; i < n; i++)
+        if (!reqs[i].carrier && reqs[i].result < 0) failed = 1;
+
+    /* Each carrier's reader starts once, before its channels race */
+    for (int i = 0; i < n && !failed; i++)
+        if (reqs[i].carrier && p9_mux_start(reqs[i].carrier, NULL) < 0) failed = 1;
+    int channels = !failed;
+    if (channels) {
+        connect_phase(reqs, n, 1);
+        for (int i = 0; i < n; i++)
+            if (reqs[i].carrier && reqs[i].result < 0) failed = 1;
+    }
+    if (!failed) return 0;
+
+    /* Roll back: channels first (failed ones released themselves) */
+    for (int i = 0; i < n && channels; i++)
+        if (reqs[i].carrier && reqs[i].result == 0)
+            p9_disconnect(reqs[i].p9);
+    for (int i = 0; i < n; i++)
+        if (!reqs[i].carrier && reqs[i].result == 0)
+            p9_disconnect(reqs[i].p9);
+    return -1;
+}
+
+void p9_shutdown(struct p9conn *p9) {
+    struct p9conn *w = wire(p9);
+    if (w->fd < 0) return;
+
+    /* The reader then fails every request instead of exiting */
+    atomic_store(&w->mux.stopping, 1);
+    shutdown(w->fd, SHUT_RDWR);
 }
 
 /* Disconnect from 9P server */
 void p9_disconnect(struct p9conn *p9) {
+    if (!p9->carrier && p9->fd < 0 && !p9->buf)
+        return;     /* Failed connect (p9_conn_fail) or already closed */
+    if (p9->carrier) {
+        /* A channel owns no socket, buffers or thread */
+        p9->carrier = NULL;
+        p9->fd = -1;
+        pthread_mutex_destroy(&p9->lock);
+        pthread_mutex_destroy(&p9->wlock);
+        pthread_mutex_destroy(&p9->mux.lock);
+        pthread_cond_destroy(&p9->mux.cond);
+        return;
+    }
+    mux_stop(p9);
     if (p9->ssl) {
         tls_disconnect(p9->ssl);
         p9->ssl = NULL;
@@ -610,5 +1409,11 @@ void p9_disconnect(struct p9conn *p9) {
         free(p9->buf);
         p9->buf = NULL;
     }
+    free(p9->txbuf);
+    p9->txbuf = NULL;
+    p9->txlen = p9->txcap = 0;
     pthread_mutex_destroy(&p9->lock);
+    pthread_mutex_destroy(&p9->wlock);
+    pthread_mutex_destroy(&p9->mux.lock);
+    pthread_cond_destroy(&p9->mux.cond);
 }
@@ -31,6 +31,82 @@
  *   functions (p9_read, p9_write, etc.) acquire this lock automatically.
  *   For pipelined writes, the caller must manage concurrency.
  *
+ * Tag Multiplexing:
+ *
+ *   p9_mux_start() switches a connection from lock-step RPCs to a tag
+ *   table with a dedicated reader thread:
+ *
+ *     caller A ──┐ alloc tag, Tread ──┐
+ *     caller B ──┤ alloc tag, Tstat ──┼──► socket (writes under wlock)
+ *     send     ──┘ alloc tag, Twrite ─┘
+ *
+ *     reader thread ◄── socket: R-message for tag t
+ *       - synchronous request: response into the tag's buffer, wake
+ *         the waiter
+ *       - pipelined Twrite: hooks->write_done(arg, result, rtt), tag
+ *         freed
+ *
+ *   Each synchronous request has its own buffer, so reads, stats and
+ *   writes from different threads are in flight together instead of
+ *   queuing on p9->lock. Up to P9_MAX_TAGS requests may be
+ *   outstanding; further callers wait for a free tag.
+ *
+ *   Errors stay with the request they belong to: an Rerror or an
+ *   unexpected type fails only that tag, and a response for a tag
+ *   nobody is waiting on is logged and skipped. Only a framing error
+ *   (invalid message length) loses the stream; the reader then marks
+ *   the connection broken (mux.broken), fails every outstanding
+ *   request and exits.
+ *
+ * Shared Connections (channels):
+ *
+ *   p9_channel_open() makes a p9conn a logical channel of another,
+ *   multiplexed connection (its carrier) instead of a socket of its
+ *   own. Opening one costs a single Twalk (a clone of the carrier's
+ *   attach root) instead of a TCP connect, a TLS handshake, Tversion
+ *   and Tattach:
+ *
+ *     mouse ──┐
+ *     kbd   ──┼── channel: own root_fid, fid range, error flags
+ *     wctl  ──┤
+ *     snarf ──┘      │ tags, wlock, reader thread
+ *                    ▼
+ *                 carrier ──► one socket / TLS session
+ *
+ *   A channel's fids start at n << P9_CHANNEL_FID_SHIFT (channel n of
+ *   the carrier), so subsystems keep allocating with next_fid++ on
+ *   their own p9conn without coordinating. Replies are matched by
+ *   tag as on any multiplexed connection, and Rerror flags
+ *   (window_deleted, ...) land on the channel whose request failed.
+ *   Every synchronous call works on a channel; pipelined writes
+ *   (p9_write_send, p9_write_queue, p9_flush) go out on the carrier
+ *   and complete through the carrier's hooks. A channel has no buffer
+ *   of its own, so p9_version(), p9_rpc() and p9_rpc_locked() are
+ *   carrier-only.
+ *
+ * Streaming Transfers:
+ *
+ *   p9_read_stream() and p9_write_stream() move a whole file in
+ *   iounit-sized chunks with up to `depth` Treads or Twrites in flight
+ *   on consecutive offsets, handing each chunk to a callback as soon
+ *   as its reply arrives (in offset order). On a WAN link this costs
+ *   one round trip per window instead of one per chunk, and nothing
+ *   is buffered beyond the window. Without multiplexing the window is
+ *   1 (plain lock-step reads and writes).
+ *
+ * Write Coalescing:
+ *
+ *   A Twrite is a 23-byte header plus payload. p9_write_send() sends
+ *   both with one writev() on plaintext connections; under TLS it
+ *   packs them into one buffer for a single SSL_write, so the header
+ *   does not become a TLS record of its own.
+ *
+ *   p9_write_queue() instead appends the message to a per-connection
+ *   send queue (up to P9_TX_MSGS × msize bytes or P9_TX_MSGS_MAX
+ *   messages), and p9_flush() writes the whole queue at once: one
+ *   syscall, and full-size TLS records. The next p9_write_send() also
+ *   sends anything queued before it.
+ *
  * Error Handling:
  *
  *   Connection errors (socket failures, TLS errors) are fatal - the
@@ -90,6 +166,22 @@
 /* Standard 9P port (plaintext) - TLS typically uses P9_TLS_PORT */
 #define P9_PORT     10000
 
+/* Outstanding requests per multiplexed connection (tags 0..N-1) */
+#define P9_MAX_TAGS 64
+
+/* Send queue size in messages of msize bytes (p9_write_queue) */
+#define P9_TX_MSGS 4
+
+/* Queued Twrites before an automatic flush (well below P9_MAX_TAGS) */
+#define P9_TX_MSGS_MAX 16
+
+/* Largest request window of p9_read_stream / p9_write_stream */
+#define P9_STREAM_DEPTH_MAX 16
+
+/* Channel n of a carrier allocates fids from n << P9_CHANNEL_FID_SHIFT */
+#define P9_CHANNEL_FID_SHIFT 24
+#define P9_CHANNELS_MAX ((1u << (32 - P9_CHANNEL_FID_SHIFT)) - 1)
+
 /* ============== 9P Message Types ============== */
 
 /*
@@ -156,6 +248,49 @@ enum {
                          (p)[2] = (uint8_t)((v) >> 16); (p)[3] = (uint8_t)((v) >> 24); } while(0)
 #define PUT64(p, v) do { PUT32(p, v); PUT32((p)+4, (v) >> 32); } while(0)
 
+/* ============== Tag Multiplexing ============== */
+
+/*
+ * One outstanding request. Indexed by tag in p9mux.reqs; the
+ * non-multiplexed path uses p9conn.sync_req over p9conn.buf.
+ */
+struct p9req {
+    uint8_t *buf;               /* Request/response buffer (msize), lazy */
+    int rxlen;                  /* Response length, -1 if failed */
+    int state;                  /* Free / waiting / done (p9.c) */
+    int async;                  /* Pipelined Twrite: reply via write_done */
+    atomic_ullong sent_us;      /* When the request hit the socket */
+};
+
+/*
+ * Callbacks for a multiplexed connection. Both run on the reader
+ * thread; any may be NULL.
+ *
+ * reader_init: called once when the reader starts (e.g. CPU pinning)
+ * write_done:  one call per pipelined p9_write_send(), with the
+ *              Rwrite count or -1 (Rerror or lost stream), and the
+ *              round-trip time from the moment the Twrite was
+ *              written to the socket (not queued) until its reply
+ *              was read, in microseconds (0 if unknown)
+ */
+struct p9mux_hooks {
+    void (*reader_init)(void *arg);
+    void (*write_done)(void *arg, int result, uint32_t rtt_us);
+    void *arg;
+};
+
+struct p9mux {
+    atomic_int active;          /* Reader running; RPCs go through tags */
+    atomic_int broken;          /* Stream desynced, all requests fail */
+    atomic_int stopping;        /* p9_disconnect() in progress */
+    pthread_t reader;
+    pthread_mutex_t lock;       /* Protects reqs[].state */
+    pthread_cond_t cond;        /* A response arrived or a tag was freed */
+    struct p9req reqs[P9_MAX_TAGS];
+    uint8_t *rx;                /* Reader buffer for async/unknown replies */
+    struct p9mux_hooks hooks;
+};
+
 /* ============== Connection Structure ============== */
 
 /*
@@ -167,15 +302,32 @@ enum {
 struct p9conn {
     int fd;                    /* Socket file descriptor */
     SSL *ssl;                  /* TLS connection (NULL if plaintext) */
+    int ktls_tx;               /* Kernel encrypts writes: use write() */
 
     uint8_t *buf;              /* Message buffer (msize bytes) */
     uint32_t msize;            /* Maximum message size (negotiated) */
     uint16_t tag;              /* Next tag to use (auto-incremented) */
 
-    uint32_t root_fid;         /* Root fid from attach (typically 0) */
-    uint32_t next_fid;         /* Next fid to allocate (caller increments) */
+    uint32_t root_fid;         /* Root for one-component walks (attach root,
+                                * or a directory below it, see p9_chdir) */
+    uint32_t attach_fid;       /* Root fid from attach (typically 0) */
+    atomic_uint next_fid;      /* Next fid to allocate: next_fid++ is atomic,
+                                * so threads sharing a session may allocate */
 
     pthread_mutex_t lock;      /* Lock for RPC operations */
+    pthread_mutex_t wlock;     /* Serializes socket writes (multiplexed) */
+    struct p9req sync_req;     /* Request over buf (not multiplexed) */
+    struct p9mux mux;          /* Tag table (after p9_mux_start) */
+
+    /* Queued pipelined Twrites, protected by wlock */
+    uint8_t *txbuf;            /* P9_TX_MSGS * msize, allocated on use */
+    size_t txlen, txcap;
+    int txcount;               /* Messages in txbuf */
+    uint16_t txtags[P9_TX_MSGS_MAX];  /* Their tags, stamped on flush */
+
+    /* Shared connections (p9_channel_open) */
+    struct p9conn *carrier;    /* Connection this channel rides on, or NULL */
+    atomic_uint nchannels;     /* Channels opened on this carrier */
 
     /* Error flags - set by protocol handlers, checked by caller.
      * atomic_int for safe cross-thread visibility (drain → send). */
@@ -203,22 +355,91 @@ struct p9conn {
  * On success:
  *   - p9->fd is the socket
  *   - p9->ssl is set if TLS enabled
- *   - p9->root_fid is attached to filesystem root
+ *   - p9->root_fid and p9->attach_fid are attached to filesystem root
  *   - p9->next_fid is ready for allocation (starts at 1)
  */
 int p9_connect(struct p9conn *p9, const char *host, int port,
                struct tls_config *tls_cfg);
 
+/*
+ * Version and attach over an already connected plaintext stream (a
+ * socketpair to an in-process server, as in the benchmark's sink).
+ * Takes ownership of fd. Returns 0 on success, -1 on error (fd closed).
+ */
+int p9_connect_fd(struct p9conn *p9, int fd);
+
 /*
  * Disconnect from 9P server and free resources.
  *
  * Closes TLS connection (if any), closes socket, frees message buffer,
- * and destroys mutex. Safe to call after a failed p9_connect().
+ * and destroys mutex. A failed p9_connect(), p9_connect_fd() or
+ * p9_channel_open() has already released everything, and a second
+ * call after a disconnect does nothing; both are safe.
  *
  * p9: connection to disconnect
  */
 void p9_disconnect(struct p9conn *p9);
 
+/*
+ * Open p9 as a channel of carrier (see "Shared Connections").
+ *
+ * Starts carrier's reader if it is not multiplexed yet (without
+ * hooks; a carrier that needs hooks must call p9_mux_start() first),
+ * then clones the carrier's attach root into the channel's first fid.
+ * On success p9 behaves like a connected session: root_fid and
+ * attach_fid are its own, next_fid is the start of its fid range,
+ * and p9_mux_start() on it is a no-op. fd is the carrier's socket.
+ *
+ * Disconnect every channel before its carrier. Closing a channel
+ * sends nothing; its fids go away with the carrier's connection.
+ * Channels of one carrier may be opened concurrently once it is
+ * multiplexed.
+ *
+ * p9:      channel to initialize
+ * carrier: connected session (p9_connect), not itself a channel
+ *
+ * Returns 0 on success, -1 on error (p9 is then safe to
+ * p9_disconnect()).
+ */
+int p9_channel_open(struct p9conn *p9, struct p9conn *carrier);
+
+/*
+ * One session for p9_connect_parallel(): its own connection
+ * (carrier NULL; tls as for p9_connect()) or a channel of carrier.
+ */
+struct p9_connect_req {
+    struct p9conn *p9;          /* Session to set up */
+    const char *name;           /* For the error message */
+    struct tls_config *tls;     /* Own connection: TLS settings, or NULL */
+    struct p9conn *carrier;     /* Or: open as a channel of this */
+    /* Filled in by p9_connect_parallel() */
+    const char *host;
+    int port;
+    int result;                 /* 0 or -1 */
+};
+
+/*
+ * Set up n sessions concurrently, one thread each: first every
+ * connection (TCP connect, TLS handshake, Tversion, Tattach all
+ * overlap, so startup costs the slowest setup instead of the sum),
+ * then every channel, once its carrier is connected and
+ * multiplexed. A carrier may be one of reqs or already connected.
+ *
+ * All or nothing: if one fails, every session this call set up is
+ * disconnected again (channels first) and -1 is returned.
+ */
+int p9_connect_parallel(const char *host, int port, struct p9_connect_req *reqs, int n);
+
+/*
+ * Fail every request in flight on the connection and any later one,
+ * and shut its socket down, to unblock threads reading from it before
+ * p9_disconnect(). For a channel this is the whole carrier: every
+ * channel on it stops, and the reader's end of stream is not treated
+ * as a lost connection. Unmultiplexed, a read or write that fails
+ * after it returns -1 instead of exiting.
+ */
+void p9_shutdown(struct p9conn *p9);
+
 /*
  * Check if connection should be terminated.
  *
@@ -231,12 +452,33 @@ void p9_disconnect(struct p9conn *p9);
  */
 int p9_should_shutdown(struct p9conn *p9);
 
+/*
+ * Start the reader thread and switch to tag-multiplexed RPCs.
+ *
+ * Must be called while no request is in flight on the connection
+ * (typically right after setup). From then on, synchronous calls
+ * from any thread run concurrently, p9_write_send() completions are
+ * reported through hooks->write_done, and p9_write_recv() must not be
+ * used. The reader runs until p9_disconnect().
+ *
+ * On a channel the carrier is multiplexed already; returns 0 and
+ * ignores hooks.
+ *
+ * p9:    connected 9P session
+ * hooks: callbacks (copied), or NULL
+ *
+ * Returns 0 on success, -1 on allocation or thread failure (the
+ * connection keeps working unmultiplexed).
+ */
+int p9_mux_start(struct p9conn *p9, const struct p9mux_hooks *hooks);
+
 /* ============== Low-Level I/O ============== */
 
 /*
  * Write exactly len bytes to the connection.
  *
- * Uses TLS if enabled, otherwise raw socket. Retries on EINTR.
+ * Uses TLS if enabled, otherwise raw socket (also for TLS with kernel
+ * transmit offload, see p9_tls.h). Retries on EINTR.
  * FATAL: calls exit(1) on any error or connection close and
  * does not return.
  *
@@ -398,6 +640,24 @@ int p9_clunk(struct p9conn *p9, uint32_t fid);
  */
 int p9_stat(struct p9conn *p9, uint32_t fid, uint32_t *qid_vers);
 
+/*
+ * Move root_fid to a directory below the attach root.
+ *
+ * Walks wnames from p9->attach_fid and makes the result the root of
+ * every single-component walk on this connection (p9_read_file(),
+ * "mouse", "winname", ...). With exportfs -r /dev, chdir to
+ * { "wsys", "<id>" } makes the connection see rio window <id>'s
+ * files in place of the exporting window's. Files that are not per
+ * window (/dev/draw) must then be walked from attach_fid.
+ *
+ * p9:     connection, not yet multiplexed
+ * nwname: number of path components (at most 16)
+ * wnames: path components
+ *
+ * Returns 0 on success, -1 on error (root_fid unchanged).
+ */
+int p9_chdir(struct p9conn *p9, int nwname, const char **wnames);
+
 /* ============== High-Level File Operations ============== */
 
 /*
@@ -437,6 +697,56 @@ int p9_read_file(struct p9conn *p9, const char *path, char *data, size_t bufsize
  */
 int p9_write_file(struct p9conn *p9, const char *path, const char *data, size_t len);
 
+/* ============== Streaming Transfers ============== */
+
+/*
+ * Consumer of p9_read_stream() data: called once per chunk, in file
+ * order. Return 0 to continue, -1 to stop early (not an error).
+ */
+typedef int (*p9_stream_sink)(void *arg, const uint8_t *data, uint32_t n);
+
+/*
+ * Producer for p9_write_stream(): fill up to max bytes of data.
+ * Returns the number of bytes produced, 0 at end of data, -1 on
+ * error (the transfer fails).
+ */
+typedef int (*p9_stream_source)(void *arg, uint8_t *data, uint32_t max);
+
+/*
+ * Read a file with several Treads in flight.
+ *
+ * Walks to path (single component, like p9_read_file), opens it, and
+ * keeps up to depth Treads of iounit bytes outstanding on consecutive
+ * offsets. Replies are handed to sink in order. A short reply
+ * discards the reads queued behind it and continues from where it
+ * ended, so servers that return partial chunks still read correctly;
+ * a zero-length reply is EOF.
+ *
+ * p9:    connection (depth > 1 needs p9_mux_start())
+ * path:  single path component relative to root
+ * depth: requests in flight, clamped to [1, P9_STREAM_DEPTH_MAX]
+ * max:   stop after this many bytes
+ * sink:  chunk consumer
+ *
+ * Returns bytes delivered to sink, or -1 on error.
+ */
+int p9_read_stream(struct p9conn *p9, const char *path, int depth,
+                   size_t max, p9_stream_sink sink, void *arg);
+
+/*
+ * Write a file with several Twrites in flight.
+ *
+ * Walks to and opens path (OWRITE), then fills iounit-sized Twrites
+ * from source and keeps up to depth of them outstanding. The server
+ * must apply a connection's writes in the order they arrive (rio's
+ * /dev/snarf appends). A short Rwrite fails the transfer, since the
+ * writes behind it are already on the wire.
+ *
+ * Returns 0 on success, -1 on error (source error included).
+ */
+int p9_write_stream(struct p9conn *p9, const char *path, int depth,
+                    p9_stream_source source, void *arg);
+
 /* ============== Pipelined Write Operations ============== */
 
 /*
@@ -452,6 +762,11 @@ int p9_write_file(struct p9conn *p9, const char *path, const char *data, size_t
  * Note: Caller must ensure proper ordering and not exceed
  * server's request queue. Does not acquire connection lock.
  *
+ * On a multiplexed connection the write takes a tag (waiting for one
+ * if all are in use) and its Rwrite is delivered to
+ * hooks->write_done instead of p9_write_recv(). Fails with -1 once
+ * the stream is broken.
+ *
  * p9:     connection
  * fid:    open fid
  * offset: byte offset in file
@@ -464,11 +779,34 @@ int p9_write_file(struct p9conn *p9, const char *path, const char *data, size_t
 int p9_write_send(struct p9conn *p9, uint32_t fid, uint64_t offset,
                   const uint8_t *data, uint32_t count);
 
+/*
+ * Queue Twrite for a later p9_flush().
+ *
+ * Like p9_write_send(), but the message is copied into the send
+ * queue and only written when the queue is flushed: by p9_flush(),
+ * the next p9_write_send(), or automatically when the queue is full.
+ * The caller may reuse data immediately.
+ *
+ * The server cannot answer a queued request, so callers must flush
+ * before waiting for its reply.
+ *
+ * Returns bytes queued (clamped like p9_write_send), or -1 if the
+ * stream is broken.
+ */
+int p9_write_queue(struct p9conn *p9, uint32_t fid, uint64_t offset,
+                   const uint8_t *data, uint32_t count);
+
+/*
+ * Write all queued Twrites in one go. No-op if the queue is empty.
+ */
+void p9_flush(struct p9conn *p9);
+
 /*
  * Receive Rwrite response from pipelined write.
  *
  * Collects one response from a prior p9_write_send().
- * Must be called once for each p9_write_send().
+ * Must be called once for each p9_write_send(). Not for multiplexed
+ * connections (returns -1).
  *
  * p9: connection
  *
@@ -499,6 +837,7 @@ int p9_rpc(struct p9conn *p9, int txlen, int expected_type);
  * Send request and receive response (caller holds lock).
  *
  * Like p9_rpc() but assumes caller already holds p9->lock.
+ * Both use p9->buf and are only valid before p9_mux_start().
  *
  * p9:            connection
  * txlen:         total length of request message (including size field)
@@ -229,6 +229,15 @@ int tls_connect(int fd, SSL **ssl_out, struct tls_config *cfg) {
         return -1;
     }
 
+    /* Kernel offload is negotiated by OpenSSL during the handshake */
+    if (cfg->ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#else
+        wlr_log(WLR_INFO, "TLS: kTLS requested but not supported by this OpenSSL");
+#endif
+    }
+
     /* Perform TLS handshake */
     wlr_log(WLR_INFO, "TLS: Starting handshake...");
 
@@ -270,10 +279,33 @@ int tls_connect(int fd, SSL **ssl_out, struct tls_config *cfg) {
         }
     }
 
+    if (cfg->ktls) {
+        int tx = tls_ktls_send(ssl);
+        int rx = 0;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+        rx = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#endif
+        if (tx || rx)
+            wlr_log(WLR_INFO, "TLS: kernel offload active (tx %s, rx %s)",
+                    tx ? "on" : "off", rx ? "on" : "off");
+        else
+            wlr_log(WLR_INFO, "TLS: kTLS unavailable for %s, using userspace TLS",
+                    SSL_get_cipher_name(ssl));
+    }
+
     *ssl_out = ssl;
     return 0;
 }
 
+int tls_ktls_send(SSL *ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl)) ? 1 : 0;
+#else
+    (void)ssl;
+    return 0;
+#endif
+}
+
 void tls_disconnect(SSL *ssl) {
     if (ssl) {
         /* Send close_notify alert */
@@ -60,6 +60,19 @@
  *   - Each SSL object should only be used by one thread at a time.
  *   - tls_cleanup() should only be called during shutdown.
  *
+ * Kernel TLS:
+ *
+ *   With tls_config.ktls set, tls_connect() asks OpenSSL to hand the
+ *   session keys to the kernel (SSL_OP_ENABLE_KTLS) once the
+ *   handshake is done. If the kernel took the transmit side
+ *   (tls_ktls_send), the socket encrypts plain write()/writev()
+ *   itself and p9.c bypasses SSL_write entirely. Reads keep going
+ *   through SSL_read, which uses kernel receive offload when present
+ *   and still handles non-data records (session tickets, alerts).
+ *   Without kernel support (no tls module, unsupported cipher, or an
+ *   OpenSSL built without KTLS) the connection silently stays in
+ *   userspace TLS.
+ *
  * OpenSSL Version:
  *
  *   Requires OpenSSL 1.1.0 or later. TLS 1.2 is the minimum protocol
@@ -139,6 +152,12 @@ struct tls_config {
      * Use only for testing or to discover server's fingerprint.
      */
     int insecure;
+
+    /*
+     * Try kernel TLS offload after the handshake (-K option).
+     * Falls back to userspace TLS when unavailable.
+     */
+    int ktls;
 };
 
 /* ============== Initialization ============== */
@@ -242,6 +261,18 @@ int tls_read_full(SSL *ssl, uint8_t *buf, int n);
  */
 int tls_write_full(SSL *ssl, const uint8_t *buf, int len);
 
+/*
+ * Check whether the kernel encrypts transmitted data for ssl.
+ *
+ * When true, plain write() on the socket produces TLS application
+ * data records, so callers may bypass tls_write_full().
+ *
+ * ssl: established SSL connection
+ *
+ * Returns 1 if kernel TLS transmit offload is active, 0 otherwise.
+ */
+int tls_ktls_send(SSL *ssl);
+
 /* ============== Utility Functions ============== */
 
 /*
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>   /* Required for clock_gettime, struct timespec in now_ms/now_us */
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_keyboard.h>
@@ -74,14 +75,20 @@
  *
  * Set to 0 to disable throttling (render every frame).
  * Non-zero values can reduce CPU usage at cost of latency.
+ *
+ * This is a fixed floor only; on a slow link the send thread's pacer
+ * (send_pace_delay_ms) defers renders further to the rate the link
+ * actually delivers.
  */
 #define FRAME_INTERVAL_MS   0
 
 /*
- * INPUT_QUEUE_SIZE - Maximum pending input events.
+ * INPUT_QUEUE_SIZE - Maximum pending input events per producer.
  *
- * Ring buffer size for mouse/keyboard events from input threads.
- * Should be large enough to handle bursts without dropping.
+ * Size of each single-producer ring (must be a power of 2). Should be
+ * large enough to handle bursts without dropping; motion bursts are
+ * merged at dequeue, so they only need to fit until the next event
+ * loop pass.
  */
 #define INPUT_QUEUE_SIZE    256
 
@@ -92,6 +99,39 @@
  */
 #define SCROLL_REGION_SIZE  512
 
+/*
+ * TILE_CACHE_DEFAULT_MB - Default server-side tile cache budget.
+ *
+ * Size in MiB of the Plan 9 image holding recently uploaded tiles
+ * (see draw/tilecache.h). Overridden with -C; 0 disables the cache.
+ * TILE_CACHE_MAX_MB caps it at a 4096×4096 XRGB32 image.
+ */
+#define TILE_CACHE_DEFAULT_MB   8
+#define TILE_CACHE_MAX_MB       64
+
+/*
+ * FILL_PALETTE_SIZE - Number of 1x1 replicated color images.
+ *
+ * Solid-color tile rectangles are drawn with a 'd' fill from one of
+ * these images (draw->fill_id_base + i). The send thread reloads the
+ * least recently used entry when a new color is needed.
+ */
+#define FILL_PALETTE_SIZE       8
+
+/*
+ * DAMAGE_* - Bits of a dirty tile map byte.
+ *
+ * Any nonzero byte means the tile is damaged. The output also records
+ * which kind of surface damaged it since the last render, so the send
+ * thread can hold back background updates under link pressure (see
+ * send.h, "Damage Priority"). A tile with neither class bit was
+ * damaged by something else (scene changes, resize) and counts as
+ * foreground.
+ */
+#define DAMAGE_DIRTY            0x01
+#define DAMAGE_FOREGROUND       0x02    /* Focused toplevel, its subsurfaces, popups */
+#define DAMAGE_BACKGROUND       0x04    /* Any other toplevel */
+
 /* ============== Forward Declarations ============== */
 
 struct server;
@@ -130,16 +170,47 @@ struct input_event {
 };
 
 /*
- * Thread-safe input queue.
+ * One lock-free single-producer/single-consumer ring.
  *
- * Uses a ring buffer with mutex protection. The pipe_fd is used
- * to wake the main Wayland event loop when events are available.
+ * tail is written only by the producer, head only by the main loop;
+ * each is published with release and read with acquire. seq[] holds
+ * the queue-wide push order, so events of different rings are
+ * delivered in the order they were pushed. head and tail live on
+ * separate cache lines so the two threads do not share one.
  */
-struct input_queue {
+struct input_ring {
     struct input_event events[INPUT_QUEUE_SIZE];
-    int head, tail;         /* Ring buffer indices */
-    pthread_mutex_t lock;   /* Protects head/tail */
-    int pipe_fd[2];         /* [0]=read, [1]=write; for waking handle_input_events */
+    uint32_t seq[INPUT_QUEUE_SIZE];
+    _Alignas(64) atomic_uint tail;  /* Next slot to fill (producer) */
+    _Alignas(64) atomic_uint head;  /* Next slot to read (consumer) */
+};
+
+/*
+ * Producers of the input queue, one ring each. Every event type has
+ * exactly one producer thread: mouse events come from the mouse
+ * thread, key events from the keyboard thread, wakeups from the send
+ * thread.
+ */
+enum input_source {
+    INPUT_SRC_MOUSE,
+    INPUT_SRC_KBD,
+    INPUT_SRC_SEND,
+    INPUT_SRC_COUNT
+};
+
+/*
+ * Cross-thread input queue (see "Input Queue" in input.h).
+ *
+ * event_fd wakes handle_input_events() on the Wayland event loop. It
+ * is written only when `signaled` goes 0 → 1, i.e. on the first push
+ * after the main loop started draining, not once per event.
+ */
+struct input_queue {
+    struct input_ring rings[INPUT_SRC_COUNT];
+    atomic_uint next_seq;   /* Push order across rings */
+    atomic_int signaled;    /* event_fd written since the last drain */
+    atomic_uint dropped;    /* Events lost to a full ring */
+    int event_fd;           /* eventfd, non-blocking; -1 if unavailable */
 };
 
 /* ============== Draw State ============== */
@@ -168,7 +239,12 @@ struct draw_state {
     int image_id;               /* Our offscreen buffer (accumulates via XOR) */
     int opaque_id;              /* 1x1 white replicated image for mask */
     int delta_id;               /* Temp image for receiving XOR deltas */
+    int cache_id;               /* Tile cache image (0 = cache disabled) */
+    int cache_cols, cache_rows; /* Tile cache slot grid (see tilecache.h) */
+    int fill_id_base;           /* First 1x1 fill color image (0 = none) */
+    int fill_count;             /* Number of fill color images allocated */
     int width, height;          /* Padded buffer dimensions (TILE_ALIGN_UP) */
+    int image_cap_w, image_cap_h;   /* Allocated size of image_id/delta_id */
     int visible_width;          /* Actual window width (what compositor renders) */
     int visible_height;         /* Actual window height (what compositor renders) */
     int win_minx, win_miny;     /* Window origin for coordinate translation */
@@ -230,6 +306,8 @@ struct toplevel {
     struct wl_listener request_minimize;    /* Minimize blocked (no restore path) */
     struct wl_list subsurfaces;     /* List of subsurface_track */
     struct server *server;
+    struct server *win;             /* Server whose Plan 9 window shows it
+                                     * (server itself unless -w, window.h) */
     bool configured;                /* Have we sent initial configure? */
     bool mapped;                    /* Is surface currently mapped? */
     int commit_count;               /* Per-toplevel commit counter */
@@ -288,6 +366,8 @@ struct server {
     struct p9conn p9_kbd;       /* For /dev/cons keyboard input */
     struct p9conn p9_wctl;      /* For /dev/wctl window monitoring */
     struct p9conn p9_snarf;     /* For /dev/snarf clipboard */
+    struct p9conn p9_shared;    /* Carrier of the five above as channels (-m) */
+    atomic_int late_up;         /* p9_kbd and p9_snarf connected (wayland/sessions.h) */
 
     struct draw_state draw;
 
@@ -304,6 +384,9 @@ struct server {
     int visible_width, visible_height;  /* Actual window dimensions */
     uint32_t *framebuf;             /* Current frame */
     uint32_t *prev_framebuf;        /* Previous frame (for delta detection) */
+    size_t fb_cap;                  /* Pixels allocated in framebuf, prev_framebuf
+                                     * and send_buf[0/1] (>= width * height) */
+    int tile_major;                 /* Buffers stored tile by tile (-B), see fb_tile() */
 
     /* ---- Tile-based rendering ---- */
     int tiles_x, tiles_y;           /* Number of tiles in each dimension */
@@ -313,6 +396,8 @@ struct server {
     int timer_armed;                /* Send timer is active */
     uint32_t last_frame_ms;         /* Timestamp of last frame */
     struct wl_event_source *send_timer;
+    struct wl_event_source *pace_timer; /* Re-renders after a paced deferral */
+    volatile int refine_pending;    /* Send thread wants a frame to refine lossy tiles */
 
     /* ---- Send thread (double buffered) ---- */
     pthread_t send_thread;
@@ -322,14 +407,72 @@ struct server {
     int pending_buf;                /* Buffer with new data (-1 = none) */
     int active_buf;                 /* Buffer send thread is using */
     int send_full;                  /* Force full frame flag */
+    uint32_t frame_seq;             /* Output frame number (timeline.h) */
+    uint32_t send_seq[2];           /* frame_seq of each send_buf */
+    void (*first_frame)(struct server *s);  /* Send thread, once its first frame
+                                             * is out (sessions.h); or NULL */
 
 
     /* ---- Damage-based dirty tile tracking ---- */
     uint8_t *dirty_staging;          /* Tile bitmap written by output thread */
+    uint8_t *damage_source;          /* DAMAGE_* classes of commits since the
+                                      * last render (output thread only) */
     int dirty_staging_valid;         /* 1 if dirty_staging has valid data */
     uint8_t *dirty_tiles[2];         /* Per-send-buffer tile bitmaps */
     int dirty_valid[2];              /* Whether bitmap is valid per buffer */
 
+    /*
+     * Damage of every frame rendered since the last handoff to the
+     * send thread, including frames send_frame() dropped.  Moved into
+     * dirty_tiles[buf] at the next handoff.  Under send_lock; NULL
+     * or !dirty_accum_valid means some of that damage is unknown.
+     */
+    uint8_t *dirty_accum;
+    int dirty_accum_valid;
+
+    /*
+     * Carried-forward damage per physical buffer.
+     *
+     * framebuf and send_buf[0/1] rotate via pointer swap, so each
+     * buffer misses the frames rendered while it was owned by the
+     * send thread.  A stale map marks tiles whose content lags the
+     * latest render; output_frame copies damage ∪ fb_stale and ORs
+     * the new damage into send_stale[].  The maps travel with their
+     * buffers in send_frame().  NULL means "all tiles stale".
+     */
+    uint8_t *fb_stale;               /* Stale tiles in framebuf */
+    uint8_t *send_stale[2];          /* Stale tiles in send_buf[0/1] */
+
+    /*
+     * Per-tile content hashes of what Plan 9 currently displays
+     * (i.e. of prev_framebuf).  Owned by the send thread; sized to
+     * tile_hash_tx × tile_hash_ty and regridded when the tile grid
+     * changes (overlapping tiles keep their hash, new ones are
+     * unknown).  TILE_HASH_UNKNOWN (0) forces a pixel compare.
+     */
+    uint64_t *tile_hash;
+    int tile_hash_tx, tile_hash_ty;
+
+    /*
+     * Tiles of prev_framebuf that do not hold what Plan 9 displays:
+     * exposed by a scroll (apply_scroll_to_prevbuf) or lost with a
+     * failed write.  Such tiles are always resent and never delta
+     * encoded; sending one clears its bit.  Owned by the send thread,
+     * sized like tile_hash; a new array starts all-invalid, a regridded
+     * one marks the tiles a resize exposed.
+     */
+    uint8_t *prev_invalid;
+    int prev_invalid_tx, prev_invalid_ty;
+
+    /*
+     * Smallest overlap (in tiles) of prev_framebuf kept by the resizes
+     * since the send thread last regridded tile_hash and prev_invalid:
+     * output_frame() may restride it more than once in between. Set by
+     * output_frame(), taken by the send thread, both under send_lock.
+     */
+    int regrid_pending;
+    int keep_tx, keep_ty;
+
 
     /* ---- Per-region scroll detection ---- */
     struct {
@@ -340,6 +483,10 @@ struct server {
     int num_scroll_regions;
     int scroll_regions_x, scroll_regions_y;  /* Grid dimensions */
 
+    /* Send thread state between frames (send_init, scroll_init) */
+    struct send_state *send;
+    struct scroll_state *scroll;
+
     /* ---- Input handling ---- */
     struct input_queue input_queue;
     struct wl_event_source *input_event;
@@ -362,10 +509,42 @@ struct server {
     char *tls_cert_file;            /* Path to certificate (-c option) */
     char *tls_fingerprint;          /* SHA256 fingerprint (-f option) */
     int tls_insecure;               /* Skip cert verification (-k option) */
+    int tls_ktls;                   /* Kernel TLS on draw connections (-K option) */
+    int share_conns;                /* Side sessions as channels of p9_shared (-m option) */
     float scale;                    /* Output scale for HiDPI (default: 1.0) */
+    int tile_cache_mb;              /* Server-side tile cache budget (-C option) */
+    int compress_effort;            /* Compression effort 0-3, -1 = auto (-E option) */
+    int cursor_offload;             /* Client cursors to /dev/cursor (off with -X) */
     enum wlr_log_importance log_level;
+
+    /* ---- Multi-window mode (-w, see wayland/window.h) ---- */
+    int multi_window;               /* Further toplevels get rio windows of their own */
+    struct server *root;            /* Root server of a window server, NULL in the root */
+    struct server *output_pending;  /* Window server new_output() is adding (root) */
+    struct wl_list windows;         /* Window servers (root, initialized with -w) */
+    struct wl_list window_link;     /* Link in root->windows */
+    struct toplevel *window_tl;     /* Toplevel the window was created for */
+    pthread_t create_thread;        /* Setup thread while being created */
+    struct wl_event_source *create_source;  /* create_fd; set until started */
+    int create_fd;                  /* eventfd: setup thread done */
+    int create_result;              /* Setup thread's result; read after join */
+    atomic_int create_stop;         /* Shutdown: setup thread gives up */
+    atomic_int input_lost;          /* Mouse reads failed while running */
+    struct wl_event_source *lost_idle;  /* window_lost() close pending */
+    int window_seq;                 /* Window servers created so far (root) */
+    int layout_x;                   /* Output position in the layout (logical) */
+    int mouse_buttons;              /* Buttons held at the last mouse event */
+    struct wlr_surface *passthrough_last;   /* See output_passthrough() */
 };
 
+/*
+ * Server owning the shared Wayland state (seat, scene, focus, toplevel
+ * list) for either a root or a window server.
+ */
+static inline struct server *server_root(struct server *s) {
+    return s->root ? s->root : s;
+}
+
 /* ============== Utility Functions ============== */
 
 /*
@@ -395,6 +574,29 @@ static inline uint64_t now_us(void) {
     return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+/* ============== Framebuffer Layout ============== */
+
+/*
+ * First pixel of tile (tx, ty) in framebuf, prev_framebuf or a
+ * send_buf, and the stride in pixels that walks the tile's rows.
+ *
+ * Row-major buffers (default) have stride width.  With tile_major
+ * (-B) each tile is TILE_SIZE × TILE_SIZE contiguous pixels (1 KiB)
+ * and tiles follow in row order, so stride is TILE_SIZE and every
+ * per-tile kernel reads one straight block.  Whole-frame passes that
+ * need pixel rows across tiles (scroll detection, merged loads) are
+ * off in that layout.
+ */
+static inline uint32_t *fb_tile(const struct server *s, uint32_t *buf, int tx, int ty) {
+    if (s->tile_major)
+        return buf + (size_t)(ty * s->tiles_x + tx) * (TILE_SIZE * TILE_SIZE);
+    return buf + (size_t)ty * TILE_SIZE * s->width + tx * TILE_SIZE;
+}
+
+static inline int fb_tile_stride(const struct server *s) {
+    return s->tile_major ? TILE_SIZE : s->width;
+}
+
 /* ============== Legacy Compatibility ============== */
 
 /*
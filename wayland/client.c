@@ -19,7 +19,9 @@
 #include <wlr/util/log.h>
 
 #include "client.h"
+#include "../draw/arena.h"
 #include "../draw/draw.h"
+#include "../draw/send.h"
 #include "../p9/p9.h"
 
 /* ============== Decoration Handling ============== */
@@ -153,29 +155,38 @@ void server_cleanup(struct server *s) {
     if (s->mouse_thread) pthread_join(s->mouse_thread, NULL);
     if (s->kbd_thread)   pthread_join(s->kbd_thread, NULL);
     if (s->send_thread)  pthread_join(s->send_thread, NULL);
+    send_cleanup(s);
     
     wlr_keyboard_finish(&s->virtual_kb);
     
     /* Cleanup focus manager */
     focus_manager_cleanup(&s->focus);
     
-    free(s->framebuf);
-    free(s->prev_framebuf);
-    free(s->send_buf[0]);
-    free(s->send_buf[1]);
+    arena_unmap(s->framebuf, s->fb_cap * 4);
+    arena_unmap(s->prev_framebuf, s->fb_cap * 4);
+    arena_unmap(s->send_buf[0], s->fb_cap * 4);
+    arena_unmap(s->send_buf[1], s->fb_cap * 4);
+    free(s->fb_stale);
+    free(s->send_stale[0]);
+    free(s->send_stale[1]);
+    free(s->tile_hash);
+    free(s->prev_invalid);
+    free(s->damage_source);
     
     pthread_mutex_destroy(&s->send_lock);
     pthread_cond_destroy(&s->send_cond);
     
     p9_disconnect(&s->p9_draw);
     p9_disconnect(&s->p9_mouse);
-    p9_disconnect(&s->p9_kbd);
     p9_disconnect(&s->p9_wctl);
-    p9_disconnect(&s->p9_snarf);
+    if (atomic_load(&s->late_up)) {     /* Connected after the first frame */
+        p9_disconnect(&s->p9_kbd);
+        p9_disconnect(&s->p9_snarf);
+    }
+    if (s->share_conns)
+        p9_disconnect(&s->p9_shared);   /* After its channels */
     
-    close(s->input_queue.pipe_fd[0]);
-    close(s->input_queue.pipe_fd[1]);
-    pthread_mutex_destroy(&s->input_queue.lock);
+    if (s->input_queue.event_fd >= 0) close(s->input_queue.event_fd);
     
     free(s->tls_cert_file);
     free(s->tls_fingerprint);
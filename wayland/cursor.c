@@ -0,0 +1,319 @@
+/*
+ * cursor.c - Client cursor images on the Plan 9 cursor (/dev/cursor)
+ *
+ * Converts the wl_pointer cursor surface to rio's 16×16 two-colour
+ * cursor format and writes it from a mailbox thread. See cursor.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <drm_fourcc.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+
+#include "cursor.h"
+#include "../types.h"
+#include "../p9/p9.h"
+
+/* Plan 9 Cursor: offset (2 × 4 bytes), clr[32], set[32] */
+#define CURSOR_DIM      16
+#define CURSOR_MASK     (CURSOR_DIM * CURSOR_DIM / 8)
+#define CURSOR_REC_SIZE (2 * 4 + 2 * CURSOR_MASK)
+
+struct cursor_rec {
+    uint8_t data[CURSOR_REC_SIZE];
+    int len;                    /* CURSOR_REC_SIZE, or 0 = rio default */
+};
+
+static struct {
+    struct server *s;
+    struct p9conn *p9;
+    uint32_t fid;
+    bool active;
+
+    /* Writer mailbox (newest record wins) */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct cursor_rec pending;
+    bool has_pending;
+    struct cursor_rec posted;   /* Last record handed to the writer */
+    bool has_posted;
+
+    /* Current client cursor surface */
+    struct wlr_surface *surface;
+    int32_t hot_x, hot_y;       /* Hot spot in surface-local coordinates */
+    struct wl_listener surface_commit;
+    struct wl_listener surface_destroy;
+
+    struct wl_listener request_set_cursor;
+    struct wl_listener focus_change;
+} cur = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* ============== Writer Thread ============== */
+
+static void *cursor_writer_func(void *arg) {
+    (void)arg;
+    struct cursor_rec rec;
+
+    pthread_mutex_lock(&cur.lock);
+    for (;;) {
+        while (cur.active && !cur.has_pending)
+            pthread_cond_wait(&cur.cond, &cur.lock);
+        if (!cur.active) break;
+        rec = cur.pending;
+        cur.has_pending = false;
+        pthread_mutex_unlock(&cur.lock);
+
+        if (p9_write(cur.p9, cur.fid, 0, rec.data, rec.len) < 0)
+            wlr_log(WLR_DEBUG, "cursor: /dev/cursor write failed");
+
+        pthread_mutex_lock(&cur.lock);
+    }
+    pthread_mutex_unlock(&cur.lock);
+    return NULL;
+}
+
+static void cursor_post(const struct cursor_rec *rec) {
+    if (cur.has_posted && rec->len == cur.posted.len &&
+        memcmp(rec->data, cur.posted.data, rec->len) == 0)
+        return;
+    cur.posted = *rec;
+    cur.has_posted = true;
+
+    pthread_mutex_lock(&cur.lock);
+    cur.pending = *rec;
+    cur.has_pending = true;
+    pthread_cond_signal(&cur.cond);
+    pthread_mutex_unlock(&cur.lock);
+}
+
+/* ============== Conversion ============== */
+
+static inline void put_le32(uint8_t *p, int32_t v) {
+    uint32_t u = (uint32_t)v;
+    p[0] = u; p[1] = u >> 8; p[2] = u >> 16; p[3] = u >> 24;
+}
+
+/*
+ * Build the record for the current surface. Returns 0 on success, -1
+ * if the buffer has no readable XRGB/ARGB data pointer (caller falls
+ * back to rio's arrow).
+ */
+static int cursor_convert(struct cursor_rec *rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->len = CURSOR_REC_SIZE;
+
+    struct wlr_surface *surface = cur.surface;
+    if (!surface)
+        return 0;       /* Hidden cursor: empty masks */
+    if (!surface->buffer || !surface->buffer->texture)
+        return 0;       /* Nothing attached yet: hidden as well */
+
+    /* The shm pixels, valid only until end_data_ptr_access */
+    struct wlr_buffer *buffer = surface->buffer->source;
+    void *data;
+    uint32_t format;
+    size_t bstride;
+    if (!buffer || !wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                                     &data, &format, &bstride))
+        return -1;
+    if (format != DRM_FORMAT_ARGB8888 && format != DRM_FORMAT_XRGB8888) {
+        wlr_buffer_end_data_ptr_access(buffer);
+        return -1;
+    }
+
+    int bw = buffer->width;
+    int bh = buffer->height;
+    int stride = (int)(bstride / 4);
+    const uint32_t *px = data;
+    int bscale = surface->current.scale > 0 ? surface->current.scale : 1;
+
+    /* Buffer pixels per physical pixel, then an integer step that fits */
+    float ratio = (float)bscale / cur.s->scale;
+    int pw = (int)(bw / ratio + 0.5f), ph = (int)(bh / ratio + 0.5f);
+    int step = 1;
+    while ((pw + step - 1) / step > CURSOR_DIM || (ph + step - 1) / step > CURSOR_DIM)
+        step++;
+    float src_step = ratio * step;
+
+    int hx = (int)(cur.hot_x * bscale / src_step);
+    int hy = (int)(cur.hot_y * bscale / src_step);
+    if (hx < 0) hx = 0;
+    if (hx >= CURSOR_DIM) hx = CURSOR_DIM - 1;
+    if (hy < 0) hy = 0;
+    if (hy >= CURSOR_DIM) hy = CURSOR_DIM - 1;
+    put_le32(rec->data, -hx);
+    put_le32(rec->data + 4, -hy);
+
+    uint8_t *clr = rec->data + 8;
+    uint8_t *set = clr + CURSOR_MASK;
+    for (int y = 0; y < CURSOR_DIM; y++) {
+        int sy = (int)(y * src_step);
+        if (sy >= bh) break;
+        for (int x = 0; x < CURSOR_DIM; x++) {
+            int sx = (int)(x * src_step);
+            if (sx >= bw) break;
+            uint32_t p = px[sy * stride + sx];
+            uint32_t a = format == DRM_FORMAT_XRGB8888 ? 0xFF : p >> 24;
+            if (a < 0x80) continue;
+
+            /* Premultiplied: compare luminance against half the alpha */
+            uint32_t lum = (((p >> 16) & 0xFF) * 77 + ((p >> 8) & 0xFF) * 150 +
+                            (p & 0xFF) * 29) >> 8;
+            uint8_t bit = 0x80 >> (x & 7);
+            int idx = y * (CURSOR_DIM / 8) + x / 8;
+            if (lum * 2 < a)
+                set[idx] |= bit;
+            else
+                clr[idx] |= bit;
+        }
+    }
+    wlr_buffer_end_data_ptr_access(buffer);
+    return 0;
+}
+
+static void cursor_update(void) {
+    struct cursor_rec rec;
+    if (cursor_convert(&rec) < 0)
+        rec.len = 0;
+    cursor_post(&rec);
+}
+
+static void cursor_restore_default(void) {
+    struct cursor_rec rec = { .len = 0 };
+    cursor_post(&rec);
+}
+
+/* ============== Surface Tracking ============== */
+
+static void cursor_set_surface(struct wlr_surface *surface);
+
+static void handle_surface_commit(struct wl_listener *listener, void *data) {
+    (void)listener;
+    (void)data;
+    struct wlr_surface *surface = cur.surface;
+
+    /* The attach offset moves the hot spot the other way */
+    cur.hot_x -= surface->current.dx;
+    cur.hot_y -= surface->current.dy;
+    cursor_update();
+
+    /* Nothing composites the surface, so answer frame callbacks here */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wlr_surface_send_frame_done(surface, &now);
+}
+
+static void handle_surface_destroy(struct wl_listener *listener, void *data) {
+    (void)listener;
+    (void)data;
+    cursor_set_surface(NULL);
+}
+
+static void cursor_set_surface(struct wlr_surface *surface) {
+    if (cur.surface == surface)
+        return;
+    if (cur.surface) {
+        wl_list_remove(&cur.surface_commit.link);
+        wl_list_remove(&cur.surface_destroy.link);
+    }
+    cur.surface = surface;
+    if (surface) {
+        cur.surface_commit.notify = handle_surface_commit;
+        wl_signal_add(&surface->events.commit, &cur.surface_commit);
+        cur.surface_destroy.notify = handle_surface_destroy;
+        wl_signal_add(&surface->events.destroy, &cur.surface_destroy);
+    }
+}
+
+/* ============== Seat Events ============== */
+
+static void handle_request_set_cursor(struct wl_listener *listener, void *data) {
+    (void)listener;
+    struct wlr_seat_pointer_request_set_cursor_event *ev = data;
+
+    /* Only the client under the pointer may change it */
+    if (ev->seat_client != cur.s->seat->pointer_state.focused_client)
+        return;
+
+    cursor_set_surface(ev->surface);
+    cur.hot_x = ev->hotspot_x;
+    cur.hot_y = ev->hotspot_y;
+    cursor_update();
+}
+
+static void handle_focus_change(struct wl_listener *listener, void *data) {
+    (void)listener;
+    struct wlr_seat_pointer_focus_change_event *ev = data;
+
+    /* A newly entered client sets its own cursor; over no surface (the
+     * background, decorations) the image is ours to choose */
+    if (ev->new_surface)
+        return;
+    cursor_set_surface(NULL);
+    cursor_restore_default();
+}
+
+/* ============== Public API ============== */
+
+int cursor_init(struct server *s) {
+    if (!s->cursor_offload)
+        return 0;
+
+    cur.s = s;
+    cur.p9 = &s->p9_wctl;
+
+    /* Shared with the blocking /dev/wctl watch read */
+    if (p9_mux_start(cur.p9, NULL) < 0) {
+        wlr_log(WLR_ERROR, "cursor: cannot multiplex wctl connection, using rio cursor");
+        return -1;
+    }
+
+    const char *wnames[] = { "cursor" };
+    cur.fid = cur.p9->next_fid++;
+    if (p9_walk(cur.p9, cur.p9->root_fid, cur.fid, 1, wnames) < 0 ||
+        p9_open(cur.p9, cur.fid, OWRITE, NULL) < 0) {
+        wlr_log(WLR_INFO, "cursor: /dev/cursor unavailable, using rio cursor");
+        return -1;
+    }
+
+    cur.active = true;
+    if (pthread_create(&cur.thread, NULL, cursor_writer_func, NULL) != 0) {
+        wlr_log(WLR_ERROR, "cursor: failed to create writer thread");
+        cur.active = false;
+        p9_clunk(cur.p9, cur.fid);
+        return -1;
+    }
+
+    cur.request_set_cursor.notify = handle_request_set_cursor;
+    wl_signal_add(&s->seat->events.request_set_cursor, &cur.request_set_cursor);
+    cur.focus_change.notify = handle_focus_change;
+    wl_signal_add(&s->seat->pointer_state.events.focus_change, &cur.focus_change);
+
+    wlr_log(WLR_INFO, "cursor: client cursors offloaded to /dev/cursor");
+    return 0;
+}
+
+void cursor_cleanup(struct server *s) {
+    (void)s;
+    if (!cur.active)
+        return;
+
+    cursor_set_surface(NULL);
+    wl_list_remove(&cur.request_set_cursor.link);
+    wl_list_remove(&cur.focus_change.link);
+
+    pthread_mutex_lock(&cur.lock);
+    cur.active = false;
+    pthread_cond_signal(&cur.cond);
+    pthread_mutex_unlock(&cur.lock);
+    pthread_join(cur.thread, NULL);
+}
@@ -0,0 +1,75 @@
+/*
+ * cursor.h - Client cursor images on the Plan 9 cursor (/dev/cursor)
+ *
+ * Rio draws the mouse cursor itself: pointer motion moves it locally
+ * on the Plan 9 side, with no round trip and no framebuffer damage.
+ * Instead of compositing Wayland cursor surfaces into the scene (which
+ * would turn every motion into dirty tiles), the cursor image a client
+ * sets with wl_pointer.set_cursor is converted once and written to the
+ * window's /dev/cursor. After that a motion costs nothing beyond the
+ * mouse event itself.
+ *
+ * Conversion:
+ *
+ *   A Plan 9 cursor is a 16×16 two-colour image with transparency:
+ *
+ *     offset   2 × 4 bytes (little endian), top-left corner relative
+ *              to the hot spot (so -hotspot)
+ *     clr      32 bytes, 1 bit per pixel, drawn white
+ *     set      32 bytes, 1 bit per pixel, drawn black (wins over clr)
+ *
+ *   The cursor buffer (shm, ARGB or XRGB, read within data pointer
+ *   access) is sampled at physical size (logical size × output
+ *   scale). Images larger than 16×16 are downsampled by the smallest
+ *   integer step that fits; the hot spot follows. Pixels with alpha >= 50% become set (dark) or clr (light)
+ *   by luminance; the rest stay transparent, so anti-aliased edges are
+ *   simply dropped.
+ *
+ * Updates:
+ *
+ *   request_set_cursor   accepted from the client with pointer focus;
+ *                        a NULL surface hides the cursor (empty masks)
+ *   surface commit       re-converts (animated cursors, new hot spot
+ *                        via the attach offset)
+ *   focus_change         pointer focus on no surface restores rio's
+ *                        default arrow (zero-length write)
+ *
+ *   Identical images are not rewritten.
+ *
+ * Writer Thread:
+ *
+ *   The 9P write runs on a small thread so the event loop never waits
+ *   on the network. The event loop posts the newest record into a
+ *   one-slot mailbox; intermediate records of a fast animation are
+ *   overwritten, not queued. The write goes to p9_wctl, which is
+ *   multiplexed so it shares the connection with the blocking
+ *   /dev/wctl watch read (see clipboard.h). The fid stays open for the
+ *   session: rio restores its own cursor when /dev/cursor is closed.
+ *
+ * Disabling:
+ *
+ *   -X keeps rio's arrow for all clients and ignores cursor surfaces,
+ *   as before this module.
+ */
+
+#ifndef P9WL_CURSOR_H
+#define P9WL_CURSOR_H
+
+struct server;
+
+/*
+ * Open /dev/cursor and hook the seat's cursor events.
+ *
+ * Call after the seat exists (init_wayland) and before
+ * clipboard_init(), which starts another user of p9_wctl. No-op
+ * when s->cursor_offload is 0.
+ *
+ * Returns 0 on success, -1 if /dev/cursor is unavailable (client
+ * cursors are then ignored and rio's arrow stays).
+ */
+int cursor_init(struct server *s);
+
+/* Stop the writer thread and remove listeners. Safe if init failed. */
+void cursor_cleanup(struct server *s);
+
+#endif /* P9WL_CURSOR_H */
@@ -22,6 +22,7 @@
 #include <wlr/util/log.h>
 
 #include "types.h"
+#include "input/clipboard.h"
 
 #define SEAT(fm)         ((fm)->server->seat)
 #define CURSOR(fm)       ((fm)->server->cursor)
@@ -176,6 +177,7 @@ void focus_keyboard_set(struct focus_manager *fm, struct wlr_surface *surface,
 
     fm->keyboard_focus = surface;
     fm->focus_change_count++;
+    clipboard_poll_hint();  /* A paste often follows a focus change */
 
     if (surface) {
         struct wlr_keyboard *kb = wlr_seat_get_keyboard(SEAT(fm));
@@ -10,19 +10,27 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 #include <pthread.h>
+#include <drm_fourcc.h>
 #include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 
 #include "output.h"
+#include "../draw/arena.h"
 #include "../draw/send.h"
 #include "../draw/draw_cmd.h"
+#include "../draw/metrics.h"
+#include "../draw/timeline.h"
 #include "../p9/p9.h"
 
 static void output_destroy(struct wl_listener *listener, void *data) {
@@ -30,35 +38,470 @@ static void output_destroy(struct wl_listener *listener, void *data) {
     (void)data;
     wl_list_remove(&s->output_frame.link);
     wl_list_remove(&s->output_destroy.link);
+    s->output = NULL;
+    s->scene_output = NULL;
+}
+
+/* Capacity growth: at least need, and half again the old capacity */
+static size_t cap_grow(size_t cap, size_t need) {
+    size_t grown = cap + cap / 2;
+    return grown > need ? grown : need;
 }
 
 /*
  * Reallocate Plan 9 draw images after resize.
  * Uses alloc_image_cmd helper instead of manual byte construction.
+ * The four commands go out in one write (one round trip).
  */
 static void reallocate_draw_images(struct draw_state *draw, int new_w, int new_h) {
     struct p9conn *p9 = draw->p9;
-    uint8_t cmd[64];
-    int off;
+    uint8_t cmd[256];
+    int off = 0;
     
     /* Free old images */
-    off = free_image_cmd(cmd, draw->image_id);
-    p9_write(p9, draw->drawdata_fid, 0, cmd, off);
-    
-    off = free_image_cmd(cmd, draw->delta_id);
-    p9_write(p9, draw->drawdata_fid, 0, cmd, off);
+    off += free_image_cmd(cmd + off, draw->image_id);
+    off += free_image_cmd(cmd + off, draw->delta_id);
     
     /* Reallocate framebuffer image (XRGB32) */
-    off = alloc_image_cmd(cmd, draw->image_id, CHAN_XRGB32, 0,
-                          0, 0, new_w, new_h, 0x00000000);
-    p9_write(p9, draw->drawdata_fid, 0, cmd, off);
+    off += alloc_image_cmd(cmd + off, draw->image_id, CHAN_XRGB32, 0,
+                           0, 0, new_w, new_h, 0x00000000);
     
     /* Reallocate delta image (ARGB32 for alpha compositing) */
-    off = alloc_image_cmd(cmd, draw->delta_id, CHAN_ARGB32, 0,
-                          0, 0, new_w, new_h, 0x00000000);
+    off += alloc_image_cmd(cmd + off, draw->delta_id, CHAN_ARGB32, 0,
+                           0, 0, new_w, new_h, 0x00000000);
     p9_write(p9, draw->drawdata_fid, 0, cmd, off);
 }
 
+/*
+ * Make the Plan 9 images cover new_w × new_h.  They are kept while the
+ * window fits their capacity, so shrinking or growing back costs no
+ * round trip and their content stays valid; otherwise they are
+ * reallocated with headroom (cap_grow, tile aligned).
+ *
+ * Returns 1 if the images were kept, 0 if reallocated (content lost).
+ */
+static int draw_images_reserve(struct draw_state *draw, int new_w, int new_h) {
+    if (new_w <= draw->image_cap_w && new_h <= draw->image_cap_h)
+        return 1;
+    
+    int cap_w = (int)cap_grow(draw->image_cap_w, new_w);
+    int cap_h = (int)cap_grow(draw->image_cap_h, new_h);
+    cap_w = (cap_w + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    cap_h = (cap_h + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+    if (cap_w > MAX_SCREEN_DIM) cap_w = new_w > MAX_SCREEN_DIM ? new_w : MAX_SCREEN_DIM;
+    if (cap_h > MAX_SCREEN_DIM) cap_h = new_h > MAX_SCREEN_DIM ? new_h : MAX_SCREEN_DIM;
+    
+    reallocate_draw_images(draw, cap_w, cap_h);
+    draw->image_cap_w = cap_w;
+    draw->image_cap_h = cap_h;
+    wlr_log(WLR_INFO, "Plan 9 images reallocated at %dx%d", cap_w, cap_h);
+    return 0;
+}
+
+/*
+ * Move the top-left cw × ch pixels of an image with stride src_w to
+ * stride dst_w.  dst may be src: rows are moved in the order that
+ * never overwrites a row still to be read.
+ */
+static void fb_restride(uint32_t *dst, int dst_w, const uint32_t *src, int src_w,
+                        int cw, int ch) {
+    if (dst_w > src_w) {
+        for (int y = ch - 1; y >= 0; y--)
+            memmove(dst + (size_t)y * dst_w, src + (size_t)y * src_w, cw * sizeof(uint32_t));
+    } else {
+        for (int y = 0; y < ch; y++)
+            memmove(dst + (size_t)y * dst_w, src + (size_t)y * src_w, cw * sizeof(uint32_t));
+    }
+}
+
+/*
+ * Tile-major fb_restride(): move the top-left ctx × cty tiles of a
+ * grid src_tx tiles wide to one dst_tx wide.  Same in-place ordering.
+ */
+static void fb_retile(uint32_t *dst, int dst_tx, const uint32_t *src, int src_tx,
+                      int ctx, int cty) {
+    const size_t tile = TILE_SIZE * TILE_SIZE;
+    if (dst_tx > src_tx) {
+        for (int i = ctx * cty - 1; i >= 0; i--) {
+            int ty = i / ctx, tx = i % ctx;
+            memmove(dst + (size_t)(ty * dst_tx + tx) * tile,
+                    src + (size_t)(ty * src_tx + tx) * tile, tile * sizeof(uint32_t));
+        }
+    } else {
+        for (int i = 0; i < ctx * cty; i++) {
+            int ty = i / ctx, tx = i % ctx;
+            memmove(dst + (size_t)(ty * dst_tx + tx) * tile,
+                    src + (size_t)(ty * src_tx + tx) * tile, tile * sizeof(uint32_t));
+        }
+    }
+}
+
+/* Keep prev_framebuf's top-left cw × ch (padded) in the new geometry */
+static void fb_keep_overlap(struct server *s, uint32_t *dst, int dst_w,
+                            const uint32_t *src, int cw, int ch) {
+    if (s->tile_major)
+        fb_retile(dst, dst_w / TILE_SIZE, src, s->tiles_x,
+                  cw / TILE_SIZE, ch / TILE_SIZE);
+    else
+        fb_restride(dst, dst_w, src, s->width, cw, ch);
+}
+
+/*
+ * Make sure all three stale maps exist.  Missing maps are allocated
+ * all-stale so the buffer they describe gets a full copy on next use.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int stale_maps_ensure(struct server *s, int ntiles) {
+    uint8_t **maps[3] = { &s->fb_stale, &s->send_stale[0], &s->send_stale[1] };
+    
+    for (int i = 0; i < 3; i++) {
+        if (*maps[i]) continue;
+        *maps[i] = malloc(ntiles);
+        if (!*maps[i]) return -1;
+        memset(*maps[i], 1, ntiles);
+    }
+    return 0;
+}
+
+/* ============== Damage Sources ============== */
+
+void output_note_damage(struct server *s, struct wlr_surface *surface,
+                        int lx, int ly, uint8_t cls) {
+    int ntiles = s->tiles_x * s->tiles_y;
+    if (ntiles <= 0 || !surface) return;
+    if (!s->damage_source) {
+        s->damage_source = calloc(1, ntiles);
+        if (!s->damage_source) return;
+    }
+    
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    wlr_surface_get_effective_damage(surface, &damage);
+    
+    /* Surface-local logical coordinates → physical tiles, rounded out */
+    double scale = s->scale > 0 ? s->scale : 1.0;
+    lx -= s->layout_x;
+    int nrects = 0;
+    pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+    for (int r = 0; r < nrects; r++) {
+        int tx0 = (int)floor((lx + rects[r].x1) * scale) / TILE_SIZE;
+        int ty0 = (int)floor((ly + rects[r].y1) * scale) / TILE_SIZE;
+        int tx1 = ((int)ceil((lx + rects[r].x2) * scale) + TILE_SIZE - 1) / TILE_SIZE;
+        int ty1 = ((int)ceil((ly + rects[r].y2) * scale) + TILE_SIZE - 1) / TILE_SIZE;
+        if (tx0 < 0) tx0 = 0;
+        if (ty0 < 0) ty0 = 0;
+        if (tx1 > s->tiles_x) tx1 = s->tiles_x;
+        if (ty1 > s->tiles_y) ty1 = s->tiles_y;
+        for (int ty = ty0; ty < ty1; ty++)
+            for (int tx = tx0; tx < tx1; tx++)
+                s->damage_source[ty * s->tiles_x + tx] |= cls;
+    }
+    pixman_region32_fini(&damage);
+}
+
+/*
+ * Copy tiles marked in mask from the wlroots buffer into framebuf.
+ * Adjacent marked tiles in a tile row are merged into one memcpy per
+ * pixel row.  Copies are clipped to copy_w × copy_h (visible area).
+ */
+static void copy_masked_tiles(uint32_t *fb, int fb_stride,
+                              const uint8_t *src, size_t src_stride,
+                              const uint8_t *mask, int tiles_x, int tiles_y,
+                              int copy_w, int copy_h) {
+    for (int ty = 0; ty < tiles_y; ty++) {
+        int y0 = ty * TILE_SIZE;
+        if (y0 >= copy_h) break;
+        int y1 = y0 + TILE_SIZE;
+        if (y1 > copy_h) y1 = copy_h;
+        
+        const uint8_t *row = &mask[ty * tiles_x];
+        for (int tx = 0; tx < tiles_x; ) {
+            if (!row[tx]) { tx++; continue; }
+            int run = tx;
+            while (run < tiles_x && row[run]) run++;
+            
+            int x0 = tx * TILE_SIZE;
+            int x1 = run * TILE_SIZE;
+            if (x1 > copy_w) x1 = copy_w;
+            if (x0 < x1) {
+                for (int y = y0; y < y1; y++) {
+                    memcpy(&fb[y * fb_stride + x0],
+                           src + y * src_stride + x0 * 4,
+                           (x1 - x0) * 4);
+                }
+            }
+            tx = run;
+        }
+    }
+}
+
+/*
+ * Tile-major copy_masked_tiles(): the rows of each marked tile are
+ * gathered into its contiguous block, so the layout conversion is
+ * this copy and nothing else.  mask NULL copies every tile.
+ */
+static void copy_tiles_blocked(uint32_t *fb, const uint8_t *src, size_t src_stride,
+                               const uint8_t *mask, int tiles_x, int tiles_y,
+                               int copy_w, int copy_h) {
+    for (int ty = 0; ty < tiles_y; ty++) {
+        int y0 = ty * TILE_SIZE;
+        if (y0 >= copy_h) break;
+        int rows = copy_h - y0 < TILE_SIZE ? copy_h - y0 : TILE_SIZE;
+        
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int x0 = tx * TILE_SIZE;
+            if (x0 >= copy_w) break;
+            if (mask && !mask[ty * tiles_x + tx]) continue;
+            int cols = copy_w - x0 < TILE_SIZE ? copy_w - x0 : TILE_SIZE;
+            
+            uint32_t *dst = fb + (size_t)(ty * tiles_x + tx) * (TILE_SIZE * TILE_SIZE);
+            const uint8_t *row = src + y0 * src_stride + x0 * 4;
+            for (int y = 0; y < rows; y++, row += src_stride)
+                memcpy(dst + y * TILE_SIZE, row, cols * 4);
+        }
+    }
+}
+
+/*
+ * Copy rendered pixels from a buffer of buf_w × buf_h into framebuf.
+ *
+ * framebuf is a recycled buffer (send_frame() swaps it with a
+ * send_buf), so it lags the render by the frames it missed.  fb_stale
+ * records exactly those tiles, so copying damage ∪ fb_stale brings it
+ * fully up to date.  The new damage (s->dirty_staging) is ORed into
+ * the send buffers' stale maps first, because they will miss this
+ * frame.
+ *
+ * Whole tiles are copied (clipped to the visible area) so the send
+ * thread never sees a tile with rows of mixed age, which would
+ * corrupt prev_framebuf and break XOR delta encoding.
+ *
+ * Without valid damage we fall back to a full visible-area copy and
+ * mark every tile stale in the send buffers.
+ */
+static void framebuf_update(struct server *s, const void *data_ptr, size_t stride,
+                            int buf_w, int buf_h) {
+    uint32_t *fb = s->framebuf;
+    int w = s->width;
+    int vis_w = s->visible_width;
+    int vis_h = s->visible_height;
+    /* Copy min of buffer and visible dims; framebuf stride is w (padded) */
+    int copy_w = (buf_w < vis_w) ? buf_w : vis_w;
+    int copy_h = (buf_h < vis_h) ? buf_h : vis_h;
+    int ntiles = s->tiles_x * s->tiles_y;
+    uint64_t t0 = now_us();
+    
+    pthread_mutex_lock(&s->send_lock);
+    if (s->dirty_staging_valid && ntiles > 0 &&
+        stale_maps_ensure(s, ntiles) == 0) {
+        const uint8_t *damage = s->dirty_staging;
+        uint8_t *stale = s->fb_stale;
+        for (int i = 0; i < ntiles; i++) {
+            s->send_stale[0][i] |= damage[i];
+            s->send_stale[1][i] |= damage[i];
+            stale[i] |= damage[i];
+        }
+        if (s->tile_major)
+            copy_tiles_blocked(fb, data_ptr, stride, stale,
+                               s->tiles_x, s->tiles_y, copy_w, copy_h);
+        else
+            copy_masked_tiles(fb, w, data_ptr, stride, stale,
+                              s->tiles_x, s->tiles_y, copy_w, copy_h);
+        memset(stale, 0, ntiles);
+    } else {
+        if (s->tile_major) {
+            copy_tiles_blocked(fb, data_ptr, stride, NULL,
+                               s->tiles_x, s->tiles_y, copy_w, copy_h);
+        } else {
+            for (int y = 0; y < copy_h; y++) {
+                memcpy(&fb[y * w],
+                       (const uint8_t *)data_ptr + y * stride,
+                       copy_w * 4);
+            }
+        }
+        if (s->fb_stale) memset(s->fb_stale, 0, ntiles);
+        if (s->send_stale[0]) memset(s->send_stale[0], 1, ntiles);
+        if (s->send_stale[1]) memset(s->send_stale[1], 1, ntiles);
+    }
+    pthread_mutex_unlock(&s->send_lock);
+    metrics_observe(METRIC_FB_COPY, now_us() - t0);
+    timeline_span("fb_copy", t0);
+}
+
+/* Paced deferral is over: render whatever accumulated meanwhile */
+static int pace_timer_fire(void *data) {
+    struct server *s = data;
+    if (s->output) wlr_output_schedule_frame(s->output);
+    return 0;
+}
+
+/* ============== Passthrough ============== */
+
+struct passthrough_scan {
+    struct wlr_box output;          /* Layout box of the output (scale 1) */
+    struct wlr_scene_buffer *buffer;
+    int count, x, y;
+};
+
+/* Buffers on this output only: with -w the scene holds every window */
+static void passthrough_scan_iter(struct wlr_scene_buffer *buffer,
+                                  int sx, int sy, void *data) {
+    struct passthrough_scan *scan = data;
+    if (!buffer->buffer) return;
+    int bw = buffer->dst_width ? buffer->dst_width : buffer->buffer->width;
+    int bh = buffer->dst_height ? buffer->dst_height : buffer->buffer->height;
+    const struct wlr_box *o = &scan->output;
+    if (sx >= o->x + o->width || sx + bw <= o->x ||
+        sy >= o->y + o->height || sy + bh <= o->y)
+        return;
+    if (scan->count++ == 0) {
+        scan->buffer = buffer;
+        scan->x = sx;
+        scan->y = sy;
+    }
+}
+
+/*
+ * The client buffer of the one surface that alone makes up the output,
+ * or NULL.  Requires scale 1, a single buffer node at the output's
+ * origin ((0,0), or (layout_x,0) for a window server) with no
+ * crop, scaling or transform, and exactly the visible size.  Anything
+ * else — popups, subsurfaces, a second window, letterboxing — goes
+ * through the scene.  Whether its pixels are readable and opaque in
+ * framebuf's layout is only known once they are accessed
+ * (passthrough_format()).
+ */
+static struct wlr_buffer *passthrough_buffer(struct server *s,
+                                             struct wlr_surface **out_surface) {
+    if (s->scale != 1.0f || !s->scene) return NULL;
+    
+    struct passthrough_scan scan = {
+        .output = { s->layout_x, 0, s->visible_width, s->visible_height },
+    };
+    wlr_scene_node_for_each_buffer(&s->scene->tree.node,
+                                   passthrough_scan_iter, &scan);
+    if (scan.count != 1 || scan.x != s->layout_x || scan.y != 0) return NULL;
+    
+    struct wlr_scene_buffer *sb = scan.buffer;
+    if (sb->transform != WL_OUTPUT_TRANSFORM_NORMAL || sb->opacity < 1.0f ||
+        !wlr_fbox_empty(&sb->src_box))
+        return NULL;
+    if (sb->buffer->width != s->visible_width ||
+        sb->buffer->height != s->visible_height)
+        return NULL;
+    if ((sb->dst_width && sb->dst_width != s->visible_width) ||
+        (sb->dst_height && sb->dst_height != s->visible_height))
+        return NULL;
+    
+    struct wlr_scene_surface *ss = wlr_scene_surface_try_from_buffer(sb);
+    if (!ss || !ss->surface->buffer || !ss->surface->buffer->source) return NULL;
+    struct wlr_buffer *buffer = ss->surface->buffer->source;
+    if (buffer->width != s->visible_width || buffer->height != s->visible_height)
+        return NULL;
+    
+    *out_surface = ss->surface;
+    return buffer;
+}
+
+/*
+ * Whether accessed pixels of surface can be copied as they are: XRGB,
+ * or ARGB with a full opaque region, and rows of the visible width.
+ */
+static int passthrough_format(struct server *s, struct wlr_surface *surface,
+                              uint32_t format, size_t stride) {
+    if (stride < (size_t)s->visible_width * 4) return 0;
+    if (format == DRM_FORMAT_ARGB8888) {
+        pixman_box32_t full = { 0, 0, s->visible_width, s->visible_height };
+        return pixman_region32_contains_rectangle(&surface->opaque_region, &full) ==
+               PIXMAN_REGION_IN;
+    }
+    return format == DRM_FORMAT_XRGB8888;
+}
+
+/*
+ * Frame from the client's buffer instead of the scene render.
+ *
+ * The surface damage collected in s->damage_source by the commit
+ * listeners is the frame's damage, so the composite and the output
+ * commit are skipped and the damaged tiles are copied straight from
+ * the client's shm pixels into framebuf, within data pointer access
+ * of its buffer.  The scene is left
+ * uncommitted: its damage ring keeps accumulating, so the first
+ * scene render after passthrough ends covers everything that changed
+ * meanwhile.
+ *
+ * s->passthrough_last is the last surface read here, compared only
+ * (never dereferenced): a different surface means its damage says
+ * nothing about what framebuf holds, so the first frame is copied in
+ * full.
+ *
+ * Returns 1 if the frame was handled, 0 to render through the scene.
+ */
+static int output_passthrough(struct server *s, struct wlr_scene_output *so,
+                              int refine) {
+    struct wlr_surface *surface = NULL;
+    struct wlr_buffer *buffer = passthrough_buffer(s, &surface);
+    int ntiles = s->tiles_x * s->tiles_y;
+    uint32_t *fb = s->framebuf;
+    if (!buffer || ntiles <= 0 || !fb ||
+        s->width > MAX_SCREEN_DIM || s->height > MAX_SCREEN_DIM) {
+        s->passthrough_last = NULL;
+        return 0;
+    }
+    
+    if (!s->dirty_staging)
+        s->dirty_staging = calloc(1, ntiles);
+    if (!s->dirty_staging) {
+        s->passthrough_last = NULL;
+        return 0;
+    }
+    
+    /* The shm data pointer is only valid between begin and end (a
+     * wl_shm_pool resize remaps it): never the texture's cached image */
+    void *data;
+    uint32_t format;
+    size_t stride;
+    if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                          &data, &format, &stride)) {
+        s->passthrough_last = NULL;
+        return 0;
+    }
+    if (!passthrough_format(s, surface, format, stride)) {
+        wlr_buffer_end_data_ptr_access(buffer);
+        s->passthrough_last = NULL;
+        return 0;
+    }
+    
+    uint64_t damage_start_us = now_us();
+    int has_dirty = 0;
+    if (surface != s->passthrough_last || s->force_full_frame || !s->damage_source) {
+        memset(s->dirty_staging, DAMAGE_DIRTY, ntiles);
+        has_dirty = 1;
+    } else {
+        for (int i = 0; i < ntiles; i++) {
+            uint8_t src = s->damage_source[i];
+            s->dirty_staging[i] = src ? (DAMAGE_DIRTY | src) : 0;
+            has_dirty |= src;
+        }
+    }
+    if (s->damage_source) memset(s->damage_source, 0, ntiles);
+    s->dirty_staging_valid = 1;
+    s->passthrough_last = surface;
+    metrics_observe(METRIC_DAMAGE, now_us() - damage_start_us);
+    timeline_span("damage", damage_start_us);
+    
+    framebuf_update(s, data, stride, s->visible_width, s->visible_height);
+    wlr_buffer_end_data_ptr_access(buffer);
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    wlr_scene_output_send_frame_done(so, &ts);
+    
+    if (s->force_full_frame || has_dirty || refine)
+        send_frame(s);
+    return 1;
+}
+
 static void output_frame(struct wl_listener *listener, void *data) {
     struct server *s = wl_container_of(listener, s, output_frame);
     struct wlr_scene_output *so = s->scene_output;
@@ -94,35 +537,62 @@ static void output_frame(struct wl_listener *listener, void *data) {
             wlr_log(WLR_INFO, "Main thread handling resize: %dx%d -> %dx%d (visible %dx%d)",
                     s->width, s->height, new_w, new_h, new_vis_w, new_vis_h);
             
-            size_t fb_size = new_w * new_h * sizeof(uint32_t);
-            uint32_t *new_framebuf = calloc(1, fb_size);
-            uint32_t *new_prev_framebuf = calloc(1, fb_size);
-            uint32_t *new_send_buf0 = calloc(1, fb_size);
-            uint32_t *new_send_buf1 = calloc(1, fb_size);
+            /*
+             * Host buffers have a capacity in pixels and are only
+             * replaced when the new size exceeds it.  prev_framebuf's
+             * overlap with the new size is kept (restrided), so tiles
+             * that Plan 9 still shows correctly are not resent; the
+             * send thread regrids its per-tile maps to the smallest
+             * overlap kept since it last did (keep_tx, keep_ty).
+             */
+            size_t need = (size_t)new_w * new_h;
+            size_t cap = s->fb_cap;
+            int cw = s->width < new_w ? s->width : new_w;
+            int ch = s->height < new_h ? s->height : new_h;
+            uint32_t *grown[4] = { NULL, NULL, NULL, NULL };
+            int ok = 1;
+            if (need > s->fb_cap) {
+                cap = cap_grow(s->fb_cap, need);
+                for (int i = 0; i < 4; i++)
+                    if (!(grown[i] = arena_map(cap * sizeof(uint32_t)))) ok = 0;
+                if (ok)
+                    fb_keep_overlap(s, grown[1], new_w, s->prev_framebuf, cw, ch);
+            }
             
-            if (!new_framebuf || !new_prev_framebuf || !new_send_buf0 || !new_send_buf1) {
+            if (!ok) {
                 wlr_log(WLR_ERROR, "Resize failed: could not allocate buffers");
-                free(new_framebuf);
-                free(new_prev_framebuf);
-                free(new_send_buf0);
-                free(new_send_buf1);
+                for (int i = 0; i < 4; i++)
+                    arena_unmap(grown[i], cap * sizeof(uint32_t));
             } else {
-                uint32_t *old_framebuf = s->framebuf;
-                uint32_t *old_prev_framebuf = s->prev_framebuf;
-                uint32_t *old_send_buf0, *old_send_buf1;
+                uint32_t *old_bufs[4] = { NULL, NULL, NULL, NULL };
+                size_t old_cap = s->fb_cap;
                 struct draw_state *draw = &s->draw;
                 
                 pthread_mutex_lock(&s->send_lock);
-                old_send_buf0 = s->send_buf[0];
-                old_send_buf1 = s->send_buf[1];
-                
-                s->framebuf = new_framebuf;
-                s->prev_framebuf = new_prev_framebuf;
-                s->send_buf[0] = new_send_buf0;
-                s->send_buf[1] = new_send_buf1;
+                if (grown[0]) {
+                    old_bufs[0] = s->framebuf;
+                    old_bufs[1] = s->prev_framebuf;
+                    old_bufs[2] = s->send_buf[0];
+                    old_bufs[3] = s->send_buf[1];
+                    s->framebuf = grown[0];
+                    s->prev_framebuf = grown[1];
+                    s->send_buf[0] = grown[2];
+                    s->send_buf[1] = grown[3];
+                    s->fb_cap = cap;
+                } else {
+                    fb_keep_overlap(s, s->prev_framebuf, new_w, s->prev_framebuf, cw, ch);
+                }
                 s->pending_buf = -1;
                 s->active_buf = -1;
                 
+                /* What survives every restride since the send thread's
+                 * last regrid; it invalidates the rest */
+                if (!s->regrid_pending || cw / TILE_SIZE < s->keep_tx)
+                    s->keep_tx = cw / TILE_SIZE;
+                if (!s->regrid_pending || ch / TILE_SIZE < s->keep_ty)
+                    s->keep_ty = ch / TILE_SIZE;
+                s->regrid_pending = 1;
+                
                 s->width = new_w;
                 s->height = new_h;
                 s->visible_width = new_vis_w;
@@ -139,6 +609,18 @@ static void output_frame(struct wl_listener *listener, void *data) {
                 s->dirty_tiles[1] = ntiles > 0 ? calloc(1, ntiles) : NULL;
                 s->dirty_valid[0] = 0;
                 s->dirty_valid[1] = 0;
+                uint8_t *old_accum = s->dirty_accum;
+                s->dirty_accum = NULL;
+                s->dirty_accum_valid = 0;
+                
+                /* Buffers were replaced or restrided: all stale; maps are
+                 * rebuilt lazily */
+                free(s->fb_stale);
+                free(s->send_stale[0]);
+                free(s->send_stale[1]);
+                s->fb_stale = NULL;
+                s->send_stale[0] = NULL;
+                s->send_stale[1] = NULL;
                 
                 draw->width = new_w;
                 draw->height = new_h;
@@ -148,20 +630,21 @@ static void output_frame(struct wl_listener *listener, void *data) {
                 draw->win_miny = new_miny;
                 pthread_mutex_unlock(&s->send_lock);
                 
-                free(old_framebuf);
-                free(old_prev_framebuf);
-                free(old_send_buf0);
-                free(old_send_buf1);
+                for (int i = 0; i < 4; i++)
+                    arena_unmap(old_bufs[i], old_cap * sizeof(uint32_t));
                 free(old_dirty0);
                 free(old_dirty1);
+                free(old_accum);
                 
                 /* Reallocate staging buffer (output thread only, no lock) */
                 free(s->dirty_staging);
                 s->dirty_staging = ntiles > 0 ? calloc(1, ntiles) : NULL;
                 s->dirty_staging_valid = 0;
+                free(s->damage_source);
+                s->damage_source = NULL;    /* Reallocated on next commit */
                 
-                /* Reallocate Plan 9 images using helper */
-                reallocate_draw_images(draw, new_w, new_h);
+                /* Plan 9 images: kept if they still fit */
+                int images_kept = draw_images_reserve(draw, new_w, new_h);
                 
                 /* Resize wlroots output to VISIBLE dimensions.
                  * The wlroots buffer will be visible_width × visible_height;
@@ -179,9 +662,11 @@ static void output_frame(struct wl_listener *listener, void *data) {
                 int logical_w = (int)(new_vis_w / s->scale + 0.5f);
                 int logical_h = (int)(new_vis_h / s->scale + 0.5f);
                 
-                /* Send configure to all toplevels (using logical dimensions) */
+                /* Send configure to all toplevels in this window (using
+                 * logical dimensions) */
                 struct toplevel *tl;
-                wl_list_for_each(tl, &s->toplevels, link) {
+                wl_list_for_each(tl, &server_root(s)->toplevels, link) {
+                    if (tl->win != s) continue;
                     if (tl->xdg && tl->xdg->base && tl->xdg->base->initialized) {
                         wlr_xdg_toplevel_set_size(tl->xdg, logical_w, logical_h);
                     }
@@ -192,13 +677,18 @@ static void output_frame(struct wl_listener *listener, void *data) {
                     wlr_scene_rect_set_size(s->background, logical_w, logical_h);
                 }
                 
-                draw->xor_enabled = 0;
-                s->force_full_frame = 1;
+                /* Kept images still match prev_framebuf's overlap, so
+                 * alpha-delta stays on and only exposed tiles go out */
+                if (!images_kept) {
+                    draw->xor_enabled = 0;
+                    s->force_full_frame = 1;
+                }
                 s->scene_dirty = 1;
                 
-                wlr_log(WLR_INFO, "Resize complete: %dx%d visible (%dx%d padded), %dx%d logical at (%d,%d)",
+                wlr_log(WLR_INFO, "Resize complete: %dx%d visible (%dx%d padded), %dx%d logical at (%d,%d)%s",
                         new_vis_w, new_vis_h, new_w, new_h,
-                        logical_w, logical_h, new_minx, new_miny);
+                        logical_w, logical_h, new_minx, new_miny,
+                        images_kept ? ", incremental" : "");
             }
         }
     }
@@ -224,19 +714,49 @@ static void output_frame(struct wl_listener *listener, void *data) {
      * buffer) and the subsequent memcpy into framebuf — the dominant
      * source of idle CPU usage.
      */
-    if (!s->scene_dirty && !s->force_full_frame) {
+    int refine = s->refine_pending;
+    if (!s->scene_dirty && !s->force_full_frame && !refine) {
         struct timespec ts;
         clock_gettime(CLOCK_MONOTONIC, &ts);
         wlr_scene_output_send_frame_done(so, &ts);
         return;
     }
+    
+    /*
+     * Link-bound pacing: while the link is still busy with earlier
+     * frames, a render now would only be dropped or go out stale.
+     * Leave scene_dirty set, so the scene keeps accumulating damage
+     * and the next render covers every intermediate frame, and come
+     * back when the pacer says the link can take one.  frame_done is
+     * withheld too, so clients wait instead of rendering frames that
+     * would be merged away.
+     */
+    if (!s->force_full_frame) {
+        int delay = send_pace_delay_ms(s);
+        if (!s->pace_timer)
+            s->pace_timer = wl_event_loop_add_timer(
+                wl_display_get_event_loop(s->display), pace_timer_fire, s);
+        if (delay > 0 && s->pace_timer) {
+            wl_event_source_timer_update(s->pace_timer, delay);
+            return;
+        }
+    }
     s->scene_dirty = 0;
+    s->refine_pending = 0;
+    s->frame_seq++;
+    timeline_set_frame(s->frame_seq);
+    
+    if (output_passthrough(s, so, refine))
+        return;
     
     struct wlr_output_state ostate;
     wlr_output_state_init(&ostate);
     struct wlr_scene_output_state_options opts = {0};
     
-    if (!wlr_scene_output_build_state(so, &ostate, &opts)) {
+    uint64_t render_start_us = now_us();
+    int built = wlr_scene_output_build_state(so, &ostate, &opts);
+    timeline_span("render", render_start_us);
+    if (!built) {
         if (frame_count <= 10 || frame_count % 60 == 0) {
             wlr_log(WLR_DEBUG, "Frame %d: build_state failed", frame_count);
         }
@@ -275,6 +795,7 @@ static void output_frame(struct wl_listener *listener, void *data) {
              * initializes damage empty, and the scene builder fills it
              * with actual changed regions.
              */
+            uint64_t damage_start_us = now_us();
             int nrects = 0;
             pixman_box32_t *rects = pixman_region32_rectangles(
                 &ostate.damage, &nrects);
@@ -296,53 +817,24 @@ static void output_frame(struct wl_listener *listener, void *data) {
                     if (ty1 > s->tiles_y) ty1 = s->tiles_y;
                     for (int ty = ty0; ty < ty1; ty++)
                         for (int tx = tx0; tx < tx1; tx++)
-                            s->dirty_staging[ty * s->tiles_x + tx] = 1;
+                            s->dirty_staging[ty * s->tiles_x + tx] = DAMAGE_DIRTY;
+                }
+                /* Which surfaces caused it (only where the scene damaged
+                 * the output, so occluded commits add nothing) */
+                if (s->damage_source) {
+                    for (int i = 0; i < ntiles; i++)
+                        if (s->dirty_staging[i])
+                            s->dirty_staging[i] |= s->damage_source[i];
+                    memset(s->damage_source, 0, ntiles);
                 }
                 s->dirty_staging_valid = 1;
                 has_dirty = (nrects > 0);
             }
+            metrics_observe(METRIC_DAMAGE, now_us() - damage_start_us);
+            timeline_span("damage", damage_start_us);
             
-            /*
-             * Copy rendered pixels from wlroots buffer to framebuf.
-             *
-             * This runs only when scene_dirty was set (a client committed
-             * new content), so on an idle screen this code never executes.
-             * We always do a full-frame copy because:
-             *
-             *   - send_frame() swaps framebuf with a recycled send_buf,
-             *     so the new framebuf has stale data from ~2 frames ago.
-             *     A partial copy would leave stale rows in the buffer.
-             *
-             *   - The send thread copies per-tile data from send_buf
-             *     into prev_framebuf (line ~544). If send_buf has stale
-             *     rows from incomplete copy, prev_framebuf gets corrupted,
-             *     breaking XOR delta encoding.
-             *
-             *   - Damage rects are pixel-precise but tiles are 16x16.
-             *     Copying only damaged rows can leave stale data within
-             *     a tile that the send thread reads in full.
-             *
-             * The scene_dirty check above already ensures we skip idle
-             * frames entirely, so the full copy only runs when content
-             * actually changed — not 60 times per second.
-             */
-            if (valid_fb) {
-                int buf_w = buffer->width;
-                int buf_h = buffer->height;
-                int vis_w = s->visible_width;
-                int vis_h = s->visible_height;
-                /* Copy min of buffer and visible dims; framebuf stride is w (padded) */
-                int copy_w = (buf_w < vis_w) ? buf_w : vis_w;
-                int copy_h = (buf_h < vis_h) ? buf_h : vis_h;
-                
-                pthread_mutex_lock(&s->send_lock);
-                for (int y = 0; y < copy_h; y++) {
-                    memcpy(&fb[y * w],
-                           (uint8_t*)data_ptr + y * stride,
-                           copy_w * 4);
-                }
-                pthread_mutex_unlock(&s->send_lock);
-            }
+            if (valid_fb)
+                framebuf_update(s, data_ptr, stride, buffer->width, buffer->height);
             
             wlr_buffer_end_data_ptr_access(buffer);
         } else {
@@ -354,8 +846,10 @@ static void output_frame(struct wl_listener *listener, void *data) {
             wlr_log(WLR_DEBUG, "Frame %d: no buffer in state", frame_count);
     }
     
+    uint64_t commit_start_us = now_us();
     wlr_output_commit_state(s->output, &ostate);
     wlr_output_state_finish(&ostate);
+    timeline_span("commit", commit_start_us);
     
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -365,10 +859,12 @@ static void output_frame(struct wl_listener *listener, void *data) {
      * Only wake the send thread when there's actual work:
      *   - force_full_frame: resize/error recovery needs full resend
      *   - has_dirty: compositor reported pixel changes
+     *   - refine: the send thread asked for a frame to refine lossy
+     *     tiles in, even if nothing changed
      *   - !dirty_staging_valid: damage extraction failed (alloc error),
      *     send thread must fall back to pixel scanning
      */
-    if (s->force_full_frame || has_dirty || !s->dirty_staging_valid) {
+    if (s->force_full_frame || has_dirty || !s->dirty_staging_valid || refine) {
         send_frame(s);
     }
 }
@@ -377,6 +873,10 @@ void new_output(struct wl_listener *l, void *d) {
     struct server *s = wl_container_of(l, s, new_output);
     struct wlr_output *out = d;
     
+    /* An output added by window_start() belongs to its window server */
+    if (s->output_pending)
+        s = s->output_pending;
+    
     wlr_output_init_render(out, s->allocator, s->renderer);
     
     struct wlr_output_state state;
@@ -389,7 +889,8 @@ void new_output(struct wl_listener *l, void *d) {
     wlr_output_commit_state(out, &state);
     wlr_output_state_finish(&state);
     
-    wlr_output_layout_add_auto(s->output_layout, out);
+    /* Fixed positions: an auto output would be moved right of the others */
+    wlr_output_layout_add(s->output_layout, out, s->layout_x, 0);
     s->output = out;
     s->scene_output = wlr_scene_output_create(s->scene, out);
     
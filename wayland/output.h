@@ -16,37 +16,54 @@
  *     - Optional HiDPI scale factor (if s->scale > 1.0)
  *     - Scene graph output for rendering
  *
+ *   With -w each window server (window.h) has an output of its own,
+ *   added while root->output_pending names it and placed at its
+ *   layout_x; the frame loop below then runs once per window.
+ *
  * Frame Loop:
  *
  *   The output_frame handler (internal) runs the compositor's render loop:
  *
  *     1. Check for pending resize from mouse thread (s->resize_pending)
  *     2. If resize pending:
- *        a. Reallocate host buffers at padded dimensions (TILE_ALIGN_UP)
+ *        a. Grow host buffers only past their capacity (s->fb_cap);
+ *           restride (or, tile-major, regrid) prev_framebuf's
+ *           overlap with the new size
  *        b. Reallocate dirty tile bitmaps (tiles_x × tiles_y, exact)
  *        c. Update s->width, s->height (padded), s->visible_width/height
  *        d. Update s->tiles_x, s->tiles_y (exact: width/TILE_SIZE)
- *        e. Reallocate Plan 9 images via reallocate_draw_images()
+ *        e. Keep the Plan 9 images if they fit, else reallocate them
+ *           with headroom (see "Resize Capacity")
  *        f. Resize wlroots output to visible dimensions
- *        g. Reconfigure all toplevels with logical visible dimensions
- *        h. Set force_full_frame and scene_dirty flags
+ *        g. Reconfigure the window's toplevels with logical visible
+ *           dimensions
+ *        h. Set scene_dirty; force_full_frame only if the Plan 9
+ *           images were reallocated
  *     3. Throttle frames if FRAME_INTERVAL_MS is non-zero
- *     4. Check scene_dirty and force_full_frame flags.  If both are
- *        clear, send frame_done and return immediately — skipping
- *        build_state, buffer copy, and send_frame.  This is the
- *        primary idle-screen optimization.  scene_dirty is set by
+ *     4. Check scene_dirty, force_full_frame and refine_pending.  If
+ *        all are clear, send frame_done and return immediately —
+ *        skipping build_state, buffer copy, and send_frame.  This is
+ *        the primary idle-screen optimization.  scene_dirty is set by
  *        client commits; force_full_frame is set by resize handling
- *        (step 2) and error recovery.
+ *        (step 2) and error recovery; refine_pending by the send
+ *        thread when lossy tiles await refinement.
+ *     4a. Ask the pacer (send_pace_delay_ms, see send.h).  If the link
+ *        is still busy, arm s->pace_timer and return without
+ *        rendering or frame_done; scene_dirty stays set, so the
+ *        deferred render covers all damage since the last one.
+ *     4b. If a single fullscreen client makes up the output, frame
+ *        from its buffer directly and stop here (see "Passthrough")
  *     5. Build scene output state via wlr_scene_output_build_state()
  *     6. Extract compositor damage into dirty tile staging bitmap
- *     7. Copy rendered pixels from wlroots buffer to s->framebuf.
+ *     7. Copy damaged tiles from wlroots buffer to s->framebuf.
  *        The wlroots buffer is visible_width × visible_height; framebuf
- *        has stride = s->width (padded to TILE_SIZE).  Only visible rows
+ *        has stride = s->width (padded to TILE_SIZE), or with -B is
+ *        tile-major and each tile's rows are gathered into its 1 KiB
+ *        block by this same copy (fb_tile()).  Only visible rows
  *        and columns are copied; padding strips are zeroed by the send
- *        thread.  Full visible-area copy is required because pointer
- *        swap between framebuf and send_buf recycles buffers with stale
- *        data.  The scene_dirty gate in step 4 ensures this only runs
- *        when content actually changed.
+ *        thread.  The copy covers dirty_staging ∪ s->fb_stale (see
+ *        "Buffer Ownership" below), falling back to a full visible-area
+ *        copy when damage is unavailable.
  *     8. Commit output state and send frame done
  *     9. Trigger send_frame() when there is actual work
  *
@@ -69,16 +86,86 @@
  *   tiles are skipped without pixel comparison, damaged tiles are
  *   assumed changed.
  *
+ *   Damage sources: commit listeners (toplevel, subsurface, popup)
+ *   call output_note_damage() with the surface's committed damage and
+ *   a DAMAGE_FOREGROUND or DAMAGE_BACKGROUND class. The classes are
+ *   collected per tile in s->damage_source and ORed into the damaged
+ *   tiles of the next render's bitmap, then cleared. Commits that do
+ *   not reach the output (occluded, deferred and merged) only mark
+ *   tiles the scene damaged anyway.
+ *
  *   Fallback: if damage extraction fails (allocation error),
  *   dirty_staging_valid remains 0 and the send thread falls back to
- *   pixel comparison via tile_changed().
- *
- * Image Reallocation:
- *
- *   reallocate_draw_images() (internal) handles Plan 9 image resize:
- *     - Frees old framebuffer and delta images via 'f' command
- *     - Allocates new images at new dimensions via 'b' command
- *     - Uses alloc_image_cmd/free_image_cmd helpers from draw_cmd.h
+ *   pixel comparison via tilecmp_row().
+ *
+ * Buffer Ownership (carried-forward damage):
+ *
+ *   framebuf, send_buf[0] and send_buf[1] rotate via pointer swap in
+ *   send_frame(), so the buffer handed back to the compositor holds
+ *   content from one or two frames ago.  Rather than recopying the
+ *   whole frame, each physical buffer carries a stale tile map:
+ *
+ *     s->fb_stale        tiles where framebuf lags the latest render
+ *     s->send_stale[N]   same for send_buf[N]
+ *
+ *   Per rendered frame with damage D:
+ *
+ *     1. send_stale[0/1] |= D   (those buffers missed this frame)
+ *     2. copy tiles in D ∪ fb_stale into framebuf
+ *     3. fb_stale = 0           (framebuf now matches the render)
+ *
+ *   send_frame() swaps fb_stale with send_stale[buf] along with the
+ *   pixel pointers.  Copies are whole tiles (clipped to the visible
+ *   area) so the send thread never reads a tile with mixed-age rows,
+ *   which keeps prev_framebuf consistent for alpha-delta encoding.
+ *   A NULL map means "everything stale"; resize frees all three maps
+ *   so the first frame after it copies the full visible area.
+ *
+ * Passthrough:
+ *
+ *   When the output shows exactly one buffer, at its origin, scale 1, with no
+ *   crop, scaling or transform, exactly visible_width × visible_height
+ *   and opaque (XRGB, or ARGB with a full opaque region), the
+ *   composite would only reproduce the client's pixels.  The frame is
+ *   then read from the committed shm buffer, between
+ *   wlr_buffer_begin_data_ptr_access() and _end() (the data pointer
+ *   moves when the client resizes its wl_shm_pool), and the tiles in
+ *   s->damage_source are the frame's damage.  build_state and the output commit are skipped;
+ *   the damaged tiles are copied into framebuf as in step 7 (framebuf
+ *   still rotates with the send buffers, so this copy stays).
+ *
+ *   The first passthrough frame for a surface, and any frame with
+ *   force_full_frame or without a damage_source map, is fully dirty.
+ *   The scene is not committed meanwhile, so its damage ring keeps
+ *   growing and the first scene render after passthrough ends (popup,
+ *   second window, resize) covers every change in between.  Buffers
+ *   without data pointer access (dmabuf) always use the scene.
+ *
+ * Resize Capacity:
+ *
+ *   A rio window drag delivers a stream of reshapes, so a resize must
+ *   not cost four fresh framebuffers, synchronous image round trips
+ *   and a full resend.  Instead:
+ *
+ *     host buffers   framebuf, prev_framebuf and send_buf[0/1] share a
+ *                    capacity in pixels (s->fb_cap); past it they grow
+ *                    to max(need, 1.5 × cap), otherwise they are
+ *                    reused with the new stride
+ *     Plan 9 images  image_id and delta_id have a capacity too
+ *                    (draw->image_cap_w/h); a size that fits keeps
+ *                    them, a larger one reallocates both at 1.5× in a
+ *                    single write (tile aligned, capped at
+ *                    MAX_SCREEN_DIM)
+ *     content        the top-left overlap of prev_framebuf is moved
+ *                    to the new stride, matching the kept image_id;
+ *                    the send thread regrids tile_hash and prev_invalid
+ *                    the same way, so only tiles outside the overlap
+ *                    (invalid) and tiles the client redrew are sent
+ *
+ *   The window itself is re-presented by the send thread after the
+ *   relookup (copy of image_id to the new window image), which is all
+ *   a pure move needs.  Only reallocated images force a full frame
+ *   and turn alpha-delta off until the next successful frame.
  *
  * Input Device Handling:
  *
@@ -104,6 +191,8 @@
 
 /* ============== Output Handling ============== */
 
+struct wlr_surface;
+
 /*
  * Handle new output creation.
  *
@@ -121,6 +210,20 @@
  */
 void new_output(struct wl_listener *l, void *d);
 
+/*
+ * Record a surface commit's damage for tile priority.
+ *
+ * Called from commit listeners on the compositor thread, before the
+ * scene renders the commit.
+ *
+ * s:       server of the window showing the surface (toplevel->win)
+ * surface: the committed surface (its effective damage is used)
+ * lx, ly:  surface origin in layout (logical) coordinates
+ * cls:     DAMAGE_FOREGROUND or DAMAGE_BACKGROUND
+ */
+void output_note_damage(struct server *s, struct wlr_surface *surface,
+                        int lx, int ly, uint8_t cls);
+
 /* ============== Input Device Handling ============== */
 
 /*
@@ -14,8 +14,24 @@
 #include <wlr/util/log.h>
 
 #include "popup.h"
+#include "output.h"
 #include "../types.h"
 
+/*
+ * Server whose window shows a popup: that of the toplevel at the root
+ * of its parent chain, or the root server if it is gone. Looked up per
+ * commit rather than kept, since the popup may outlive the toplevel.
+ */
+static struct server *popup_window(struct server *s, struct wlr_xdg_popup *popup) {
+    struct wlr_surface *parent = popup->parent;
+    struct wlr_xdg_surface *xdg;
+    while (parent && (xdg = wlr_xdg_surface_try_from_wlr_surface(parent)) &&
+           xdg->role == WLR_XDG_SURFACE_ROLE_POPUP && xdg->popup)
+        parent = xdg->popup->parent;
+    struct toplevel *tl = focus_toplevel_from_surface(&s->focus, parent);
+    return tl ? tl->win : s;
+}
+
 static void popup_destroy(struct wl_listener *l, void *d) {
     struct popup_data *pd = wl_container_of(l, pd, destroy);
     (void)d;
@@ -42,10 +58,12 @@ static void popup_commit(struct wl_listener *l, void *d) {
     struct wlr_xdg_popup *popup = pd->popup;
     struct wlr_surface *surface = popup->base->surface;
     struct server *s = pd->server;
+    struct server *win = popup_window(s, popup);
     
     if (popup->base->initial_commit) {
-        int logical_w = focus_phys_to_logical(s->visible_width, s->scale);
-        int logical_h = focus_phys_to_logical(s->visible_height, s->scale);
+        /* Toplevel-relative box: the toplevel fills its window */
+        int logical_w = focus_phys_to_logical(win->visible_width, win->scale);
+        int logical_h = focus_phys_to_logical(win->visible_height, win->scale);
         struct wlr_box box = {
             .x = 0,
             .y = 0,
@@ -73,9 +91,17 @@ static void popup_commit(struct wl_listener *l, void *d) {
         wlr_log(WLR_INFO, "Popup UNMAPPED: surface=%p", pd->surface);
         focus_popup_unmapped(&s->focus, pd);
     }
+    
+    /* Popups (menus, tooltips) are what the user is looking at */
+    if (pd->mapped && pd->scene_tree) {
+        int lx = 0, ly = 0;
+        wlr_scene_node_coords(&pd->scene_tree->node, &lx, &ly);
+        output_note_damage(win, surface, lx - popup->base->geometry.x,
+                           ly - popup->base->geometry.y, DAMAGE_FOREGROUND);
+    }
 
-    s->scene_dirty = 1;
-    wlr_output_schedule_frame(s->output);
+    win->scene_dirty = 1;
+    if (win->output) wlr_output_schedule_frame(win->output);
 }
 
 void new_popup(struct wl_listener *l, void *d) {
@@ -0,0 +1,198 @@
+/*
+ * sessions.c - Late sessions: kbd and snarf after the first frame
+ *
+ * A thread waits for the send thread's first frame, connects kbd and
+ * snarf, and hands back to the event loop through an eventfd, which
+ * starts the kbd thread and the clipboard's snarf side. See sessions.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <wayland-server-core.h>
+#include <wlr/util/log.h>
+
+#include "sessions.h"
+#include "../types.h"
+#include "../p9/p9.h"
+#include "../p9/p9_tls.h"
+#include "../input/input.h"
+#include "../input/clipboard.h"
+
+static struct {
+    pthread_t thread;
+    int started;                    /* thread not yet joined */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* CLOCK_MONOTONIC */
+    int go;                         /* first frame is out */
+    int stopping;
+    int result;                     /* connect_late(); read after join */
+    int ready_fd;                   /* eventfd: thread done */
+    struct wl_event_source *source;
+} late = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready_fd = -1,
+};
+
+/* ============== Connecting ============== */
+
+/* kbd and snarf side by side; channels of p9_shared with -m */
+static int connect_late(struct server *s) {
+    struct tls_config cfg = {0};
+    if (s->use_tls) {
+        cfg.cert_file = s->tls_cert_file;
+        cfg.cert_fingerprint = s->tls_fingerprint;
+        cfg.insecure = s->tls_insecure;
+    }
+    struct p9conn *carrier = s->share_conns ? &s->p9_shared : NULL;
+
+    struct p9_connect_req reqs[] = {
+        { .p9 = &s->p9_kbd,   .name = "kbd",   .tls = &cfg, .carrier = carrier },
+        { .p9 = &s->p9_snarf, .name = "snarf", .tls = &cfg, .carrier = carrier },
+    };
+    if (p9_connect_parallel(s->host, s->port, reqs, 2) < 0)
+        return -1;
+    atomic_store(&s->late_up, 1);
+    return 0;
+}
+
+/* Event loop: start what needs the sessions; -1 ends the display */
+static int bring_up(struct server *s, int result) {
+    if (result < 0) {
+        wlr_log(WLR_ERROR, "Late sessions failed, exiting");
+        wl_display_terminate(s->display);
+        return -1;
+    }
+    int err = pthread_create(&s->kbd_thread, NULL, kbd_thread_func, s);
+    if (err != 0) {
+        wlr_log(WLR_ERROR, "sessions: kbd thread: %s", strerror(err));
+        s->kbd_thread = 0;
+    }
+    clipboard_connected(s);
+    wlr_log(WLR_INFO, "sessions: kbd and snarf up");
+    return 0;
+}
+
+/* ============== Late Thread ============== */
+
+/* Send thread, after its first frame */
+static void first_frame_hook(struct server *s) {
+    (void)s;
+    pthread_mutex_lock(&late.lock);
+    late.go = 1;
+    pthread_cond_signal(&late.cond);
+    pthread_mutex_unlock(&late.lock);
+}
+
+static void *late_thread_func(void *arg) {
+    struct server *s = arg;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += SESSIONS_LATE_MAX_MS / 1000;
+    deadline.tv_nsec += (long)(SESSIONS_LATE_MAX_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&late.lock);
+    while (!late.go && !late.stopping) {
+        if (pthread_cond_timedwait(&late.cond, &late.lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    int stopping = late.stopping;
+    int go = late.go;
+    pthread_mutex_unlock(&late.lock);
+    if (stopping) {
+        late.result = -1;
+        return NULL;
+    }
+    if (!go)
+        wlr_log(WLR_INFO, "sessions: no frame after %d ms, connecting anyway",
+                SESSIONS_LATE_MAX_MS);
+
+    late.result = connect_late(s);
+
+    uint64_t one = 1;
+    if (write(late.ready_fd, &one, sizeof(one)) < 0)
+        wlr_log(WLR_ERROR, "sessions: eventfd write: %s", strerror(errno));
+    return NULL;
+}
+
+static int handle_late_ready(int fd, uint32_t mask, void *data) {
+    struct server *s = data;
+    (void)mask;
+
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) < 0 && errno == EAGAIN)
+        return 0;
+
+    pthread_join(late.thread, NULL);
+    late.started = 0;
+    wl_event_source_remove(late.source);
+    late.source = NULL;
+
+    bring_up(s, late.result);
+    return 0;
+}
+
+/* ============== Public API ============== */
+
+int sessions_late_start(struct server *s) {
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&late.cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    late.ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (late.ready_fd >= 0)
+        late.source = wl_event_loop_add_fd(wl_display_get_event_loop(s->display),
+                                           late.ready_fd, WL_EVENT_READABLE,
+                                           handle_late_ready, s);
+    if (late.source) {
+        if (pthread_create(&late.thread, NULL, late_thread_func, s) == 0) {
+            /* Before wlr_backend_start(): no frame can have gone out */
+            s->first_frame = first_frame_hook;
+            late.started = 1;
+            return 0;
+        }
+        wl_event_source_remove(late.source);
+        late.source = NULL;
+    }
+    if (late.ready_fd >= 0) {
+        close(late.ready_fd);
+        late.ready_fd = -1;
+    }
+
+    /* No thread: connect now, as startup did before */
+    wlr_log(WLR_ERROR, "sessions: no late thread, connecting kbd and snarf now");
+    return bring_up(s, connect_late(s));
+}
+
+void sessions_late_stop(struct server *s) {
+    (void)s;
+    if (late.started) {
+        pthread_mutex_lock(&late.lock);
+        late.stopping = 1;
+        pthread_cond_signal(&late.cond);
+        pthread_mutex_unlock(&late.lock);
+        pthread_join(late.thread, NULL);
+        late.started = 0;
+    }
+    if (late.source) {
+        wl_event_source_remove(late.source);
+        late.source = NULL;
+    }
+    if (late.ready_fd >= 0) {
+        close(late.ready_fd);
+        late.ready_fd = -1;
+    }
+}
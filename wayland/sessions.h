@@ -0,0 +1,69 @@
+/*
+ * sessions.h - Late sessions: kbd and snarf after the first frame
+ *
+ * Startup used to connect all six 9P sessions one after another before
+ * the first pixel could go out: six TCP (and TLS) handshakes, versions
+ * and attaches in series. Only draw, relookup, mouse and wctl are
+ * needed to put a frame on screen, so main.c connects those four side
+ * by side (p9_connect_parallel(), p9.h) and this module brings up the
+ * other two once the window shows something.
+ *
+ * Startup Order:
+ *
+ *   main thread    draw, relookup, mouse, wctl (and p9_shared with -m)
+ *                  connected concurrently; init_draw(); compositor up
+ *   late thread    waits for the first frame, then connects kbd and
+ *                  snarf concurrently (channels of p9_shared with -m)
+ *   event loop     once they are up: starts the kbd thread and calls
+ *                  clipboard_connected() (clipboard.h)
+ *
+ *   The send thread reports its first frame through s->first_frame.
+ *   Should no frame go out within SESSIONS_LATE_MAX_MS (nothing to
+ *   draw, window hidden) the late thread connects anyway.
+ *
+ * Until Then:
+ *
+ *   Keys typed before kbd is up stay queued in /dev/kbd on the Plan 9
+ *   side and arrive when the kbd thread starts. Wayland clients can
+ *   copy and paste among themselves; a copy made before snarf is up
+ *   reaches /dev/snarf only with the next one.
+ *
+ *   s->late_up is set once both sessions are connected; cleanup
+ *   disconnects them only then. A failure is fatal, as it was when
+ *   every session connected at startup: the display is terminated.
+ *
+ * Scope:
+ *
+ *   Root server only. Window servers (-w, window.h) connect their five
+ *   sessions in parallel in window_connect() and have no snarf.
+ *
+ * Usage:
+ *
+ *   clipboard_init(&s);
+ *   sessions_late_start(&s);       // after init_wayland()
+ *   wl_display_run(s.display);
+ *   sessions_late_stop(&s);        // before clipboard_cleanup()
+ */
+
+#ifndef P9WL_SESSIONS_H
+#define P9WL_SESSIONS_H
+
+struct server;
+
+#define SESSIONS_LATE_MAX_MS   1500    /* Connect without a first frame after */
+
+/*
+ * Arm the first-frame hook and start the late thread. Returns 0, or
+ * -1 if the thread or its event source could not be created (kbd and
+ * snarf are then connected synchronously before returning, or the
+ * call fails if that does too).
+ */
+int sessions_late_start(struct server *s);
+
+/*
+ * Stop the late thread (waiting out a connection attempt in progress)
+ * and remove its event source. Safe without sessions_late_start().
+ */
+void sessions_late_stop(struct server *s);
+
+#endif /* P9WL_SESSIONS_H */
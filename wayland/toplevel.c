@@ -19,6 +19,8 @@
 #include <wlr/util/log.h>
 
 #include "toplevel.h"
+#include "output.h"
+#include "window.h"
 #include "types.h"
 #include "draw/draw_helpers.h"
 #include "draw/draw.h"
@@ -40,6 +42,28 @@ static void check_new_subsurfaces(struct toplevel *tl);
                              : &(surface)->current.subsurfaces_above, \
             current.link)
 
+/* ============== Damage Sources ============== */
+
+/*
+ * Foreground unless another toplevel holds keyboard focus; with focus
+ * on a popup or nowhere, nothing counts as background.
+ */
+static uint8_t toplevel_damage_class(struct toplevel *tl) {
+    struct toplevel *focused = focus_get_focused_toplevel(&tl->server->focus);
+    return (focused && focused != tl) ? DAMAGE_BACKGROUND : DAMAGE_FOREGROUND;
+}
+
+/* Layout position of the toplevel's wl_surface (the scene tree sits at
+ * the window geometry origin) */
+static void toplevel_surface_origin(struct toplevel *tl, int *lx, int *ly) {
+    *lx = *ly = 0;
+    if (tl->scene_tree) wlr_scene_node_coords(&tl->scene_tree->node, lx, ly);
+    if (tl->xdg) {
+        *lx -= tl->xdg->base->geometry.x;
+        *ly -= tl->xdg->base->geometry.y;
+    }
+}
+
 /* ============== Subsurface Tracking ============== */
 
 static void subsurface_commit(struct wl_listener *l, void *d) {
@@ -59,8 +83,22 @@ static void subsurface_commit(struct wl_listener *l, void *d) {
         focus_pointer_recheck(&st->server->focus);
     }
     
-    wlr_output_schedule_frame(st->server->output);
-    st->server->scene_dirty = 1;
+    /* Subsurface offsets are relative to the parent, up to the toplevel */
+    if (st->mapped && st->toplevel->xdg) {
+        int lx, ly;
+        toplevel_surface_origin(st->toplevel, &lx, &ly);
+        for (struct wlr_subsurface *sub = st->subsurface; sub;
+             sub = wlr_subsurface_try_from_wlr_surface(sub->parent)) {
+            lx += sub->current.x;
+            ly += sub->current.y;
+        }
+        output_note_damage(st->toplevel->win, surface, lx, ly,
+                           toplevel_damage_class(st->toplevel));
+    }
+    
+    struct server *win = st->toplevel->win;
+    if (win->output) wlr_output_schedule_frame(win->output);
+    win->scene_dirty = 1;
 }
 
 static void subsurface_destroy(struct wl_listener *l, void *d) {
@@ -190,8 +228,11 @@ static void toplevel_commit(struct wl_listener *l, void *d) {
     struct wlr_surface *surface = xdg_surface->surface;
     
     if (xdg_surface->initial_commit) {
-        int logical_w = focus_phys_to_logical(s->visible_width, s->scale);
-        int logical_h = focus_phys_to_logical(s->visible_height, s->scale);
+        /* Parent known, first configure not sent: pick the window */
+        window_assign(s, tl);
+        struct server *win = tl->win;
+        int logical_w = focus_phys_to_logical(win->visible_width, win->scale);
+        int logical_h = focus_phys_to_logical(win->visible_height, win->scale);
         
         wlr_xdg_toplevel_set_size(tl->xdg, logical_w, logical_h);
         wlr_xdg_toplevel_set_maximized(tl->xdg, true);
@@ -223,8 +264,14 @@ static void toplevel_commit(struct wl_listener *l, void *d) {
     
     check_new_subsurfaces(tl);
     focus_pointer_recheck(&s->focus);
-    s->scene_dirty = 1;
-    wlr_output_schedule_frame(s->output);
+    
+    if (tl->mapped) {
+        int lx, ly;
+        toplevel_surface_origin(tl, &lx, &ly);
+        output_note_damage(tl->win, surface, lx, ly, toplevel_damage_class(tl));
+    }
+    tl->win->scene_dirty = 1;
+    if (tl->win->output) wlr_output_schedule_frame(tl->win->output);
 }
 
 static void toplevel_destroy(struct wl_listener *l, void *d) {
@@ -259,8 +306,14 @@ static void toplevel_destroy(struct wl_listener *l, void *d) {
     }
     
     wl_list_remove(&tl->link);
+    struct server *win = tl->win;
+    window_cancel(s, tl);
     free(tl);
     
+    /* Its own rio window goes with it (never the root's) */
+    if (win != s && win->window_tl == tl)
+        window_destroy(win);
+    
     /* Exit when last toplevel is destroyed */
     if (s->had_toplevel && wl_list_empty(&s->toplevels)) {
         wlr_log(WLR_INFO, "Last toplevel destroyed - initiating shutdown");
@@ -304,6 +357,7 @@ void new_toplevel(struct wl_listener *l, void *d) {
     
     tl->xdg = xdg;
     tl->server = s;
+    tl->win = s;            /* Until window_assign() at the initial commit */
     tl->surface = xdg->base->surface;
     tl->scene_tree = wlr_scene_xdg_surface_create(&s->scene->tree, xdg->base);
     
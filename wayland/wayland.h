@@ -12,6 +12,9 @@
  *   toplevel.h     - XDG toplevel window management
  *   wl_input.h     - Input event processing (mouse, keyboard)
  *   output.h       - Output creation and frame rendering
+ *   cursor.h       - Client cursor images on /dev/cursor
+ *   window.h       - Multi-window mode (-w): one Plan 9 window per toplevel
+ *   sessions.h     - kbd and snarf sessions, connected after the first frame
  *   client.h       - Decoration handling and server cleanup
  *
  * Focus Management:
@@ -43,6 +46,9 @@
 #include "toplevel.h"
 #include "wl_input.h"
 #include "output.h"
+#include "cursor.h"
+#include "window.h"
+#include "sessions.h"
 #include "client.h"
 
 #endif /* P9WL_WAYLAND_H */
@@ -0,0 +1,553 @@
+/*
+ * window.c - Multi-window mode: one Plan 9 window per toplevel
+ *
+ * Window servers: rio window creation through /dev/wctl, session
+ * setup below /dev/wsys/<id> on a setup thread, pipeline start on the
+ * event loop, teardown, and the toplevel-to-window assignment. See
+ * window.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend/headless.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/log.h>
+
+#include "window.h"
+#include "output.h"
+#include "wl_input.h"
+#include "../types.h"
+#include "../p9/p9.h"
+#include "../p9/p9_tls.h"
+#include "../input/input.h"
+#include "../draw/arena.h"
+#include "../draw/draw.h"
+#include "../draw/send.h"
+
+/* ============== Finding the Rio Window ============== */
+
+/* Read /dev/wsys/<id>/label; -1 if the window is gone */
+static int wsys_label(struct p9conn *p9, const char *id, char *buf, size_t size) {
+    const char *wnames[3] = { "wsys", id, "label" };
+    uint32_t fid = p9->next_fid++;
+
+    if (p9_walk(p9, p9->attach_fid, fid, 3, wnames) < 0)
+        return -1;
+    if (p9_open(p9, fid, OREAD, NULL) < 0) {
+        p9_clunk(p9, fid);
+        return -1;
+    }
+    int n = p9_read(p9, fid, 0, size - 1, (uint8_t *)buf);
+    p9_clunk(p9, fid);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+/*
+ * Find the window labelled label in /dev/wsys and store its directory
+ * name in id. Directory reads return whole stat entries: size[2],
+ * then the name's len[2] at offset 41 and the name.
+ *
+ * Returns 0 if found, -1 if not (yet).
+ */
+static int wsys_find(struct p9conn *p9, const char *label, char *id, size_t idlen) {
+    const char *wnames[1] = { "wsys" };
+    uint32_t fid = p9->next_fid++;
+    uint8_t buf[4096];
+    char lbl[64];
+    int ret = -1;
+
+    if (p9_walk(p9, p9->attach_fid, fid, 1, wnames) < 0)
+        return -1;
+    if (p9_open(p9, fid, OREAD, NULL) < 0) {
+        p9_clunk(p9, fid);
+        return -1;
+    }
+
+    uint32_t count = sizeof(buf);
+    if (p9->msize - 24 < count) count = p9->msize - 24;
+    uint64_t offset = 0;
+    int n;
+    while (ret < 0 && (n = p9_read(p9, fid, offset, count, buf)) > 0) {
+        offset += n;
+        for (int pos = 0; ret < 0 && pos + 43 <= n; ) {
+            int size = buf[pos] | buf[pos + 1] << 8;
+            int nlen = buf[pos + 41] | buf[pos + 42] << 8;
+            if (pos + 2 + size > n || 43 + nlen > 2 + size)
+                break;
+            if ((size_t)nlen < idlen) {
+                memcpy(id, buf + pos + 43, nlen);
+                id[nlen] = '\0';
+                if (wsys_label(p9, id, lbl, sizeof(lbl)) >= 0 && strcmp(lbl, label) == 0)
+                    ret = 0;
+            }
+            pos += 2 + size;
+        }
+    }
+    p9_clunk(p9, fid);
+    return ret;
+}
+
+/*
+ * Ask rio for a new window and move p9 (the window's wctl session)
+ * into its /dev/wsys directory. The window runs a shell that labels
+ * it and sleeps; deleting the window ends it.
+ */
+static int window_open(struct server *win, const char *label, char *id, size_t idlen) {
+    struct p9conn *p9 = &win->p9_wctl;
+    char cmd[128];
+    int len = snprintf(cmd, sizeof(cmd),
+                       "new echo -n %s > /dev/label; exec sleep 1000000000", label);
+
+    if (p9_write_file(p9, "wctl", cmd, len) < 0) {
+        wlr_log(WLR_ERROR, "window: rio refused a new window");
+        return -1;
+    }
+
+    struct timespec ts = { 0, WINDOW_FIND_MS * 1000000L };
+    for (int i = 0; i < WINDOW_FIND_TRIES && !atomic_load(&win->create_stop); i++) {
+        if (wsys_find(p9, label, id, idlen) == 0) {
+            const char *dir[2] = { "wsys", id };
+            return p9_chdir(p9, 2, dir);
+        }
+        nanosleep(&ts, NULL);
+    }
+    wlr_log(WLR_ERROR, "window: %s did not appear in /dev/wsys", label);
+    return -1;
+}
+
+/* ============== Window Servers ============== */
+
+/*
+ * Connect the window server's sessions concurrently, rolling back on
+ * failure. With -m, wctl, relookup, mouse and kbd are channels of the
+ * window's own p9_shared, so a window costs two handshakes and tearing
+ * one down never touches the root's carrier.
+ */
+static int window_connect(struct server *win) {
+    struct tls_config cfg = {0};
+    if (win->use_tls) {
+        cfg.cert_file = win->tls_cert_file;
+        cfg.cert_fingerprint = win->tls_fingerprint;
+        cfg.insecure = win->tls_insecure;
+    }
+    struct tls_config draw_cfg = cfg;
+    draw_cfg.ktls = win->use_tls && win->tls_ktls;
+    struct p9conn *carrier = win->share_conns ? &win->p9_shared : NULL;
+
+    struct p9_connect_req reqs[] = {
+        { .p9 = &win->p9_wctl,     .name = "window wctl",     .tls = &cfg,      .carrier = carrier },
+        { .p9 = &win->p9_draw,     .name = "window draw",     .tls = &draw_cfg, .carrier = NULL },
+        { .p9 = &win->p9_relookup, .name = "window relookup", .tls = &cfg,      .carrier = carrier },
+        { .p9 = &win->p9_mouse,    .name = "window mouse",    .tls = &cfg,      .carrier = carrier },
+        { .p9 = &win->p9_kbd,      .name = "window kbd",      .tls = &cfg,      .carrier = carrier },
+        { .p9 = &win->p9_shared,   .name = "window shared",   .tls = &cfg,      .carrier = NULL },
+    };
+    int n = sizeof(reqs) / sizeof(reqs[0]);
+    if (!win->share_conns) n--;
+
+    return p9_connect_parallel(win->host, win->port, reqs, n);
+}
+
+/* Everything but the rio window and the sessions; safe at any stage */
+static void window_free(struct server *win) {
+    send_cleanup(win);
+    arena_unmap(win->framebuf, win->fb_cap * 4);
+    arena_unmap(win->prev_framebuf, win->fb_cap * 4);
+    arena_unmap(win->send_buf[0], win->fb_cap * 4);
+    arena_unmap(win->send_buf[1], win->fb_cap * 4);
+    free(win->dirty_staging);
+    free(win->damage_source);
+    free(win->dirty_tiles[0]);
+    free(win->dirty_tiles[1]);
+    free(win->dirty_accum);
+    free(win->fb_stale);
+    free(win->send_stale[0]);
+    free(win->send_stale[1]);
+    free(win->tile_hash);
+    free(win->prev_invalid);
+    if (win->input_queue.event_fd >= 0) close(win->input_queue.event_fd);
+    pthread_mutex_destroy(&win->send_lock);
+    pthread_cond_destroy(&win->send_cond);
+    free(win);
+}
+
+static void window_disconnect(struct server *win) {
+    p9_disconnect(&win->p9_draw);
+    p9_disconnect(&win->p9_relookup);
+    p9_disconnect(&win->p9_mouse);
+    p9_disconnect(&win->p9_kbd);
+    p9_disconnect(&win->p9_wctl);
+    if (win->share_conns)
+        p9_disconnect(&win->p9_shared);
+}
+
+/*
+ * Setup thread: sessions, rio window, draw device and buffers, which
+ * need only 9P and memory. Everything touching the event loop or the
+ * backend is left to window_start(). On failure the sessions and rio
+ * window are gone again.
+ */
+static int window_setup(struct server *win) {
+    if (window_connect(win) < 0)
+        return -1;
+
+    /* The rio window, then every session into its directory */
+    char label[48], id[32];
+    snprintf(label, sizeof(label), "p9wl.%d.%d", (int)getpid(),
+             win->layout_x / MAX_SCREEN_DIM);
+    if (window_open(win, label, id, sizeof(id)) < 0)
+        goto fail;
+
+    const char *dir[2] = { "wsys", id };
+    if (p9_chdir(&win->p9_draw, 2, dir) < 0 || p9_chdir(&win->p9_relookup, 2, dir) < 0 ||
+        p9_chdir(&win->p9_mouse, 2, dir) < 0 || p9_chdir(&win->p9_kbd, 2, dir) < 0)
+        goto fail_window;
+
+    if (init_draw(win) < 0) {
+        wlr_log(WLR_ERROR, "window: failed to initialize draw device");
+        goto fail_window;
+    }
+
+    win->width = win->draw.width;
+    win->height = win->draw.height;
+    win->visible_width = win->draw.visible_width;
+    win->visible_height = win->draw.visible_height;
+    win->tiles_x = win->width / TILE_SIZE;
+    win->tiles_y = win->height / TILE_SIZE;
+
+    win->fb_cap = (size_t)win->width * win->height;
+    win->framebuf = arena_map(win->fb_cap * 4);
+    win->prev_framebuf = arena_map(win->fb_cap * 4);
+    win->send_buf[0] = arena_map(win->fb_cap * 4);
+    win->send_buf[1] = arena_map(win->fb_cap * 4);
+    if (!win->framebuf || !win->prev_framebuf || !win->send_buf[0] || !win->send_buf[1] ||
+        send_init(win) < 0) {
+        wlr_log(WLR_ERROR, "window: memory allocation failed");
+        goto fail_window;
+    }
+
+    wlr_log(WLR_INFO, "window: %s is /dev/wsys/%s, %dx%d",
+            label, id, win->visible_width, win->visible_height);
+    return 0;
+
+fail_window:
+    delete_rio_window(&win->p9_wctl);
+fail:
+    window_disconnect(win);
+    return -1;
+}
+
+static void *window_setup_thread(void *arg) {
+    struct server *win = arg;
+
+    win->create_result = window_setup(win);
+
+    uint64_t one = 1;
+    if (write(win->create_fd, &one, sizeof(one)) < 0)
+        wlr_log(WLR_ERROR, "window: eventfd write: %s", strerror(errno));
+    return NULL;
+}
+
+/* Event loop: threads, event sources and output of a set-up window */
+static int window_start(struct server *win) {
+    struct server *root = win->root;
+
+    win->force_full_frame = 1;
+    win->frame_dirty = 1;
+
+    /* window_destroy() joins only the handles left non-zero */
+    int err = 0;
+    if ((err = pthread_create(&win->mouse_thread, NULL, mouse_thread_func, win)) != 0)
+        win->mouse_thread = 0;
+    else if ((err = pthread_create(&win->kbd_thread, NULL, kbd_thread_func, win)) != 0)
+        win->kbd_thread = 0;
+    else if ((err = pthread_create(&win->send_thread, NULL, send_thread_func, win)) != 0)
+        win->send_thread = 0;
+    if (err) {
+        wlr_log(WLR_ERROR, "window: thread creation failed: %s", strerror(err));
+        return -1;
+    }
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(win->display);
+    win->input_event = wl_event_loop_add_fd(loop, win->input_queue.event_fd,
+                                            WL_EVENT_READABLE, handle_input_events, win);
+    win->send_timer = wl_event_loop_add_timer(loop, send_timer_callback, win);
+
+    /* new_output() fires synchronously on the started backend */
+    root->output_pending = win;
+    wlr_headless_add_output(root->backend, win->visible_width, win->visible_height);
+    root->output_pending = NULL;
+    if (!win->output) {
+        wlr_log(WLR_ERROR, "window: failed to create output");
+        return -1;
+    }
+    return 0;
+}
+
+/* Move tl and its dialogs over from the root's window */
+static void window_adopt(struct server *win, struct toplevel *tl) {
+    struct server *root = win->root;
+    int logical_w = focus_phys_to_logical(win->visible_width, win->scale);
+    int logical_h = focus_phys_to_logical(win->visible_height, win->scale);
+
+    struct toplevel *t;
+    wl_list_for_each(t, &root->toplevels, link) {
+        if (t->win != root || !t->xdg) continue;
+        if (t != tl && (!t->xdg->parent ||
+                        focus_toplevel_from_surface(&root->focus,
+                                                    t->xdg->parent->base->surface) != tl))
+            continue;
+        t->win = win;
+        wlr_scene_node_set_position(&t->scene_tree->node, win->layout_x, 0);
+        if (t->xdg->base->initialized)
+            wlr_xdg_toplevel_set_size(t->xdg, logical_w, logical_h);
+    }
+    root->scene_dirty = 1;
+    if (root->output) wlr_output_schedule_frame(root->output);
+}
+
+/* Join the setup thread and drop its event source */
+static void window_join(struct server *win) {
+    pthread_join(win->create_thread, NULL);
+    wl_event_source_remove(win->create_source);
+    win->create_source = NULL;
+    close(win->create_fd);
+    win->create_fd = -1;
+}
+
+/* A window server that never started; the setup thread is joined */
+static void window_discard(struct server *win) {
+    if (win->create_result == 0) {
+        delete_rio_window(&win->p9_wctl);
+        window_disconnect(win);
+    }
+    wl_list_remove(&win->window_link);
+    window_free(win);
+}
+
+static int handle_window_ready(int fd, uint32_t mask, void *data) {
+    struct server *win = data;
+    (void)mask;
+
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) < 0 && errno == EAGAIN)
+        return 0;
+
+    window_join(win);
+
+    struct toplevel *tl = win->window_tl;
+    if (win->create_result < 0 || !tl) {
+        wlr_log(WLR_INFO, tl ? "window: staying in the root's window"
+                             : "window: toplevel closed before its window was up");
+        window_discard(win);
+        return 0;
+    }
+
+    /* From here on window_destroy() undoes everything */
+    if (window_start(win) < 0) {
+        window_destroy(win);
+        return 0;
+    }
+    window_adopt(win, tl);
+    wlr_log(WLR_INFO, "window: up at layout x %d", win->layout_x);
+    return 0;
+}
+
+int window_create(struct server *root, struct toplevel *tl) {
+    struct server *win = calloc(1, sizeof(*win));
+    if (!win) return -1;
+
+    /* Shared Wayland state and settings */
+    win->root = root;
+    win->display = root->display;
+    win->backend = root->backend;
+    win->renderer = root->renderer;
+    win->allocator = root->allocator;
+    win->scene = root->scene;
+    win->output_layout = root->output_layout;
+    win->seat = root->seat;
+    win->cursor = root->cursor;
+    win->host = root->host;
+    win->port = root->port;
+    win->use_tls = root->use_tls;
+    win->tls_cert_file = root->tls_cert_file;
+    win->tls_fingerprint = root->tls_fingerprint;
+    win->tls_insecure = root->tls_insecure;
+    win->tls_ktls = root->tls_ktls;
+    win->share_conns = root->share_conns;
+    win->scale = root->scale;
+    win->tile_cache_mb = root->tile_cache_mb;
+    win->compress_effort = root->compress_effort;
+    win->tile_major = root->tile_major;
+    win->log_level = root->log_level;
+
+    win->window_tl = tl;
+    win->layout_x = ++root->window_seq * MAX_SCREEN_DIM;
+    wl_list_init(&win->toplevels);
+    wl_list_init(&win->window_link);
+    win->running = 1;
+    win->pending_buf = -1;
+    win->active_buf = -1;
+    win->create_result = -1;
+    pthread_mutex_init(&win->send_lock, NULL);
+    pthread_cond_init(&win->send_cond, NULL);
+    input_queue_init(&win->input_queue);
+
+    win->create_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (win->create_fd >= 0)
+        win->create_source = wl_event_loop_add_fd(wl_display_get_event_loop(win->display),
+                                                  win->create_fd, WL_EVENT_READABLE,
+                                                  handle_window_ready, win);
+    if (win->create_source) {
+        if (pthread_create(&win->create_thread, NULL, window_setup_thread, win) == 0) {
+            wl_list_insert(&root->windows, &win->window_link);
+            return 0;
+        }
+        wl_event_source_remove(win->create_source);
+        win->create_source = NULL;
+    }
+    wlr_log(WLR_ERROR, "window: no setup thread, staying in the root's window");
+    if (win->create_fd >= 0) close(win->create_fd);
+    window_free(win);
+    return -1;
+}
+
+void window_cancel(struct server *root, struct toplevel *tl) {
+    if (!root->multi_window) return;
+    struct server *win;
+    wl_list_for_each(win, &root->windows, window_link) {
+        if (win->create_source && win->window_tl == tl)
+            win->window_tl = NULL;
+    }
+}
+
+void window_destroy(struct server *win) {
+    struct server *root = win->root;
+
+    pthread_mutex_lock(&win->send_lock);
+    win->running = 0;
+    pthread_cond_signal(&win->send_cond);
+    pthread_mutex_unlock(&win->send_lock);
+    if (win->send_thread) pthread_join(win->send_thread, NULL);
+
+    /* Deleting the window fails the input reads; shutdown makes sure
+     * (with -m, of the window's whole carrier) */
+    delete_rio_window(&win->p9_wctl);
+    p9_shutdown(&win->p9_mouse);
+    p9_shutdown(&win->p9_kbd);
+    if (win->mouse_thread) pthread_join(win->mouse_thread, NULL);
+    if (win->kbd_thread) pthread_join(win->kbd_thread, NULL);
+
+    if (win->input_event) wl_event_source_remove(win->input_event);
+    if (win->send_timer) wl_event_source_remove(win->send_timer);
+    if (win->pace_timer) wl_event_source_remove(win->pace_timer);
+    if (win->lost_idle) wl_event_source_remove(win->lost_idle);
+    if (win->output) wlr_output_destroy(win->output);
+    wl_list_remove(&win->window_link);
+
+    /* Toplevels left in it (dialogs) move to the root's window */
+    int logical_w = focus_phys_to_logical(root->visible_width, root->scale);
+    int logical_h = focus_phys_to_logical(root->visible_height, root->scale);
+    struct toplevel *tl;
+    wl_list_for_each(tl, &root->toplevels, link) {
+        if (tl->win != win) continue;
+        tl->win = root;
+        wlr_scene_node_set_position(&tl->scene_tree->node, 0, 0);
+        if (tl->xdg && tl->xdg->base->initialized)
+            wlr_xdg_toplevel_set_size(tl->xdg, logical_w, logical_h);
+    }
+    root->scene_dirty = 1;
+    if (root->output) wlr_output_schedule_frame(root->output);
+
+    window_disconnect(win);
+    wlr_log(WLR_INFO, "window: closed window at layout x %d", win->layout_x);
+    window_free(win);
+}
+
+static void handle_window_lost(void *data) {
+    struct server *win = data;
+    struct toplevel *tl = win->window_tl;
+
+    win->lost_idle = NULL;      /* An idle source goes after dispatch */
+    wlr_log(WLR_INFO, "window: rio window at layout x %d is gone", win->layout_x);
+    window_destroy(win);
+    if (tl && tl->xdg)
+        wlr_xdg_toplevel_send_close(tl->xdg);
+}
+
+void window_lost(struct server *s) {
+    if (!s->root || s->lost_idle) return;
+    s->lost_idle = wl_event_loop_add_idle(wl_display_get_event_loop(s->display),
+                                          handle_window_lost, s);
+}
+
+void window_destroy_all(struct server *root) {
+    if (!root->multi_window) return;
+    struct server *win, *tmp;
+    wl_list_for_each_safe(win, tmp, &root->windows, window_link) {
+        if (win->create_source) {
+            atomic_store(&win->create_stop, 1);
+            window_join(win);
+            window_discard(win);
+        } else {
+            window_destroy(win);
+        }
+    }
+}
+
+/* ============== Toplevel Assignment ============== */
+
+void window_assign(struct server *root, struct toplevel *tl) {
+    /* Reassigned only from the root's window (a re-map keeps its own) */
+    if (!root->multi_window || tl->win != root || !tl->xdg) return;
+
+    struct server *win = NULL;
+    if (tl->xdg->parent) {
+        struct toplevel *parent =
+            focus_toplevel_from_surface(&root->focus, tl->xdg->parent->base->surface);
+        win = parent ? parent->win : root;
+    } else {
+        /* The root's window is taken by another parentless toplevel */
+        struct toplevel *other;
+        wl_list_for_each(other, &root->toplevels, link) {
+            if (other != tl && other->win == root && other->xdg && !other->xdg->parent) {
+                window_create(root, tl);
+                break;
+            }
+        }
+    }
+
+    tl->win = win ? win : root;
+    wlr_scene_node_set_position(&tl->scene_tree->node, tl->win->layout_x, 0);
+}
+
+/* ============== Keyboard Focus ============== */
+
+void window_focus(struct server *s) {
+    struct server *root = server_root(s);
+    if (!root->multi_window) return;
+
+    struct toplevel *focused = focus_get_focused_toplevel(&root->focus);
+    if (!focused || focused->win == s) return;
+
+    struct toplevel *tl;
+    wl_list_for_each(tl, &root->toplevels, link) {
+        if (tl->win == s && tl->mapped) {
+            focus_toplevel(&root->focus, tl, FOCUS_REASON_EXPLICIT);
+            return;
+        }
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ * window.h - Multi-window mode: one Plan 9 window per toplevel
+ *
+ * By default every toplevel is composited into the one rio window p9wl
+ * was started from, and the whole screen goes through one draw
+ * connection and one send thread. With -w, each further top-level
+ * application window gets a rio window of its own, with its own
+ * draw_state, buffers and send pipeline. Every pipeline diffs and
+ * compresses only its own surface, the pipelines run side by side
+ * on the shared worker pool, and a client repainting constantly no
+ * longer delays the others' frames.
+ *
+ * Window Servers:
+ *
+ *   Each extra window is a struct server of its own (a "window
+ *   server", s->root set) holding everything that is per pipeline:
+ *   9P sessions, draw_state, framebuffers, dirty maps, send thread and
+ *   send_state, input queue and input threads, headless output. The
+ *   Wayland side stays single: display, backend, scene, output layout,
+ *   seat, cursor, focus manager and the toplevel list belong to the
+ *   root server and the window server only copies the pointers.
+ *   toplevel->win names the server whose window shows a toplevel; it
+ *   is the root server for every toplevel without -w. server_root()
+ *   (types.h) finds the root from either.
+ *
+ * Layout:
+ *
+ *   The outputs sit side by side in the shared output layout, window
+ *   server n at x = n * MAX_SCREEN_DIM (logical), the root's at 0, so
+ *   they never overlap however the rio windows are resized. A
+ *   toplevel's scene tree is placed at its window's layout_x; the
+ *   scene then renders each output on its own, damage and
+ *   passthrough included, and output_note_damage() converts to the
+ *   window's tiles by subtracting layout_x.
+ *
+ * Assignment:
+ *
+ *   A toplevel is assigned at its initial commit, when xdg_toplevel's
+ *   parent is known and before the first configure (whose size is the
+ *   window's):
+ *
+ *     - a child toplevel (dialog) joins its parent's window
+ *     - the first toplevel without a parent takes the root's window
+ *     - any further one gets a new window (window_create()); it is
+ *       shown in the root's window until that is up, and stays there
+ *       if creation fails
+ *
+ *   Destroying the toplevel of a window server deletes its rio window
+ *   (window_destroy()); children still in it move to the root's.
+ *   The root's own window is never deleted, as before. Deleting the
+ *   rio window in rio fails its mouse reads, and the window server
+ *   goes the same way (window_lost()); the toplevel is then asked to
+ *   close, and whatever it shows meanwhile is in the root's window.
+ *
+ * Creating a Window:
+ *
+ *   With exportfs -r /dev, the exporting window's /dev/wctl accepts
+ *   "new <command>", and the new window's files appear under
+ *   /dev/wsys/<id>/. The command writes a unique label to the new
+ *   window's /dev/label and sleeps; window_create() polls /dev/wsys
+ *   for the window with that label (WINDOW_FIND_TRIES tries
+ *   WINDOW_FIND_MS apart), then moves every session of the window
+ *   server into /dev/wsys/<id> with p9_chdir(). From there init_draw(),
+ *   the input threads and relookup_window() find that window's
+ *   winname, mouse and kbd like the root's find its own; /dev/draw is
+ *   walked from the attach root.
+ *
+ *   The connects, the "new" and the poll take a few round trips, up to
+ *   WINDOW_FIND_TRIES * WINDOW_FIND_MS for the poll alone, so they run
+ *   on a setup thread of the window server together with init_draw()
+ *   and the buffer allocation, none of which touch the event loop. An
+ *   eventfd hands back to the event loop (as in sessions.c), which
+ *   starts the input and send threads and adds the output, then moves
+ *   the toplevel and any dialogs of it over from the root's window. A
+ *   toplevel destroyed meanwhile (window_cancel()) has its window
+ *   deleted at that point instead.
+ *
+ * Input:
+ *
+ *   Each window's mouse and kbd threads fill that window server's
+ *   input queue, drained on the shared event loop by
+ *   handle_input_events(). Mouse positions are made window-local and
+ *   offset by layout_x before warping the shared cursor. Keys typed in
+ *   a window go to the seat; window_focus() first moves keyboard focus
+ *   to a toplevel of that window if another window's toplevel has it.
+ *
+ * Limits:
+ *
+ *   Client cursor images (cursor.h), the clipboard and frame trace
+ *   capture (-T) stay with the root's window. Deleting an extra window
+ *   from rio's menu stops its input and drawing; the client keeps
+ *   running until it closes the toplevel.
+ */
+
+#ifndef P9WL_WINDOW_H
+#define P9WL_WINDOW_H
+
+struct server;
+struct toplevel;
+
+#define WINDOW_FIND_TRIES   40      /* Polls of /dev/wsys for a new window */
+#define WINDOW_FIND_MS      50      /* Between polls */
+
+/*
+ * Choose the window of a toplevel at its initial commit and set
+ * tl->win (see "Assignment"). Creates a rio window if needed. Moves
+ * the toplevel's scene tree to the window's layout position.
+ *
+ * root: root server
+ * tl:   toplevel being configured
+ */
+void window_assign(struct server *root, struct toplevel *tl);
+
+/*
+ * Start creating a window server and its rio window for tl on a setup
+ * thread (see "Creating a Window"); tl stays in the root's window
+ * until the window is up. Returns 0 if the setup thread runs, -1 if
+ * not. A later failure is logged and leaves tl where it is.
+ */
+int window_create(struct server *root, struct toplevel *tl);
+
+/*
+ * Toplevel tl is being destroyed: a window still being created for it
+ * is deleted once its setup thread is done. No-op otherwise.
+ */
+void window_cancel(struct server *root, struct toplevel *tl);
+
+/*
+ * Stop a window server's threads, delete its rio window and free it.
+ * Toplevels still shown in it move to the root's window. Only for a
+ * window server that is up; window_destroy_all() also waits out those
+ * still being created.
+ */
+void window_destroy(struct server *win);
+
+/*
+ * s's mouse reads failed while it was running, most likely because
+ * the user deleted its rio window: from an idle callback, destroy the
+ * window server (its toplevels move back to the root's window) and
+ * ask the toplevel it was created for to close. No-op for the root
+ * server or when already pending. Called by handle_input_events().
+ */
+void window_lost(struct server *s);
+
+/* Destroy every window server of root (shutdown) */
+void window_destroy_all(struct server *root);
+
+/*
+ * Keyboard input arrived from s's Plan 9 window: give keyboard focus
+ * to a mapped toplevel of that window unless one already has it. No-op
+ * without -w, and while a popup holds the keyboard.
+ */
+void window_focus(struct server *s);
+
+#endif /* P9WL_WINDOW_H */
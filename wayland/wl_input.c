@@ -10,6 +10,9 @@
  *
  * Mouse: Plan 9 absolute coordinates and button bitmask are translated
  * to Wayland pointer motion, button, and scroll axis events.
+ *
+ * s is the server whose queue the event came from, a window server
+ * with -w (see window.h); seat, cursor and focus are the root's.
  */
 
 #include <stdbool.h>
@@ -25,6 +28,7 @@
 #include <wlr/util/log.h>
 
 #include "wl_input.h"
+#include "window.h"
 #include "../types.h"
 #include "../input/input.h"
 #include "../input/clipboard.h"
@@ -68,9 +72,14 @@ static const struct {
 
 /* ============== Keyboard Handling ============== */
 
-void handle_key(struct server *s, uint32_t rune, int pressed) {
+void handle_key(struct server *win, uint32_t rune, int pressed) {
+    struct server *s = server_root(win);
     struct focus_manager *fm = &s->focus;
     
+    /* Typing in a window is typing into its toplevel */
+    if (pressed)
+        window_focus(win);
+    
     /* Handle Escape for popup dismissal (unless keyboard shortcuts are inhibited,
      * e.g. during fullscreen video — let the client handle Escape itself) */
     if (rune == 0x1B && pressed) {
@@ -182,32 +191,34 @@ static void send_scroll_events(struct server *s, uint32_t t,
     }
 }
 
-void handle_mouse(struct server *s, int mx, int my, int buttons) {
+void handle_mouse(struct server *win, int mx, int my, int buttons) {
+    struct server *s = server_root(win);
     struct focus_manager *fm = &s->focus;
     
     /* Translate to window-local coordinates */
-    int local_x = mx - s->draw.win_minx;
-    int local_y = my - s->draw.win_miny;
+    int local_x = mx - win->draw.win_minx;
+    int local_y = my - win->draw.win_miny;
     
     /* Clamp to visible window bounds (not padded buffer bounds) */
-    int vis_w = s->visible_width;
-    int vis_h = s->visible_height;
+    int vis_w = win->visible_width;
+    int vis_h = win->visible_height;
     if (local_x < 0) local_x = 0;
     if (local_y < 0) local_y = 0;
     if (local_x >= vis_w) local_x = vis_w - 1;
     if (local_y >= vis_h) local_y = vis_h - 1;
     
-    /* Update cursor — normalize over visible area */
-    wlr_cursor_warp_absolute(s->cursor, NULL,
-                             (double)local_x / vis_w,
-                             (double)local_y / vis_h);
+    /* Update cursor — this window's output, in logical layout coordinates */
+    float scale = win->scale > 0 ? win->scale : 1.0f;
+    wlr_cursor_warp_closest(s->cursor, NULL,
+                            win->layout_x + local_x / scale,
+                            local_y / scale);
     
     /* Find surface under cursor */
     double sx, sy;
     struct wlr_surface *surface = focus_surface_at_cursor(fm, &sx, &sy);
     
     uint32_t t = now_ms();
-    static int last_buttons = 0;
+    int last_buttons = win->mouse_buttons;
     int changed = buttons ^ last_buttons;
     bool releasing_all = (last_buttons & 7) && !(buttons & 7);
     
@@ -241,7 +252,7 @@ void handle_mouse(struct server *s, int mx, int my, int buttons) {
     send_button_events(s, t, buttons, changed);
     send_scroll_events(s, t, buttons, changed);
     
-    last_buttons = buttons & ~0x78;  /* Scroll bits are instantaneous, not holdable */
+    win->mouse_buttons = buttons & ~0x78;  /* Scroll bits are instantaneous, not holdable */
     wlr_seat_pointer_notify_frame(s->seat);
 }
 
@@ -250,12 +261,11 @@ void handle_mouse(struct server *s, int mx, int my, int buttons) {
 int handle_input_events(int fd, uint32_t mask, void *data) {
     struct server *s = data;
     struct input_event ev;
-    char buf[32];
     
+    (void)fd;
     (void)mask;
     
-    /* Drain pipe */
-    while (read(fd, buf, sizeof(buf)) > 0);
+    input_queue_ack(&s->input_queue);
     
     /* Process all queued events */
     while (input_queue_pop(&s->input_queue, &ev)) {
@@ -272,5 +282,8 @@ int handle_input_events(int fd, uint32_t mask, void *data) {
         }
     }
     
+    /* The mouse thread is gone */
+    if (atomic_load(&s->input_lost))
+        window_lost(s);
     return 0;
 }
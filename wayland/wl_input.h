@@ -52,10 +52,11 @@
  *
  * Usage:
  *
- *   Register handle_input_events as a pipe event source:
+ *   Register handle_input_events as an event source on the queue's
+ *   eventfd:
  *
  *     server->input_event = wl_event_loop_add_fd(loop,
- *         server->input_queue.pipe_fd[0],
+ *         server->input_queue.event_fd,
  *         WL_EVENT_READABLE,
  *         handle_input_events,
  *         server);
@@ -82,11 +83,14 @@
  * If pressed is true and rune is Escape (0x1B), attempts to dismiss
  * the topmost grabbed popup before processing as a regular key.
  *
- * s:       server instance
+ * A press moves keyboard focus into win's Plan 9 window first (see
+ * window_focus() in window.h).
+ *
+ * win:     server whose Plan 9 window the key came from
  * rune:    Plan 9 rune (Unicode codepoint or Kxxx constant)
  * pressed: 1 for key press, 0 for key release
  */
-void handle_key(struct server *s, uint32_t rune, int pressed);
+void handle_key(struct server *win, uint32_t rune, int pressed);
 
 /* ============== Mouse Handling ============== */
 
@@ -109,23 +113,29 @@ void handle_key(struct server *s, uint32_t rune, int pressed);
  * and pointer motion. Popup dismissal occurs when clicking outside the
  * popup stack.
  *
- * s:       server instance
+ * The position is made local to win's window and moved to win's
+ * output (layout_x) before the shared cursor is warped.
+ *
+ * win:     server whose Plan 9 window the event came from
  * mx:      X coordinate in Plan 9 screen coordinates
  * my:      Y coordinate in Plan 9 screen coordinates
  * buttons: button bitmask
  */
-void handle_mouse(struct server *s, int mx, int my, int buttons);
+void handle_mouse(struct server *win, int mx, int my, int buttons);
 
 /* ============== Event Loop Integration ============== */
 
 /*
  * Main loop callback for input events.
  *
- * Called by the Wayland event loop when the input queue pipe is readable.
- * Drains the pipe and processes all queued input events by calling
- * handle_mouse() or handle_key() as appropriate.
+ * Called by the Wayland event loop when input_queue.event_fd is
+ * readable. Clears it with input_queue_ack() first, so an event pushed
+ * while draining raises a new wakeup, then pops all queued input
+ * events and calls handle_mouse() or handle_key() as appropriate. Once the mouse
+ * thread has lost its window (s->input_lost), passes s to
+ * window_lost().
  *
- * fd:   file descriptor (input_queue.pipe_fd[0])
+ * fd:   file descriptor (input_queue.event_fd)
  * mask: event mask (WL_EVENT_READABLE)
  * data: pointer to struct server
  *